@@ -0,0 +1,517 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief Microbenchmarks of the client's hot paths against a canned local HTTP responder
+ */
+
+// benchmark the client's static functions directly
+#include "hawkbit-client.c"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define BENCH_CONTROLLER_ID     "bench"
+#define BENCH_ACTION_ID         "1"
+#define BENCH_WRITE_CB_CHUNK    256
+#define BENCH_SEND_BUFFER_SIZE  64 * 1024 // 64KB
+
+/**
+ * @brief struct containing the state of the canned local HTTP responder.
+ */
+typedef struct Responder_ {
+        int fd;                       /**< listening socket */
+        guint16 port;                 /**< port the responder listens on (127.0.0.1) */
+        gchar *poll_body;             /**< canned base resource response */
+        gchar *deployment_body;       /**< canned deployment resource response */
+        gint64 download_size;         /**< size of the canned download in bytes */
+} Responder;
+
+static Responder responder = { .fd = -1 };
+
+static gint iterations = 1000;
+static gint download_iterations = 5;
+static gint download_size = 64;
+
+static GOptionEntry entries[] = {
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+          "Iterations of request benchmarks (x100 for in-memory benchmarks)", "N" },
+        { "download-iterations", 'd', 0, G_OPTION_ARG_INT, &download_iterations,
+          "Iterations of download and checksum benchmarks", "N" },
+        { "download-size", 's', 0, G_OPTION_ARG_INT, &download_size,
+          "Size of the canned download in MiB", "MiB" },
+        { NULL }
+};
+
+/**
+ * @brief Write len bytes of buf to fd.
+ *
+ * @param[in] fd  File descriptor to write to
+ * @param[in] buf Data to write
+ * @param[in] len Length of data
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean write_all(int fd, const void *buf, gsize len)
+{
+        const gchar *p = buf;
+
+        while (len) {
+                ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+
+                if (r < 0 && errno == EINTR)
+                        continue;
+                if (r <= 0)
+                        return FALSE;
+
+                p += r;
+                len -= r;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Send a canned response for the request of given path.
+ *
+ * @param[in] fd   Connection socket
+ * @param[in] path Request path
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean respond(int fd, const gchar *path)
+{
+        g_autofree gchar *header = NULL;
+        const gchar *body = "";
+
+        if (g_str_has_prefix(path, "/download")) {
+                static gchar chunk[BENCH_SEND_BUFFER_SIZE];
+                gint64 left = responder.download_size;
+
+                header = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                                         "Content-Type: application/octet-stream\r\n"
+                                         "Content-Length: %" G_GINT64_FORMAT "\r\n\r\n",
+                                         responder.download_size);
+                if (!write_all(fd, header, strlen(header)))
+                        return FALSE;
+
+                memset(chunk, 0xa5, sizeof(chunk));
+                while (left > 0) {
+                        gsize len = MIN((gint64) sizeof(chunk), left);
+
+                        if (!write_all(fd, chunk, len))
+                                return FALSE;
+                        left -= len;
+                }
+
+                return TRUE;
+        }
+
+        if (g_str_has_suffix(path, "/feedback"))
+                body = "";
+        else if (strstr(path, "/deploymentBase/"))
+                body = responder.deployment_body;
+        else
+                body = responder.poll_body;
+
+        header = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: application/json;charset=UTF-8\r\n"
+                                 "Content-Length: %zu\r\n\r\n", strlen(body));
+
+        return write_all(fd, header, strlen(header)) && write_all(fd, body, strlen(body));
+}
+
+/**
+ * @brief Thread serving the requests of one (keep-alive) connection.
+ *
+ * @param[in] data connection socket, as GINT_TO_POINTER()
+ * @return NULL is always returned
+ */
+static gpointer connection_thread(gpointer data)
+{
+        int fd = GPOINTER_TO_INT(data);
+        gchar buf[16 * 1024];
+        gsize fill = 0;
+
+        while (1) {
+                gchar method[16], path[1024];
+                gchar *end, *length_header;
+                gsize header_len, body_len = 0;
+                ssize_t r;
+
+                // read request header
+                buf[fill] = '\0';
+                while (!(end = strstr(buf, "\r\n\r\n"))) {
+                        if (fill == sizeof(buf) - 1)
+                                goto out;
+
+                        r = recv(fd, buf + fill, sizeof(buf) - 1 - fill, 0);
+                        if (r < 0 && errno == EINTR)
+                                continue;
+                        if (r <= 0)
+                                goto out;
+
+                        fill += r;
+                        buf[fill] = '\0';
+                }
+                header_len = end + 4 - buf;
+
+                if (sscanf(buf, "%15s %1023s", method, path) != 2)
+                        goto out;
+
+                length_header = g_strstr_len(buf, header_len, "Content-Length:");
+                if (length_header)
+                        body_len = g_ascii_strtoull(length_header + strlen("Content-Length:"),
+                                                    NULL, 10);
+
+                // discard request body, keeping data of a pipelined request
+                if (fill >= header_len + body_len) {
+                        fill -= header_len + body_len;
+                        memmove(buf, buf + header_len + body_len, fill);
+                } else {
+                        gsize left = header_len + body_len - fill;
+
+                        while (left) {
+                                r = recv(fd, buf, MIN(sizeof(buf) - 1, left), 0);
+                                if (r < 0 && errno == EINTR)
+                                        continue;
+                                if (r <= 0)
+                                        goto out;
+
+                                left -= r;
+                        }
+                        fill = 0;
+                }
+
+                if (!respond(fd, path))
+                        goto out;
+        }
+
+out:
+        close(fd);
+        return NULL;
+}
+
+/**
+ * @brief Thread accepting connections to the responder.
+ *
+ * @param[in] data unused
+ * @return NULL is always returned
+ */
+static gpointer responder_thread(gpointer data)
+{
+        while (1) {
+                int fd = accept(responder.fd, NULL, NULL);
+
+                if (fd < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return NULL;
+                }
+
+                g_thread_unref(g_thread_new("connection", connection_thread,
+                                            GINT_TO_POINTER(fd)));
+        }
+}
+
+/**
+ * @brief Start the canned responder on an ephemeral port of 127.0.0.1.
+ *
+ * @param[out] error Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean responder_start(GError **error)
+{
+        struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+                .sin_port = 0,
+        };
+        socklen_t addr_len = sizeof(addr);
+
+        responder.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (responder.fd < 0 ||
+            bind(responder.fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+            listen(responder.fd, 16) ||
+            getsockname(responder.fd, (struct sockaddr *) &addr, &addr_len)) {
+                int err = errno;
+                g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err),
+                            "Failed to start responder: %s", g_strerror(err));
+                return FALSE;
+        }
+
+        responder.port = ntohs(addr.sin_port);
+        g_thread_unref(g_thread_new("responder", responder_thread, NULL));
+
+        return TRUE;
+}
+
+/**
+ * @brief Write a config file for the responder and load it as hawkbit_config.
+ *
+ * @param[in]  tmp_dir Directory to place config and download in
+ * @param[out] error   Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean bench_config_load(const gchar *tmp_dir, GError **error)
+{
+        g_autoptr(GKeyFile) key_file = g_key_file_new();
+        g_autofree gchar *server = g_strdup_printf("127.0.0.1:%u", responder.port);
+        g_autofree gchar *download = g_build_filename(tmp_dir, "bench.raucb", NULL);
+        g_autofree gchar *config_file = g_build_filename(tmp_dir, "bench.conf", NULL);
+        Config *config = NULL;
+
+        g_key_file_set_string(key_file, "client", "hawkbit_server", server);
+        g_key_file_set_string(key_file, "client", "ssl", "false");
+        g_key_file_set_string(key_file, "client", "auth_token", "bench");
+        g_key_file_set_string(key_file, "client", "target_name", BENCH_CONTROLLER_ID);
+        g_key_file_set_string(key_file, "client", "bundle_download_location", download);
+        g_key_file_set_string(key_file, "device", "product", "bench");
+
+        if (!g_key_file_save_to_file(key_file, config_file, error))
+                return FALSE;
+
+        config = load_config_file(config_file, error);
+        if (!config)
+                return FALSE;
+
+        hawkbit_init(config, NULL, NULL, NULL);
+        active_action = action_new();
+
+        return TRUE;
+}
+
+/**
+ * @brief Print latency distribution and throughput of a benchmark.
+ *
+ * @param[in] name      Benchmark name
+ * @param[in] latencies GArray of gint64 per-iteration latencies in microseconds, sorted
+ * @param[in] bytes     Number of bytes processed per iteration or 0
+ */
+static void report(const gchar *name, GArray *latencies, gint64 bytes)
+{
+        gint64 total = 0;
+        gdouble seconds;
+        guint n = latencies->len;
+
+        for (guint i = 0; i < n; i++)
+                total += g_array_index(latencies, gint64, i);
+        seconds = MAX(total, 1) / (gdouble) G_USEC_PER_SEC;
+
+        g_print("%-10s %8u x  min %10" G_GINT64_FORMAT " us  median %10" G_GINT64_FORMAT
+                " us  p99 %10" G_GINT64_FORMAT " us  %12.1f ops/s", name, n,
+                g_array_index(latencies, gint64, 0),
+                g_array_index(latencies, gint64, n / 2),
+                g_array_index(latencies, gint64, MIN(n - 1, n * 99 / 100)),
+                n / seconds);
+        if (bytes)
+                g_print("  %10.2f MiB/s", (gdouble) bytes * n / (1024 * 1024) / seconds);
+        g_print("\n");
+}
+
+/**
+ * @brief GCompareFunc for gint64.
+ */
+static gint compare_gint64(gconstpointer a, gconstpointer b)
+{
+        gint64 va = *(const gint64 *) a, vb = *(const gint64 *) b;
+
+        return (va > vb) - (va < vb);
+}
+
+typedef gboolean (*BenchFunc)(gpointer data, GError **error);
+
+/**
+ * @brief Run func n times, reporting its latency and throughput.
+ *
+ * @param[in]  name  Benchmark name
+ * @param[in]  n     Number of iterations
+ * @param[in]  bytes Number of bytes processed per iteration or 0
+ * @param[in]  func  Function to benchmark
+ * @param[in]  data  Data passed to func
+ * @param[out] error Error
+ * @return TRUE on success, FALSE if func failed (error set)
+ */
+static gboolean bench_run(const gchar *name, gint n, gint64 bytes, BenchFunc func,
+                          gpointer data, GError **error)
+{
+        g_autoptr(GArray) latencies = g_array_sized_new(FALSE, FALSE, sizeof(gint64), n);
+
+        // warm up connection and caches
+        if (!func(data, error))
+                goto error;
+
+        for (gint i = 0; i < n; i++) {
+                gint64 start = g_get_monotonic_time(), latency;
+
+                if (!func(data, error))
+                        goto error;
+
+                latency = g_get_monotonic_time() - start;
+                g_array_append_val(latencies, latency);
+        }
+
+        g_array_sort(latencies, compare_gint64);
+        report(name, latencies, bytes);
+
+        return TRUE;
+
+error:
+        g_prefix_error(error, "Benchmark %s failed: ", name);
+        return FALSE;
+}
+
+static gboolean bench_poll(gpointer data, GError **error)
+{
+        g_autoptr(JsonParser) parser = NULL;
+
+        return rest_request(GET, data, NULL, &parser, error);
+}
+
+static gboolean bench_feedback(gpointer data, GError **error)
+{
+        g_autoptr(JsonBuilder) builder = NULL;
+
+        builder = json_build_status(BENCH_ACTION_ID, "Download complete. 1.00 MB/s", "none",
+                                    "proceeding", NULL);
+
+        return rest_request(POST, data, builder, NULL, error);
+}
+
+static gboolean bench_json(gpointer data, GError **error)
+{
+        g_autofree gchar *download = NULL, *name = NULL;
+        g_autoptr(JsonArray) chunks = NULL;
+
+        download = json_get_string(data, "$.deployment.download", error);
+        if (!download)
+                return FALSE;
+
+        chunks = json_get_array(data, "$.deployment.chunks", error);
+        if (!chunks)
+                return FALSE;
+
+        // not a plain member chain, evaluated as JSONPath
+        name = json_get_string(data, "$.deployment.chunks[0].name", error);
+        if (!name)
+                return FALSE;
+
+        return TRUE;
+}
+
+static gboolean bench_write_cb(gpointer data, GError **error)
+{
+        RestPayload *payload = get_rest_buffer();
+        const gchar *body = data;
+        gsize len = strlen(body);
+
+        for (gsize offset = 0; offset < len; offset += BENCH_WRITE_CB_CHUNK) {
+                gsize chunk = MIN(BENCH_WRITE_CB_CHUNK, len - offset);
+
+                if (curl_write_cb(body + offset, 1, chunk, payload) != chunk) {
+                        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Write callback failed");
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+static gboolean bench_download(gpointer data, GError **error)
+{
+        g_autoptr(DownloadState) state = download_state_new(TRUE);
+        curl_off_t speed;
+
+        return get_binary(data, FALSE, hawkbit_config->bundle_download_location, 0,
+                          responder.download_size, state, &speed, error);
+}
+
+static gboolean bench_checksum(gpointer data, GError **error)
+{
+        g_autoptr(DownloadState) state = download_state_new(TRUE);
+
+        return download_state_update_from_file(state, hawkbit_config->bundle_download_location,
+                                               responder.download_size, error);
+}
+
+int main(int argc, char **argv)
+{
+        g_autoptr(GOptionContext) context = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(JsonParser) deployment = NULL;
+        g_autofree gchar *tmp_dir = NULL, *poll_url = NULL, *feedback_url = NULL,
+                         *deployment_url = NULL, *download_url = NULL, *config_file = NULL;
+        int res = 1;
+
+        context = g_option_context_new("- benchmark rauc-hawkbit-updater hot paths");
+        g_option_context_add_main_entries(context, entries, NULL);
+        if (!g_option_context_parse(context, &argc, &argv, &error))
+                goto out;
+
+        if (iterations < 1 || download_iterations < 1 || download_size < 1) {
+                g_set_error(&error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                            "Iterations and download size must be greater than 0");
+                goto out;
+        }
+
+        tmp_dir = g_dir_make_tmp("rauc-hawkbit-bench-XXXXXX", &error);
+        if (!tmp_dir)
+                goto out;
+
+        if (!responder_start(&error) || !bench_config_load(tmp_dir, &error))
+                goto out;
+
+        poll_url = build_api_url(NULL);
+        feedback_url = build_api_url("deploymentBase/%s/feedback", BENCH_ACTION_ID);
+        deployment_url = build_api_url("deploymentBase/%s", BENCH_ACTION_ID);
+        download_url = g_strdup_printf("http://127.0.0.1:%u/download", responder.port);
+
+        responder.download_size = (gint64) download_size * 1024 * 1024;
+        responder.poll_body = g_strdup_printf(
+                "{\"config\":{\"polling\":{\"sleep\":\"00:05:00\"}},"
+                "\"_links\":{\"deploymentBase\":{\"href\":\"%s?c=-2129030598\"}}}",
+                deployment_url);
+        responder.deployment_body = g_strdup_printf(
+                "{\"id\":\"%s\",\"deployment\":{\"download\":\"forced\",\"update\":\"forced\","
+                "\"chunks\":[{\"part\":\"os\",\"version\":\"1.0\",\"name\":\"bench\","
+                "\"artifacts\":[{\"filename\":\"bench.raucb\",\"hashes\":{"
+                "\"sha1\":\"0000000000000000000000000000000000000000\","
+                "\"md5\":\"00000000000000000000000000000000\","
+                "\"sha256\":\"0000000000000000000000000000000000000000000000000000000000000000\"},"
+                "\"size\":%" G_GINT64_FORMAT ",\"_links\":{"
+                "\"download-http\":{\"href\":\"%s\"},"
+                "\"md5sum-http\":{\"href\":\"%s.MD5SUM\"}}}]}]},"
+                "\"actionHistory\":{\"status\":\"RUNNING\",\"messages\":[]}}",
+                BENCH_ACTION_ID, responder.download_size, download_url, download_url);
+
+        deployment = json_parser_new_immutable();
+        if (!json_parser_load_from_data(deployment, responder.deployment_body, -1, &error))
+                goto out;
+
+        if (!bench_run("poll", iterations, 0, bench_poll, poll_url, &error) ||
+            !bench_run("feedback", iterations, 0, bench_feedback, feedback_url, &error) ||
+            !bench_run("json", iterations * 100, 0, bench_json,
+                       json_parser_get_root(deployment), &error) ||
+            !bench_run("write-cb", iterations * 100, strlen(responder.deployment_body),
+                       bench_write_cb, responder.deployment_body, &error) ||
+            !bench_run("download", download_iterations, responder.download_size,
+                       bench_download, download_url, &error) ||
+            !bench_run("checksum", download_iterations, responder.download_size,
+                       bench_checksum, NULL, &error))
+                goto out;
+
+        res = 0;
+
+out:
+        if (error)
+                g_printerr("%s\n", error->message);
+
+        if (tmp_dir) {
+                config_file = g_build_filename(tmp_dir, "bench.conf", NULL);
+                if (hawkbit_config)
+                        g_remove(hawkbit_config->bundle_download_location);
+                g_remove(config_file);
+                g_rmdir(tmp_dir);
+        }
+
+        return res;
+}
@@ -0,0 +1,59 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __ARTIFACT_CACHE_H__
+#define __ARTIFACT_CACHE_H__
+
+#include <glib.h>
+
+/**
+ * @brief Check whether the cache holds a complete entry for key.
+ *
+ * @param[in] cache_dir Cache directory
+ * @param[in] key       Cache key (checksum based, see artifact_cache_store())
+ * @param[in] size      Expected size of the cached file in bytes
+ * @return TRUE if a cache entry with matching size exists, FALSE otherwise
+ */
+gboolean artifact_cache_lookup(const gchar *cache_dir, const gchar *key, gint64 size);
+
+/**
+ * @brief Provide the cached file for key at dest, hard linking it if possible, copying it
+ *        otherwise. Marks the entry as recently used.
+ *
+ * @param[in]  cache_dir Cache directory
+ * @param[in]  key       Cache key
+ * @param[in]  size      Expected size of the cached file in bytes
+ * @param[in]  dest      Path to provide the cached file at, replaced if existing
+ * @param[out] error     Error, G_FILE_ERROR_NOENT if not cached
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+gboolean artifact_cache_restore(const gchar *cache_dir, const gchar *key, gint64 size,
+                                const gchar *dest, GError **error);
+
+/**
+ * @brief Open the cached file for key for reading, e.g. to serve it to peers. Marks the entry as
+ *        recently used.
+ *
+ * @param[in]  cache_dir Cache directory
+ * @param[in]  key       Cache key
+ * @param[out] error     Error, G_FILE_ERROR_NOENT if not cached
+ * @return file descriptor to be closed by the caller, -1 on error (error set)
+ */
+int artifact_cache_open(const gchar *cache_dir, const gchar *key, GError **error);
+
+/**
+ * @brief Add verified file src to the cache as key. Least recently used entries are evicted to
+ *        keep the cache below max_size. Files larger than max_size are not cached.
+ *
+ * @param[in]  cache_dir Cache directory, created if missing
+ * @param[in]  key       Cache key, must only consist of alphanumeric characters and '-'
+ * @param[in]  src       Path of the file to cache, hard linked if possible, copied otherwise
+ * @param[in]  max_size  Maximum total size of all cache entries in bytes
+ * @param[out] error     Error
+ * @return TRUE on success (or if src is too large to be cached), FALSE otherwise (error set)
+ */
+gboolean artifact_cache_store(const gchar *cache_dir, const gchar *key, const gchar *src,
+                              gint64 max_size, GError **error);
+
+#endif // __ARTIFACT_CACHE_H__
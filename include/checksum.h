@@ -0,0 +1,106 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <glib.h>
+
+/**
+ * @brief Implementation used to calculate checksums.
+ */
+typedef enum {
+        CHECKSUM_BACKEND_AUTO = 0,        /**< kernel if it offers an accelerated driver, software otherwise */
+        CHECKSUM_BACKEND_SOFTWARE,        /**< GLib's GChecksum */
+        CHECKSUM_BACKEND_KERNEL,          /**< Linux kernel crypto API (AF_ALG) */
+} ChecksumBackend;
+
+/**
+ * @brief Running checksum, calculated by the backend selected with checksum_set_backend().
+ */
+typedef struct Checksum_ Checksum;
+
+/**
+ * @brief Function consuming data read by checksum_read_file().
+ *
+ * @param[in] data      Data read
+ * @param[in] len       Length of data
+ * @param[in] user_data User data passed to checksum_read_file()
+ */
+typedef void (*ChecksumReadFunc)(const guchar *data, gsize len, gpointer user_data);
+
+/**
+ * @brief Select the backend used by checksums created with checksum_new() afterwards.
+ *
+ * @param[in] backend Backend to use
+ */
+void checksum_set_backend(ChecksumBackend backend);
+
+/**
+ * @brief Create a running checksum of the given type. If the kernel backend is selected but not
+ *        usable, the software backend is used instead.
+ *
+ * @param[in] type Checksum type
+ * @return Checksum*, to be freed with checksum_free()
+ */
+Checksum* checksum_new(GChecksumType type);
+
+/**
+ * @brief Create a copy of checksum, e.g. to get the checksum of the data fed so far while
+ *        continuing to feed checksum.
+ *
+ * @param[in] checksum Checksum to copy
+ * @return Checksum*, to be freed with checksum_free()
+ */
+Checksum* checksum_copy(Checksum *checksum);
+
+/**
+ * @brief Feed data into checksum. Must not be called after checksum_get_string().
+ *
+ * @param[in] checksum Checksum to update
+ * @param[in] data     Data to feed
+ * @param[in] len      Length of data
+ */
+void checksum_update(Checksum *checksum, const guchar *data, gsize len);
+
+/**
+ * @brief Reset checksum to its state after checksum_new().
+ *
+ * @param[in] checksum Checksum to reset
+ */
+void checksum_reset(Checksum *checksum);
+
+/**
+ * @brief Finish checksum and get its hexadecimal digest.
+ *
+ * @param[in] checksum Checksum to finish
+ * @return digest owned by checksum, or NULL if the backend failed
+ */
+const gchar* checksum_get_string(Checksum *checksum);
+
+/**
+ * @brief Free checksum.
+ *
+ * @param[in] checksum Checksum to free
+ */
+void checksum_free(Checksum *checksum);
+
+/**
+ * @brief Read file from offset to size and pass its data to func in order. Reading is done by a
+ *        separate thread, so it overlaps with the processing done by func.
+ *
+ * @param[in]  file      File to read
+ * @param[in]  offset    Offset to start reading at
+ * @param[in]  size      Offset to stop reading at
+ * @param[in]  func      Function consuming the data read
+ * @param[in]  user_data User data passed to func
+ * @param[out] error     Error
+ * @return TRUE if the data was read completely, FALSE otherwise (error set)
+ */
+gboolean checksum_read_file(const gchar *file, goffset offset, goffset size,
+                            ChecksumReadFunc func, gpointer user_data, GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Checksum, checksum_free)
+
+#endif // __CHECKSUM_H__
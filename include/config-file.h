@@ -8,25 +8,89 @@
 
 #include <glib.h>
 
+#include "checksum.h"
+#include "thread-priority.h"
+
+/**
+ * @brief struct that contains a time-of-day window downloads are allowed in.
+ */
+typedef struct DownloadWindow_ {
+        int start;                        /**< start in minutes after midnight (local time) */
+        int end;                          /**< end in minutes after midnight (local time), before start if window spans midnight */
+        int rate;                         /**< download rate limit in bytes/s within window, 0 for unlimited, -1 for max_download_rate */
+} DownloadWindow;
+
+/**
+ * @brief How bundle downloads are written to disk.
+ */
+typedef enum {
+        DOWNLOAD_IO_BUFFERED = 0,         /**< write through the page cache */
+        DOWNLOAD_IO_DONTNEED,             /**< write through the page cache, dropping written pages */
+        DOWNLOAD_IO_DIRECT,               /**< bypass the page cache (O_DIRECT) */
+} DownloadIOMode;
+
+/**
+ * @brief struct that contains a downstream device served in gateway mode.
+ */
+typedef struct GatewayDeviceConfig_ {
+        gchar *controller_id;             /**< hawkBit controller id of the device */
+        GHashTable *attributes;           /**< attributes sent to hawkBit for the device or NULL */
+} GatewayDeviceConfig;
+
 /**
  * @brief struct that contains the Rauc HawkBit configuration.
  */
 typedef struct Config_ {
+        gchar* config_file;               /**< path of the loaded config file */
         gchar* hawkbit_server;            /**< hawkBit host or IP and port */
         gboolean ssl;                     /**< use https or http */
         gboolean ssl_verify;              /**< verify https certificate */
         gboolean post_update_reboot;      /**< reboot system after successful update */
+        int reboot_feedback_timeout;      /**< max. time to wait for the result to be sent before rebooting */
         gboolean resume_downloads;        /**< resume downloads or not */
+        gboolean stream_bundle;           /**< let RAUC stream bundle instead of downloading it */
+        gboolean preflight_check;         /**< let RAUC check bundle before downloading it */
+        gboolean dbus_service;            /**< export D-Bus interface for polls and cancelations */
+        gboolean http2;                   /**< use HTTP/2 for DDI requests if the server supports it */
+        gboolean compressed_responses;    /**< request compressed DDI responses */
+        gboolean low_memory;              /**< bound and pool response buffers, trim heap after polls */
         gchar* auth_token;                /**< hawkBit target security token */
         gchar* gateway_token;             /**< hawkBit gateway security token */
         gchar* tenant_id;                 /**< hawkBit tenant id */
         gchar* controller_id;             /**< hawkBit controller id*/
         gchar* bundle_download_location;  /**< file to download rauc bundle to */
+        gchar* artifact_cache_dir;        /**< directory to cache verified bundles in or NULL */
+        gchar* metrics_file;              /**< Prometheus text file to export metrics to or NULL */
+        gchar* connection_state_file;     /**< file to persist DNS results and TLS sessions in or NULL */
+        gchar* feedback_state_file;       /**< file to persist undelivered final feedback in or NULL */
+        int peer_port;                    /**< port to serve verified bundles to peers on, 0 to disable */
+        gchar* peer_address;              /**< IP address to serve peers on or NULL for all addresses */
+        GStrv peer_allow;                 /**< addresses or subnets of peers to serve or NULL for all peers */
+        GStrv peers;                      /**< "host:port" of peers to try downloading bundles from or NULL */
+        GStrv mirrors;                    /**< base URLs of mirrors serving hawkBit's artifact paths without credentials or NULL */
+        GStrv authenticated_mirrors;      /**< base HTTPS URLs of mirrors like mirrors, but sent hawkBit credentials, or NULL */
+        GPtrArray* gateway_devices;       /**< GatewayDeviceConfig array served in gateway mode or NULL */
+        gchar* gateway_install_command;   /**< command delivering bundles to devices in gateway mode or NULL */
+        int gateway_max_connections;      /**< max. number of connections in gateway mode */
         int connect_timeout;              /**< connection timeout */
         int timeout;                      /**< reply timeout */
         int retry_wait;                   /**< wait between retries */
+        int poll_jitter;                  /**< max. random delay added to polling interval */
+        int retry_backoff_max;            /**< max. exponentially growing wait between retries, 0 for fixed waits */
         int low_speed_time;               /**< time to be below the speed to trigger low speed abort */
         int low_speed_rate;               /**< low speed limit to abort transfer */
+        int max_response_size;            /**< max. size of DDI API responses in bytes, 0 for unlimited */
+        int connection_idle_timeout;      /**< max. idle time of connections kept open for reuse */
+        int download_segments;            /**< number of parallel range requests per download */
+        int download_segment_min_size;    /**< minimum size of a download segment in bytes */
+        int max_download_rate;            /**< download rate limit in bytes/s, 0 for unlimited */
+        GArray* download_windows;         /**< DownloadWindow array downloads are restricted to or NULL */
+        int artifact_cache_max_size;      /**< maximum total size of cached bundles in MiB */
+        int download_write_size;          /**< size of the staging buffer bundle downloads are written in */
+        DownloadIOMode download_io_mode;  /**< how bundle downloads are written to disk */
+        ChecksumBackend checksum_backend; /**< implementation calculating bundle checksums */
+        int download_flush_size;          /**< bytes after which buffered writes are flushed, 0 to leave it to the kernel */
+        ThreadPriority thread_priority;   /**< scheduling of threads streaming and hashing bundles */
         GLogLevelFlags log_level;         /**< log level */
         GHashTable* device;               /**< Additional attributes sent to hawkBit */
 } Config;
@@ -40,6 +104,27 @@ typedef struct Config_ {
  */
 Config* load_config_file(const gchar *config_file, GError **error);
 
+/**
+ * @brief Get the download rate options max_download_rate and download_windows from config_file,
+ *        allowing to apply changed options without restarting.
+ *
+ * @param[in]  config_file       String value containing path to config file
+ * @param[out] max_download_rate Output download rate limit in bytes/s, 0 for unlimited
+ * @param[out] download_windows  Output DownloadWindow array (must be freed) or NULL if downloads
+ *                               are not restricted to time-of-day windows
+ * @param[out] error             Error
+ * @return TRUE on success, FALSE otherwise (error is set)
+ */
+gboolean load_download_rate_config(const gchar *config_file, int *max_download_rate,
+                                   GArray **download_windows, GError **error);
+
+/**
+ * @brief Frees the memory allocated by a GatewayDeviceConfig
+ *
+ * @param[in] device GatewayDeviceConfig to free
+ */
+void gateway_device_config_free(GatewayDeviceConfig *device);
+
 /**
  * @brief Frees the memory allocated by a Config
  *
@@ -48,5 +133,6 @@ Config* load_config_file(const gchar *config_file, GError **error);
 void config_file_free(Config *config);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(Config, config_file_free)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(GatewayDeviceConfig, gateway_device_config_free)
 
 #endif // __CONFIG_FILE_H__
@@ -0,0 +1,44 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __CONNECTION_CACHE_H__
+#define __CONNECTION_CACHE_H__
+
+#include <curl/curl.h>
+#include <glib.h>
+
+/**
+ * @brief Set up the DNS cache and TLS session cache shared by all curl handles. If state_file is
+ *        given, DNS results and TLS sessions persisted by a previous run are loaded from it, so
+ *        the first requests of this run can skip name resolution and resume TLS sessions.
+ *
+ * @param[in] state_file Path of the file to persist DNS results and TLS sessions in or NULL
+ */
+void connection_cache_init(const gchar *state_file);
+
+/**
+ * @brief Let curl use the shared caches. Must be called again after curl_easy_reset().
+ *
+ * @param[in] curl Curl handle
+ */
+void connection_cache_setup(CURL *curl);
+
+/**
+ * @brief Account for a finished transfer: the address connected to is remembered to be
+ *        persisted, a persisted address that could not be connected to is dropped.
+ *
+ * @param[in] curl Curl handle of the finished transfer
+ * @param[in] res  Curl result of the transfer
+ */
+void connection_cache_record(CURL *curl, CURLcode res);
+
+/**
+ * @brief Write remembered DNS results and the cached TLS sessions to the state file, if
+ *        configured. Unless forced, the state file is written at most once an hour.
+ *
+ * @param[in] force Whether to write the state file regardless of when it was written last
+ */
+void connection_cache_save(gboolean force);
+
+#endif // __CONNECTION_CACHE_H__
@@ -0,0 +1,56 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __CURL_SOURCE_H__
+#define __CURL_SOURCE_H__
+
+#include <curl/curl.h>
+#include <glib.h>
+
+/**
+ * @brief Function called once a transfer added with curl_source_add() finished.
+ *
+ * @param[in] curl      Curl handle of the finished transfer, already removed from the source
+ * @param[in] res       Curl result of the transfer
+ * @param[in] user_data User data passed to curl_source_add()
+ */
+typedef void (*CurlTransferFunc)(CURL *curl, CURLcode res, gpointer user_data);
+
+/**
+ * @brief Create a GSource running curl transfers from the main loop it is attached to. The
+ *        transfers' sockets are watched by the main loop and curl's timeouts are mapped to the
+ *        source's ready time, so transfers never block the main loop and idle transfers cause no
+ *        wakeups. Must only be used from the thread running the main context it is attached to.
+ *
+ * @param[in] max_connections Maximum number of simultaneously open connections, 0 for unlimited
+ * @return the newly-created GSource
+ */
+GSource* curl_source_new(long max_connections);
+
+/**
+ * @brief Start transfer curl on source. Once it finished, done is called. If the transfer is
+ *        removed before, with curl_source_remove() or by destroying source, destroy is called
+ *        instead.
+ *
+ * @param[in] source    GSource created with curl_source_new()
+ * @param[in] curl      Curl handle set up for the transfer, must stay valid until done or
+ *                      destroy were called
+ * @param[in] done      Function called once the transfer finished
+ * @param[in] user_data User data passed to done or destroy
+ * @param[in] destroy   Function called on user_data if the transfer is removed unfinished, or
+ *                      NULL
+ * @return CURLM_OK on success, curl's error otherwise
+ */
+CURLMcode curl_source_add(GSource *source, CURL *curl, CurlTransferFunc done, gpointer user_data,
+                          GDestroyNotify destroy);
+
+/**
+ * @brief Abort transfer curl started with curl_source_add(), if it is still running.
+ *
+ * @param[in] source GSource created with curl_source_new()
+ * @param[in] curl   Curl handle of the transfer
+ */
+void curl_source_remove(GSource *source, CURL *curl);
+
+#endif // __CURL_SOURCE_H__
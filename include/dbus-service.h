@@ -0,0 +1,56 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __DBUS_SERVICE_H__
+#define __DBUS_SERVICE_H__
+
+#include <glib.h>
+
+#define DBUS_SERVICE_NAME "de.pengutronix.rauc.HawkbitUpdater"
+
+/**
+ * @brief Function canceling the running download, called for CancelDownload().
+ *
+ * @param[out] error Error
+ * @return TRUE if the download is being canceled, FALSE otherwise (error set)
+ */
+typedef gboolean (*ServiceCancelFunc)(GError **error);
+
+/**
+ * @brief Export the de.pengutronix.rauc.HawkbitUpdater interface on the bus RAUC is expected on
+ *        (see rauc_get_bus_type()) and request its name. Method calls are dispatched from
+ *        context.
+ *
+ * @param[in]  context   GMainContext to dispatch method calls from
+ * @param[in]  poll_now  Function called with poll_data for PollNow()
+ * @param[in]  poll_data User data passed to poll_now
+ * @param[in]  cancel    Function called for CancelDownload()
+ * @param[out] error     Error
+ * @return TRUE if the interface was exported, FALSE otherwise (error set)
+ */
+gboolean dbus_service_start(GMainContext *context, GSourceFunc poll_now, gpointer poll_data,
+                            ServiceCancelFunc cancel, GError **error);
+
+/**
+ * @brief Update the State and ActionId properties. May be called from any thread, does nothing
+ *        unless the service was started.
+ *
+ * @param[in] state     Name of the deployment state
+ * @param[in] action_id hawkBit action id or NULL
+ */
+void dbus_service_set_state(const gchar *state, const gchar *action_id);
+
+/**
+ * @brief Update the LastPoll property. Does nothing unless the service was started.
+ *
+ * @param[in] time Time of the last successful poll in seconds since the epoch
+ */
+void dbus_service_set_last_poll(gint64 time);
+
+/**
+ * @brief Release the name and unexport the interface exported by dbus_service_start().
+ */
+void dbus_service_stop(void);
+
+#endif // __DBUS_SERVICE_H__
@@ -10,6 +10,7 @@
 #include <glib/gtypes.h>
 #include <stdio.h>
 
+#include "checksum.h"
 #include "config-file.h"
 
 #define RHU_HAWKBIT_CLIENT_ERROR rhu_hawkbit_client_error_quark()
@@ -22,6 +23,8 @@ typedef enum {
         RHU_HAWKBIT_CLIENT_ERROR_MULTI_ARTIFACTS,
         RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD,
         RHU_HAWKBIT_CLIENT_ERROR_CANCELATION,
+        RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD_RESCHEDULED,
+        RHU_HAWKBIT_CLIENT_ERROR_NO_APPLICABLE_ARTIFACT,
 } RHUHawkbitClientError;
 
 // uses CURLcode as error codes
@@ -35,6 +38,12 @@ GQuark rhu_hawkbit_client_http_error_quark(void);
 #define HAWKBIT_USERAGENT                 "rauc-hawkbit-c-agent/1.0"
 #define DEFAULT_CURL_REQUEST_BUFFER_SIZE  512
 #define DEFAULT_CURL_DOWNLOAD_BUFFER_SIZE 64 * 1024 // 64KB
+#define DIRECT_IO_ALIGNMENT               4096
+#define RESUME_CHECKPOINT_INTERVAL        10 * G_USEC_PER_SEC // 10 s
+#define PEER_CONNECT_TIMEOUT              5 // s
+#define MIRROR_PROBE_SIZE                 64 * 1024 // 64KB
+#define MIRROR_PROBE_TIMEOUT              5 // s
+#define FEEDBACK_QUEUE_MAX_LENGTH         32
 
 extern gboolean run_once;                  /**< only run software check once and exit */
 
@@ -68,7 +77,10 @@ struct HawkbitAction {
         gchar *id;                    /**< HawkBit action id */
         GMutex mutex;                 /**< mutex used for accessing all other members */
         enum ActionState state;       /**< state of this action */
-        GCond cond;                   /**< condition on state */
+        gboolean cancel_local;        /**< cancelation was requested locally, not by hawkBit */
+        gboolean install_fallback;    /**< failed installation falls back to another artifact */
+        gint64 start_time;            /**< monotonic time processing of the action started at */
+        gint64 install_start_time;    /**< monotonic time the current installation started at */
 };
 
 /**
@@ -77,6 +89,8 @@ struct HawkbitAction {
 typedef struct RestPayload_ {
         gchar *payload;               /**< string representation of payload */
         size_t size;                  /**< size of payload */
+        size_t capacity;              /**< allocated size of payload buffer */
+        gboolean exceeded;            /**< payload exceeded max_response_size and was cut off */
 } RestPayload;
 
 /**
@@ -89,17 +103,79 @@ typedef struct Artifact_ {
         gchar *download_url;          /**< download URL of software bundle file */
         gchar *feedback_url;          /**< URL status feedback should be sent to */
         gchar *sha1;                  /**< sha1 checksum of software bundle file */
+        gchar *sha256;                /**< sha256 checksum of software bundle file or NULL */
+        gchar *base_version;          /**< installed version a delta bundle applies to, NULL for full bundles */
         gboolean do_install;          /**< whether the installation should be started or not */
 } Artifact;
 
+/**
+ * @brief struct containing the state of a software bundle file written through a staging buffer.
+ */
+typedef struct BundleWriter_ {
+        const gchar *file;            /**< path of the file written to */
+        int fd;                       /**< file descriptor of the file written to, -1 if closed */
+        DownloadIOMode mode;          /**< how data is written to disk */
+        guchar *buffer;               /**< staging buffer, aligned to DIRECT_IO_ALIGNMENT */
+        gsize size;                   /**< size of buffer, a multiple of DIRECT_IO_ALIGNMENT */
+        gsize fill;                   /**< number of bytes in buffer not written yet */
+        goffset offset;               /**< file offset of the first byte in buffer */
+        goffset end;                  /**< end of the data written to the file so far */
+        goffset dropped;              /**< file offset up to which written pages were dropped */
+        gsize flush_size;             /**< bytes after which buffered writes are flushed, 0 for never */
+        goffset flush_start;          /**< file offset writeback was started from last */
+        goffset flush_end;            /**< file offset up to which writeback was started */
+        int write_errno;              /**< errno of the first failed write, 0 if none */
+} BundleWriter;
+
+/**
+ * @brief struct containing the checksums calculated while downloading a software bundle file.
+ */
+typedef struct DownloadState_ {
+        BundleWriter *writer;         /**< writer currently used (only set during transfer) */
+        void *curl;                   /**< Curl handle currently used (only set during transfer) */
+        glong http_code;              /**< HTTP status of the current response, 0 before its body */
+        Checksum *sha1;               /**< running sha1 checksum */
+        Checksum *sha256;             /**< running sha256 checksum or NULL */
+        goffset size;                 /**< number of bytes fed into the checksums */
+        gchar *etag;                  /**< ETag of the downloaded file or NULL */
+        gchar *last_modified;         /**< Last-Modified date of the downloaded file or NULL */
+        GKeyFile *resume_info;        /**< resume sidecar contents, NULL if not persisted */
+        gint64 next_checkpoint;       /**< monotonic time to persist resume_info at next */
+        gint64 hash_time;             /**< time spent hashing data read back from disk [us] */
+} DownloadState;
+
+/**
+ * @brief struct containing validators of a previous REST response, allowing to detect unchanged
+ *        responses.
+ */
+typedef struct RestValidator_ {
+        gchar *etag;                  /**< ETag of the previous response or NULL */
+        gchar *checksum;              /**< SHA-1 checksum of the previous response body or NULL */
+} RestValidator;
+
+/**
+ * @brief struct containing a feedback message queued for sending to hawkBit.
+ */
+typedef struct FeedbackMessage_ {
+        gchar *url;                   /**< hawkBit URL used for request */
+        gchar *id;                    /**< hawkBit action ID */
+        gchar *detail;                /**< detail message */
+        gchar *finished;              /**< hawkBit status of the result */
+        gchar *execution;             /**< hawkBit status of the action execution */
+        gboolean coalesce;            /**< may be superseded by the next coalescable message */
+} FeedbackMessage;
+
 /**
  * @brief struct containing the new downloaded file.
  */
 struct on_new_software_userdata {
         GSourceFunc install_progress_callback;  /**< callback function to be called when new progress */
         GSourceFunc install_complete_callback;  /**< callback function to be called when installation is complete */
-        gchar *file;                            /**< downloaded new software file */
-        gboolean install_success;               /**< whether the installation succeeded or not (only meaningful for run_once mode!) */
+        gchar *file;                            /**< downloaded new software file or URL to stream from */
+        gchar *auth_header;                     /**< HTTP authorization header for streaming or NULL */
+        gboolean ssl_verify;                    /**< whether to verify the server's certificate when streaming */
+        gboolean wait;                          /**< whether to wait for the installation to finish */
+        gboolean install_success;               /**< whether the installation succeeded or not (only meaningful if wait is set!) */
 };
 
 /**
@@ -109,6 +185,20 @@ struct on_install_complete_userdata {
         gboolean install_success;               /**< status of installation */
 };
 
+/**
+ * @brief Function returning the installed bundle version (must be freed), NULL on error (error
+ *        set).
+ */
+typedef gchar* (*InstalledVersionFunc)(GError **error);
+
+/**
+ * @brief Function checking a bundle (file or URL, streamed with auth_header) is valid and
+ *        compatible without installing it. Returns TRUE if it is, FALSE otherwise (error set,
+ *        G_DBUS_ERROR_UNKNOWN_METHOD if the check is unsupported).
+ */
+typedef gboolean (*BundleCheckFunc)(const gchar *bundle, const gchar *auth_header,
+                                    gboolean ssl_verify, GError **error);
+
 /**
  * @brief Pass config, callback for installation ready and initialize libcurl.
  *        Intended to be called from program's main().
@@ -116,8 +206,13 @@ struct on_install_complete_userdata {
  * @param[in] config Config* to make global
  * @param[in] on_install_ready GSourceFunc to call after artifact download, to
  *                             trigger RAUC installation
+ * @param[in] get_installed_version InstalledVersionFunc to call to find out whether delta
+ *                                  artifacts apply
+ * @param[in] check_bundle BundleCheckFunc to call for config's preflight_check before
+ *                         downloading a bundle
  */
-void hawkbit_init(Config *config, GSourceFunc on_install_ready);
+void hawkbit_init(Config *config, GSourceFunc on_install_ready,
+                  InstalledVersionFunc get_installed_version, BundleCheckFunc check_bundle);
 
 /**
  * @brief Sets up timeout and event sources, initializes and runs main loop.
@@ -157,7 +252,23 @@ void rest_payload_free(RestPayload *payload);
  */
 void artifact_free(Artifact *artifact);
 
+/**
+ * @brief Frees the memory allocated by a DownloadState
+ *
+ * @param[in] state DownloadState to free
+ */
+void download_state_free(DownloadState *state);
+
+/**
+ * @brief Frees the memory allocated by a FeedbackMessage
+ *
+ * @param[in] message FeedbackMessage to free
+ */
+void feedback_message_free(FeedbackMessage *message);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(RestPayload, rest_payload_free)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(Artifact, artifact_free)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(DownloadState, download_state_free)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(FeedbackMessage, feedback_message_free)
 
 #endif // __HAWKBIT_CLIENT_H__
@@ -10,6 +10,31 @@
 #include <glib/gtypes.h>
 #include <json-glib/json-glib.h>
 
+/**
+ * @brief Precompiled JSONPath expression, resolved by walking JsonObject members.
+ */
+typedef struct JsonMemberPath_ JsonMemberPath;
+
+/**
+ * @brief Get the precompiled JsonMemberPath for a JSONPath expression. Each expression is compiled
+ *        once, subsequent calls return the cached JsonMemberPath.
+ *        Plain member chains ("$.a.b") are resolved directly, other expressions fall back to
+ *        json_path_query().
+ *
+ * @param[in] expression JSONPath expression
+ * @return const JsonMemberPath*, owned by json-helper and valid for the process lifetime
+ */
+const JsonMemberPath* json_member_path(const gchar *expression);
+
+/**
+ * @brief Resolve a plain member chain JsonMemberPath in json_node without allocating.
+ *
+ * @param[in] json_node JsonNode to evaluate path on
+ * @param[in] path      JsonMemberPath as returned by json_member_path() for a plain member chain
+ * @return JsonNode*, matching node owned by json_node, NULL if there is no match
+ */
+JsonNode* json_member_path_lookup(JsonNode *json_node, const JsonMemberPath *path);
+
 /**
  * @brief Get the string inside the first JsonNode element matching path in json_node.
  *
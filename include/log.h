@@ -20,4 +20,58 @@
  */
 void setup_logging(const gchar *domain, GLogLevelFlags level, gboolean output_to_systemd);
 
+/**
+ * @brief     Write all messages queued and stop the log thread started by setup_logging().
+ *            Messages logged afterwards are written synchronously.
+ */
+void shutdown_logging(void);
+
+/**
+ * @brief     Check whether messages of given log level are output, allowing to skip expensive
+ *            preparation of messages that would be dropped anyway
+ *
+ * @param[in] level Log level
+ * @return    TRUE if level was enabled by setup_logging(), FALSE otherwise
+ */
+gboolean log_level_enabled(GLogLevelFlags level);
+
+/**
+ * @brief     Log message with additional structured fields. When logging to the systemd journal,
+ *            the fields are attached to the journal entry, allowing to query them (e.g. with
+ *            journalctl -o json). Otherwise only the message is output.
+ *
+ * @param[in] level  Log level
+ * @param[in] fields NULL-terminated array of "KEY=value" journal fields or NULL
+ * @param[in] format printf()-style format string of the message
+ * @param[in] ...    Arguments for format
+ */
+void log_structured(GLogLevelFlags level, const gchar *const *fields, const gchar *format, ...)
+G_GNUC_PRINTF(3, 4);
+
+/**
+ * @brief     Set the hawkBit action id attached as RHU_ACTION_ID field to all messages logged to
+ *            the systemd journal from now on.
+ *
+ * @param[in] action_id hawkBit action id or NULL if no action is active
+ */
+void log_set_action_id(const gchar *action_id);
+
+/**
+ * @brief     Like g_debug(), but neither evaluates nor formats its arguments unless debug
+ *            messages are enabled.
+ */
+#define log_debug(...) G_STMT_START { \
+        if (log_level_enabled(G_LOG_LEVEL_DEBUG)) \
+                g_debug(__VA_ARGS__); \
+} G_STMT_END
+
+/**
+ * @brief     Like g_info(), but neither evaluates nor formats its arguments unless info messages
+ *            are enabled.
+ */
+#define log_info(...) G_STMT_START { \
+        if (log_level_enabled(G_LOG_LEVEL_INFO)) \
+                g_info(__VA_ARGS__); \
+} G_STMT_END
+
 #endif // __LOG_H__
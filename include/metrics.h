@@ -0,0 +1,81 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <curl/curl.h>
+#include <glib.h>
+
+/**
+ * @brief Kinds of HTTP transfers metrics are collected for.
+ */
+typedef enum {
+        METRICS_TRANSFER_API,         /**< DDI API requests (polls, feedback, ...) */
+        METRICS_TRANSFER_DOWNLOAD,    /**< bundle downloads, one per request/segment */
+        METRICS_TRANSFER_COUNT,
+} MetricsTransfer;
+
+/**
+ * @brief Timed phases of polls and deployments.
+ */
+typedef enum {
+        METRICS_PHASE_POLL,           /**< processing of a poll of the base resource */
+        METRICS_PHASE_DOWNLOAD,       /**< transferring the bundle */
+        METRICS_PHASE_CHECKSUM,       /**< hashing downloaded data from disk and verification */
+        METRICS_PHASE_INSTALL,        /**< RAUC installation */
+        METRICS_PHASE_DEPLOYMENT,     /**< deployment from processing to its final result */
+        METRICS_PHASE_COUNT,
+} MetricsPhase;
+
+/**
+ * @brief Set up metrics collection.
+ *
+ * @param[in] textfile Path of the Prometheus text file to export metrics to or NULL to only log
+ *                     them
+ */
+void metrics_init(const gchar *textfile);
+
+/**
+ * @brief Account for a finished transfer, taking DNS, connect, TLS, time-to-first-byte and total
+ *        time as well as the bytes transferred from curl. Logs them at debug level, with
+ *        structured journal fields if logging to the journal.
+ *
+ * @param[in] kind    Kind of transfer
+ * @param[in] curl    Handle of the finished transfer
+ * @param[in] success Whether the transfer succeeded
+ */
+void metrics_record_transfer(MetricsTransfer kind, CURL *curl, gboolean success);
+
+/**
+ * @brief Account for a retried transfer.
+ *
+ * @param[in] kind Kind of transfer
+ */
+void metrics_record_retry(MetricsTransfer kind);
+
+/**
+ * @brief Account for a download resumed from a non-zero offset.
+ */
+void metrics_record_resume(void);
+
+/**
+ * @brief Account for a finished phase, log its duration at info level (with structured journal
+ *        fields if logging to the journal) and update the text file passed to metrics_init().
+ *
+ * @param[in] phase    Phase
+ * @param[in] duration Duration of the phase in microseconds
+ */
+void metrics_record_phase(MetricsPhase phase, gint64 duration);
+
+/**
+ * @brief Get the current and peak resident set size of the process.
+ *
+ * @param[out] rss  Return location for the current resident set size in bytes
+ * @param[out] peak Return location for the peak resident set size in bytes
+ * @return TRUE on success, FALSE if unavailable (e.g. no /proc)
+ */
+gboolean metrics_get_memory_usage(guint64 *rss, guint64 *peak);
+
+#endif // __METRICS_H__
@@ -0,0 +1,47 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __PEER_SERVER_H__
+#define __PEER_SERVER_H__
+
+#include <glib.h>
+
+/**
+ * @brief Start serving verified bundles to peers via HTTP on port. Bundles are requested by
+ *        their cache key (see artifact_cache_store()) as path, i.e. GET /sha256-<checksum>, and
+ *        sent with sendfile(). Served are the bundle published with peer_server_publish() and,
+ *        if cache_dir is given, the entries of the artifact cache. Peers do not authenticate,
+ *        connections from addresses not in allow are refused with 403.
+ *
+ * @param[in]  port      TCP port to listen on
+ * @param[in]  address   IP address to listen on or NULL for all addresses
+ * @param[in]  allow     Addresses or subnets (e.g. 192.168.1.0/24) of peers to serve or NULL for
+ *                       all peers
+ * @param[in]  cache_dir Artifact cache directory or NULL
+ * @param[out] error     Error
+ * @return TRUE if the server was started, FALSE otherwise (error set)
+ */
+gboolean peer_server_start(guint16 port, const gchar *address, GStrv allow,
+                           const gchar *cache_dir, GError **error);
+
+/**
+ * @brief Serve the verified file as key, replacing the bundle published before.
+ *
+ * @param[in] key  Cache key of the bundle
+ * @param[in] file Path of the bundle
+ */
+void peer_server_publish(const gchar *key, const gchar *file);
+
+/**
+ * @brief Stop serving the bundle published with peer_server_publish(), e.g. before it is
+ *        removed or overwritten. Transfers already started are completed.
+ */
+void peer_server_withdraw(void);
+
+/**
+ * @brief Stop the server started with peer_server_start(), aborting running transfers.
+ */
+void peer_server_stop(void);
+
+#endif // __PEER_SERVER_H__
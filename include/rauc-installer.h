@@ -7,12 +7,15 @@
 #define __RAUC_INSTALLER_H__
 
 #include <glib.h>
+#include <gio/gio.h>
 
 /**
  * @brief struct that contains the context of an Rauc installation.
  */
 struct install_context {
-        gchar *bundle;                /**< Rauc bundle file to install */
+        gchar *bundle;                /**< Rauc bundle file or URL to install */
+        gchar *auth_header;           /**< HTTP header to pass for streaming or NULL */
+        gboolean ssl_verify;          /**< verify server certificate when streaming */
         GSourceFunc notify_event;     /**< Callback function */
         GSourceFunc notify_complete;  /**< Callback function */
         GMutex status_mutex;          /**< Mutex used for accessing status_messages */
@@ -26,7 +29,10 @@ struct install_context {
 /**
  * @brief RAUC install bundle
  *
- * @param[in] bundle RAUC bundle file (.raucb) to install.
+ * @param[in] bundle RAUC bundle file (.raucb) or HTTP(S) URL to install.
+ * @param[in] auth_header HTTP authorization header RAUC should pass when streaming bundle from
+ *                        URL or NULL. Ignored for local bundle files.
+ * @param[in] ssl_verify Whether RAUC should verify the server certificate when streaming.
  * @param[in] on_install_notify Callback function to be called with status info during
  *                              installation.
  * @param[in] on_install_complete Callback function to be called with the result of the
@@ -35,7 +41,37 @@ struct install_context {
  * @return for wait=TRUE, TRUE if installation succeeded, FALSE otherwise; for
  *         wait=FALSE TRUE is always returned immediately
  */
-gboolean rauc_install(const gchar *bundle, GSourceFunc on_install_notify,
-                GSourceFunc on_install_complete, gboolean wait);
+gboolean rauc_install(const gchar *bundle, const gchar *auth_header, gboolean ssl_verify,
+                GSourceFunc on_install_notify, GSourceFunc on_install_complete, gboolean wait);
+
+/**
+ * @brief Get the version of the bundle installed to the booted slot(s) via RAUC's GetSlotStatus.
+ *
+ * @param[out] error Error
+ * @return bundle version (must be freed), NULL on error (error set)
+ */
+gchar* rauc_get_installed_version(GError **error);
+
+/**
+ * @brief Let RAUC verify the bundle's signature and check its compatible matches the system's,
+ *        without installing it. Bundle URLs are inspected via HTTP(S) streaming, RAUC only fetches
+ *        the byte ranges holding the signature and manifest then. Requires RAUC v1.8 or newer.
+ *
+ * @param[in]  bundle      Rauc bundle file or URL to check
+ * @param[in]  auth_header HTTP header to pass for streaming or NULL
+ * @param[in]  ssl_verify  Verify server certificate when streaming
+ * @param[out] error       Error, G_DBUS_ERROR_UNKNOWN_METHOD if RAUC lacks InspectBundle()
+ * @return TRUE if the bundle is validly signed and compatible, FALSE otherwise (error set)
+ */
+gboolean rauc_check_bundle(const gchar *bundle, const gchar *auth_header, gboolean ssl_verify,
+                           GError **error);
+
+/**
+ * @brief Get the D-Bus bus type RAUC is expected on, the session bus if DBUS_STARTER_BUS_TYPE is
+ *        "session", the system bus otherwise.
+ *
+ * @return GBusType to use
+ */
+GBusType rauc_get_bus_type(void);
 
 #endif // __RAUC_INSTALLER_H__
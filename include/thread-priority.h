@@ -0,0 +1,54 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef __THREAD_PRIORITY_H__
+#define __THREAD_PRIORITY_H__
+
+#include <glib.h>
+
+/**
+ * @brief I/O scheduling class, see ioprio_set(2).
+ */
+typedef enum {
+        IO_CLASS_DEFAULT = 0,             /**< keep the class inherited from the process */
+        IO_CLASS_BEST_EFFORT,             /**< best-effort class with the given priority */
+        IO_CLASS_IDLE,                    /**< only get disk time when no one else needs it */
+} IOClass;
+
+/**
+ * @brief CPU scheduling policy, see sched(7).
+ */
+typedef enum {
+        CPU_POLICY_OTHER = 0,             /**< standard round-robin time-sharing */
+        CPU_POLICY_BATCH,                 /**< CPU-intensive, slightly disfavored in wakeups */
+        CPU_POLICY_IDLE,                  /**< only run when nothing else wants to */
+} CPUPolicy;
+
+/**
+ * @brief Scheduling parameters of the threads streaming and hashing bundles.
+ */
+typedef struct ThreadPriority_ {
+        IOClass io_class;                 /**< I/O scheduling class */
+        int io_priority;                  /**< priority within IO_CLASS_BEST_EFFORT, 0 (highest) to 7 */
+        CPUPolicy cpu_policy;             /**< CPU scheduling policy */
+        int nice;                         /**< nice level, -20 to 19, ignored for CPU_POLICY_IDLE */
+        GArray *cpu_affinity;             /**< guint CPUs to run on or NULL for all */
+} ThreadPriority;
+
+/**
+ * @brief Set the scheduling parameters thread_priority_apply() applies afterwards.
+ *
+ * @param[in] priority Scheduling parameters, cpu_affinity is referenced
+ */
+void thread_priority_set(const ThreadPriority *priority);
+
+/**
+ * @brief Apply the scheduling parameters set with thread_priority_set() to the calling thread.
+ *        Failures are logged, the thread keeps running with the parameters it had then.
+ *
+ * @param[in] name Name of the calling thread, for logging
+ */
+void thread_priority_apply(const gchar *name);
+
+#endif // __THREAD_PRIORITY_H__
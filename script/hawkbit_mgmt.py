@@ -238,6 +238,24 @@ class HawkbitMgmtTestClient:
 
         return self.get(f'softwaremodules/{module_id}')
 
+    def add_softwaremodule_metadata(self, metadata: dict, module_id: str = None):
+        """
+        Adds `metadata` key/value pairs as target visible metadata to the software module matching
+        `module_id`.
+        If `module_id` is not given, uses the software module created by the most recent
+        `add_softwaremodule()` call.
+
+        https://www.eclipse.org/hawkbit/rest-api/softwaremodules-api-guide/#_post_rest_v1_softwaremodules_softwaremoduleid_metadata
+        """
+        module_id = module_id or self.id['softwaremodule']
+        data = [{
+            'key': key,
+            'value': value,
+            'targetVisible': True,
+        } for key, value in metadata.items()]
+
+        self.post(f'softwaremodules/{module_id}/metadata', data)
+
     def delete_softwaremodule(self, module_id: str = None):
         """
         Deletes the software module matching `module_id`.
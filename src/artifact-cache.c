@@ -0,0 +1,297 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief Content-addressed cache of downloaded and verified artifacts
+ */
+
+#include "artifact-cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/**
+ * @brief struct describing a cache entry found while scanning the cache directory.
+ */
+typedef struct CacheEntry_ {
+        gchar *path;                  /**< path of the cached file */
+        gint64 size;                  /**< size of the cached file */
+        gint64 mtime;                 /**< last use, the cached file's modification time */
+} CacheEntry;
+
+static void cache_entry_free(CacheEntry *entry)
+{
+        if (!entry)
+                return;
+
+        g_free(entry->path);
+        g_free(entry);
+}
+
+/**
+ * @brief GCompareFunc ordering CacheEntry** by last use, least recently used first.
+ */
+static gint cache_entry_compare_mtime(gconstpointer a, gconstpointer b)
+{
+        const CacheEntry *entry_a = *(const CacheEntry **) a;
+        const CacheEntry *entry_b = *(const CacheEntry **) b;
+
+        return (entry_a->mtime > entry_b->mtime) - (entry_a->mtime < entry_b->mtime);
+}
+
+/**
+ * @brief Check key is safe to be used as a file name in the cache directory.
+ *
+ * @param[in] key Cache key
+ * @return TRUE if key only consists of alphanumeric characters and '-', FALSE otherwise
+ */
+static gboolean key_is_valid(const gchar *key)
+{
+        if (!key || !key[0])
+                return FALSE;
+
+        for (const gchar *c = key; *c; c++) {
+                if (!g_ascii_isalnum(*c) && *c != '-')
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Provide src at dest, hard linking it if possible (same file system), copying it
+ *        otherwise. An existing dest is replaced.
+ *
+ * @param[in]  src   Source path
+ * @param[in]  dest  Destination path
+ * @param[out] error Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean link_or_copy(const gchar *src, const gchar *dest, GError **error)
+{
+        g_autoptr(GFile) src_file = NULL, dest_file = NULL;
+
+        g_return_val_if_fail(src, FALSE);
+        g_return_val_if_fail(dest, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (g_remove(dest) && errno != ENOENT) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to remove %s: %s", dest, g_strerror(err));
+                return FALSE;
+        }
+
+        if (!link(src, dest))
+                return TRUE;
+
+        log_debug("Failed to link %s to %s: %s, copying instead", src, dest, g_strerror(errno));
+
+        src_file = g_file_new_for_path(src);
+        dest_file = g_file_new_for_path(dest);
+        if (!g_file_copy(src_file, dest_file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, error)) {
+                g_prefix_error(error, "Failed to copy %s to %s: ", src, dest);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Evict least recently used entries from cache_dir until space bytes fit into max_size.
+ *
+ * @param[in]  cache_dir Cache directory
+ * @param[in]  space     Number of bytes required for the entry to add
+ * @param[in]  max_size  Maximum total size of all cache entries in bytes
+ * @param[out] error     Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean evict_entries(const gchar *cache_dir, gint64 space, gint64 max_size,
+                              GError **error)
+{
+        g_autoptr(GDir) dir = NULL;
+        g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func(
+                (GDestroyNotify) cache_entry_free);
+        const gchar *name = NULL;
+        gint64 total = 0;
+
+        g_return_val_if_fail(cache_dir, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        dir = g_dir_open(cache_dir, 0, error);
+        if (!dir)
+                return FALSE;
+
+        while ((name = g_dir_read_name(dir))) {
+                g_autofree gchar *path = g_build_filename(cache_dir, name, NULL);
+                CacheEntry *entry = NULL;
+                GStatBuf st;
+
+                if (g_stat(path, &st) || !S_ISREG(st.st_mode))
+                        continue;
+
+                entry = g_new0(CacheEntry, 1);
+                entry->path = g_steal_pointer(&path);
+                entry->size = st.st_size;
+                entry->mtime = st.st_mtime;
+                g_ptr_array_add(entries, entry);
+
+                total += entry->size;
+        }
+
+        g_ptr_array_sort(entries, cache_entry_compare_mtime);
+
+        for (guint i = 0; i < entries->len && total + space > max_size; i++) {
+                CacheEntry *entry = g_ptr_array_index(entries, i);
+
+                log_debug("Evicting %s from artifact cache", entry->path);
+                if (g_remove(entry->path)) {
+                        int err = errno;
+                        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                                    "Failed to evict %s: %s", entry->path, g_strerror(err));
+                        return FALSE;
+                }
+
+                total -= entry->size;
+        }
+
+        return TRUE;
+}
+
+gboolean artifact_cache_lookup(const gchar *cache_dir, const gchar *key, gint64 size)
+{
+        g_autofree gchar *path = NULL;
+        GStatBuf st;
+
+        g_return_val_if_fail(cache_dir, FALSE);
+
+        if (!key_is_valid(key))
+                return FALSE;
+
+        path = g_build_filename(cache_dir, key, NULL);
+
+        return g_stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == size;
+}
+
+gboolean artifact_cache_restore(const gchar *cache_dir, const gchar *key, gint64 size,
+                                const gchar *dest, GError **error)
+{
+        g_autofree gchar *path = NULL;
+
+        g_return_val_if_fail(cache_dir, FALSE);
+        g_return_val_if_fail(dest, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!artifact_cache_lookup(cache_dir, key, size)) {
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                            "Artifact %s not cached", key);
+                return FALSE;
+        }
+
+        path = g_build_filename(cache_dir, key, NULL);
+        if (!link_or_copy(path, dest, error))
+                return FALSE;
+
+        // mark as recently used
+        if (g_utime(path, NULL))
+                log_debug("Failed to update modification time of %s: %s", path, g_strerror(errno));
+
+        return TRUE;
+}
+
+int artifact_cache_open(const gchar *cache_dir, const gchar *key, GError **error)
+{
+        g_autofree gchar *path = NULL;
+        int fd;
+
+        g_return_val_if_fail(cache_dir, -1);
+        g_return_val_if_fail(error == NULL || *error == NULL, -1);
+
+        if (!key_is_valid(key)) {
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                            "Artifact %s not cached", key);
+                return -1;
+        }
+
+        path = g_build_filename(cache_dir, key, NULL);
+        fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to open %s: %s", path, g_strerror(err));
+                return -1;
+        }
+
+        // mark as recently used
+        if (g_utime(path, NULL))
+                log_debug("Failed to update modification time of %s: %s", path, g_strerror(errno));
+
+        return fd;
+}
+
+gboolean artifact_cache_store(const gchar *cache_dir, const gchar *key, const gchar *src,
+                              gint64 max_size, GError **error)
+{
+        g_autofree gchar *path = NULL, *tmp_path = NULL;
+        GStatBuf st;
+
+        g_return_val_if_fail(cache_dir, FALSE);
+        g_return_val_if_fail(src, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!key_is_valid(key)) {
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                            "Invalid artifact cache key '%s'", key);
+                return FALSE;
+        }
+
+        if (g_stat(src, &st)) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to stat %s: %s", src, g_strerror(err));
+                return FALSE;
+        }
+
+        if (st.st_size > max_size) {
+                log_debug("%s exceeds artifact cache size, not caching it", src);
+                return TRUE;
+        }
+
+        if (g_mkdir_with_parents(cache_dir, 0700)) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to create %s: %s", cache_dir, g_strerror(err));
+                return FALSE;
+        }
+
+        path = g_build_filename(cache_dir, key, NULL);
+        if (g_remove(path) && errno != ENOENT)
+                log_debug("Failed to remove stale %s: %s", path, g_strerror(errno));
+
+        if (!evict_entries(cache_dir, st.st_size, max_size, error))
+                return FALSE;
+
+        // add atomically, incomplete entries must never be found by artifact_cache_lookup()
+        tmp_path = g_build_filename(cache_dir, ".incomplete", NULL);
+        if (!link_or_copy(src, tmp_path, error))
+                return FALSE;
+
+        if (g_rename(tmp_path, path)) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to rename %s to %s: %s", tmp_path, path, g_strerror(err));
+                g_remove(tmp_path);
+                return FALSE;
+        }
+
+        // a hard linked entry carries the download's modification time, mark it as used now
+        if (g_utime(path, NULL))
+                log_debug("Failed to update modification time of %s: %s", path, g_strerror(errno));
+
+        return TRUE;
+}
@@ -0,0 +1,510 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief Checksums calculated in software or offloaded to the kernel crypto API
+ *
+ * @see https://www.kernel.org/doc/html/latest/crypto/userspace-if.html
+ */
+
+#include "checksum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <linux/if_alg.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "thread-priority.h"
+
+/**
+ * @brief Small updates are batched up to this size before they are passed to the kernel
+ */
+#define KERNEL_BATCH_SIZE 64 * 1024 // 64KB
+
+/**
+ * @brief Size and number of buffers checksum_read_file() reads ahead with
+ */
+#define READ_BUFFER_SIZE 128 * 1024 // 128KB
+#define READ_BUFFERS 3
+
+/**
+ * @brief Running checksum, either a GChecksum or an AF_ALG operation socket.
+ */
+struct Checksum_ {
+        GChecksumType type;           /**< checksum type */
+        GChecksum *software;          /**< software checksum, NULL if calculated by the kernel */
+        int tfm_fd;                   /**< AF_ALG socket bound to the hash algorithm */
+        int op_fd;                    /**< AF_ALG operation socket holding the running state */
+        guchar *pending;              /**< data batched for the kernel or NULL */
+        gsize pending_len;            /**< length of pending data */
+        gchar *digest;                /**< hexadecimal digest once finished by the kernel */
+        gboolean failed;              /**< whether passing data to the kernel failed */
+};
+
+/**
+ * @brief struct describing a buffer filled by the file reader thread.
+ */
+typedef struct ReadBuffer_ {
+        guchar *data;                 /**< buffer of READ_BUFFER_SIZE bytes */
+        gssize len;                   /**< bytes read, 0 at end of file, -1 on error */
+        int err;                      /**< errno if len is -1 */
+} ReadBuffer;
+
+/**
+ * @brief struct describing the file read by the file reader thread.
+ */
+typedef struct FileReader_ {
+        int fd;                       /**< file to read */
+        goffset offset;               /**< offset to read next */
+        goffset end;                  /**< offset to stop reading at */
+        GAsyncQueue *empty;           /**< ReadBuffer* to be filled */
+        GAsyncQueue *filled;          /**< ReadBuffer* filled, in file order */
+} FileReader;
+
+G_LOCK_DEFINE_STATIC(checksum);
+static ChecksumBackend backend = CHECKSUM_BACKEND_AUTO;
+// per GChecksumType: 0 not decided yet, 1 use kernel, -1 use software
+static gint kernel_state[G_CHECKSUM_SHA512 + 1];
+
+/**
+ * @brief Get the kernel crypto API name of the algorithm calculating type.
+ *
+ * @param[in] type Checksum type
+ * @return algorithm name or NULL if unknown
+ */
+static const gchar* kernel_alg_name(GChecksumType type)
+{
+        switch (type) {
+        case G_CHECKSUM_MD5:
+                return "md5";
+        case G_CHECKSUM_SHA1:
+                return "sha1";
+        case G_CHECKSUM_SHA256:
+                return "sha256";
+        case G_CHECKSUM_SHA512:
+                return "sha512";
+        default:
+                return NULL;
+        }
+}
+
+/**
+ * @brief Find out whether the driver the kernel uses for alg is accelerated, i.e. it is not the
+ *        generic C implementation. The kernel picks the registered driver with the highest
+ *        priority, e.g. a crypto engine (CAAM) or CPU extensions (ARMv8 CE, SHA-NI).
+ *
+ * @param[in] alg Kernel crypto API algorithm name
+ * @return TRUE if an accelerated driver is used, FALSE otherwise
+ */
+static gboolean kernel_driver_accelerated(const gchar *alg)
+{
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *best_driver = NULL;
+        g_auto(GStrv) lines = NULL;
+        const gchar *name = NULL, *driver = NULL;
+        gint64 priority = -1, best_priority = -1;
+
+        if (!g_file_get_contents("/proc/crypto", &contents, NULL, NULL))
+                return FALSE;
+
+        lines = g_strsplit(contents, "\n", -1);
+        for (gchar **line = lines; ; line++) {
+                gchar *sep;
+
+                // entries are separated by empty lines
+                if (!*line || !**line) {
+                        if (!g_strcmp0(name, alg) && driver && priority > best_priority) {
+                                g_free(best_driver);
+                                best_driver = g_strdup(driver);
+                                best_priority = priority;
+                        }
+                        name = driver = NULL;
+                        priority = -1;
+
+                        if (!*line)
+                                break;
+                        continue;
+                }
+
+                sep = strchr(*line, ':');
+                if (!sep)
+                        continue;
+                *sep = '\0';
+                g_strstrip(*line);
+
+                if (!g_strcmp0(*line, "name"))
+                        name = g_strstrip(sep + 1);
+                else if (!g_strcmp0(*line, "driver"))
+                        driver = g_strstrip(sep + 1);
+                else if (!g_strcmp0(*line, "priority"))
+                        priority = g_ascii_strtoll(sep + 1, NULL, 10);
+        }
+
+        if (!best_driver)
+                return FALSE;
+
+        log_debug("Kernel uses %s for %s checksums", best_driver, alg);
+        return !g_str_has_suffix(best_driver, "-generic");
+}
+
+/**
+ * @brief Open the AF_ALG sockets calculating checksum in the kernel.
+ *
+ * @param[in]  checksum Checksum to open the sockets for
+ * @param[out] error    Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean kernel_open(Checksum *checksum, GError **error)
+{
+        struct sockaddr_alg addr = {
+                .salg_family = AF_ALG,
+                .salg_type = "hash",
+        };
+        int err;
+
+        g_strlcpy((gchar *) addr.salg_name, kernel_alg_name(checksum->type),
+                  sizeof(addr.salg_name));
+
+        checksum->tfm_fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (checksum->tfm_fd >= 0 &&
+            bind(checksum->tfm_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+                checksum->op_fd = accept4(checksum->tfm_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (checksum->op_fd >= 0)
+                        return TRUE;
+        }
+
+        err = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err), "%s", g_strerror(err));
+        if (checksum->tfm_fd >= 0)
+                close(checksum->tfm_fd);
+        checksum->tfm_fd = -1;
+        return FALSE;
+}
+
+/**
+ * @brief Pass data to the kernel. On failure, checksum is marked failed.
+ *
+ * @param[in] checksum Checksum to update
+ * @param[in] data     Data to pass
+ * @param[in] len      Length of data
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean kernel_send(Checksum *checksum, const guchar *data, gsize len)
+{
+        while (len) {
+                // MSG_MORE keeps the hash running, it is finished by reading its digest
+                ssize_t sent = send(checksum->op_fd, data, len, MSG_MORE);
+
+                if (sent < 0 && errno == EINTR)
+                        continue;
+                if (sent <= 0) {
+                        g_warning("Kernel %s checksum failed: %s",
+                                  kernel_alg_name(checksum->type), g_strerror(errno));
+                        checksum->failed = TRUE;
+                        return FALSE;
+                }
+
+                data += sent;
+                len -= sent;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Pass the data batched in checksum to the kernel.
+ *
+ * @param[in] checksum Checksum to flush
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean kernel_flush(Checksum *checksum)
+{
+        gsize len = checksum->pending_len;
+
+        if (checksum->failed)
+                return FALSE;
+
+        checksum->pending_len = 0;
+        return !len || kernel_send(checksum, checksum->pending, len);
+}
+
+void checksum_set_backend(ChecksumBackend new_backend)
+{
+        G_LOCK(checksum);
+        backend = new_backend;
+        memset(kernel_state, 0, sizeof(kernel_state));
+        G_UNLOCK(checksum);
+}
+
+Checksum* checksum_new(GChecksumType type)
+{
+        Checksum *checksum = g_new0(Checksum, 1);
+        const gchar *alg = kernel_alg_name(type);
+        g_autoptr(GError) error = NULL;
+        gint state = -1;
+
+        checksum->type = type;
+        checksum->tfm_fd = -1;
+        checksum->op_fd = -1;
+
+        G_LOCK(checksum);
+        if (alg && backend != CHECKSUM_BACKEND_SOFTWARE) {
+                if (!kernel_state[type])
+                        kernel_state[type] = (backend == CHECKSUM_BACKEND_KERNEL ||
+                                              kernel_driver_accelerated(alg)) ? 1 : -1;
+                state = kernel_state[type];
+        }
+        G_UNLOCK(checksum);
+
+        if (state > 0) {
+                if (kernel_open(checksum, &error))
+                        return checksum;
+
+                G_LOCK(checksum);
+                kernel_state[type] = -1;
+                G_UNLOCK(checksum);
+                g_message("Kernel crypto API not usable for %s, using software checksums: %s",
+                          alg, error->message);
+        }
+
+        checksum->software = g_checksum_new(type);
+        return checksum;
+}
+
+Checksum* checksum_copy(Checksum *checksum)
+{
+        Checksum *copy = NULL;
+
+        g_return_val_if_fail(checksum, NULL);
+
+        copy = g_new0(Checksum, 1);
+        copy->type = checksum->type;
+        copy->tfm_fd = -1;
+        copy->op_fd = -1;
+
+        if (checksum->software) {
+                copy->software = g_checksum_copy(checksum->software);
+                return copy;
+        }
+
+        copy->digest = g_strdup(checksum->digest);
+        copy->failed = checksum->failed;
+        if (copy->digest || copy->failed)
+                return copy;
+
+        // accept() on an operation socket clones its state, so pending data is passed first
+        copy->failed = !kernel_flush(checksum);
+        if (!copy->failed) {
+                copy->tfm_fd = fcntl(checksum->tfm_fd, F_DUPFD_CLOEXEC, 0);
+                copy->op_fd = accept4(checksum->op_fd, NULL, NULL, SOCK_CLOEXEC);
+        }
+        if (!copy->failed && (copy->tfm_fd < 0 || copy->op_fd < 0)) {
+                g_warning("Copying kernel %s checksum failed: %s",
+                          kernel_alg_name(copy->type), g_strerror(errno));
+                copy->failed = TRUE;
+        }
+
+        return copy;
+}
+
+void checksum_update(Checksum *checksum, const guchar *data, gsize len)
+{
+        g_return_if_fail(checksum);
+
+        if (checksum->software) {
+                g_checksum_update(checksum->software, data, len);
+                return;
+        }
+
+        g_return_if_fail(!checksum->digest);
+
+        if (checksum->failed || !len)
+                return;
+
+        if (checksum->pending_len + len > KERNEL_BATCH_SIZE && !kernel_flush(checksum))
+                return;
+
+        if (len >= KERNEL_BATCH_SIZE) {
+                kernel_send(checksum, data, len);
+                return;
+        }
+
+        // every send() is a syscall, batch the small chunks curl delivers
+        if (!checksum->pending)
+                checksum->pending = g_malloc(KERNEL_BATCH_SIZE);
+        memcpy(checksum->pending + checksum->pending_len, data, len);
+        checksum->pending_len += len;
+
+        if (checksum->pending_len == KERNEL_BATCH_SIZE)
+                kernel_flush(checksum);
+}
+
+void checksum_reset(Checksum *checksum)
+{
+        g_return_if_fail(checksum);
+
+        if (checksum->software) {
+                g_checksum_reset(checksum->software);
+                return;
+        }
+
+        g_clear_pointer(&checksum->digest, g_free);
+        checksum->pending_len = 0;
+        checksum->failed = FALSE;
+
+        // a fresh operation socket starts a new hash
+        if (checksum->op_fd >= 0)
+                close(checksum->op_fd);
+        checksum->op_fd = checksum->tfm_fd >= 0 ?
+                          accept4(checksum->tfm_fd, NULL, NULL, SOCK_CLOEXEC) : -1;
+        if (checksum->op_fd < 0) {
+                g_warning("Resetting kernel %s checksum failed: %s",
+                          kernel_alg_name(checksum->type), g_strerror(errno));
+                checksum->failed = TRUE;
+        }
+}
+
+const gchar* checksum_get_string(Checksum *checksum)
+{
+        guchar digest[64];
+        gssize len;
+
+        g_return_val_if_fail(checksum, NULL);
+
+        if (checksum->software)
+                return g_checksum_get_string(checksum->software);
+
+        if (checksum->digest || !kernel_flush(checksum))
+                return checksum->digest;
+
+        len = g_checksum_type_get_length(checksum->type);
+        g_return_val_if_fail(len > 0 && len <= (gssize) sizeof(digest), NULL);
+
+        // reading the digest finishes the hash
+        if (read(checksum->op_fd, digest, len) != len) {
+                g_warning("Finishing kernel %s checksum failed: %s",
+                          kernel_alg_name(checksum->type), g_strerror(errno));
+                checksum->failed = TRUE;
+                return NULL;
+        }
+
+        checksum->digest = g_malloc(len * 2 + 1);
+        for (gssize i = 0; i < len; i++)
+                g_snprintf(checksum->digest + i * 2, 3, "%02x", digest[i]);
+
+        return checksum->digest;
+}
+
+void checksum_free(Checksum *checksum)
+{
+        if (!checksum)
+                return;
+
+        if (checksum->software)
+                g_checksum_free(checksum->software);
+        if (checksum->op_fd >= 0)
+                close(checksum->op_fd);
+        if (checksum->tfm_fd >= 0)
+                close(checksum->tfm_fd);
+        g_free(checksum->pending);
+        g_free(checksum->digest);
+        g_free(checksum);
+}
+
+/**
+ * @brief Thread filling the empty buffers of a FileReader with consecutive parts of its file,
+ *        until its end was read or reading failed.
+ *
+ * @param[in] data FileReader*
+ * @return NULL
+ */
+static gpointer file_reader_thread(gpointer data)
+{
+        FileReader *reader = data;
+
+        thread_priority_apply("checksum-read");
+
+        while (reader->offset < reader->end) {
+                ReadBuffer *buf = g_async_queue_pop(reader->empty);
+
+                do {
+                        buf->len = pread(reader->fd, buf->data,
+                                         MIN(READ_BUFFER_SIZE, reader->end - reader->offset),
+                                         reader->offset);
+                } while (buf->len < 0 && errno == EINTR);
+                buf->err = buf->len < 0 ? errno : 0;
+
+                g_async_queue_push(reader->filled, buf);
+                if (buf->len <= 0)
+                        break;
+
+                reader->offset += buf->len;
+        }
+
+        return NULL;
+}
+
+gboolean checksum_read_file(const gchar *file, goffset offset, goffset size,
+                            ChecksumReadFunc func, gpointer user_data, GError **error)
+{
+        ReadBuffer buffers[READ_BUFFERS];
+        FileReader reader = { .offset = offset, .end = size };
+        GThread *thread = NULL;
+        gboolean res = TRUE;
+
+        g_return_val_if_fail(file, FALSE);
+        g_return_val_if_fail(func, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (offset >= size)
+                return TRUE;
+
+        reader.fd = g_open(file, O_RDONLY | O_CLOEXEC, 0);
+        if (reader.fd < 0) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to read %s for checksum calculation: %s", file,
+                            g_strerror(err));
+                return FALSE;
+        }
+        posix_fadvise(reader.fd, offset, size - offset, POSIX_FADV_SEQUENTIAL);
+
+        reader.empty = g_async_queue_new();
+        reader.filled = g_async_queue_new();
+        for (guint i = 0; i < READ_BUFFERS; i++) {
+                buffers[i].data = g_malloc(READ_BUFFER_SIZE);
+                g_async_queue_push(reader.empty, &buffers[i]);
+        }
+
+        thread = g_thread_new("checksum-read", file_reader_thread, &reader);
+
+        while (offset < size) {
+                ReadBuffer *buf = g_async_queue_pop(reader.filled);
+
+                if (buf->len <= 0) {
+                        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Read failed: %s",
+                                    buf->len ? g_strerror(buf->err) : "unexpected end of file");
+                        res = FALSE;
+                        break;
+                }
+
+                func(buf->data, buf->len, user_data);
+                offset += buf->len;
+                g_async_queue_push(reader.empty, buf);
+        }
+
+        // the reader stops on its own at the end of the range and after a failed read
+        g_thread_join(thread);
+
+        for (guint i = 0; i < READ_BUFFERS; i++)
+                g_free(buffers[i].data);
+        g_async_queue_unref(reader.empty);
+        g_async_queue_unref(reader.filled);
+        g_close(reader.fd, NULL);
+
+        return res;
+}
@@ -8,13 +8,24 @@
  */
 
 #include "config-file.h"
+#include <gio/gio.h>
 #include <glib/gtypes.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 static const gint DEFAULT_CONNECTTIMEOUT  = 20;     // 20 sec.
 static const gint DEFAULT_TIMEOUT         = 60;     // 1 min.
 static const gint DEFAULT_RETRY_WAIT      = 5 * 60; // 5 min.
+static const gint DEFAULT_IDLE_TIMEOUT    = 2 * 60; // 2 min.
+static const gint DEFAULT_SEGMENT_MIN     = 4 * 1024 * 1024; // 4 MiB
+static const gint DEFAULT_CACHE_MAX_SIZE  = 1024;    // 1 GiB
+static const gint DEFAULT_WRITE_SIZE      = 1024 * 1024; // 1 MiB
+static const gint DEFAULT_GATEWAY_CONNECTIONS = 8;
+static const gint DEFAULT_LOW_MEM_RESPONSE_SIZE = 1024 * 1024; // 1 MiB
+static const gint DEFAULT_REBOOT_FEEDBACK_TIMEOUT = 60; // 1 min.
+static const gint MAX_CPU_AFFINITY    = 1024;    // CPU_SETSIZE
 static const gboolean DEFAULT_SSL         = TRUE;
 static const gboolean DEFAULT_SSL_VERIFY  = TRUE;
 static const gboolean DEFAULT_REBOOT      = FALSE;
@@ -198,6 +209,598 @@ static gboolean get_group(GKeyFile *key_file, const gchar *group, GHashTable **h
         return TRUE;
 }
 
+/**
+ * @brief GCompareFunc ordering gchar** alphabetically.
+ */
+static gint compare_strings(gconstpointer a, gconstpointer b)
+{
+        return g_strcmp0(*(const gchar **) a, *(const gchar **) b);
+}
+
+/**
+ * @brief Get the devices served in gateway mode, from the controller_ids list (sharing the
+ * attributes of key_file's [device] group) and from the per-device "*.conf" files in
+ * controller_dir. Each of these files holds the device's target_name in a [controller] group and
+ * optionally its attributes in a [device] group, falling back to the shared attributes.
+ *
+ * @param[in]  key_file   GKeyFile to look values up
+ * @param[in]  attributes Attributes shared by devices listed in controller_ids or NULL
+ * @param[out] devices    Output GatewayDeviceConfig array (must be freed) or NULL if gateway mode is
+ *                        not configured
+ * @param[out] error      Error
+ * @return TRUE on success, FALSE otherwise (error is set)
+ */
+static gboolean get_gateway_devices(GKeyFile *key_file, GHashTable *attributes,
+                                    GPtrArray **devices, GError **error)
+{
+        g_autoptr(GPtrArray) tmp_devices = g_ptr_array_new_with_free_func(
+                (GDestroyNotify) gateway_device_config_free);
+        g_autoptr(GHashTable) ids = g_hash_table_new(g_str_hash, g_str_equal);
+        g_autofree gchar *controller_dir = NULL;
+        g_auto(GStrv) controller_ids = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(devices && *devices == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        controller_ids = g_key_file_get_string_list(key_file, "client", "controller_ids", NULL,
+                                                    NULL);
+        for (gchar **id = controller_ids; id && *id; id++) {
+                GatewayDeviceConfig *device = NULL;
+
+                g_strstrip(*id);
+                if (!**id)
+                        continue;
+
+                device = g_new0(GatewayDeviceConfig, 1);
+                device->controller_id = g_strdup(*id);
+                device->attributes = attributes ? g_hash_table_ref(attributes) : NULL;
+                g_ptr_array_add(tmp_devices, device);
+        }
+
+        if (get_key_string(key_file, "client", "controller_dir", &controller_dir, NULL, NULL)) {
+                g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func(g_free);
+                g_autoptr(GDir) dir = NULL;
+                const gchar *name;
+
+                dir = g_dir_open(controller_dir, 0, error);
+                if (!dir)
+                        return FALSE;
+
+                while ((name = g_dir_read_name(dir))) {
+                        if (g_str_has_suffix(name, ".conf"))
+                                g_ptr_array_add(names, g_strdup(name));
+                }
+                g_ptr_array_sort(names, compare_strings);
+
+                for (guint i = 0; i < names->len; i++) {
+                        g_autofree gchar *path = g_build_filename(
+                                controller_dir, g_ptr_array_index(names, i), NULL);
+                        g_autoptr(GKeyFile) device_file = g_key_file_new();
+                        g_autoptr(GatewayDeviceConfig) device = g_new0(GatewayDeviceConfig, 1);
+
+                        if (!g_key_file_load_from_file(device_file, path, G_KEY_FILE_NONE, error) ||
+                            !get_key_string(device_file, "controller", "target_name",
+                                            &device->controller_id, NULL, error) ||
+                            (g_key_file_has_group(device_file, "device") &&
+                             !get_group(device_file, "device", &device->attributes, error))) {
+                                g_prefix_error(error, "%s: ", path);
+                                return FALSE;
+                        }
+                        if (!device->attributes && attributes)
+                                device->attributes = g_hash_table_ref(attributes);
+
+                        g_ptr_array_add(tmp_devices, g_steal_pointer(&device));
+                }
+        }
+
+        for (guint i = 0; i < tmp_devices->len; i++) {
+                GatewayDeviceConfig *device = g_ptr_array_index(tmp_devices, i);
+
+                if (!g_hash_table_add(ids, device->controller_id)) {
+                        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                                    "Controller '%s' is configured more than once",
+                                    device->controller_id);
+                        return FALSE;
+                }
+        }
+
+        *devices = tmp_devices->len ? g_steal_pointer(&tmp_devices) : NULL;
+        return TRUE;
+}
+
+/**
+ * @brief Get list of "host:port" peers from key_file for key in group.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] peers    Output NULL-terminated peer list, NULL if key not found in group
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise. Note that TRUE is returned if key in
+ *         group is not found, peers is set to NULL in this case.
+ */
+static gboolean get_key_peers(GKeyFile *key_file, const gchar *group, const gchar *key,
+                              GStrv *peers, GError **error)
+{
+        g_autoptr(GPtrArray) tmp_peers = g_ptr_array_new_with_free_func(g_free);
+        g_auto(GStrv) entries = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(peers && *peers == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        entries = g_key_file_get_string_list(key_file, group, key, NULL, NULL);
+        for (gchar **entry = entries; entry && *entry; entry++) {
+                gchar *port = NULL, *end = NULL;
+                gint64 port_num = 0;
+
+                g_strstrip(*entry);
+                if (!**entry)
+                        continue;
+
+                port = strrchr(*entry, ':');
+                if (port && port != *entry)
+                        port_num = g_ascii_strtoll(port + 1, &end, 10);
+                if (!end || end == port + 1 || *end || port_num < 1 || port_num > G_MAXUINT16) {
+                        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                                    "Invalid %s entry '%s', expected HOST:PORT", key, *entry);
+                        return FALSE;
+                }
+
+                g_ptr_array_add(tmp_peers, g_strdup(*entry));
+        }
+
+        if (!tmp_peers->len)
+                return TRUE;
+
+        g_ptr_array_add(tmp_peers, NULL);
+        *peers = (GStrv) g_ptr_array_free(g_steal_pointer(&tmp_peers), FALSE);
+        return TRUE;
+}
+
+/**
+ * @brief Get list of IP addresses or subnets ("ADDRESS[/PREFIX]") from key_file for key in group.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] subnets  Output NULL-terminated subnet list, NULL if key not found in group
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise. Note that TRUE is returned if key in
+ *         group is not found, subnets is set to NULL in this case.
+ */
+static gboolean get_key_subnets(GKeyFile *key_file, const gchar *group, const gchar *key,
+                                GStrv *subnets, GError **error)
+{
+        g_autoptr(GPtrArray) tmp_subnets = g_ptr_array_new_with_free_func(g_free);
+        g_auto(GStrv) entries = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(subnets && *subnets == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        entries = g_key_file_get_string_list(key_file, group, key, NULL, NULL);
+        for (gchar **entry = entries; entry && *entry; entry++) {
+                g_autoptr(GInetAddressMask) mask = NULL;
+
+                g_strstrip(*entry);
+                if (!**entry)
+                        continue;
+
+                mask = g_inet_address_mask_new_from_string(*entry, NULL);
+                if (!mask) {
+                        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                                    "Invalid %s entry '%s', expected ADDRESS[/PREFIX]", key,
+                                    *entry);
+                        return FALSE;
+                }
+
+                g_ptr_array_add(tmp_subnets, g_strdup(*entry));
+        }
+
+        if (!tmp_subnets->len)
+                return TRUE;
+
+        g_ptr_array_add(tmp_subnets, NULL);
+        *subnets = (GStrv) g_ptr_array_free(g_steal_pointer(&tmp_subnets), FALSE);
+        return TRUE;
+}
+
+/**
+ * @brief Get list of HTTP(S) base URLs from key_file for key in group. Trailing slashes are
+ *        removed.
+ *
+ * @param[in]  key_file   GKeyFile to look value up
+ * @param[in]  group      A group name
+ * @param[in]  key        A key
+ * @param[in]  https_only Whether to reject plain HTTP URLs
+ * @param[out] urls     Output NULL-terminated URL list, NULL if key not found in group
+ * @param[out] error      Error
+ * @return FALSE on error (error is set), TRUE otherwise. Note that TRUE is returned if key in
+ *         group is not found, urls is set to NULL in this case.
+ */
+static gboolean get_key_base_urls(GKeyFile *key_file, const gchar *group, const gchar *key,
+                                  gboolean https_only, GStrv *urls, GError **error)
+{
+        g_autoptr(GPtrArray) tmp_urls = g_ptr_array_new_with_free_func(g_free);
+        g_auto(GStrv) entries = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(urls && *urls == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        entries = g_key_file_get_string_list(key_file, group, key, NULL, NULL);
+        for (gchar **entry = entries; entry && *entry; entry++) {
+                gchar *host = NULL;
+                gsize len;
+
+                g_strstrip(*entry);
+                if (!**entry)
+                        continue;
+
+                if (!https_only && g_str_has_prefix(*entry, "http://"))
+                        host = *entry + strlen("http://");
+                else if (g_str_has_prefix(*entry, "https://"))
+                        host = *entry + strlen("https://");
+                if (!host || !*host || *host == '/') {
+                        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                                    "Invalid %s entry '%s', expected %s://HOST[:PORT][/PATH]",
+                                    key, *entry, https_only ? "https" : "http(s)");
+                        return FALSE;
+                }
+
+                len = strlen(*entry);
+                while ((*entry)[len - 1] == '/')
+                        (*entry)[--len] = '\0';
+
+                g_ptr_array_add(tmp_urls, g_strdup(*entry));
+        }
+
+        if (!tmp_urls->len)
+                return TRUE;
+
+        g_ptr_array_add(tmp_urls, NULL);
+        *urls = (GStrv) g_ptr_array_free(g_steal_pointer(&tmp_urls), FALSE);
+        return TRUE;
+}
+
+/**
+ * @brief Get DownloadWindow array from key_file for key in group, given as list of
+ * "HH:MM-HH:MM[@RATE]" entries.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] windows  Output DownloadWindow array, NULL if key not found in group
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise. Note that TRUE is returned if key in
+ *         group is not found, windows is set to NULL in this case.
+ */
+static gboolean get_key_download_windows(GKeyFile *key_file, const gchar *group, const gchar *key,
+                                         GArray **windows, GError **error)
+{
+        g_autoptr(GArray) tmp_windows = NULL;
+        g_auto(GStrv) entries = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(windows && *windows == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        entries = g_key_file_get_string_list(key_file, group, key, NULL, NULL);
+        if (!entries)
+                return TRUE;
+
+        tmp_windows = g_array_new(FALSE, FALSE, sizeof(DownloadWindow));
+        for (gchar **entry = entries; *entry; entry++) {
+                DownloadWindow window = { .rate = -1 };
+                int start_h, start_m, end_h, end_m, len = 0, rate_len = 0;
+                gboolean valid;
+
+                g_strstrip(*entry);
+                if (!**entry)
+                        continue;
+
+                valid = sscanf(*entry, "%2d:%2d-%2d:%2d%n", &start_h, &start_m, &end_h, &end_m,
+                               &len) == 4;
+                if (valid && (*entry)[len])
+                        valid = sscanf(*entry + len, "@%d%n", &window.rate, &rate_len) == 1 &&
+                                !(*entry)[len + rate_len] && window.rate >= 0;
+                if (!valid || start_h < 0 || start_h > 23 || start_m < 0 || start_m > 59 ||
+                    end_h < 0 || end_h > 23 || end_m < 0 || end_m > 59) {
+                        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                                    "Invalid %s entry '%s', expected HH:MM-HH:MM[@RATE]", key,
+                                    *entry);
+                        return FALSE;
+                }
+
+                window.start = start_h * 60 + start_m;
+                window.end = end_h * 60 + end_m;
+                g_array_append_val(tmp_windows, window);
+        }
+
+        *windows = g_steal_pointer(&tmp_windows);
+        return TRUE;
+}
+
+/**
+ * @brief Get download rate options from key_file.
+ *
+ * @param[in]  key_file          GKeyFile to look values up
+ * @param[out] max_download_rate Output download rate limit in bytes/s
+ * @param[out] download_windows  Output DownloadWindow array or NULL
+ * @param[out] error             Error
+ * @return TRUE on success, FALSE otherwise (error is set)
+ */
+static gboolean get_download_rate_options(GKeyFile *key_file, int *max_download_rate,
+                                          GArray **download_windows, GError **error)
+{
+        g_autoptr(GArray) windows = NULL;
+
+        if (!get_key_int(key_file, "client", "max_download_rate", max_download_rate, 0, error))
+                return FALSE;
+        if (!get_key_download_windows(key_file, "client", "download_windows", &windows, error))
+                return FALSE;
+
+        if (*max_download_rate < 0) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "max_download_rate (%d) must not be negative", *max_download_rate);
+                return FALSE;
+        }
+
+        *download_windows = g_steal_pointer(&windows);
+        return TRUE;
+}
+
+gboolean load_download_rate_config(const gchar *config_file, int *max_download_rate,
+                                   GArray **download_windows, GError **error)
+{
+        g_autoptr(GKeyFile) ini_file = NULL;
+
+        g_return_val_if_fail(config_file, FALSE);
+        g_return_val_if_fail(max_download_rate, FALSE);
+        g_return_val_if_fail(download_windows && *download_windows == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        ini_file = g_key_file_new();
+
+        if (!g_key_file_load_from_file(ini_file, config_file, G_KEY_FILE_NONE, error))
+                return FALSE;
+
+        return get_download_rate_options(ini_file, max_download_rate, download_windows, error);
+}
+
+/**
+ * @brief Get DownloadIOMode value from key_file for key in group, DOWNLOAD_IO_BUFFERED if key is
+ *        not found in group.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] value    Output DownloadIOMode value
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise
+ */
+static gboolean get_key_download_io_mode(GKeyFile *key_file, const gchar *group,
+                                         const gchar *key, DownloadIOMode *value,
+                                         GError **error)
+{
+        g_autofree gchar *val = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(value, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!get_key_string(key_file, group, key, &val, "buffered", error))
+                return FALSE;
+
+        if (!g_strcmp0(val, "buffered")) {
+                *value = DOWNLOAD_IO_BUFFERED;
+        } else if (!g_strcmp0(val, "dontneed")) {
+                *value = DOWNLOAD_IO_DONTNEED;
+        } else if (!g_strcmp0(val, "direct")) {
+                *value = DOWNLOAD_IO_DIRECT;
+        } else {
+                g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "Invalid %s '%s', expected buffered, dontneed or direct", key, val);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Get IOClass for key in group of key_file, IO_CLASS_DEFAULT if key is not found.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] value    Output IOClass
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise
+ */
+static gboolean get_key_io_class(GKeyFile *key_file, const gchar *group, const gchar *key,
+                                 IOClass *value, GError **error)
+{
+        g_autofree gchar *val = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(value, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!get_key_string(key_file, group, key, &val, "default", error))
+                return FALSE;
+
+        if (!g_strcmp0(val, "default")) {
+                *value = IO_CLASS_DEFAULT;
+        } else if (!g_strcmp0(val, "best-effort")) {
+                *value = IO_CLASS_BEST_EFFORT;
+        } else if (!g_strcmp0(val, "idle")) {
+                *value = IO_CLASS_IDLE;
+        } else {
+                g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "Invalid %s '%s', expected default, best-effort or idle", key, val);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Get CPUPolicy for key in group of key_file, CPU_POLICY_OTHER if key is not found.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] value    Output CPUPolicy
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise
+ */
+static gboolean get_key_cpu_policy(GKeyFile *key_file, const gchar *group, const gchar *key,
+                                   CPUPolicy *value, GError **error)
+{
+        g_autofree gchar *val = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(value, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!get_key_string(key_file, group, key, &val, "other", error))
+                return FALSE;
+
+        if (!g_strcmp0(val, "other")) {
+                *value = CPU_POLICY_OTHER;
+        } else if (!g_strcmp0(val, "batch")) {
+                *value = CPU_POLICY_BATCH;
+        } else if (!g_strcmp0(val, "idle")) {
+                *value = CPU_POLICY_IDLE;
+        } else {
+                g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "Invalid %s '%s', expected other, batch or idle", key, val);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Get the CPUs listed for key in group of key_file, separated by ',' and given as single
+ *        numbers or ranges, e.g. "0,2-3". NULL if key is not found.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] cpus     Output GArray of guint CPU numbers, NULL if key is not found
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise
+ */
+static gboolean get_key_cpu_list(GKeyFile *key_file, const gchar *group, const gchar *key,
+                                 GArray **cpus, GError **error)
+{
+        g_autoptr(GArray) tmp_cpus = g_array_new(FALSE, FALSE, sizeof(guint));
+        g_autofree gchar *val = NULL;
+        g_auto(GStrv) entries = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(cpus && *cpus == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!get_key_string(key_file, group, key, &val, "", error))
+                return FALSE;
+
+        entries = g_strsplit(val, ",", -1);
+        for (gchar **entry = entries; *entry; entry++) {
+                gchar *end = NULL;
+                guint64 first = 0, last = 0;
+
+                g_strstrip(*entry);
+                if (!**entry)
+                        continue;
+
+                first = g_ascii_strtoull(*entry, &end, 10);
+                last = first;
+                if (end != *entry && *end == '-') {
+                        gchar *start = end + 1;
+
+                        last = g_ascii_strtoull(start, &end, 10);
+                        if (end == start)
+                                end = NULL;
+                }
+                if (!end || end == *entry || *end || first > last ||
+                    last >= (guint64) MAX_CPU_AFFINITY) {
+                        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                                    "Invalid %s entry '%s', expected CPU or CPU range below %d",
+                                    key, *entry, MAX_CPU_AFFINITY);
+                        return FALSE;
+                }
+
+                for (guint cpu = first; cpu <= last; cpu++)
+                        g_array_append_val(tmp_cpus, cpu);
+        }
+
+        if (tmp_cpus->len)
+                *cpus = g_steal_pointer(&tmp_cpus);
+
+        return TRUE;
+}
+
+/**
+ * @brief Get ChecksumBackend for key in group of key_file.
+ *
+ * @param[in]  key_file GKeyFile to look value up
+ * @param[in]  group    A group name
+ * @param[in]  key      A key
+ * @param[out] value    Output ChecksumBackend
+ * @param[out] error    Error
+ * @return FALSE on error (error is set), TRUE otherwise
+ */
+static gboolean get_key_checksum_backend(GKeyFile *key_file, const gchar *group,
+                                         const gchar *key, ChecksumBackend *value,
+                                         GError **error)
+{
+        g_autofree gchar *val = NULL;
+
+        g_return_val_if_fail(key_file, FALSE);
+        g_return_val_if_fail(group, FALSE);
+        g_return_val_if_fail(key, FALSE);
+        g_return_val_if_fail(value, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!get_key_string(key_file, group, key, &val, "auto", error))
+                return FALSE;
+
+        if (!g_strcmp0(val, "auto")) {
+                *value = CHECKSUM_BACKEND_AUTO;
+        } else if (!g_strcmp0(val, "software")) {
+                *value = CHECKSUM_BACKEND_SOFTWARE;
+        } else if (!g_strcmp0(val, "kernel")) {
+                *value = CHECKSUM_BACKEND_KERNEL;
+        } else {
+                g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "Invalid %s '%s', expected auto, software or kernel", key, val);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
 /**
  * @brief Get GLogLevelFlags for error string.
  *
@@ -238,6 +841,7 @@ Config* load_config_file(const gchar *config_file, GError **error)
         g_autoptr(Config) config = NULL;
         g_autofree gchar *val = NULL;
         g_autoptr(GKeyFile) ini_file = NULL;
+        g_autoptr(GError) target_name_error = NULL;
         gboolean key_auth_token_exists = FALSE;
         gboolean key_gateway_token_exists = FALSE;
 
@@ -250,6 +854,8 @@ Config* load_config_file(const gchar *config_file, GError **error)
         if (!g_key_file_load_from_file(ini_file, config_file, G_KEY_FILE_NONE, error))
                 return NULL;
 
+        config->config_file = g_strdup(config_file);
+
         if (!get_key_string(ini_file, "client", "hawkbit_server", &config->hawkbit_server, NULL,
                             error))
                 return NULL;
@@ -269,14 +875,37 @@ Config* load_config_file(const gchar *config_file, GError **error)
                 return NULL;
         }
 
-        if (!get_key_string(ini_file, "client", "target_name", &config->controller_id, NULL,
-                            error))
-                return NULL;
+        // target_name is not needed in gateway mode, checked below
+        get_key_string(ini_file, "client", "target_name", &config->controller_id, NULL,
+                       &target_name_error);
         if (!get_key_string(ini_file, "client", "tenant_id", &config->tenant_id, "DEFAULT", error))
                 return NULL;
         if (!get_key_string(ini_file, "client", "bundle_download_location",
                             &config->bundle_download_location, NULL, error))
                 return NULL;
+        // artifact cache is optional
+        get_key_string(ini_file, "client", "artifact_cache_dir", &config->artifact_cache_dir, NULL,
+                       NULL);
+        // metrics export is optional
+        get_key_string(ini_file, "client", "metrics_file", &config->metrics_file, NULL, NULL);
+        get_key_string(ini_file, "client", "connection_state_file", &config->connection_state_file,
+                       NULL, NULL);
+        get_key_string(ini_file, "client", "feedback_state_file", &config->feedback_state_file,
+                       NULL, NULL);
+        if (!get_key_int(ini_file, "client", "peer_port", &config->peer_port, 0, error))
+                return NULL;
+        // peers are served on all addresses by default
+        get_key_string(ini_file, "client", "peer_address", &config->peer_address, NULL, NULL);
+        if (!get_key_subnets(ini_file, "client", "peer_allow", &config->peer_allow, error))
+                return NULL;
+        if (!get_key_peers(ini_file, "client", "peers", &config->peers, error))
+                return NULL;
+        if (!get_key_base_urls(ini_file, "client", "mirrors", FALSE, &config->mirrors, error))
+                return NULL;
+        // credentials must not be sent in cleartext
+        if (!get_key_base_urls(ini_file, "client", "authenticated_mirrors", TRUE,
+                               &config->authenticated_mirrors, error))
+                return NULL;
         if (!get_key_bool(ini_file, "client", "ssl", &config->ssl, DEFAULT_SSL, error))
                 return NULL;
         if (!get_key_bool(ini_file, "client", "ssl_verify", &config->ssl_verify,
@@ -284,6 +913,23 @@ Config* load_config_file(const gchar *config_file, GError **error)
                 return NULL;
         if (!get_group(ini_file, "device", &config->device, error))
                 return NULL;
+        if (!get_gateway_devices(ini_file, config->device, &config->gateway_devices, error))
+                return NULL;
+        if (!config->gateway_devices && !config->controller_id) {
+                g_propagate_error(error, g_steal_pointer(&target_name_error));
+                return NULL;
+        }
+        if (config->gateway_devices && !key_gateway_token_exists) {
+                g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "Gateway mode (controller_ids, controller_dir) requires gateway_token.");
+                return NULL;
+        }
+        // gateway install command is optional, bundles are only downloaded without it
+        get_key_string(ini_file, "client", "gateway_install_command",
+                       &config->gateway_install_command, NULL, NULL);
+        if (!get_key_int(ini_file, "client", "gateway_max_connections",
+                         &config->gateway_max_connections, DEFAULT_GATEWAY_CONNECTIONS, error))
+                return NULL;
         if (!get_key_int(ini_file, "client", "connect_timeout", &config->connect_timeout,
                          DEFAULT_CONNECTTIMEOUT, error))
                 return NULL;
@@ -292,6 +938,11 @@ Config* load_config_file(const gchar *config_file, GError **error)
         if (!get_key_int(ini_file, "client", "retry_wait", &config->retry_wait, DEFAULT_RETRY_WAIT,
                          error))
                 return NULL;
+        if (!get_key_int(ini_file, "client", "poll_jitter", &config->poll_jitter, 0, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "retry_backoff_max", &config->retry_backoff_max, 0,
+                         error))
+                return NULL;
         if (!get_key_int(ini_file, "client", "low_speed_rate", &config->low_speed_rate, 100,
                          error))
                 return NULL;
@@ -300,12 +951,75 @@ Config* load_config_file(const gchar *config_file, GError **error)
         if (!get_key_bool(ini_file, "client", "resume_downloads", &config->resume_downloads, FALSE,
                           error))
                 return NULL;
+        if (!get_key_bool(ini_file, "client", "stream_bundle", &config->stream_bundle, FALSE,
+                          error))
+                return NULL;
+        if (!get_key_bool(ini_file, "client", "preflight_check", &config->preflight_check,
+                          FALSE, error))
+                return NULL;
+        if (!get_key_bool(ini_file, "client", "dbus_service", &config->dbus_service, FALSE,
+                          error))
+                return NULL;
+        if (!get_key_bool(ini_file, "client", "http2", &config->http2, FALSE, error))
+                return NULL;
+        if (!get_key_bool(ini_file, "client", "compressed_responses",
+                          &config->compressed_responses, FALSE, error))
+                return NULL;
+        if (!get_key_bool(ini_file, "client", "low_memory", &config->low_memory, FALSE, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "max_response_size", &config->max_response_size,
+                         config->low_memory ? DEFAULT_LOW_MEM_RESPONSE_SIZE : 0, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "connection_idle_timeout",
+                         &config->connection_idle_timeout, DEFAULT_IDLE_TIMEOUT, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "download_segments", &config->download_segments, 1,
+                         error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "download_segment_min_size",
+                         &config->download_segment_min_size, DEFAULT_SEGMENT_MIN, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "download_write_size",
+                         &config->download_write_size, DEFAULT_WRITE_SIZE, error))
+                return NULL;
+        if (!get_key_download_io_mode(ini_file, "client", "download_io_mode",
+                                      &config->download_io_mode, error))
+                return NULL;
+        if (!get_key_checksum_backend(ini_file, "client", "checksum_backend",
+                                      &config->checksum_backend, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "download_flush_size", &config->download_flush_size,
+                         0, error))
+                return NULL;
+        if (!get_key_io_class(ini_file, "client", "io_scheduling_class",
+                              &config->thread_priority.io_class, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "io_scheduling_priority",
+                         &config->thread_priority.io_priority, 4, error))
+                return NULL;
+        if (!get_key_cpu_policy(ini_file, "client", "cpu_scheduling_policy",
+                                &config->thread_priority.cpu_policy, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "nice", &config->thread_priority.nice, 0, error))
+                return NULL;
+        if (!get_key_cpu_list(ini_file, "client", "cpu_affinity",
+                              &config->thread_priority.cpu_affinity, error))
+                return NULL;
+        if (!get_key_int(ini_file, "client", "artifact_cache_max_size",
+                         &config->artifact_cache_max_size, DEFAULT_CACHE_MAX_SIZE, error))
+                return NULL;
+        if (!get_download_rate_options(ini_file, &config->max_download_rate,
+                                       &config->download_windows, error))
+                return NULL;
         if (!get_key_string(ini_file, "client", "log_level", &val, DEFAULT_LOG_LEVEL, error))
                 return NULL;
         config->log_level = log_level_from_string(val);
 
         if (!get_key_bool(ini_file, "client", "post_update_reboot", &config->post_update_reboot, DEFAULT_REBOOT, error))
                 return NULL;
+        if (!get_key_int(ini_file, "client", "reboot_feedback_timeout",
+                         &config->reboot_feedback_timeout, DEFAULT_REBOOT_FEEDBACK_TIMEOUT, error))
+                return NULL;
 
         if (config->timeout > 0 && config->connect_timeout > 0 &&
             config->timeout < config->connect_timeout) {
@@ -316,21 +1030,147 @@ Config* load_config_file(const gchar *config_file, GError **error)
                 return NULL;
         }
 
+        if (config->retry_backoff_max &&
+            config->retry_backoff_max < MAX(config->retry_wait, 1)) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "retry_backoff_max (%d) must be 0 or at least retry_wait (%d)",
+                            config->retry_backoff_max, config->retry_wait);
+                return NULL;
+        }
+
+        if (config->max_response_size < 0 ||
+            (config->low_memory && config->max_response_size == 0)) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "max_response_size (%d) must be greater than 0%s",
+                            config->max_response_size,
+                            config->low_memory ? " in low_memory mode" : " or 0");
+                return NULL;
+        }
+
+        if (config->download_segments < 1 || config->download_segment_min_size < 1) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "download_segments (%d) and download_segment_min_size (%d) must be greater than 0",
+                            config->download_segments, config->download_segment_min_size);
+                return NULL;
+        }
+
+        if (config->download_write_size < 1) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "download_write_size (%d) must be greater than 0",
+                            config->download_write_size);
+                return NULL;
+        }
+
+        if (config->gateway_max_connections < 1) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "gateway_max_connections (%d) must be greater than 0",
+                            config->gateway_max_connections);
+                return NULL;
+        }
+
+        if (config->artifact_cache_max_size < 1) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "artifact_cache_max_size (%d) must be greater than 0",
+                            config->artifact_cache_max_size);
+                return NULL;
+        }
+
+        if (config->download_flush_size < 0) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "download_flush_size (%d) must be greater than or equal to 0",
+                            config->download_flush_size);
+                return NULL;
+        }
+
+        if (config->thread_priority.io_priority < 0 || config->thread_priority.io_priority > 7) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "io_scheduling_priority (%d) must be between 0 and 7",
+                            config->thread_priority.io_priority);
+                return NULL;
+        }
+
+        if (config->thread_priority.nice < -20 || config->thread_priority.nice > 19) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "nice (%d) must be between -20 and 19",
+                            config->thread_priority.nice);
+                return NULL;
+        }
+
+        if (config->reboot_feedback_timeout < 0) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "reboot_feedback_timeout (%d) must not be negative",
+                            config->reboot_feedback_timeout);
+                return NULL;
+        }
+
+        if (config->peer_port < 0 || config->peer_port > G_MAXUINT16) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "peer_port (%d) must be between 0 and %d",
+                            config->peer_port, G_MAXUINT16);
+                return NULL;
+        }
+
+        if (config->peer_address && !g_hostname_is_ip_address(config->peer_address)) {
+                g_set_error(error,
+                            G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                            "peer_address (%s) must be an IP address", config->peer_address);
+                return NULL;
+        }
+
         return g_steal_pointer(&config);
 }
 
+void gateway_device_config_free(GatewayDeviceConfig *device)
+{
+        if (!device)
+                return;
+
+        g_free(device->controller_id);
+        if (device->attributes)
+                g_hash_table_unref(device->attributes);
+        g_free(device);
+}
+
 void config_file_free(Config *config)
 {
         if (!config)
                 return;
 
+        g_free(config->config_file);
         g_free(config->hawkbit_server);
         g_free(config->controller_id);
         g_free(config->tenant_id);
         g_free(config->auth_token);
         g_free(config->gateway_token);
         g_free(config->bundle_download_location);
+        g_free(config->artifact_cache_dir);
+        g_free(config->metrics_file);
+        g_free(config->connection_state_file);
+        g_free(config->feedback_state_file);
+        g_strfreev(config->peers);
+        g_free(config->peer_address);
+        g_strfreev(config->peer_allow);
+        g_strfreev(config->mirrors);
+        g_strfreev(config->authenticated_mirrors);
+        if (config->gateway_devices)
+                g_ptr_array_unref(config->gateway_devices);
+        g_free(config->gateway_install_command);
         if (config->device)
                 g_hash_table_destroy(config->device);
+        if (config->download_windows)
+                g_array_unref(config->download_windows);
+        if (config->thread_priority.cpu_affinity)
+                g_array_unref(config->thread_priority.cpu_affinity);
         g_free(config);
 }
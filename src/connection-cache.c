@@ -0,0 +1,492 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief DNS and TLS session cache shared by all curl handles and persisted across runs
+ *
+ * @see https://curl.se/libcurl/c/libcurl-share.html
+ * @see https://curl.se/libcurl/c/curl_easy_ssls_export.html
+ */
+
+#include "connection-cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define STATE_GROUP_DNS "dns"
+#define STATE_GROUP_TLS_PREFIX "tls-session-"
+
+/**
+ * @brief Persisted DNS results older than this are not used [s]
+ */
+static const gint64 DNS_MAX_AGE = 24 * 60 * 60;
+
+/**
+ * @brief Minimum time between saves of the state file not forced [us]
+ */
+static const gint64 SAVE_INTERVAL = (gint64) 60 * 60 * G_USEC_PER_SEC;
+
+/**
+ * @brief struct describing an address a host was connected to.
+ */
+typedef struct DnsEntry_ {
+        gchar *address;               /**< IP address connected to */
+        gint64 resolved;              /**< unix time of the connection */
+} DnsEntry;
+
+/**
+ * @brief struct passed to the TLS session export callback.
+ */
+typedef struct TlsSessionExport_ {
+        GKeyFile *state;              /**< state to add the sessions to */
+        guint count;                  /**< number of sessions added */
+} TlsSessionExport;
+
+G_LOCK_DEFINE_STATIC(connection_cache);
+static GMutex share_locks[CURL_LOCK_DATA_LAST];
+static CURLSH *share = NULL;
+static gchar *state_file = NULL;
+static GHashTable *dns_entries = NULL;
+static struct curl_slist *dns_resolve = NULL;
+static gboolean dns_resolve_pending = FALSE;
+static gint64 last_save = 0;
+
+static void dns_entry_free(gpointer data)
+{
+        DnsEntry *entry = data;
+
+        if (!entry)
+                return;
+
+        g_free(entry->address);
+        g_free(entry);
+}
+
+static void share_lock_cb(CURL *curl, curl_lock_data data, curl_lock_access access,
+                          void *userptr)
+{
+        g_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock_cb(CURL *curl, curl_lock_data data, void *userptr)
+{
+        g_mutex_unlock(&share_locks[data]);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x074b00
+/**
+ * @brief Check whether curl may use a proxy, in which case the address connected to is the
+ *        proxy's rather than the host's.
+ *
+ * @return TRUE if a proxy is configured in the environment, FALSE otherwise
+ */
+static gboolean proxy_configured(void)
+{
+        const gchar *vars[] = { "http_proxy", "https_proxy", "HTTPS_PROXY", "all_proxy",
+                                "ALL_PROXY", NULL };
+
+        for (const gchar **var = vars; *var; var++) {
+                const gchar *value = g_getenv(*var);
+
+                if (value && value[0])
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+/**
+ * @brief Get "host:port" of the last transfer of curl.
+ *
+ * @param[in] curl Curl handle
+ * @return newly allocated "host:port", NULL if unknown, the host is an IP address or a proxy may
+ *         be in use
+ */
+static gchar* get_host_port(CURL *curl)
+{
+        gchar *host_port = NULL;
+        char *url = NULL, *host = NULL, *port = NULL;
+        CURLU *curlu = NULL;
+
+        if (proxy_configured())
+                return NULL;
+
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+        if (!url)
+                return NULL;
+
+        curlu = curl_url();
+        if (!curlu)
+                return NULL;
+
+        if (curl_url_set(curlu, CURLUPART_URL, url, 0) == CURLUE_OK &&
+            curl_url_get(curlu, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+            curl_url_get(curlu, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK &&
+            host[0] != '[' && !g_hostname_is_ip_address(host))
+                host_port = g_strdup_printf("%s:%s", host, port);
+
+        curl_free(host);
+        curl_free(port);
+        curl_url_cleanup(curlu);
+
+        return host_port;
+}
+#endif
+
+/**
+ * @brief Load persisted DNS results younger than DNS_MAX_AGE and hand them to curl. The entries
+ *        are added with a "+" prefix, so they time out of curl's DNS cache like resolved ones.
+ *
+ * @param[in] state State loaded from the state file
+ */
+static void load_dns_entries(GKeyFile *state)
+{
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        g_auto(GStrv) keys = g_key_file_get_keys(state, STATE_GROUP_DNS, NULL, NULL);
+        gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+        for (gchar **key = keys; key && *key; key++) {
+                g_auto(GStrv) value = g_key_file_get_string_list(state, STATE_GROUP_DNS, *key,
+                                                                  NULL, NULL);
+                g_autofree gchar *resolve = NULL;
+                struct curl_slist *temp = NULL;
+                DnsEntry *entry = NULL;
+                gboolean ipv6;
+                gint64 resolved;
+
+                if (!value || g_strv_length(value) != 2)
+                        continue;
+
+                resolved = g_ascii_strtoll(value[1], NULL, 10);
+                if (resolved > now || now - resolved > DNS_MAX_AGE)
+                        continue;
+
+                ipv6 = strchr(value[0], ':') != NULL;
+                resolve = g_strdup_printf("+%s:%s%s%s", *key, ipv6 ? "[" : "", value[0],
+                                          ipv6 ? "]" : "");
+                temp = curl_slist_append(dns_resolve, resolve);
+                if (!temp)
+                        break;
+                dns_resolve = temp;
+
+                entry = g_new0(DnsEntry, 1);
+                entry->address = g_strdup(value[0]);
+                entry->resolved = resolved;
+                g_hash_table_replace(dns_entries, g_strdup(*key), entry);
+        }
+
+        dns_resolve_pending = dns_resolve != NULL;
+#endif
+}
+
+/**
+ * @brief Add remembered DNS results to state.
+ *
+ * @param[in] state State to save to the state file
+ */
+static void save_dns_entries(GKeyFile *state)
+{
+        GHashTableIter iter;
+        gpointer key, value;
+
+        G_LOCK(connection_cache);
+        g_hash_table_iter_init(&iter, dns_entries);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+                DnsEntry *entry = value;
+                g_autofree gchar *resolved = g_strdup_printf("%" G_GINT64_FORMAT,
+                                                             entry->resolved);
+                const gchar *list[] = { entry->address, resolved };
+
+                g_key_file_set_string_list(state, STATE_GROUP_DNS, key, list, G_N_ELEMENTS(list));
+        }
+        G_UNLOCK(connection_cache);
+}
+
+/**
+ * @brief Import persisted TLS sessions that did not expire yet into the shared session cache.
+ *        Requires libcurl 8.12.0 or newer.
+ *
+ * @param[in] state State loaded from the state file
+ */
+static void load_tls_sessions(GKeyFile *state)
+{
+#if LIBCURL_VERSION_NUM >= 0x080c00
+        g_auto(GStrv) groups = g_key_file_get_groups(state, NULL);
+        gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+        CURL *curl = NULL;
+        guint count = 0;
+
+        curl = curl_easy_init();
+        if (!curl)
+                return;
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+        for (gchar **group = groups; *group; group++) {
+                g_autofree gchar *key = NULL, *shmac_b64 = NULL, *data_b64 = NULL;
+                g_autofree guchar *shmac = NULL, *data = NULL;
+                gsize shmac_len = 0, data_len = 0;
+
+                if (!g_str_has_prefix(*group, STATE_GROUP_TLS_PREFIX) ||
+                    g_key_file_get_int64(state, *group, "valid_until", NULL) <= now)
+                        continue;
+
+                key = g_key_file_get_string(state, *group, "key", NULL);
+                shmac_b64 = g_key_file_get_string(state, *group, "shmac", NULL);
+                data_b64 = g_key_file_get_string(state, *group, "data", NULL);
+                if (!data_b64 || (!key && !shmac_b64))
+                        continue;
+
+                if (shmac_b64)
+                        shmac = g_base64_decode(shmac_b64, &shmac_len);
+                data = g_base64_decode(data_b64, &data_len);
+
+                if (curl_easy_ssls_import(curl, key, shmac, shmac_len, data,
+                                          data_len) == CURLE_OK)
+                        count++;
+        }
+
+        curl_easy_cleanup(curl);
+        log_debug("Loaded %u persisted TLS session(s)", count);
+#endif
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+static CURLcode export_tls_session_cb(CURL *curl, void *userptr, const char *session_key,
+                                      const unsigned char *shmac, size_t shmac_len,
+                                      const unsigned char *sdata, size_t sdata_len,
+                                      curl_off_t valid_until, int ietf_tls_id,
+                                      const char *alpn, size_t earlydata_max)
+{
+        TlsSessionExport *export = userptr;
+        g_autofree gchar *group = g_strdup_printf(STATE_GROUP_TLS_PREFIX "%u", export->count++);
+        g_autofree gchar *data_b64 = g_base64_encode(sdata, sdata_len);
+
+        if (session_key)
+                g_key_file_set_string(export->state, group, "key", session_key);
+        if (shmac) {
+                g_autofree gchar *shmac_b64 = g_base64_encode(shmac, shmac_len);
+
+                g_key_file_set_string(export->state, group, "shmac", shmac_b64);
+        }
+        g_key_file_set_string(export->state, group, "data", data_b64);
+        g_key_file_set_int64(export->state, group, "valid_until", valid_until);
+
+        return CURLE_OK;
+}
+#endif
+
+/**
+ * @brief Add the shared cache's TLS sessions to state. Requires libcurl 8.12.0 or newer.
+ *
+ * @param[in] state State to save to the state file
+ */
+static void save_tls_sessions(GKeyFile *state)
+{
+#if LIBCURL_VERSION_NUM >= 0x080c00
+        TlsSessionExport export = { .state = state, .count = 0 };
+        CURL *curl = NULL;
+
+        curl = curl_easy_init();
+        if (!curl)
+                return;
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        curl_easy_ssls_export(curl, export_tls_session_cb, &export);
+        curl_easy_cleanup(curl);
+#endif
+}
+
+/**
+ * @brief Atomically replace the state file with data, readable by the owner only as it contains
+ *        TLS session secrets.
+ *
+ * @param[in]  data   Data to write
+ * @param[in]  length Length of data
+ * @param[out] error  Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean write_state_file(const gchar *data, gsize length, GError **error)
+{
+#if GLIB_CHECK_VERSION(2, 66, 0)
+        return g_file_set_contents_full(state_file, data, length,
+                                        G_FILE_SET_CONTENTS_CONSISTENT, 0600, error);
+#else
+        g_autofree gchar *tmp_file = g_strdup_printf("%s.XXXXXX", state_file);
+        int fd, err;
+
+        // create the temporary file with final permissions, the secrets must never be readable
+        fd = g_mkstemp_full(tmp_file, O_WRONLY | O_CLOEXEC, 0600);
+        if (fd < 0) {
+                err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to create %s: %s", tmp_file, g_strerror(err));
+                return FALSE;
+        }
+
+        while (length) {
+                gssize written = write(fd, data, length);
+
+                if (written < 0 && errno == EINTR)
+                        continue;
+                if (written < 0) {
+                        err = errno;
+                        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                                    "Failed to write %s: %s", tmp_file, g_strerror(err));
+                        goto fail;
+                }
+
+                data += written;
+                length -= written;
+        }
+
+        if (fsync(fd)) {
+                err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to sync %s: %s", tmp_file, g_strerror(err));
+                goto fail;
+        }
+
+        close(fd);
+        fd = -1;
+
+        if (g_rename(tmp_file, state_file)) {
+                err = errno;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to rename %s to %s: %s", tmp_file, state_file,
+                            g_strerror(err));
+                goto fail;
+        }
+
+        return TRUE;
+
+fail:
+        if (fd >= 0)
+                close(fd);
+        g_unlink(tmp_file);
+        return FALSE;
+#endif
+}
+
+void connection_cache_init(const gchar *file)
+{
+        g_autoptr(GKeyFile) state = NULL;
+        g_autoptr(GError) error = NULL;
+
+        // set up once per process
+        if (share)
+                return;
+
+        share = curl_share_init();
+        if (!share) {
+                g_warning("Unable to set up shared DNS and TLS session cache");
+                return;
+        }
+
+        // sharing connections between concurrently running threads is not supported by libcurl
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        dns_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, dns_entry_free);
+
+        if (!file)
+                return;
+
+        state_file = g_strdup(file);
+        state = g_key_file_new();
+        if (!g_key_file_load_from_file(state, state_file, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning("Failed to load connection state: %s", error->message);
+                return;
+        }
+
+        load_dns_entries(state);
+        load_tls_sessions(state);
+}
+
+void connection_cache_setup(CURL *curl)
+{
+        g_return_if_fail(curl);
+
+        if (!share)
+                return;
+
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+        G_LOCK(connection_cache);
+        if (dns_resolve_pending)
+                curl_easy_setopt(curl, CURLOPT_RESOLVE, dns_resolve);
+        G_UNLOCK(connection_cache);
+}
+
+void connection_cache_record(CURL *curl, CURLcode res)
+{
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        g_autofree gchar *host_port = NULL;
+        char *address = NULL;
+#endif
+
+        g_return_if_fail(curl);
+
+        if (!share)
+                return;
+
+        // persisted DNS results are in the shared DNS cache once a transfer used them
+        G_LOCK(connection_cache);
+        dns_resolve_pending = FALSE;
+        G_UNLOCK(connection_cache);
+
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        if (!state_file || (res != CURLE_OK && res != CURLE_COULDNT_CONNECT))
+                return;
+
+        host_port = get_host_port(curl);
+        if (!host_port)
+                return;
+
+        G_LOCK(connection_cache);
+        if (res == CURLE_COULDNT_CONNECT) {
+                // the address may be stale, let the next run resolve it again
+                g_hash_table_remove(dns_entries, host_port);
+        } else if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &address) == CURLE_OK &&
+                   address && address[0]) {
+                DnsEntry *entry = g_new0(DnsEntry, 1);
+
+                entry->address = g_strdup(address);
+                entry->resolved = g_get_real_time() / G_USEC_PER_SEC;
+                g_hash_table_replace(dns_entries, g_steal_pointer(&host_port), entry);
+        }
+        G_UNLOCK(connection_cache);
+#endif
+}
+
+void connection_cache_save(gboolean force)
+{
+        g_autoptr(GKeyFile) state = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *data = NULL;
+        gint64 now = g_get_monotonic_time();
+        gsize length = 0;
+
+        if (!share || !state_file)
+                return;
+
+        // limit flash wear of long running processes
+        if (!force && last_save && now - last_save < SAVE_INTERVAL)
+                return;
+        last_save = now;
+
+        state = g_key_file_new();
+        save_dns_entries(state);
+        save_tls_sessions(state);
+
+        data = g_key_file_to_data(state, &length, NULL);
+        if (!write_state_file(data, length, &error))
+                g_warning("Failed to save connection state: %s", error->message);
+}
@@ -0,0 +1,267 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief GSource running curl multi transfers from a GLib main loop
+ *
+ * @see https://curl.se/libcurl/c/libcurl-multi.html
+ * @see https://curl.se/libcurl/c/CURLMOPT_SOCKETFUNCTION.html
+ */
+
+#include "curl-source.h"
+
+/**
+ * @brief struct describing a transfer added to a CurlSource.
+ */
+typedef struct CurlTransfer_ {
+        CurlTransferFunc done;        /**< called once the transfer finished */
+        gpointer user_data;           /**< passed to done or destroy */
+        GDestroyNotify destroy;       /**< called on user_data if removed unfinished, or NULL */
+} CurlTransfer;
+
+/**
+ * @brief GSource driving a curl multi handle by socket and timer events.
+ */
+typedef struct CurlSource_ {
+        GSource source;
+        CURLM *multi;                 /**< curl multi handle running all transfers */
+        GHashTable *sockets;          /**< socket fd -> tag returned by g_source_add_unix_fd() */
+        GHashTable *transfers;        /**< CURL* -> CurlTransfer* */
+} CurlSource;
+
+/**
+ * @brief struct describing a socket ready for curl_multi_socket_action().
+ */
+typedef struct CurlSocketEvent_ {
+        curl_socket_t fd;             /**< socket */
+        int flags;                    /**< CURL_CSELECT_* flags */
+} CurlSocketEvent;
+
+/**
+ * @brief Curl multi callback keeping the source's watched file descriptors in sync with the
+ *        sockets curl waits on.
+ *
+ * @see https://curl.se/libcurl/c/CURLMOPT_SOCKETFUNCTION.html
+ */
+static int curl_source_socket_cb(CURL *curl, curl_socket_t fd, int what, void *userp,
+                                 void *socketp)
+{
+        CurlSource *curl_source = userp;
+        GSource *source = userp;
+        GIOCondition condition = G_IO_ERR | G_IO_HUP;
+        gpointer tag = socketp;
+
+        if (what == CURL_POLL_REMOVE) {
+                if (tag)
+                        g_source_remove_unix_fd(source, tag);
+                g_hash_table_remove(curl_source->sockets, GINT_TO_POINTER(fd));
+                curl_multi_assign(curl_source->multi, fd, NULL);
+                return 0;
+        }
+
+        if (what & CURL_POLL_IN)
+                condition |= G_IO_IN;
+        if (what & CURL_POLL_OUT)
+                condition |= G_IO_OUT;
+
+        if (tag) {
+                g_source_modify_unix_fd(source, tag, condition);
+                return 0;
+        }
+
+        tag = g_source_add_unix_fd(source, fd, condition);
+        g_hash_table_insert(curl_source->sockets, GINT_TO_POINTER(fd), tag);
+        curl_multi_assign(curl_source->multi, fd, tag);
+
+        return 0;
+}
+
+/**
+ * @brief Curl multi callback mapping curl's timeout to the source's ready time.
+ *
+ * @see https://curl.se/libcurl/c/CURLMOPT_TIMERFUNCTION.html
+ */
+static int curl_source_timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+        GSource *source = userp;
+
+        if (timeout_ms < 0)
+                g_source_set_ready_time(source, -1);
+        else
+                g_source_set_ready_time(source, g_get_monotonic_time() + (gint64) timeout_ms * 1000);
+
+        return 0;
+}
+
+/**
+ * @brief Remove transfer curl from curl_source without calling its done function.
+ *
+ * @param[in] curl_source CurlSource running the transfer
+ * @param[in] curl        Curl handle of the transfer
+ * @return CurlTransfer* of the transfer, to be freed by the caller, or NULL if unknown
+ */
+static CurlTransfer* curl_source_steal(CurlSource *curl_source, CURL *curl)
+{
+        CurlTransfer *transfer = g_hash_table_lookup(curl_source->transfers, curl);
+
+        if (!transfer)
+                return NULL;
+
+        g_hash_table_steal(curl_source->transfers, curl);
+        curl_multi_remove_handle(curl_source->multi, curl);
+
+        return transfer;
+}
+
+static gboolean curl_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+        CurlSource *curl_source = (CurlSource *) source;
+        g_autoptr(GArray) events = g_array_new(FALSE, FALSE, sizeof(CurlSocketEvent));
+        gint64 ready_time = g_source_get_ready_time(source);
+        GHashTableIter iter;
+        gpointer fd, tag;
+        CURLMsg *msg = NULL;
+        int running = 0, queued = 0;
+
+        if (ready_time >= 0 && ready_time <= g_source_get_time(source)) {
+                // curl arms a new timer if needed
+                g_source_set_ready_time(source, -1);
+                curl_multi_socket_action(curl_source->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+
+        // collect ready sockets first, curl_multi_socket_action() changes the watched ones
+        g_hash_table_iter_init(&iter, curl_source->sockets);
+        while (g_hash_table_iter_next(&iter, &fd, &tag)) {
+                GIOCondition revents = g_source_query_unix_fd(source, tag);
+                CurlSocketEvent event = { .fd = GPOINTER_TO_INT(fd), .flags = 0 };
+
+                if (revents & G_IO_IN)
+                        event.flags |= CURL_CSELECT_IN;
+                if (revents & G_IO_OUT)
+                        event.flags |= CURL_CSELECT_OUT;
+                if (revents & (G_IO_ERR | G_IO_HUP))
+                        event.flags |= CURL_CSELECT_ERR;
+
+                if (event.flags)
+                        g_array_append_val(events, event);
+        }
+
+        for (guint i = 0; i < events->len; i++) {
+                CurlSocketEvent *event = &g_array_index(events, CurlSocketEvent, i);
+
+                curl_multi_socket_action(curl_source->multi, event->fd, event->flags, &running);
+        }
+
+        while ((msg = curl_multi_info_read(curl_source->multi, &queued))) {
+                CurlTransfer *transfer = NULL;
+                CURL *curl = msg->easy_handle;
+                CURLcode res = msg->data.result;
+
+                if (msg->msg != CURLMSG_DONE)
+                        continue;
+
+                // msg is invalidated by removing the handle from the multi handle
+                transfer = curl_source_steal(curl_source, curl);
+                if (!transfer)
+                        continue;
+
+                transfer->done(curl, res, transfer->user_data);
+                g_free(transfer);
+        }
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void curl_source_finalize(GSource *source)
+{
+        CurlSource *curl_source = (CurlSource *) source;
+        g_autoptr(GList) curls = g_hash_table_get_keys(curl_source->transfers);
+
+        // the source's file descriptors are dropped along with it
+        curl_multi_setopt(curl_source->multi, CURLMOPT_SOCKETFUNCTION, NULL);
+
+        for (GList *l = curls; l; l = l->next) {
+                CurlTransfer *transfer = curl_source_steal(curl_source, l->data);
+
+                if (transfer->destroy)
+                        transfer->destroy(transfer->user_data);
+                g_free(transfer);
+        }
+
+        curl_multi_cleanup(curl_source->multi);
+        g_hash_table_destroy(curl_source->transfers);
+        g_hash_table_destroy(curl_source->sockets);
+}
+
+static GSourceFuncs curl_source_funcs = {
+        .prepare = NULL,
+        .check = NULL,
+        .dispatch = curl_source_dispatch,
+        .finalize = curl_source_finalize,
+};
+
+GSource* curl_source_new(long max_connections)
+{
+        GSource *source = g_source_new(&curl_source_funcs, sizeof(CurlSource));
+        CurlSource *curl_source = (CurlSource *) source;
+
+        g_source_set_name(source, "curl");
+
+        curl_source->sockets = g_hash_table_new(g_direct_hash, g_direct_equal);
+        curl_source->transfers = g_hash_table_new(g_direct_hash, g_direct_equal);
+        curl_source->multi = curl_multi_init();
+        curl_multi_setopt(curl_source->multi, CURLMOPT_SOCKETFUNCTION, curl_source_socket_cb);
+        curl_multi_setopt(curl_source->multi, CURLMOPT_SOCKETDATA, source);
+        curl_multi_setopt(curl_source->multi, CURLMOPT_TIMERFUNCTION, curl_source_timer_cb);
+        curl_multi_setopt(curl_source->multi, CURLMOPT_TIMERDATA, source);
+        // run concurrent transfers on one connection where the server speaks HTTP/2
+        curl_multi_setopt(curl_source->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        if (max_connections > 0)
+                curl_multi_setopt(curl_source->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                                  max_connections);
+
+        return source;
+}
+
+CURLMcode curl_source_add(GSource *source, CURL *curl, CurlTransferFunc done, gpointer user_data,
+                          GDestroyNotify destroy)
+{
+        CurlSource *curl_source = (CurlSource *) source;
+        CurlTransfer *transfer = NULL;
+        CURLMcode res;
+
+        g_return_val_if_fail(source, CURLM_BAD_HANDLE);
+        g_return_val_if_fail(curl, CURLM_BAD_EASY_HANDLE);
+        g_return_val_if_fail(done, CURLM_BAD_EASY_HANDLE);
+        g_return_val_if_fail(!g_hash_table_contains(curl_source->transfers, curl),
+                             CURLM_ADDED_ALREADY);
+
+        // curl arms the timer, the transfer starts on the next main loop iteration
+        res = curl_multi_add_handle(curl_source->multi, curl);
+        if (res != CURLM_OK)
+                return res;
+
+        transfer = g_new0(CurlTransfer, 1);
+        transfer->done = done;
+        transfer->user_data = user_data;
+        transfer->destroy = destroy;
+        g_hash_table_insert(curl_source->transfers, curl, transfer);
+
+        return CURLM_OK;
+}
+
+void curl_source_remove(GSource *source, CURL *curl)
+{
+        CurlTransfer *transfer = NULL;
+
+        g_return_if_fail(source);
+        g_return_if_fail(curl);
+
+        transfer = curl_source_steal((CurlSource *) source, curl);
+        if (!transfer)
+                return;
+
+        if (transfer->destroy)
+                transfer->destroy(transfer->user_data);
+        g_free(transfer);
+}
@@ -0,0 +1,158 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief D-Bus interface letting local agents trigger polls and cancel downloads
+ */
+
+#include "dbus-service.h"
+
+#include <gio/gio.h>
+
+#include "hawkbit-updater-gen.h"
+#include "log.h"
+#include "rauc-installer.h"
+
+G_LOCK_DEFINE_STATIC(dbus_service);
+static RHawkbitUpdater *service = NULL;
+static GDBusConnection *connection = NULL;
+static guint owner_id = 0;
+static GSourceFunc poll_now_func = NULL;
+static gpointer poll_now_data = NULL;
+static ServiceCancelFunc cancel_func = NULL;
+
+/**
+ * @brief Handler of the PollNow() method.
+ */
+static gboolean on_handle_poll_now(RHawkbitUpdater *object, GDBusMethodInvocation *invocation,
+                                   gpointer user_data)
+{
+        log_debug("Poll requested via D-Bus by %s",
+                g_dbus_method_invocation_get_sender(invocation));
+
+        poll_now_func(poll_now_data);
+        r_hawkbit_updater_complete_poll_now(object, invocation);
+
+        return TRUE;
+}
+
+/**
+ * @brief Handler of the CancelDownload() method.
+ */
+static gboolean on_handle_cancel_download(RHawkbitUpdater *object,
+                                          GDBusMethodInvocation *invocation, gpointer user_data)
+{
+        g_autoptr(GError) error = NULL;
+
+        log_debug("Download cancelation requested via D-Bus by %s",
+                g_dbus_method_invocation_get_sender(invocation));
+
+        if (!cancel_func(&error)) {
+                g_dbus_method_invocation_return_error_literal(invocation, G_DBUS_ERROR,
+                                                              G_DBUS_ERROR_FAILED, error->message);
+                return TRUE;
+        }
+
+        r_hawkbit_updater_complete_cancel_download(object, invocation);
+
+        return TRUE;
+}
+
+/**
+ * @brief Called if DBUS_SERVICE_NAME could not be acquired or was lost.
+ */
+static void on_name_lost(GDBusConnection *conn, const gchar *name, gpointer user_data)
+{
+        g_warning("Failed to own D-Bus name %s, check the bus' policy allows it", name);
+}
+
+gboolean dbus_service_start(GMainContext *context, GSourceFunc poll_now, gpointer poll_data,
+                            ServiceCancelFunc cancel, GError **error)
+{
+        RHawkbitUpdater *skeleton = NULL;
+        g_autoptr(GDBusConnection) conn = NULL;
+        gboolean res = FALSE;
+
+        g_return_val_if_fail(context, FALSE);
+        g_return_val_if_fail(poll_now, FALSE);
+        g_return_val_if_fail(cancel, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        g_return_val_if_fail(!service, FALSE);
+
+        poll_now_func = poll_now;
+        poll_now_data = poll_data;
+        cancel_func = cancel;
+
+        // skeleton and name ownership dispatch from the thread-default context they are set up in
+        g_main_context_push_thread_default(context);
+
+        conn = g_bus_get_sync(rauc_get_bus_type(), NULL, error);
+        if (!conn)
+                goto out;
+
+        skeleton = r_hawkbit_updater_skeleton_new();
+        r_hawkbit_updater_set_state(skeleton, "none");
+        r_hawkbit_updater_set_action_id(skeleton, "");
+        r_hawkbit_updater_set_last_poll(skeleton, 0);
+        g_signal_connect(skeleton, "handle-poll-now", G_CALLBACK(on_handle_poll_now), NULL);
+        g_signal_connect(skeleton, "handle-cancel-download", G_CALLBACK(on_handle_cancel_download),
+                         NULL);
+
+        if (!g_dbus_interface_skeleton_export(G_DBUS_INTERFACE_SKELETON(skeleton), conn, "/",
+                                              error))
+                goto out;
+
+        owner_id = g_bus_own_name_on_connection(conn, DBUS_SERVICE_NAME,
+                                                G_BUS_NAME_OWNER_FLAGS_NONE, NULL, on_name_lost,
+                                                NULL, NULL);
+
+        G_LOCK(dbus_service);
+        service = g_steal_pointer(&skeleton);
+        G_UNLOCK(dbus_service);
+        connection = g_steal_pointer(&conn);
+        res = TRUE;
+
+out:
+        g_clear_object(&skeleton);
+        g_main_context_pop_thread_default(context);
+        return res;
+}
+
+void dbus_service_set_state(const gchar *state, const gchar *action_id)
+{
+        g_return_if_fail(state);
+
+        // generated skeletons emit PropertiesChanged from their own context, any thread may set
+        G_LOCK(dbus_service);
+        if (service) {
+                r_hawkbit_updater_set_state(service, state);
+                r_hawkbit_updater_set_action_id(service, action_id ? action_id : "");
+        }
+        G_UNLOCK(dbus_service);
+}
+
+void dbus_service_set_last_poll(gint64 time)
+{
+        G_LOCK(dbus_service);
+        if (service)
+                r_hawkbit_updater_set_last_poll(service, time);
+        G_UNLOCK(dbus_service);
+}
+
+void dbus_service_stop(void)
+{
+        RHawkbitUpdater *skeleton = NULL;
+
+        G_LOCK(dbus_service);
+        skeleton = g_steal_pointer(&service);
+        G_UNLOCK(dbus_service);
+
+        if (!skeleton)
+                return;
+
+        g_bus_unown_name(owner_id);
+        owner_id = 0;
+        g_dbus_interface_skeleton_unexport(G_DBUS_INTERFACE_SKELETON(skeleton));
+        g_object_unref(skeleton);
+        g_clear_object(&connection);
+}
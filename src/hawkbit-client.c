@@ -19,17 +19,32 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/statvfs.h>
 #include <curl/curl.h>
 #include <glib.h>
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 #include <libgen.h>
 #include <gio/gio.h>
 #include <sys/reboot.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
+#include "artifact-cache.h"
+#include "connection-cache.h"
+#include "curl-source.h"
+#include "dbus-service.h"
 #include "json-helper.h"
+#include "log.h"
+#include "metrics.h"
+#include "peer-server.h"
+#include "thread-priority.h"
 #ifdef WITH_SYSTEMD
 #include "sd-helper.h"
 #endif
@@ -37,11 +52,16 @@
 #include "hawkbit-client.h"
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(FILE, fclose)
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(CURL, curl_easy_cleanup)
 
 gboolean run_once = FALSE;
 
 static const gint MAX_RETRIES_ON_API_ERROR = 10;
+static const gint64 API_RETRY_WAIT_MS = 1000;
+static const gint64 RESUME_WAIT_MS = 500;
+static const gint64 FEEDBACK_RETRY_WAIT_MS = 5000;
+static const guint POLL_WAIT_INTERVAL_MS = 100;
+static const guint FEEDBACK_WAIT_INTERVAL_MS = 1000;
+static const gint64 FEEDBACK_WAIT_MAX_MS = 30000;
 
 /**
  * @brief String representation of HTTP methods.
@@ -67,8 +87,29 @@ static const gint resumable_codes[] = {
 
 static Config *hawkbit_config = NULL;
 static GSourceFunc software_ready_cb;
+static InstalledVersionFunc installed_version_cb;
+static BundleCheckFunc check_bundle_cb;
+static GPrivate curl_handle = G_PRIVATE_INIT((GDestroyNotify) curl_easy_cleanup);
+static GPrivate rest_buffer = G_PRIVATE_INIT((GDestroyNotify) rest_payload_free);
+static gchar *api_base_url = NULL;
+static struct curl_slist *api_headers = NULL;
+static struct curl_slist *api_body_headers = NULL;
+static GQueue rest_payload_pool = G_QUEUE_INIT;
+G_LOCK_DEFINE_STATIC(rest_payload_pool);
 static struct HawkbitAction *active_action = NULL;
+// set once an action failed or was canceled, the next poll must not be skipped as unchanged
+static gint poll_validator_stale = FALSE;
 static GThread *thread_download = NULL;
+static GThread *thread_feedback = NULL;
+static GQueue feedback_queue = G_QUEUE_INIT;
+static GMutex feedback_mutex;
+static GCond feedback_cond;
+static FeedbackMessage *feedback_current = NULL;
+static gboolean feedback_stopping = FALSE;
+static GThread *thread_reboot = NULL;
+// set while rebooting after an installation, no new actions must be processed meanwhile
+static gint reboot_pending = FALSE;
+G_LOCK_DEFINE_STATIC(download_rate);
 
 GQuark rhu_hawkbit_client_error_quark(void)
 {
@@ -95,13 +136,59 @@ static struct HawkbitAction *action_new(void)
         struct HawkbitAction *action = g_new0(struct HawkbitAction, 1);
 
         g_mutex_init(&action->mutex);
-        g_cond_init(&action->cond);
         action->id = NULL;
         action->state = ACTION_STATE_NONE;
 
         return action;
 }
 
+/**
+ * @brief Get the name of an action state, as published via D-Bus.
+ *
+ * @param[in] state Action state
+ * @return static name of state
+ */
+static const gchar* action_state_to_str(enum ActionState state)
+{
+        switch (state) {
+        case ACTION_STATE_NONE:
+                return "none";
+        case ACTION_STATE_CANCELED:
+                return "canceled";
+        case ACTION_STATE_ERROR:
+                return "error";
+        case ACTION_STATE_SUCCESS:
+                return "success";
+        case ACTION_STATE_PROCESSING:
+                return "processing";
+        case ACTION_STATE_DOWNLOADING:
+                return "downloading";
+        case ACTION_STATE_INSTALLING:
+                return "installing";
+        case ACTION_STATE_CANCEL_REQUESTED:
+                return "canceling";
+        }
+
+        g_return_val_if_reached("unknown");
+}
+
+/**
+ * @brief Set the state of active_action and publish it via D-Bus.
+ *        Must be called under locked active_action->mutex.
+ *
+ * @param[in] state New action state
+ */
+static void action_set_state(enum ActionState state)
+{
+        // hawkBit still lists failed actions, they must be processed again even if unchanged
+        if (state == ACTION_STATE_ERROR || state == ACTION_STATE_CANCELED)
+                g_atomic_int_set(&poll_validator_stale, TRUE);
+
+        active_action->state = state;
+        dbus_service_set_state(action_state_to_str(state), active_action->id);
+        log_set_action_id(state >= ACTION_STATE_PROCESSING ? active_action->id : NULL);
+}
+
 /**
  * @brief Get available free space of a mounted file system.
  *
@@ -131,1211 +218,6089 @@ static gboolean get_available_space(const char *path, goffset *free_space, GErro
 }
 
 /**
- * @brief Calculate checksum for file.
+ * @brief Create a DownloadState with fresh checksums.
  *
- * @param[in]  fp       File to read data from
- * @param[in]  type     Desired type of checksum
- * @param[out] checksum Calculated checksum digest hex string
- * @param[out] error    Error
+ * @param[in] sha256 Whether a SHA-256 checksum should be calculated in addition to SHA-1
+ * @return DownloadState*, to be freed with download_state_free()
+ */
+static DownloadState* download_state_new(gboolean sha256)
+{
+        DownloadState *state = g_new0(DownloadState, 1);
+
+        state->sha1 = checksum_new(G_CHECKSUM_SHA1);
+        state->sha256 = sha256 ? checksum_new(G_CHECKSUM_SHA256) : NULL;
+        state->size = 0;
+
+        return state;
+}
+
+/**
+ * @brief Feed data into the checksums of a DownloadState.
+ *
+ * @param[in] state DownloadState to update
+ * @param[in] data  Data to feed
+ * @param[in] len   Length of data
+ */
+static void download_state_update(DownloadState *state, const guchar *data, gsize len)
+{
+        g_return_if_fail(state);
+
+        checksum_update(state->sha1, data, len);
+        if (state->sha256)
+                checksum_update(state->sha256, data, len);
+        state->size += len;
+}
+
+/**
+ * @brief ChecksumReadFunc feeding data read from disk into the checksums of a DownloadState.
+ *
+ * @param[in] data      Data read
+ * @param[in] len       Length of data
+ * @param[in] user_data DownloadState* to update
+ */
+static void download_state_update_cb(const guchar *data, gsize len, gpointer user_data)
+{
+        download_state_update(user_data, data, len);
+}
+
+/**
+ * @brief Reset the checksums of a DownloadState, e.g. to start a download over.
+ *
+ * @param[in] state DownloadState to reset
+ */
+static void download_state_reset(DownloadState *state)
+{
+        g_return_if_fail(state);
+
+        checksum_reset(state->sha1);
+        if (state->sha256)
+                checksum_reset(state->sha256);
+        state->size = 0;
+}
+
+/**
+ * @brief Bring the checksums of a DownloadState up to date with the first size bytes of file,
+ *        reading only the part not yet covered. Used to account for an already downloaded prefix
+ *        before resuming a download.
+ *
+ * @param[in]  state DownloadState to update
+ * @param[in]  file  File to read data from
+ * @param[in]  size  Number of bytes of file the checksums should cover afterwards
+ * @param[out] error Error
  * @return TRUE if checksum calculation succeeded, FALSE otherwise (error set)
  */
-static gboolean get_file_checksum(FILE *fp, const GChecksumType type, gchar **checksum,
-                                  GError **error)
+static gboolean download_state_update_from_file(DownloadState *state, const gchar *file,
+                                                goffset size, GError **error)
 {
-        g_autoptr(GChecksum) ctx = g_checksum_new(type);
-        guchar buf[4096];
-        size_t r;
+        gint64 start_time;
+        gboolean res;
 
-        g_return_val_if_fail(fp, FALSE);
-        g_return_val_if_fail(checksum && *checksum == NULL, FALSE);
+        g_return_val_if_fail(state, FALSE);
+        g_return_val_if_fail(file, FALSE);
         g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-        g_assert_nonnull(ctx);
+        if (state->size == size)
+                return TRUE;
+
+        // file shrunk in the meantime, start over
+        if (state->size > size)
+                download_state_reset(state);
 
-        fseek(fp, 0, SEEK_SET);
+        // reading overlaps with hashing
+        start_time = g_get_monotonic_time();
+        res = checksum_read_file(file, state->size, size, download_state_update_cb, state, error);
+        state->hash_time += g_get_monotonic_time() - start_time;
 
-        while (1) {
-                r = fread(buf, 1, sizeof(buf), fp);
-                if (ferror(fp)) {
-                        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Read failed");
-                        return FALSE;
+        return res;
+}
+
+/**
+ * @brief Open file for writing a bundle download through writer's staging buffer. Space for the
+ *        complete bundle is preallocated (without changing the file size, which is what
+ *        resuming is based on) to avoid fragmentation.
+ *
+ * @param[out] writer      BundleWriter to initialize, to be closed with bundle_writer_close()
+ * @param[in]  file        File to write to, truncated unless resume_from is given
+ * @param[in]  resume_from Offset to continue writing at, must match the file's size
+ * @param[in]  size        Size of the complete bundle, 0 if unknown
+ * @param[out] error       Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean bundle_writer_open(BundleWriter *writer, const gchar *file, goffset resume_from,
+                                   goffset size, GError **error)
+{
+        int flags = O_RDWR | O_CREAT | O_CLOEXEC | (resume_from ? 0 : O_TRUNC);
+        int err;
+
+        g_return_val_if_fail(writer, FALSE);
+        g_return_val_if_fail(file, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        writer->file = file;
+        writer->fd = -1;
+        writer->mode = hawkbit_config->download_io_mode;
+        writer->buffer = NULL;
+        writer->size = ((gsize) hawkbit_config->download_write_size + DIRECT_IO_ALIGNMENT - 1) /
+                       DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        writer->fill = 0;
+        writer->offset = resume_from;
+        writer->end = resume_from;
+        writer->dropped = 0;
+        writer->flush_size = writer->mode == DOWNLOAD_IO_BUFFERED
+                             ? (gsize) hawkbit_config->download_flush_size : 0;
+        writer->flush_start = resume_from;
+        writer->flush_end = resume_from;
+        writer->write_errno = 0;
+
+        if (writer->mode == DOWNLOAD_IO_DIRECT) {
+                writer->fd = g_open(file, flags | O_DIRECT, 0644);
+                if (writer->fd < 0 && errno == EINVAL) {
+                        log_debug("Direct I/O not supported for %s, dropping written pages instead",
+                                file);
+                        writer->mode = DOWNLOAD_IO_DONTNEED;
                 }
+        }
+        if (writer->mode != DOWNLOAD_IO_DIRECT)
+                writer->fd = g_open(file, flags, 0644);
+        if (writer->fd < 0) {
+                err = errno;
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                            "Failed to open %s for download: %s", file, g_strerror(err));
+                return FALSE;
+        }
 
-                g_checksum_update(ctx, buf, r);
+        if (size > resume_from &&
+            fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, resume_from, size - resume_from)) {
+                err = errno;
+                if (err == ENOSPC) {
+                        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+                                    "Failed to preallocate %s: %s", file, g_strerror(err));
+                        goto err_close;
+                }
+                log_debug("Cannot preallocate %s: %s", file, g_strerror(err));
+        }
 
-                if (feof(fp))
-                        break;
+        err = posix_memalign((void **) &writer->buffer, DIRECT_IO_ALIGNMENT, writer->size);
+        if (err) {
+                writer->buffer = NULL;
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to allocate download buffer: %s", g_strerror(err));
+                goto err_close;
         }
 
-        *checksum = g_strdup(g_checksum_get_string(ctx));
+        // direct I/O writes whole blocks only, start at the block containing resume_from
+        if (writer->mode == DOWNLOAD_IO_DIRECT && resume_from % DIRECT_IO_ALIGNMENT) {
+                gsize head = resume_from % DIRECT_IO_ALIGNMENT;
+                ssize_t r;
+
+                writer->offset = resume_from - head;
+                r = pread(writer->fd, writer->buffer, DIRECT_IO_ALIGNMENT, writer->offset);
+                if (r < (ssize_t) head) {
+                        err = r < 0 ? errno : EIO;
+                        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                                    "Failed to read %s: %s", file, g_strerror(err));
+                        goto err_close;
+                }
+                writer->fill = head;
+        }
 
         return TRUE;
+
+err_close:
+        free(writer->buffer);
+        writer->buffer = NULL;
+        close(writer->fd);
+        writer->fd = -1;
+        return FALSE;
 }
 
 /**
- * @brief Add string to Curl headers, avoiding overwriting an existing
- *        non-empty list on failure.
+ * @brief Write writer's staging buffer to disk. In DOWNLOAD_IO_DONTNEED mode, writeback of the
+ *        written range is started and the previously written range is dropped from the page
+ *        cache once it reached the disk. In DOWNLOAD_IO_BUFFERED mode with a flush_size, the
+ *        same is done for every flush_size bytes, without dropping pages. Afterwards,
+ *        writer->end covers all data passed to writer.
  *
- * @param[out] headers curl_slist** of already set headers
- * @param[in]  string  Header to add
- * @param[out] error   Error
- * @return TRUE if string was added to headers successfully, FALSE otherwise (error set)
+ * @param[in] writer BundleWriter to flush
+ * @return TRUE on success, FALSE otherwise (writer->write_errno set)
  */
-static gboolean add_curl_header(struct curl_slist **headers, const char *string, GError **error)
+static gboolean bundle_writer_flush(BundleWriter *writer)
 {
-        struct curl_slist *temp = NULL;
+        gsize len = writer->fill, done = 0;
 
-        g_return_val_if_fail(headers, FALSE);
-        g_return_val_if_fail(string, FALSE);
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        g_return_val_if_fail(writer, FALSE);
 
-        temp = curl_slist_append(*headers, string);
-        if (!temp) {
-                curl_slist_free_all(*headers);
-                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
-                            "Could not add header %s", string);
-                return FALSE;
+        if (!writer->fill)
+                return TRUE;
+
+        // pad a trailing partial block for direct I/O, bundle_writer_close() truncates it
+        if (writer->mode == DOWNLOAD_IO_DIRECT && len % DIRECT_IO_ALIGNMENT) {
+                gsize pad = DIRECT_IO_ALIGNMENT - len % DIRECT_IO_ALIGNMENT;
+
+                memset(writer->buffer + len, 0, pad);
+                len += pad;
+        }
+
+        while (done < len) {
+                ssize_t w = pwrite(writer->fd, writer->buffer + done, len - done,
+                                   writer->offset + done);
+                if (w < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        writer->write_errno = errno;
+                        return FALSE;
+                }
+                done += w;
+        }
+
+        if (writer->mode == DOWNLOAD_IO_DONTNEED) {
+                sync_file_range(writer->fd, writer->offset, writer->fill,
+                                SYNC_FILE_RANGE_WRITE);
+                if (writer->offset > writer->dropped) {
+                        sync_file_range(writer->fd, writer->dropped,
+                                        writer->offset - writer->dropped,
+                                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                        SYNC_FILE_RANGE_WAIT_AFTER);
+                        posix_fadvise(writer->fd, writer->dropped,
+                                      writer->offset - writer->dropped, POSIX_FADV_DONTNEED);
+                        writer->dropped = writer->offset;
+                }
+        }
+
+        // bound dirty pages to two flush ranges, written back at the pace data arrives instead of
+        // in bursts stalling other writers once the kernel's dirty limits are hit
+        if (writer->flush_size &&
+            writer->offset + (goffset) writer->fill - writer->flush_end >=
+            (goffset) writer->flush_size) {
+                if (writer->flush_end > writer->flush_start)
+                        sync_file_range(writer->fd, writer->flush_start,
+                                        writer->flush_end - writer->flush_start,
+                                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                        SYNC_FILE_RANGE_WAIT_AFTER);
+                writer->flush_start = writer->flush_end;
+                writer->flush_end = writer->offset + writer->fill;
+                sync_file_range(writer->fd, writer->flush_start,
+                                writer->flush_end - writer->flush_start, SYNC_FILE_RANGE_WRITE);
+        }
+
+        writer->end = writer->offset + writer->fill;
+        if (writer->mode == DOWNLOAD_IO_DIRECT && writer->fill % DIRECT_IO_ALIGNMENT) {
+                // keep the partial last block, the next flush rewrites it with more data
+                gsize tail = writer->fill % DIRECT_IO_ALIGNMENT;
+
+                memmove(writer->buffer, writer->buffer + writer->fill - tail, tail);
+                writer->offset += writer->fill - tail;
+                writer->fill = tail;
+        } else {
+                writer->offset += writer->fill;
+                writer->fill = 0;
         }
 
-        *headers = temp;
         return TRUE;
 }
 
 /**
- * @brief Add hawkBit authorization header to Curl headers.
+ * @brief Discard everything written by writer so far, e.g. because the server sent the complete
+ *        file instead of the requested range.
  *
- * @param[out] headers curl_slist** of already set headers
- * @param[out] error   Error
- * @return TRUE if authorization method set in config and header was added successfully, TRUE if no
- *         authorization method set, FALSE otherwise (error set)
+ * @param[in] writer BundleWriter to restart
+ * @return TRUE on success, FALSE otherwise (writer->write_errno set)
  */
-static gboolean set_auth_curl_header(struct curl_slist **headers, GError **error)
+static gboolean bundle_writer_restart(BundleWriter *writer)
 {
-        gboolean res = TRUE;
-        g_autofree gchar *token = NULL;
+        g_return_val_if_fail(writer, FALSE);
 
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        if (ftruncate(writer->fd, 0)) {
+                writer->write_errno = errno;
+                return FALSE;
+        }
 
-        if (hawkbit_config->auth_token)
-                token = g_strdup_printf("Authorization: TargetToken %s",
-                                        hawkbit_config->auth_token);
-        else if (hawkbit_config->gateway_token)
-                token = g_strdup_printf("Authorization: GatewayToken %s",
-                                        hawkbit_config->gateway_token);
-        if (token)
-                res = add_curl_header(headers, token, error);
+        writer->fill = 0;
+        writer->offset = 0;
+        writer->end = 0;
+        writer->dropped = 0;
+        writer->flush_start = 0;
+        writer->flush_end = 0;
 
-        return res;
+        return TRUE;
 }
 
 /**
- * @brief Set common Curl options, namely user agent, connect timeout, SSL
- *        verify peer and SSL verify host options.
+ * @brief Pass data to writer, writing it to disk whenever the staging buffer is full.
  *
- * @param[in] curl Curl handle
+ * @param[in] writer BundleWriter to write to
+ * @param[in] data   Data to write
+ * @param[in] len    Length of data
+ * @return TRUE on success, FALSE otherwise (writer->write_errno set)
  */
-static void set_default_curl_opts(CURL *curl)
+static gboolean bundle_writer_write(BundleWriter *writer, const guchar *data, gsize len)
 {
-        g_return_if_fail(curl);
+        g_return_val_if_fail(writer, FALSE);
 
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, HAWKBIT_USERAGENT);
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, hawkbit_config->connect_timeout);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, hawkbit_config->ssl_verify ? 1L : 0L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, hawkbit_config->ssl_verify ? 1L : 0L);
+        while (len) {
+                gsize n = MIN(len, writer->size - writer->fill);
+
+                memcpy(writer->buffer + writer->fill, data, n);
+                writer->fill += n;
+                data += n;
+                len -= n;
+
+                if (writer->fill == writer->size && !bundle_writer_flush(writer))
+                        return FALSE;
+        }
+
+        return TRUE;
 }
 
 /**
- * @brief Download download_url to file.
+ * @brief Flush writer's staging buffer and close its file. The file's size afterwards matches
+ *        the data written successfully, allowing to resume from there.
  *
- * @param[in]  download_url URL to download from
- * @param[in]  file         Download destination
- * @param[in]  resume_from  Offset to resume download from
- * @param[out] sha1sum      Calculated checksum or NULL
- * @param[out] speed        Average download speed
- * @param[out] error        Error
- * @return TRUE if download succeeded, FALSE otherwise (error set)
+ * @param[in]  writer BundleWriter to close
+ * @param[out] error  Error
+ * @return TRUE on success, FALSE if writing failed at any point (error set)
  */
-static gboolean get_binary(const gchar *download_url, const gchar *file, curl_off_t resume_from,
-                           gchar **sha1sum, curl_off_t *speed, GError **error)
+static gboolean bundle_writer_close(BundleWriter *writer, GError **error)
 {
-        g_autoptr(CURL) curl = NULL;
-        g_autoptr(FILE) fp = NULL;
-        CURLcode curl_code;
-        glong http_code = 0;
-        struct curl_slist *headers = NULL;
-
-        g_return_val_if_fail(download_url, FALSE);
-        g_return_val_if_fail(file, FALSE);
-        g_return_val_if_fail(sha1sum == NULL || *sha1sum == NULL, FALSE);
+        g_return_val_if_fail(writer, FALSE);
         g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-        if (resume_from)
-                g_debug("Resuming download from offset %" CURL_FORMAT_CURL_OFF_T, resume_from);
+        if (writer->fd < 0)
+                return TRUE;
 
-        fp = g_fopen(file, (resume_from) ? "ab+" : "wb+");
-        if (!fp) {
-                int err = errno;
-                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
-                            "Failed to open %s for download: %s", file, g_strerror(err));
-                return FALSE;
+        if (!writer->write_errno)
+                bundle_writer_flush(writer);
+
+        // drop the padding of the last block (and anything after a failed write)
+        if (writer->mode == DOWNLOAD_IO_DIRECT && ftruncate(writer->fd, writer->end) &&
+            !writer->write_errno)
+                writer->write_errno = errno;
+
+        if (writer->mode == DOWNLOAD_IO_DONTNEED) {
+                if (fdatasync(writer->fd) && !writer->write_errno)
+                        writer->write_errno = errno;
+                posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
         }
 
-        curl = curl_easy_init();
-        if (!curl) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
-                            "Unable to start libcurl easy session");
+        if (close(writer->fd) && !writer->write_errno)
+                writer->write_errno = errno;
+        writer->fd = -1;
+
+        free(writer->buffer);
+        writer->buffer = NULL;
+
+        if (writer->write_errno) {
+                g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(writer->write_errno),
+                            "Failed to write %s: %s", writer->file,
+                            g_strerror(writer->write_errno));
                 return FALSE;
         }
 
-        set_default_curl_opts(curl);
-        curl_easy_setopt(curl, CURLOPT_URL, download_url);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 8L);
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+        return TRUE;
+}
 
-        // abort if slower than configured download rate during configured time span
-        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, hawkbit_config->low_speed_time);
-        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, hawkbit_config->low_speed_rate);
+/**
+ * @brief Close writer, ignoring errors. For use with g_auto().
+ *
+ * @param[in] writer BundleWriter to close
+ */
+static void bundle_writer_clear(BundleWriter *writer)
+{
+        bundle_writer_close(writer, NULL);
+}
 
-        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, resume_from);
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(BundleWriter, bundle_writer_clear)
 
-        if (!set_auth_curl_header(&headers, error))
-                return FALSE;
+/**
+ * @brief Get the path of the resume sidecar belonging to config's bundle_download_location.
+ *
+ * @return newly allocated path
+ */
+static gchar* get_resume_file(void)
+{
+        return g_strdup_printf("%s.resume", hawkbit_config->bundle_download_location);
+}
 
-        // set up request headers
-        if (!add_curl_header(&headers, "Accept: application/octet-stream", error))
-                return FALSE;
+/**
+ * @brief Persist the download progress in state->resume_info to the resume sidecar, allowing to
+ *        resume the download after a restart of rauc-hawkbit-updater or the system. The
+ *        persisted offset only covers data synced to disk, along with the SHA-1 of this prefix.
+ *
+ * @param[in] state DownloadState of the running transfer
+ */
+static void download_state_checkpoint(DownloadState *state)
+{
+        g_autoptr(Checksum) prefix = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *resume_file = NULL;
 
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        g_return_if_fail(state);
+        g_return_if_fail(state->writer);
 
-        // perform transfer
-        curl_code = curl_easy_perform(curl);
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-        curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, speed);
-        curl_slist_free_all(headers);
+        if (!state->resume_info)
+                return;
 
-        if (curl_code != CURLE_OK) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, curl_code, "%s",
-                            curl_easy_strerror(curl_code));
-                return FALSE;
-        }
-        // consider ok/partial download/range not satisfiable (EOF reached) as success
-        if (http_code != 200 && http_code != 206 && http_code != 416) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, http_code,
-                            "HTTP request failed: %ld", http_code);
-                return FALSE;
+        state->next_checkpoint = g_get_monotonic_time() + RESUME_CHECKPOINT_INTERVAL;
+
+        // failed writes abort the transfer anyway
+        if (!bundle_writer_flush(state->writer))
+                return;
+
+        if (fdatasync(state->writer->fd)) {
+                log_debug("Skipping resume checkpoint, syncing %s failed: %s",
+                        state->writer->file, g_strerror(errno));
+                return;
         }
 
-        // if checksum enabled then return the value
-        if (sha1sum && !get_file_checksum(fp, G_CHECKSUM_SHA1, sha1sum, error))
-                return FALSE;
+        prefix = checksum_copy(state->sha1);
+        if (!checksum_get_string(prefix))
+                return;
+        g_key_file_set_int64(state->resume_info, "resume", "offset", state->size);
+        g_key_file_set_string(state->resume_info, "resume", "prefix_sha1",
+                              checksum_get_string(prefix));
+        g_key_file_remove_key(state->resume_info, "resume", "etag", NULL);
+        if (state->etag)
+                g_key_file_set_string(state->resume_info, "resume", "etag", state->etag);
+        g_key_file_remove_key(state->resume_info, "resume", "last_modified", NULL);
+        if (state->last_modified)
+                g_key_file_set_string(state->resume_info, "resume", "last_modified",
+                                      state->last_modified);
+
+        resume_file = get_resume_file();
+        if (!g_key_file_save_to_file(state->resume_info, resume_file, &error)) {
+                log_debug("Failed to save resume checkpoint: %s", error->message);
+                return;
+        }
 
-        return TRUE;
+        log_debug("Saved resume checkpoint at offset %" G_GOFFSET_FORMAT, state->size);
 }
 
 /**
- * @brief Curl callback writing REST response to RestPayload*->payload buffer.
+ * @brief Curl callback writing downloaded data to DownloadState*->writer, feeding it into the
+ *        DownloadState's checksums on the way.
  *
  * @see   https://curl.haxx.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
  */
-static size_t curl_write_cb(const void *content, size_t size, size_t nmemb, void *data)
+static size_t curl_write_file_cb(const void *content, size_t size, size_t nmemb, void *data)
 {
-        RestPayload *p = NULL;
+        DownloadState *state = data;
         size_t real_size = size * nmemb;
 
         g_return_val_if_fail(content, 0);
         g_return_val_if_fail(data, 0);
 
-        p = (RestPayload *) data;
-        p->payload = (gchar *) g_realloc(p->payload, p->size + real_size + 1);
+        if (!state->http_code) {
+                curl_easy_getinfo(state->curl, CURLINFO_RESPONSE_CODE, &state->http_code);
 
-        // copy content to buffer
-        memcpy(&(p->payload[p->size]), content, real_size);
-        p->size += real_size;
-        p->payload[p->size] = '\0';
+                // server ignored the range (e.g. If-Range did not match), start over
+                if (state->http_code == 200 && state->size) {
+                        g_message("Server sent complete file instead of requested range, restarting download.");
+                        if (!bundle_writer_restart(state->writer))
+                                return 0;
+                        download_state_reset(state);
+                }
+        }
+
+        // error responses (e.g. 416 for an already complete file) are not part of the file
+        if (state->http_code != 200 && state->http_code != 206)
+                return real_size;
+
+        // a short write makes libcurl abort the transfer with CURLE_WRITE_ERROR
+        if (!bundle_writer_write(state->writer, content, real_size))
+                return 0;
+
+        download_state_update(state, content, real_size);
+
+        if (state->resume_info && g_get_monotonic_time() >= state->next_checkpoint)
+                download_state_checkpoint(state);
 
         return real_size;
 }
 
 /**
- * @brief Perform REST request with JSON data, expecting response JSON data.
+ * @brief Curl callback remembering the ETag and Last-Modified response headers in
+ *        DownloadState*, used for If-Range when resuming.
  *
- * @param[in]  method             HTTP Method, e.g. GET
- * @param[in]  url                URL used in HTTP REST request
- * @param[in]  jsonRequestBody    REST request body. If NULL, no body is sent
- * @param[out] jsonResponseParser Return location for a REST response or NULL to skip response
- *                                parsing
- * @param[out] error              Error
- * @return TRUE if request and response parser (if given) suceeded, FALSE otherwise (error set).
+ * @see   https://curl.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
  */
-static gboolean rest_request(enum HTTPMethod method, const gchar *url,
-                             JsonBuilder *jsonRequestBody, JsonParser **jsonResponseParser,
-                             GError **error)
+static size_t curl_header_validators_cb(const char *buffer, size_t size, size_t nitems,
+                                        void *data)
 {
-        g_autofree gchar *postdata = NULL;
-        g_autoptr(RestPayload) fetch_buffer = NULL;
-        struct curl_slist *headers = NULL;
-        g_autoptr(CURL) curl = NULL;
-        glong http_code = 0;
-        CURLcode res;
+        DownloadState *state = data;
+        size_t real_size = size * nitems;
+
+        g_return_val_if_fail(buffer, 0);
+        g_return_val_if_fail(data, 0);
+
+        // new response (e.g. after redirect), forget previous headers
+        if (real_size >= 5 && !g_ascii_strncasecmp(buffer, "HTTP/", 5)) {
+                g_clear_pointer(&state->etag, g_free);
+                g_clear_pointer(&state->last_modified, g_free);
+        }
+
+        if (real_size > 5 && !g_ascii_strncasecmp(buffer, "ETag:", 5)) {
+                g_free(state->etag);
+                state->etag = g_strstrip(g_strndup(buffer + 5, real_size - 5));
+        } else if (real_size > 14 && !g_ascii_strncasecmp(buffer, "Last-Modified:", 14)) {
+                g_free(state->last_modified);
+                state->last_modified = g_strstrip(g_strndup(buffer + 14, real_size - 14));
+        }
+
+        return real_size;
+}
+
+/**
+ * @brief Add string to Curl headers, avoiding overwriting an existing
+ *        non-empty list on failure.
+ *
+ * @param[out] headers curl_slist** of already set headers
+ * @param[in]  string  Header to add
+ * @param[out] error   Error
+ * @return TRUE if string was added to headers successfully, FALSE otherwise (error set)
+ */
+static gboolean add_curl_header(struct curl_slist **headers, const char *string, GError **error)
+{
+        struct curl_slist *temp = NULL;
+
+        g_return_val_if_fail(headers, FALSE);
+        g_return_val_if_fail(string, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        temp = curl_slist_append(*headers, string);
+        if (!temp) {
+                g_clear_pointer(headers, curl_slist_free_all);
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Could not add header %s", string);
+                return FALSE;
+        }
+
+        *headers = temp;
+        return TRUE;
+}
+
+/**
+ * @brief Build hawkBit authorization header from config's auth_token or gateway_token.
+ *
+ * @return newly allocated authorization header string, NULL if no authorization method set
+ */
+static gchar* build_auth_header(void)
+{
+        if (hawkbit_config->auth_token)
+                return g_strdup_printf("Authorization: TargetToken %s",
+                                       hawkbit_config->auth_token);
+        if (hawkbit_config->gateway_token)
+                return g_strdup_printf("Authorization: GatewayToken %s",
+                                       hawkbit_config->gateway_token);
+
+        return NULL;
+}
+
+/**
+ * @brief Add hawkBit authorization header to Curl headers.
+ *
+ * @param[out] headers curl_slist** of already set headers
+ * @param[out] error   Error
+ * @return TRUE if authorization method set in config and header was added successfully, TRUE if no
+ *         authorization method set, FALSE otherwise (error set)
+ */
+static gboolean set_auth_curl_header(struct curl_slist **headers, GError **error)
+{
+        gboolean res = TRUE;
+        g_autofree gchar *token = NULL;
 
-        g_return_val_if_fail(url, FALSE);
-        g_return_val_if_fail(jsonResponseParser == NULL || *jsonResponseParser == NULL, FALSE);
         g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+        token = build_auth_header();
+        if (token)
+                res = add_curl_header(headers, token, error);
+
+        return res;
+}
+
+/**
+ * @brief Build the headers sent along with all DDI API requests. These do not change at runtime,
+ *        so they are built once and shared by all requests.
+ *
+ * @param[in]  body  Whether to build the headers for requests with JSON body
+ * @param[out] error Error
+ * @return curl_slist* of headers, NULL on error (error set)
+ */
+static struct curl_slist* build_api_headers(gboolean body, GError **error)
+{
+        struct curl_slist *headers = NULL;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+        if (!add_curl_header(&headers, "Accept: application/json;charset=UTF-8", error) ||
+            !set_auth_curl_header(&headers, error))
+                return NULL;
+
+        if (body &&
+            !add_curl_header(&headers, "Content-Type: application/json;charset=UTF-8", error))
+                return NULL;
+
+        return headers;
+}
+
+/**
+ * @brief Get the calling thread's Curl handle, creating it on first use.
+ *        The handle is reset to its default options but keeps its connection cache, so
+ *        connections (and TLS sessions) are reused across requests. The handle is owned by the
+ *        calling thread and cleaned up on thread exit.
+ *
+ * @param[out] error Error
+ * @return CURL* handle of the calling thread, NULL on error (error set)
+ */
+static CURL* get_curl_handle(GError **error)
+{
+        CURL *curl = NULL;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+        curl = g_private_get(&curl_handle);
+        if (curl) {
+                curl_easy_reset(curl);
+                return curl;
+        }
+
         curl = curl_easy_init();
         if (!curl) {
                 g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
                             "Unable to start libcurl easy session");
-                return FALSE;
+                return NULL;
         }
 
-        // init response buffer
-        fetch_buffer = g_new0(RestPayload, 1);
-        fetch_buffer->size = 0;
-        fetch_buffer->payload = g_malloc0(DEFAULT_CURL_REQUEST_BUFFER_SIZE);
+        g_private_set(&curl_handle, curl);
+        return curl;
+}
 
-        // set up CURL options
-        set_default_curl_opts(curl);
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, HTTPMethod_STRING[method]);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, hawkbit_config->timeout);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fetch_buffer);
+/**
+ * @brief Set common Curl options, namely user agent, connect timeout, SSL
+ *        verify peer, SSL verify host, shared DNS/TLS session cache and connection reuse
+ *        options.
+ *
+ * @param[in] curl Curl handle
+ */
+static void set_default_curl_opts(CURL *curl)
+{
+        g_return_if_fail(curl);
 
-        if (jsonRequestBody) {
-                g_autoptr(JsonGenerator) generator = json_generator_new();
-                g_autoptr(JsonNode) req_root = json_builder_get_root(jsonRequestBody);
-                g_autofree gchar *json_req_str = NULL;
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, HAWKBIT_USERAGENT);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, hawkbit_config->connect_timeout);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, hawkbit_config->ssl_verify ? 1L : 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, hawkbit_config->ssl_verify ? 1L : 0L);
+        connection_cache_setup(curl);
 
-                json_generator_set_root(generator, req_root);
-                postdata = json_generator_to_data(generator, NULL);
-                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postdata);
-                json_req_str = json_to_string(req_root, TRUE);
-                g_debug("Request body: %s", json_req_str);
+        // keep connections open for reuse unless disabled
+        if (hawkbit_config->connection_idle_timeout <= 0) {
+                curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
+                return;
         }
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x074100
+        curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, (long) hawkbit_config->connection_idle_timeout);
+#endif
+}
 
-        // set up request headers
-        if (!add_curl_header(&headers, "Accept: application/json;charset=UTF-8", error))
+/**
+ * @brief struct containing the download rate limit a transfer was started with.
+ */
+typedef struct DownloadRate_ {
+        curl_off_t limit;             /**< rate limit in bytes/s applied to the transfer, 0 for unlimited */
+        gint64 next_check;            /**< monotonic time to check the rate limit in effect again */
+        gboolean changed;             /**< rate limit in effect changed, transfer was aborted */
+} DownloadRate;
+
+/**
+ * @brief Get the download rate limit currently in effect according to config's
+ *        max_download_rate and download_windows.
+ *
+ * @param[out] rate Rate limit in bytes/s, 0 for unlimited
+ * @return TRUE if downloading is allowed now, FALSE if outside of all download windows
+ */
+static gboolean get_download_rate(curl_off_t *rate)
+{
+        g_autoptr(GDateTime) now = g_date_time_new_now_local();
+        gint minute = g_date_time_get_hour(now) * 60 + g_date_time_get_minute(now);
+        GArray *windows = NULL;
+        gboolean allowed;
+
+        g_return_val_if_fail(rate, FALSE);
+
+        G_LOCK(download_rate);
+        windows = hawkbit_config->download_windows;
+        allowed = windows == NULL;
+        *rate = hawkbit_config->max_download_rate;
+
+        for (guint i = 0; windows && i < windows->len; i++) {
+                DownloadWindow *window = &g_array_index(windows, DownloadWindow, i);
+                gboolean inside;
+
+                if (window->start < window->end)
+                        inside = minute >= window->start && minute < window->end;
+                else if (window->start > window->end)
+                        inside = minute >= window->start || minute < window->end;
+                else
+                        inside = TRUE;
+
+                if (!inside)
+                        continue;
+
+                allowed = TRUE;
+                if (window->rate >= 0)
+                        *rate = window->rate;
+                break;
+        }
+        G_UNLOCK(download_rate);
+
+        return allowed;
+}
+
+/**
+ * @brief Check (at most once per second) whether the download rate limit in effect differs from
+ *        the one rate was set up with, or downloading is not allowed anymore.
+ *
+ * @param[in] rate DownloadRate of the running transfer, changed is set accordingly
+ * @return TRUE if the transfer should be aborted, FALSE otherwise
+ */
+static gboolean download_rate_changed(DownloadRate *rate)
+{
+        curl_off_t limit = 0;
+        gint64 now = g_get_monotonic_time();
+
+        g_return_val_if_fail(rate, FALSE);
+
+        if (now < rate->next_check)
+                return rate->changed;
+
+        rate->next_check = now + G_USEC_PER_SEC;
+        if (!get_download_rate(&limit) || limit != rate->limit)
+                rate->changed = TRUE;
+
+        return rate->changed;
+}
+
+/**
+ * @brief Curl callback aborting the transfer once the download rate limit in effect changes,
+ *        allowing to resume it with the new limit.
+ *
+ * @see   https://curl.se/libcurl/c/CURLOPT_XFERINFOFUNCTION.html
+ */
+static int curl_xferinfo_rate_cb(void *data, curl_off_t dltotal, curl_off_t dlnow,
+                                 curl_off_t ultotal, curl_off_t ulnow)
+{
+        g_return_val_if_fail(data, 1);
+
+        return download_rate_changed((DownloadRate *) data) ? 1 : 0;
+}
+
+/**
+ * @brief Download download_url to file, updating the checksums in state with the received data.
+ *
+ * @param[in]  download_url URL to download from
+ * @param[in]  peer         Whether download_url points to a peer in the local network, which
+ *                          is given up on quickly
+ * @param[in]  auth         Whether to send hawkBit credentials to download_url
+ * @param[in]  file         Download destination
+ * @param[in]  resume_from  Offset to resume download from, must match the number of bytes state's
+ *                          checksums cover
+ * @param[in]  size         Size of the complete file, space for it is preallocated
+ * @param[in]  state        DownloadState holding the running checksums
+ * @param[out] speed        Average download speed
+ * @param[out] error        Error
+ * @return TRUE if download succeeded, FALSE otherwise (error set)
+ */
+static gboolean get_binary(const gchar *download_url, gboolean peer, gboolean auth,
+                           const gchar *file, curl_off_t resume_from, curl_off_t size, DownloadState *state,
+                           curl_off_t *speed, GError **error)
+{
+        CURL *curl = NULL;
+        g_auto(BundleWriter) writer = { .fd = -1 };
+        g_autofree gchar *range = NULL;
+        CURLcode curl_code;
+        glong http_code = 0;
+        struct curl_slist *headers = NULL;
+        DownloadRate rate = { 0 };
+
+        g_return_val_if_fail(download_url, FALSE);
+        g_return_val_if_fail(file, FALSE);
+        g_return_val_if_fail(state && state->size == resume_from, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (resume_from)
+                log_debug("Resuming download from offset %" CURL_FORMAT_CURL_OFF_T, resume_from);
+
+        if (!bundle_writer_open(&writer, file, resume_from, size, error))
                 return FALSE;
 
-        if (!set_auth_curl_header(&headers, error))
+        curl = get_curl_handle(error);
+        if (!curl)
                 return FALSE;
 
-        if (jsonRequestBody &&
-            !add_curl_header(&headers, "Content-Type: application/json;charset=UTF-8", error))
+        set_default_curl_opts(curl);
+        curl_easy_setopt(curl, CURLOPT_URL, download_url);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, peer ? 0L : 1L);
+        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 8L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        if (peer)
+                curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, PEER_CONNECT_TIMEOUT);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_file_cb);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, state);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_validators_cb);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, state);
+
+        // abort if slower than configured download rate during configured time span
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, hawkbit_config->low_speed_time);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, hawkbit_config->low_speed_rate);
+
+        // limit download rate, abort once the limit in effect changes
+        get_download_rate(&rate.limit);
+        if (rate.limit > 0)
+                curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, rate.limit);
+        rate.next_check = g_get_monotonic_time() + G_USEC_PER_SEC;
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_xferinfo_rate_cb);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &rate);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+        // unlike CURLOPT_RESUME_FROM_LARGE, a plain range lets us handle a complete file in reply
+        if (resume_from) {
+                range = g_strdup_printf("%" CURL_FORMAT_CURL_OFF_T "-", resume_from);
+                curl_easy_setopt(curl, CURLOPT_RANGE, range);
+        }
+
+        if (auth && !set_auth_curl_header(&headers, error))
                 return FALSE;
 
+        // set up request headers
+        if (!add_curl_header(&headers, "Accept: application/octet-stream", error))
+                return FALSE;
+
+        // only resume if the file did not change on the server, weak ETags are not allowed here
+        if (resume_from) {
+                const gchar *validator = state->last_modified;
+
+                if (state->etag && !g_str_has_prefix(state->etag, "W/"))
+                        validator = state->etag;
+
+                if (validator) {
+                        g_autofree gchar *if_range = g_strdup_printf("If-Range: %s", validator);
+
+                        if (!add_curl_header(&headers, if_range, error))
+                                return FALSE;
+                }
+        }
+
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-        // perform request
-        res = curl_easy_perform(curl);
+        // perform transfer
+        state->writer = &writer;
+        state->curl = curl;
+        state->http_code = 0;
+        state->next_checkpoint = g_get_monotonic_time() + RESUME_CHECKPOINT_INTERVAL;
+        curl_code = curl_easy_perform(curl);
+        metrics_record_transfer(METRICS_TRANSFER_DOWNLOAD, curl, curl_code == CURLE_OK);
+        connection_cache_record(curl, curl_code);
+        if (curl_code != CURLE_OK)
+                download_state_checkpoint(state);
+        state->writer = NULL;
+        state->curl = NULL;
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, speed);
         curl_slist_free_all(headers);
-        if (res != CURLE_OK) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, res, "%s",
-                            curl_easy_strerror(res));
+
+        // write out the staging buffer, keeping everything received for resuming
+        if (!bundle_writer_close(&writer, error))
+                return FALSE;
+
+        if (curl_code == CURLE_ABORTED_BY_CALLBACK && rate.changed) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD_RESCHEDULED,
+                            "Download rate limit changed");
                 return FALSE;
         }
-        if (http_code != 200) {
+        if (curl_code != CURLE_OK) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, curl_code, "%s",
+                            curl_easy_strerror(curl_code));
+                return FALSE;
+        }
+        // consider ok/partial download/range not satisfiable (EOF reached) as success
+        if (http_code != 200 && http_code != 206 && http_code != 416) {
                 g_set_error(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, http_code,
-                            "HTTP request failed: %ld; server response: %s", http_code,
-                            fetch_buffer->payload);
+                            "HTTP request failed: %ld", http_code);
                 return FALSE;
         }
 
-        if (jsonResponseParser && fetch_buffer->size > 0) {
-                // process JSON repsonse
-                g_autoptr(JsonParser) parser = json_parser_new_immutable();
-                JsonNode *resp_root = NULL;
-                g_autofree gchar *json_resp_str = NULL;
+        return TRUE;
+}
 
-                if (!json_parser_load_from_data(parser, fetch_buffer->payload, fetch_buffer->size,
-                                                error))
-                        return FALSE;
+/**
+ * @brief Get the time to wait before retrying an operation that failed attempt times in a row.
+ *        If config's retry_backoff_max is set, the limit starts at base and doubles with each
+ *        failure up to retry_backoff_max, the wait is chosen at random from a tenth of base up to
+ *        that limit ("full jitter" with a small floor), so clients failing at the same time do
+ *        not retry in lockstep, not even on their first retry. Otherwise, base is returned.
+ *
+ * @param[in] base    Time to wait before the first retry [ms]
+ * @param[in] attempt Number of retries made before
+ * @return time to wait [ms]
+ */
+static gint64 get_backoff_time(gint64 base, guint attempt)
+{
+        gint64 cap = (gint64) hawkbit_config->retry_backoff_max * 1000;
+        gint64 limit = base;
+
+        if (cap <= base)
+                return base;
+
+        for (guint i = 0; i < attempt && limit < cap; i++)
+                limit *= 2;
+        limit = MIN(limit, cap);
+
+        return (gint64) g_random_double_range(base / 10.0, limit);
+}
+
+/**
+ * @brief struct containing the state of one byte range of a segmented download.
+ */
+typedef struct DownloadSegment_ {
+        CURL *curl;                   /**< Curl handle transferring this segment, NULL if idle */
+        int fd;                       /**< file descriptor of the download destination */
+        curl_off_t start;             /**< offset of the first byte of this segment */
+        curl_off_t end;               /**< offset of the last byte of this segment */
+        curl_off_t written;           /**< number of bytes of this segment written so far */
+        gint64 retry_at;              /**< monotonic time to (re)start the transfer at */
+        guint failures;               /**< number of transfers failed in a row without progress */
+        curl_off_t failed_written;    /**< written at the last failed transfer */
+        curl_off_t max_speed;         /**< receive rate limit in bytes/s, 0 for unlimited */
+        gboolean range_ignored;       /**< server did not answer with the requested range */
+        gboolean write_failed;        /**< writing to fd failed (errno in write_errno) */
+        int write_errno;              /**< errno of failed write */
+} DownloadSegment;
+
+/**
+ * @brief Curl callback writing a segment's data to its position in DownloadSegment*->fd.
+ *
+ * @see   https://curl.haxx.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
+ */
+static size_t curl_write_segment_cb(const void *content, size_t size, size_t nmemb, void *data)
+{
+        DownloadSegment *segment = data;
+        size_t real_size = size * nmemb;
+        size_t done = 0;
+        glong http_code = 0;
+
+        g_return_val_if_fail(content, 0);
+        g_return_val_if_fail(data, 0);
+
+        // refuse anything but the requested range, the data would end up at the wrong offset
+        curl_easy_getinfo(segment->curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code != 206 ||
+            segment->start + segment->written + (curl_off_t) real_size > segment->end + 1) {
+                segment->range_ignored = TRUE;
+                return 0;
+        }
+
+        while (done < real_size) {
+                ssize_t w = pwrite(segment->fd, (const guchar *) content + done, real_size - done,
+                                   segment->start + segment->written);
+                if (w < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        segment->write_failed = TRUE;
+                        segment->write_errno = errno;
+                        return 0;
+                }
+                done += w;
+                segment->written += w;
+        }
+
+        return real_size;
+}
+
+/**
+ * @brief Start (or resume) the transfer of segment's remaining byte range on multi.
+ *
+ * @param[in]  multi        Curl multi handle to add the transfer to
+ * @param[in]  segment      DownloadSegment to transfer
+ * @param[in]  download_url URL to download from
+ * @param[in]  headers      Request headers to use
+ * @param[out] error        Error
+ * @return TRUE if the transfer was added, FALSE otherwise (error set)
+ */
+static gboolean download_segment_start(CURLM *multi, DownloadSegment *segment,
+                                       const gchar *download_url, struct curl_slist *headers,
+                                       GError **error)
+{
+        g_autofree gchar *range = NULL;
+        CURLMcode mcode;
+
+        g_return_val_if_fail(multi, FALSE);
+        g_return_val_if_fail(segment && !segment->curl, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        segment->curl = curl_easy_init();
+        if (!segment->curl) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Unable to start libcurl easy session");
+                return FALSE;
+        }
+
+        range = g_strdup_printf("%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T,
+                                segment->start + segment->written, segment->end);
+        log_debug("Downloading segment %s", range);
+
+        set_default_curl_opts(segment->curl);
+        curl_easy_setopt(segment->curl, CURLOPT_URL, download_url);
+        curl_easy_setopt(segment->curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(segment->curl, CURLOPT_MAXREDIRS, 8L);
+        curl_easy_setopt(segment->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(segment->curl, CURLOPT_RANGE, range);
+        curl_easy_setopt(segment->curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(segment->curl, CURLOPT_WRITEFUNCTION, curl_write_segment_cb);
+        curl_easy_setopt(segment->curl, CURLOPT_WRITEDATA, segment);
+        curl_easy_setopt(segment->curl, CURLOPT_PRIVATE, segment);
+
+        // abort if slower than configured download rate during configured time span
+        curl_easy_setopt(segment->curl, CURLOPT_LOW_SPEED_TIME, hawkbit_config->low_speed_time);
+        curl_easy_setopt(segment->curl, CURLOPT_LOW_SPEED_LIMIT, hawkbit_config->low_speed_rate);
+
+        if (segment->max_speed > 0)
+                curl_easy_setopt(segment->curl, CURLOPT_MAX_RECV_SPEED_LARGE, segment->max_speed);
+
+        mcode = curl_multi_add_handle(multi, segment->curl);
+        if (mcode != CURLM_OK) {
+                g_clear_pointer(&segment->curl, curl_easy_cleanup);
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Failed to add segment transfer: %s", curl_multi_strerror(mcode));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Stop segment's transfer (if any) and release its Curl handle.
+ *
+ * @param[in] multi   Curl multi handle the transfer was added to
+ * @param[in] segment DownloadSegment to stop
+ */
+static void download_segment_stop(CURLM *multi, DownloadSegment *segment)
+{
+        g_return_if_fail(segment);
+
+        if (!segment->curl)
+                return;
+
+        curl_multi_remove_handle(multi, segment->curl);
+        g_clear_pointer(&segment->curl, curl_easy_cleanup);
+}
+
+/**
+ * @brief Get the number of segments a download of size bytes (starting at resume_from) should be
+ *        split into, honoring config's download_segments and download_segment_min_size.
+ *
+ * @param[in] size        Size of the complete file
+ * @param[in] resume_from Offset the download starts at
+ * @return number of segments, 1 for a regular single stream download
+ */
+static gint get_download_segment_count(curl_off_t size, curl_off_t resume_from)
+{
+        curl_off_t remaining = size - resume_from;
+
+        if (hawkbit_config->download_segments <= 1 || remaining <= 0)
+                return 1;
+
+        return (gint) MAX(1, MIN(hawkbit_config->download_segments,
+                                 remaining / hawkbit_config->download_segment_min_size));
+}
+
+/**
+ * @brief Download download_url to file in segments: the remaining byte range is split into
+ *        config's download_segments ranges, which are transferred in parallel and written to
+ *        their position in the preallocated file. A segment failing with a resumable error is
+ *        resumed on its own if config's resume_downloads is enabled.
+ *        On failure, file is truncated to the contiguous part downloaded so far, so a later
+ *        download can resume from there.
+ *        Note that, unlike get_binary(), this does not update state's checksums.
+ *
+ * @param[in]  download_url URL to download from
+ * @param[in]  auth         Whether to send hawkBit credentials to download_url
+ * @param[in]  file         Download destination
+ * @param[in]  resume_from  Offset to resume download from
+ * @param[in]  size         Size of the complete file
+ * @param[in]  segments     Number of segments to split the download into
+ * @param[out] speed        Average download speed
+ * @param[out] error        Error
+ * @return TRUE if download succeeded, FALSE otherwise (error set)
+ */
+static gboolean get_binary_segmented(const gchar *download_url, gboolean auth,
+                                     const gchar *file, curl_off_t resume_from, curl_off_t size, gint segments,
+                                     curl_off_t *speed, GError **error)
+{
+        g_autofree DownloadSegment *segment = NULL;
+        struct curl_slist *headers = NULL;
+        CURLM *multi = NULL;
+        GError *ierror = NULL;
+        curl_off_t seg_size, contiguous;
+        DownloadRate rate = { 0 };
+        gint64 start_time, wait;
+        gint i, finished = 0;
+        int fd;
+
+        g_return_val_if_fail(download_url, FALSE);
+        g_return_val_if_fail(file, FALSE);
+        g_return_val_if_fail(size > resume_from, FALSE);
+        g_return_val_if_fail(segments > 1, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        log_debug("Downloading %" CURL_FORMAT_CURL_OFF_T " bytes in %d segments",
+                size - resume_from, segments);
+
+        fd = g_open(file, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+                int err = errno;
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                            "Failed to open %s for download: %s", file, g_strerror(err));
+                return FALSE;
+        }
+
+        // segments are written at their offsets, the file size need not be set up front
+        if (fallocate(fd, FALLOC_FL_KEEP_SIZE, resume_from, size - resume_from)) {
+                int err = errno;
+
+                if (err == ENOSPC) {
+                        g_set_error(&ierror, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+                                    "Failed to preallocate %s: %s", file, g_strerror(err));
+                        goto out;
+                }
+                log_debug("Cannot preallocate %s: %s", file, g_strerror(err));
+        }
+
+        // share download rate limit among segments
+        get_download_rate(&rate.limit);
+        rate.next_check = g_get_monotonic_time() + G_USEC_PER_SEC;
+
+        // split remaining range into segments, the last one takes the remainder
+        segment = g_new0(DownloadSegment, segments);
+        seg_size = (size - resume_from) / segments;
+        for (i = 0; i < segments; i++) {
+                segment[i].fd = fd;
+                segment[i].max_speed = rate.limit > 0 ? MAX(1, rate.limit / segments) : 0;
+                segment[i].start = resume_from + i * seg_size;
+                segment[i].end = (i == segments - 1) ? size - 1
+                                 : segment[i].start + seg_size - 1;
+        }
+
+        if ((auth && !set_auth_curl_header(&headers, &ierror)) ||
+            !add_curl_header(&headers, "Accept: application/octet-stream", &ierror))
+                goto out;
+
+        multi = curl_multi_init();
+        if (!multi) {
+                g_set_error(&ierror, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Unable to start libcurl multi session");
+                goto out;
+        }
+
+        start_time = g_get_monotonic_time();
+        while (finished < segments) {
+                CURLMsg *msg;
+                int running, msgs_left;
+                gboolean cancel;
+
+                g_mutex_lock(&active_action->mutex);
+                cancel = active_action->state == ACTION_STATE_CANCEL_REQUESTED;
+                g_mutex_unlock(&active_action->mutex);
+                if (cancel) {
+                        g_set_error(&ierror, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_CANCELATION, "Download canceled");
+                        goto out;
+                }
+
+                if (download_rate_changed(&rate)) {
+                        g_set_error(&ierror, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD_RESCHEDULED,
+                                    "Download rate limit changed");
+                        goto out;
+                }
+
+                // (re)start idle segments that are due
+                for (i = 0; i < segments; i++) {
+                        if (segment[i].curl || segment[i].retry_at < 0 ||
+                            segment[i].retry_at > g_get_monotonic_time())
+                                continue;
+
+                        if (!download_segment_start(multi, &segment[i], download_url, headers,
+                                                    &ierror))
+                                goto out;
+                }
+
+                curl_multi_perform(multi, &running);
+
+                while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+                        DownloadSegment *seg = NULL;
+                        CURLcode code = msg->data.result;
+                        glong http_code = 0;
+                        gboolean resumable = FALSE;
+
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+
+                        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &seg);
+                        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
+                        metrics_record_transfer(METRICS_TRANSFER_DOWNLOAD, msg->easy_handle,
+                                                code == CURLE_OK);
+                        connection_cache_record(msg->easy_handle, code);
+                        download_segment_stop(multi, seg);
+
+                        if (code == CURLE_OK && seg->start + seg->written == seg->end + 1) {
+                                // segment done, never restart it
+                                seg->retry_at = -1;
+                                finished++;
+                                continue;
+                        }
+
+                        if (seg->write_failed) {
+                                g_set_error(&ierror, G_FILE_ERROR,
+                                            g_file_error_from_errno(seg->write_errno),
+                                            "Failed to write %s: %s", file,
+                                            g_strerror(seg->write_errno));
+                                goto out;
+                        }
+                        if (seg->range_ignored || (code == CURLE_OK && http_code != 206)) {
+                                g_set_error(&ierror, RHU_HAWKBIT_CLIENT_HTTP_ERROR, http_code,
+                                            "HTTP range request failed: %ld", http_code);
+                                goto out;
+                        }
+
+                        // a complete transfer with missing data is a partial download
+                        if (code == CURLE_OK)
+                                code = CURLE_PARTIAL_FILE;
+
+                        for (const gint *c = &resumable_codes[0]; *c; c++)
+                                resumable |= (code == (CURLcode) *c);
+
+                        if (!hawkbit_config->resume_downloads || !resumable) {
+                                g_set_error(&ierror, RHU_HAWKBIT_CLIENT_CURL_ERROR, code, "%s",
+                                            curl_easy_strerror(code));
+                                goto out;
+                        }
+
+                        // back off from failing resume attempts without progress
+                        if (seg->written > seg->failed_written)
+                                seg->failures = 0;
+                        seg->failed_written = seg->written;
+                        wait = get_backoff_time(RESUME_WAIT_MS, seg->failures++);
+
+                        log_debug("%s, resuming segment from offset %" CURL_FORMAT_CURL_OFF_T " in %.1fs..",
+                                curl_easy_strerror(code), seg->start + seg->written,
+                                (gdouble) wait / 1000);
+                        metrics_record_retry(METRICS_TRANSFER_DOWNLOAD);
+                        metrics_record_resume();
+                        seg->retry_at = g_get_monotonic_time() + wait * 1000;
+                }
+
+                if (finished < segments)
+                        curl_multi_wait(multi, NULL, 0, 100, NULL);
+        }
+
+        *speed = (size - resume_from) * G_USEC_PER_SEC /
+                 MAX(1, g_get_monotonic_time() - start_time);
+
+out:
+        for (i = 0; segment && i < segments; i++)
+                download_segment_stop(multi, &segment[i]);
+        if (multi)
+                curl_multi_cleanup(multi);
+        curl_slist_free_all(headers);
+
+        if (ierror) {
+                // only keep contiguous data, allowing to resume from there
+                contiguous = resume_from;
+                for (i = 0; segment && i < segments; i++) {
+                        contiguous = segment[i].start + segment[i].written;
+                        if (contiguous != segment[i].end + 1)
+                                break;
+                }
+                if (ftruncate(fd, contiguous))
+                        g_warning("Failed to truncate %s: %s", file, g_strerror(errno));
+        }
+
+        if (close(fd) && !ierror) {
+                int err = errno;
+                g_set_error(&ierror, G_FILE_ERROR, g_file_error_from_errno(err),
+                            "Failed to write %s: %s", file, g_strerror(err));
+        }
+
+        if (ierror) {
+                g_propagate_error(error, ierror);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Curl callback writing REST response to RestPayload*->payload buffer.
+ *
+ * @see   https://curl.haxx.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
+ */
+static size_t curl_write_cb(const void *content, size_t size, size_t nmemb, void *data)
+{
+        RestPayload *p = NULL;
+        size_t real_size = size * nmemb;
+
+        g_return_val_if_fail(content, 0);
+        g_return_val_if_fail(data, 0);
+
+        p = (RestPayload *) data;
+        if (hawkbit_config->max_response_size > 0 &&
+            p->size + real_size > (size_t) hawkbit_config->max_response_size) {
+                // aborts the transfer
+                p->exceeded = TRUE;
+                return 0;
+        }
+
+        if (p->size + real_size + 1 > p->capacity) {
+                // grow geometrically to avoid reallocating on each chunk
+                while (p->size + real_size + 1 > p->capacity)
+                        p->capacity *= 2;
+                p->payload = (gchar *) g_realloc(p->payload, p->capacity);
+        }
+
+        // copy content to buffer
+        memcpy(&(p->payload[p->size]), content, real_size);
+        p->size += real_size;
+        p->payload[p->size] = '\0';
+
+        return real_size;
+}
+
+/**
+ * @brief Create an empty REST response buffer. In low-memory mode, it is allocated for
+ *        max_response_size right away, so it never needs to grow.
+ *
+ * @return newly allocated RestPayload*
+ */
+static RestPayload* rest_payload_new(void)
+{
+        RestPayload *payload = g_new0(RestPayload, 1);
+
+        payload->capacity = hawkbit_config->low_memory
+                            ? (size_t) hawkbit_config->max_response_size + 1
+                            : DEFAULT_CURL_REQUEST_BUFFER_SIZE;
+        payload->payload = g_malloc(payload->capacity);
+        payload->payload[0] = '\0';
+
+        return payload;
+}
+
+/**
+ * @brief Empty payload for reuse, keeping its capacity.
+ *
+ * @param[in] payload RestPayload* to empty
+ */
+static void rest_payload_reset(RestPayload *payload)
+{
+        payload->size = 0;
+        payload->payload[0] = '\0';
+        payload->exceeded = FALSE;
+}
+
+/**
+ * @brief Get a REST response buffer for a request run by a curl source. In low-memory mode,
+ *        buffers are taken from a pool, so their number is bounded by the number of concurrent
+ *        requests and no heap is fragmented by allocating them per request.
+ *
+ * @return RestPayload*, to be returned with rest_payload_release()
+ */
+static RestPayload* rest_payload_acquire(void)
+{
+        RestPayload *payload = NULL;
+
+        if (hawkbit_config->low_memory) {
+                G_LOCK(rest_payload_pool);
+                payload = g_queue_pop_head(&rest_payload_pool);
+                G_UNLOCK(rest_payload_pool);
+        }
+
+        if (!payload)
+                return rest_payload_new();
+
+        rest_payload_reset(payload);
+        return payload;
+}
+
+/**
+ * @brief Return a buffer from rest_payload_acquire(), pooling it in low-memory mode.
+ *
+ * @param[in] payload RestPayload* to release
+ */
+static void rest_payload_release(RestPayload *payload)
+{
+        if (!payload)
+                return;
+
+        if (!hawkbit_config->low_memory) {
+                rest_payload_free(payload);
+                return;
+        }
+
+        G_LOCK(rest_payload_pool);
+        g_queue_push_head(&rest_payload_pool, payload);
+        G_UNLOCK(rest_payload_pool);
+}
+
+/**
+ * @brief Get the calling thread's REST response buffer, emptied but keeping its capacity.
+ *
+ * @return RestPayload*, owned by the calling thread
+ */
+static RestPayload* get_rest_buffer(void)
+{
+        RestPayload *buffer = g_private_get(&rest_buffer);
+
+        if (!buffer) {
+                buffer = rest_payload_new();
+                g_private_set(&rest_buffer, buffer);
+        }
+
+        rest_payload_reset(buffer);
+
+        return buffer;
+}
+
+/**
+ * @brief Curl callback remembering the ETag response header in gchar** data.
+ *
+ * @see   https://curl.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+ */
+static size_t curl_header_etag_cb(const char *buffer, size_t size, size_t nitems, void *data)
+{
+        gchar **etag = data;
+        size_t real_size = size * nitems;
+
+        g_return_val_if_fail(buffer, 0);
+        g_return_val_if_fail(data, 0);
+
+        // new response (e.g. after redirect), forget previous headers
+        if (real_size >= 5 && !g_ascii_strncasecmp(buffer, "HTTP/", 5))
+                g_clear_pointer(etag, g_free);
+
+        if (real_size > 5 && !g_ascii_strncasecmp(buffer, "ETag:", 5)) {
+                g_free(*etag);
+                *etag = g_strstrip(g_strndup(buffer + 5, real_size - 5));
+        }
+
+        return real_size;
+}
+
+/**
+ * @brief Set up curl for a REST request with JSON data, expecting response JSON data. If
+ *        validator is given, If-None-Match is sent along with its ETag and the ETag of the
+ *        response is collected in etag.
+ *
+ * @param[in]  curl            Curl handle
+ * @param[in]  method          HTTP Method, e.g. GET
+ * @param[in]  url             URL used in HTTP REST request
+ * @param[in]  jsonRequestBody REST request body. If NULL, no body is sent
+ * @param[in]  validator       RestValidator of the previous response or NULL
+ * @param[in]  response        RestPayload* to collect the response body in
+ * @param[out] postdata        Return location for the serialized request body, must be kept
+ *                             until the request finished
+ * @param[out] etag            Return location for the response ETag, must be kept until the
+ *                             request finished
+ * @param[out] headers         Return location for request specific headers, to be freed once
+ *                             the request finished, left NULL if the shared API headers are used
+ * @param[out] error           Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean rest_request_setup(CURL *curl, enum HTTPMethod method, const gchar *url,
+                                   JsonBuilder *jsonRequestBody, RestValidator *validator,
+                                   RestPayload *response, gchar **postdata, gchar **etag,
+                                   struct curl_slist **headers, GError **error)
+{
+        struct curl_slist *request_headers = jsonRequestBody ? api_body_headers : api_headers;
+
+        g_return_val_if_fail(curl, FALSE);
+        g_return_val_if_fail(url, FALSE);
+        g_return_val_if_fail(response, FALSE);
+        g_return_val_if_fail(postdata && *postdata == NULL, FALSE);
+        g_return_val_if_fail(etag, FALSE);
+        g_return_val_if_fail(headers && *headers == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        // set up CURL options
+        set_default_curl_opts(curl);
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, HTTPMethod_STRING[method]);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, hawkbit_config->timeout);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+
+        if (hawkbit_config->http2) {
+                // HTTP/2 is negotiated via TLS ALPN, plain HTTP stays HTTP/1.1
+                curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+                // prefer multiplexing on a connection being set up over opening another one
+                curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        }
+
+        // let curl offer and decode all content encodings it supports, e.g. gzip and br
+        if (hawkbit_config->compressed_responses)
+                curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+        // refuse responses announced too large early, curl_write_cb() catches the others
+        if (hawkbit_config->max_response_size > 0)
+                curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE,
+                                 (curl_off_t) hawkbit_config->max_response_size);
+
+        if (jsonRequestBody) {
+                g_autoptr(JsonGenerator) generator = json_generator_new();
+                g_autoptr(JsonNode) req_root = json_builder_get_root(jsonRequestBody);
+
+                json_generator_set_root(generator, req_root);
+                *postdata = json_generator_to_data(generator, NULL);
+                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, *postdata);
+
+                // pretty-printing is expensive, only do it if it is output
+                if (log_level_enabled(G_LOG_LEVEL_DEBUG)) {
+                        g_autofree gchar *json_req_str = json_to_string(req_root, TRUE);
+                        log_debug("Request body: %s", json_req_str);
+                }
+        }
+
+        if (!request_headers) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "API request headers not set up");
+                return FALSE;
+        }
+
+        if (validator) {
+                if (validator->etag) {
+                        g_autofree gchar *if_none_match = g_strdup_printf("If-None-Match: %s",
+                                                                          validator->etag);
+
+                        // extend a copy, the shared headers must stay unchanged
+                        for (struct curl_slist *h = request_headers; h; h = h->next) {
+                                if (!add_curl_header(headers, h->data, error))
+                                        return FALSE;
+                        }
+                        if (!add_curl_header(headers, if_none_match, error))
+                                return FALSE;
+                        request_headers = *headers;
+                }
+
+                curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_etag_cb);
+                curl_easy_setopt(curl, CURLOPT_HEADERDATA, etag);
+        }
+
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request_headers);
+
+        return TRUE;
+}
+
+/**
+ * @brief Evaluate the result of a REST request set up with rest_request_setup(). A response with
+ *        HTTP 304 (Not Modified) or a body matching the validator's checksum (for servers not
+ *        supporting ETags) is considered unchanged and is not parsed.
+ *
+ * @param[in]     curl               Curl handle the request was performed with
+ * @param[in]     res                Curl result of the request
+ * @param[in]     response           RestPayload* containing the response body
+ * @param[in,out] validator          RestValidator of the previous response, updated with the
+ *                                   current response's validators, or NULL
+ * @param[in,out] etag               ETag collected from the response, taken over by validator
+ * @param[out]    unchanged          Return location for whether the response is unchanged
+ *                                   according to validator, or NULL
+ * @param[out]    jsonResponseParser Return location for a REST response or NULL to skip response
+ *                                   parsing, not set for unchanged responses
+ * @param[out]    error              Error
+ * @return TRUE if request and response parser (if given) suceeded, FALSE otherwise (error set).
+ */
+static gboolean rest_response_process(CURL *curl, CURLcode res, RestPayload *response,
+                                      RestValidator *validator, gchar **etag,
+                                      gboolean *unchanged, JsonParser **jsonResponseParser,
+                                      GError **error)
+{
+        g_autofree gchar *checksum = NULL;
+        glong http_code = 0;
+
+        g_return_val_if_fail(curl, FALSE);
+        g_return_val_if_fail(response, FALSE);
+        g_return_val_if_fail(etag, FALSE);
+        g_return_val_if_fail(jsonResponseParser == NULL || *jsonResponseParser == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (unchanged)
+                *unchanged = FALSE;
+
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        metrics_record_transfer(METRICS_TRANSFER_API, curl,
+                                res == CURLE_OK && (http_code == 200 || http_code == 304));
+        connection_cache_record(curl, res);
+        if (response->exceeded || res == CURLE_FILESIZE_EXCEEDED) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FILESIZE_EXCEEDED,
+                            "Response exceeds max_response_size (%d bytes)",
+                            hawkbit_config->max_response_size);
+                return FALSE;
+        }
+        if (res != CURLE_OK) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, res, "%s",
+                            curl_easy_strerror(res));
+                return FALSE;
+        }
+        if (http_code == 304 && validator && validator->etag) {
+                if (unchanged)
+                        *unchanged = TRUE;
+                return TRUE;
+        }
+        if (http_code != 200) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, http_code,
+                            "HTTP request failed: %ld; server response: %s", http_code,
+                            response->payload);
+                return FALSE;
+        }
+
+        if (validator) {
+                checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                                       (const guchar *) response->payload,
+                                                       response->size);
+                // validator only ever holds the checksum of a successfully parsed response
+                if (unchanged && !g_strcmp0(checksum, validator->checksum)) {
+                        *unchanged = TRUE;
+                        g_free(validator->etag);
+                        validator->etag = g_steal_pointer(etag);
+                        return TRUE;
+                }
+        }
+
+        if (jsonResponseParser && response->size > 0) {
+                // process JSON repsonse
+                g_autoptr(JsonParser) parser = json_parser_new_immutable();
+
+                if (!json_parser_load_from_data(parser, response->payload, response->size,
+                                                error))
+                        return FALSE;
+
+                if (log_level_enabled(G_LOG_LEVEL_DEBUG)) {
+                        g_autofree gchar *json_resp_str = NULL;
+
+                        json_resp_str = json_to_string(json_parser_get_root(parser), TRUE);
+                        log_debug("Response body: %s", json_resp_str);
+                }
+                *jsonResponseParser = g_steal_pointer(&parser);
+        }
+
+        // remember validators only once the response was processed successfully
+        if (validator) {
+                g_free(validator->etag);
+                validator->etag = g_steal_pointer(etag);
+                g_free(validator->checksum);
+                validator->checksum = g_steal_pointer(&checksum);
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Perform conditional REST request with JSON data, expecting response JSON data.
+ *        If validator is given, If-None-Match is sent along with its ETag. A response with HTTP
+ *        304 (Not Modified) or a body matching the validator's checksum (for servers not
+ *        supporting ETags) is considered unchanged and is not parsed.
+ *
+ * @param[in]     method             HTTP Method, e.g. GET
+ * @param[in]     url                URL used in HTTP REST request
+ * @param[in]     jsonRequestBody    REST request body. If NULL, no body is sent
+ * @param[in,out] validator          RestValidator of the previous response, updated with the
+ *                                   current response's validators, or NULL
+ * @param[out]    unchanged          Return location for whether the response is unchanged
+ *                                   according to validator, or NULL
+ * @param[out]    jsonResponseParser Return location for a REST response or NULL to skip response
+ *                                   parsing, not set for unchanged responses
+ * @param[out]    error              Error
+ * @return TRUE if request and response parser (if given) suceeded, FALSE otherwise (error set).
+ */
+static gboolean rest_request_full(enum HTTPMethod method, const gchar *url,
+                                  JsonBuilder *jsonRequestBody, RestValidator *validator,
+                                  gboolean *unchanged, JsonParser **jsonResponseParser,
+                                  GError **error)
+{
+        g_autofree gchar *postdata = NULL, *etag = NULL;
+        RestPayload *fetch_buffer = NULL;
+        struct curl_slist *headers = NULL;
+        CURL *curl = NULL;
+        CURLcode res;
+
+        g_return_val_if_fail(url, FALSE);
+        g_return_val_if_fail(jsonResponseParser == NULL || *jsonResponseParser == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        curl = get_curl_handle(error);
+        if (!curl)
+                return FALSE;
+
+        // reuse response buffer of previous requests
+        fetch_buffer = get_rest_buffer();
+
+        if (!rest_request_setup(curl, method, url, jsonRequestBody, validator, fetch_buffer,
+                                &postdata, &etag, &headers, error))
+                return FALSE;
+
+        // perform request
+        res = curl_easy_perform(curl);
+        curl_slist_free_all(headers);
+
+        return rest_response_process(curl, res, fetch_buffer, validator, &etag, unchanged,
+                                     jsonResponseParser, error);
+}
+
+/**
+ * @brief Perform REST request with JSON data, expecting response JSON data.
+ *
+ * @param[in]  method             HTTP Method, e.g. GET
+ * @param[in]  url                URL used in HTTP REST request
+ * @param[in]  jsonRequestBody    REST request body. If NULL, no body is sent
+ * @param[out] jsonResponseParser Return location for a REST response or NULL to skip response
+ *                                parsing
+ * @param[out] error              Error
+ * @return TRUE if request and response parser (if given) suceeded, FALSE otherwise (error set).
+ */
+static gboolean rest_request(enum HTTPMethod method, const gchar *url,
+                             JsonBuilder *jsonRequestBody, JsonParser **jsonResponseParser,
+                             GError **error)
+{
+        return rest_request_full(method, url, jsonRequestBody, NULL, NULL, jsonResponseParser,
+                                 error);
+}
+
+/**
+ * @brief Get the time to wait requested by the Retry-After header of a 429 (Too Many Requests) or
+ *        503 (Service Unavailable) response. Limited to config's retry_backoff_max, or retry_wait
+ *        if unset. Requires libcurl 7.66.0 or newer.
+ *
+ * @param[in] curl Curl handle of the finished request
+ * @return time to wait [ms], 0 if none was requested
+ */
+static gint64 get_retry_after(CURL *curl)
+{
+        curl_off_t retry_after = 0;
+        glong http_code = 0;
+        gint64 max;
+
+        g_return_val_if_fail(curl, 0);
+
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code != 429 && http_code != 503)
+                return 0;
+
+#if LIBCURL_VERSION_NUM >= 0x074200
+        curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+#endif
+
+        max = hawkbit_config->retry_backoff_max > 0 ? hawkbit_config->retry_backoff_max
+                                                     : hawkbit_config->retry_wait;
+
+        return (gint64) MIN(retry_after, (curl_off_t) max) * 1000;
+}
+
+/**
+ * @brief Check whether error is a transient API error worth retrying the request for: HTTP 409
+ *        (Conflict), 429 (Too Many Requests) or 503 (Service Unavailable).
+ *
+ * @param[in] error Error or NULL
+ * @return TRUE if the request should be retried, FALSE otherwise
+ */
+static gboolean is_retriable_api_error(const GError *error)
+{
+        return g_error_matches(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 409) ||
+               g_error_matches(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 429) ||
+               g_error_matches(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 503);
+}
+
+/**
+ * @brief Perform REST request with JSON data, expecting response JSON data. On HTTP error
+ * 409 (Conflict), 429 (Too Many Requests) and 503 (Service Unavailable), try again (up to
+ * MAX_RETRIES_ON_API_ERROR), backing off as described for get_backoff_time() and honoring
+ * Retry-After.
+ *
+ * @param[in]  method             HTTP Method, e.g. GET
+ * @param[in]  url                URL used in HTTP REST request
+ * @param[in]  jsonRequestBody    REST request body. If NULL, no body is sent
+ * @param[out] jsonResponseParser Return location for a REST response or NULL to skip response
+ *                                parsing
+ * @param[out] error              Error
+ * @return TRUE if request and response parser (if given) suceeded, FALSE otherwise (error set).
+ */
+static gboolean rest_request_retriable(enum HTTPMethod method, const gchar *url,
+                                       JsonBuilder *jsonRequestBody,
+                                       JsonParser **jsonResponseParser, GError **error)
+{
+        gboolean res, retry;
+        gint retry_count = 0;
+        GError *ierror = NULL;
+
+        g_return_val_if_fail(url, FALSE);
+        g_return_val_if_fail(jsonResponseParser == NULL || *jsonResponseParser == NULL, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        while (1) {
+                gint64 wait;
+
+                res = rest_request(method, url, jsonRequestBody, jsonResponseParser, &ierror);
+                retry = is_retriable_api_error(ierror) && retry_count < MAX_RETRIES_ON_API_ERROR;
+                if (!retry)
+                        break;
+
+                // the request was performed with the calling thread's handle
+                wait = MAX(get_backoff_time(API_RETRY_WAIT_MS, retry_count),
+                           get_retry_after(g_private_get(&curl_handle)));
+                log_debug("%s Trying again in %.1fs (%d/%d)..", ierror->message,
+                        (gdouble) wait / 1000, retry_count+1, MAX_RETRIES_ON_API_ERROR);
+                g_clear_error(&ierror);
+                metrics_record_retry(METRICS_TRANSFER_API);
+                g_usleep(wait * 1000);
+                retry_count++;
+        }
+
+        if (!res)
+                g_propagate_error(error, ierror);
+
+        return res;
+}
+
+/**
+ * @brief Function called once a REST request started with rest_request_async() finished.
+ *
+ * @param[in] response  Parsed JSON response, owned by the request (reference it to keep it), or
+ *                      NULL if the response was empty, unchanged or the request failed
+ * @param[in] unchanged   Whether the response is unchanged according to the request's validator
+ * @param[in] error       Error if the request failed, NULL otherwise
+ * @param[in] retry_after Time to wait before retrying requested by the server [ms], see
+ *                        get_retry_after(), 0 if none
+ * @param[in] user_data   User data passed to rest_request_async()
+ */
+typedef void (*RestResponseFunc)(JsonParser *response, gboolean unchanged, const GError *error,
+                                 gint64 retry_after, gpointer user_data);
+
+/**
+ * @brief struct containing a REST request run by a curl source.
+ */
+typedef struct RestRequest_ {
+        CURL *curl;                       /**< Curl handle of the request */
+        struct curl_slist *headers;       /**< request headers */
+        RestPayload *response;            /**< response body */
+        RestValidator *validator;         /**< validator of the previous response or NULL */
+        gchar *postdata;                  /**< request body or NULL */
+        gchar *etag;                      /**< ETag of the response or NULL */
+        RestResponseFunc done;            /**< called once the request finished */
+        gpointer user_data;               /**< passed to done */
+} RestRequest;
+
+static void rest_request_free(RestRequest *request)
+{
+        if (!request)
+                return;
+
+        if (request->curl)
+                curl_easy_cleanup(request->curl);
+        curl_slist_free_all(request->headers);
+        rest_payload_release(request->response);
+        g_free(request->postdata);
+        g_free(request->etag);
+        g_free(request);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RestRequest, rest_request_free)
+
+/**
+ * @brief CurlTransferFunc of requests started with rest_request_async(), evaluates the response
+ *        and passes it on to the request's done callback.
+ */
+static void rest_request_done_cb(CURL *curl, CURLcode res, gpointer user_data)
+{
+        g_autoptr(RestRequest) request = user_data;
+        g_autoptr(JsonParser) parser = NULL;
+        g_autoptr(GError) error = NULL;
+        gboolean unchanged = FALSE;
+
+        rest_response_process(curl, res, request->response, request->validator, &request->etag,
+                              &unchanged, &parser, &error);
+
+        request->done(parser, unchanged, error, error ? get_retry_after(curl) : 0,
+                      request->user_data);
+}
+
+/**
+ * @brief Start conditional REST request with JSON data on curl_source, expecting response JSON
+ *        data, see rest_request_full(). The main loop is not blocked while the request is in
+ *        flight, done is called with the result once it finished.
+ *
+ * @param[in]  curl_source     GSource created with curl_source_new() running the request
+ * @param[in]  method          HTTP Method, e.g. GET
+ * @param[in]  url             URL used in HTTP REST request
+ * @param[in]  jsonRequestBody REST request body. If NULL, no body is sent
+ * @param[in]  validator       RestValidator of the previous response, updated with the current
+ *                             response's validators, or NULL. Must stay valid until done is
+ *                             called.
+ * @param[in]  done            Function called once the request finished
+ * @param[in]  user_data       User data passed to done
+ * @param[out] error           Error
+ * @return TRUE if the request was started, FALSE otherwise (error set, done is not called)
+ */
+static gboolean rest_request_async(GSource *curl_source, enum HTTPMethod method, const gchar *url,
+                                   JsonBuilder *jsonRequestBody, RestValidator *validator,
+                                   RestResponseFunc done, gpointer user_data, GError **error)
+{
+        g_autoptr(RestRequest) request = g_new0(RestRequest, 1);
+        CURLMcode mres;
+
+        g_return_val_if_fail(curl_source, FALSE);
+        g_return_val_if_fail(url, FALSE);
+        g_return_val_if_fail(done, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        request->validator = validator;
+        request->done = done;
+        request->user_data = user_data;
+        request->response = rest_payload_acquire();
+        request->curl = curl_easy_init();
+        if (!request->curl) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Unable to start libcurl easy session");
+                return FALSE;
+        }
+
+        if (!rest_request_setup(request->curl, method, url, jsonRequestBody, validator,
+                                request->response, &request->postdata, &request->etag,
+                                &request->headers, error))
+                return FALSE;
+
+        mres = curl_source_add(curl_source, request->curl, rest_request_done_cb, request,
+                               (GDestroyNotify) rest_request_free);
+        if (mres != CURLM_OK) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Failed to start request: %s", curl_multi_strerror(mres));
+                return FALSE;
+        }
+
+        // owned by the curl source now, freed once the request finished
+        request = NULL;
+
+        return TRUE;
+}
+
+/**
+ * @brief Build hawkBit JSON request.
+ *
+ * @see https://www.eclipse.org/hawkbit/rest-api/rootcontroller-api-guide/#_post_tenant_controller_v1_controllerid_deploymentbase_actionid_feedback
+ *
+ * @param[in] id         hawkBit action ID or NULL (configData usecase)
+ * @param[in] detail     Detail message or NULL (configData usecase)
+ * @param[in] finished   hawkBit status of the result
+ * @param[in] execution  hawkBit status of the action execution
+ * @param[in] attributes hawkBit controller attributes or NULL (feedback usecase)
+ * @return JsonBuilder* with built hawkBit request
+ */
+static JsonBuilder* json_build_status(const gchar *id, const gchar *detail, const gchar *finished,
+                                      const gchar *execution, GHashTable *attributes)
+{
+        GHashTableIter iter;
+        gpointer key, value;
+        g_autoptr(JsonBuilder) builder = NULL;
+        time_t current_time;
+        struct tm time_info;
+        char timeString[16];
+
+        g_return_val_if_fail(finished, NULL);
+        g_return_val_if_fail(execution, NULL);
+
+        // get current time in UTC
+        time(&current_time);
+        gmtime_r(&current_time, &time_info);
+        strftime(timeString, sizeof(timeString), "%Y%m%dT%H%M%S", &time_info);
+
+        builder = json_builder_new();
+
+        // build json status
+        json_builder_begin_object(builder);
+
+        if (id) {
+                json_builder_set_member_name(builder, "id");
+                json_builder_add_string_value(builder, id);
+        }
+
+        json_builder_set_member_name(builder, "time");
+        json_builder_add_string_value(builder, timeString);
+
+        json_builder_set_member_name(builder, "status");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "result");
+        json_builder_begin_object(builder);
+
+        json_builder_set_member_name(builder, "finished");
+        json_builder_add_string_value(builder, finished);
+        json_builder_end_object(builder);
+
+        json_builder_set_member_name(builder, "execution");
+        json_builder_add_string_value(builder, execution);
+
+        if (detail) {
+                json_builder_set_member_name(builder, "details");
+                json_builder_begin_array(builder);
+                json_builder_add_string_value(builder, detail);
+                json_builder_end_array(builder);
+        }
+        json_builder_end_object(builder);
+
+        if (attributes) {
+                json_builder_set_member_name(builder, "data");
+                json_builder_begin_object(builder);
+                g_hash_table_iter_init(&iter, attributes);
+                while (g_hash_table_iter_next(&iter, &key, &value)) {
+                        json_builder_set_member_name(builder, key);
+                        json_builder_add_string_value(builder, value);
+                }
+                json_builder_end_object(builder);
+        }
+        json_builder_end_object(builder);
+
+        return g_steal_pointer(&builder);
+}
+
+/**
+ * @brief Send a queued feedback message to hawkBit.
+ *
+ * @param[in]  message FeedbackMessage to send
+ * @param[out] error   Error
+ * @return TRUE if feedback was sent successfully, FALSE otherwise (error set)
+ */
+static gboolean feedback_send(FeedbackMessage *message, GError **error)
+{
+        g_autoptr(JsonBuilder) builder = NULL;
+        gboolean res = FALSE;
+
+        g_return_val_if_fail(message, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        builder = json_build_status(message->id, message->detail, message->finished,
+                                    message->execution, NULL);
+
+        res = rest_request_retriable(POST, message->url, builder, NULL, error);
+        if (!res)
+                g_prefix_error(error, "Failed to report \"%s\" feedback: ", message->detail);
+
+        return res;
+}
+
+/**
+ * @brief Check whether sending final feedback failed in a way worth retrying, i.e. not because
+ *        hawkBit rejected it for good (HTTP 4xx other than those is_retriable_api_error() names).
+ *
+ * @param[in] error Error of feedback_send()
+ * @return TRUE if the feedback should be sent again, FALSE otherwise
+ */
+static gboolean is_retriable_feedback_error(const GError *error)
+{
+        if (!error || error->domain != RHU_HAWKBIT_CLIENT_HTTP_ERROR)
+                return TRUE;
+
+        return error->code >= 500 || is_retriable_api_error(error);
+}
+
+/**
+ * @brief Append a final feedback message to config's feedback_state_file, to be sent again by
+ *        feedback_load() on the next start. Must be called with feedback_mutex held.
+ *
+ * @param[in] message FeedbackMessage to persist
+ */
+static void feedback_persist(const FeedbackMessage *message)
+{
+        g_autoptr(GKeyFile) state = g_key_file_new();
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *group = NULL;
+        const gchar *file = hawkbit_config->feedback_state_file;
+        gsize length = 0;
+
+        g_return_if_fail(message);
+
+        if (!file)
+                return;
+
+        // keep messages persisted before, they are sent in order
+        if (!g_key_file_load_from_file(state, file, G_KEY_FILE_NONE, &error) &&
+            !g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                log_debug("Overwriting %s: %s", file, error->message);
+        g_clear_error(&error);
+
+        g_strfreev(g_key_file_get_groups(state, &length));
+        group = g_strdup_printf("feedback-%" G_GSIZE_FORMAT, length);
+        g_key_file_set_string(state, group, "url", message->url);
+        g_key_file_set_string(state, group, "id", message->id);
+        g_key_file_set_string(state, group, "detail", message->detail);
+        g_key_file_set_string(state, group, "finished", message->finished);
+        g_key_file_set_string(state, group, "execution", message->execution);
+
+        if (!g_key_file_save_to_file(state, file, &error)) {
+                g_warning("Failed to persist feedback \"%s\": %s", message->detail,
+                          error->message);
+                return;
+        }
+
+        g_message("Feedback \"%s\" will be sent again on the next start", message->detail);
+}
+
+/**
+ * @brief Queue final feedback persisted by feedback_persist() before the previous exit or reboot
+ *        and remove config's feedback_state_file. Must be called before the feedback thread
+ *        starts.
+ */
+static void feedback_load(void)
+{
+        g_autoptr(GKeyFile) state = g_key_file_new();
+        g_autoptr(GError) error = NULL;
+        g_auto(GStrv) groups = NULL;
+        const gchar *file = hawkbit_config->feedback_state_file;
+
+        if (!file)
+                return;
+
+        if (!g_key_file_load_from_file(state, file, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning("Ignoring persisted feedback: %s", error->message);
+                return;
+        }
+
+        groups = g_key_file_get_groups(state, NULL);
+        for (gchar **group = groups; *group; group++) {
+                g_autoptr(FeedbackMessage) message = g_new0(FeedbackMessage, 1);
+
+                message->url = g_key_file_get_string(state, *group, "url", NULL);
+                message->id = g_key_file_get_string(state, *group, "id", NULL);
+                message->detail = g_key_file_get_string(state, *group, "detail", NULL);
+                message->finished = g_key_file_get_string(state, *group, "finished", NULL);
+                message->execution = g_key_file_get_string(state, *group, "execution", NULL);
+                if (!message->url || !message->id || !message->detail || !message->finished ||
+                    !message->execution) {
+                        log_debug("Ignoring incomplete persisted feedback %s", *group);
+                        continue;
+                }
+
+                g_message("Sending feedback \"%s\" persisted before restart", message->detail);
+                g_queue_push_tail(&feedback_queue, g_steal_pointer(&message));
+        }
+
+        if (g_unlink(file))
+                g_warning("Failed to remove %s: %s", file, g_strerror(errno));
+}
+
+/**
+ * @brief Thread sending queued feedback messages to hawkBit in order, until feedback_stop() is
+ *        called and the queue is drained. Progress messages failing to be sent are dropped, final
+ *        messages stay at the head of the queue and are sent again, backing off as described for
+ *        get_backoff_time(), until hawkBit acknowledges them. Once stopping, each message is
+ *        tried once more, final messages still failing are persisted via feedback_persist().
+ *
+ * @param[in] data unused
+ * @return NULL is always returned
+ */
+static gpointer feedback_thread(gpointer data)
+{
+        guint failures = 0;
+
+        g_mutex_lock(&feedback_mutex);
+        while (TRUE) {
+                g_autoptr(FeedbackMessage) message = NULL;
+                g_autoptr(GError) error = NULL;
+                gboolean retriable;
+                gint64 wait, end_time;
+
+                while (g_queue_is_empty(&feedback_queue) && !feedback_stopping)
+                        g_cond_wait(&feedback_cond, &feedback_mutex);
+
+                message = g_queue_pop_head(&feedback_queue);
+                if (!message)
+                        break;
+
+                feedback_current = message;
+                g_mutex_unlock(&feedback_mutex);
+
+                if (feedback_send(message, &error))
+                        failures = 0;
+
+                g_mutex_lock(&feedback_mutex);
+                feedback_current = NULL;
+                g_cond_broadcast(&feedback_cond);
+
+                if (!error)
+                        continue;
+
+                retriable = g_strcmp0(message->execution, "proceeding") &&
+                            is_retriable_feedback_error(error);
+                if (!retriable || feedback_stopping) {
+                        g_warning("%s%s", message->coalesce ? "Progress feedback: " : "",
+                                  error->message);
+                        if (retriable)
+                                feedback_persist(message);
+                        continue;
+                }
+
+                // keep the final result first in line, hawkBit must not miss it
+                wait = get_backoff_time(FEEDBACK_RETRY_WAIT_MS, failures++);
+                g_warning("%s Trying again in %.1fs..", error->message, (gdouble) wait / 1000);
+                g_queue_push_head(&feedback_queue, g_steal_pointer(&message));
+
+                end_time = g_get_monotonic_time() + wait * G_TIME_SPAN_MILLISECOND;
+                while (!feedback_stopping &&
+                       g_cond_wait_until(&feedback_cond, &feedback_mutex, end_time))
+                        ;
+        }
+        g_mutex_unlock(&feedback_mutex);
+
+        return NULL;
+}
+
+/**
+ * @brief Start the feedback thread, sending feedback persisted before restart first.
+ */
+static void feedback_start(void)
+{
+        g_return_if_fail(!thread_feedback);
+
+        feedback_load();
+        feedback_stopping = FALSE;
+        thread_feedback = g_thread_new("feedback", feedback_thread, NULL);
+}
+
+/**
+ * @brief Block until all queued feedback messages were sent, or failed to be sent for good (see
+ *        feedback_thread()), or end_time passed.
+ *
+ * @param[in] end_time Monotonic time to wait until at most
+ * @return TRUE if no feedback is pending anymore, FALSE if end_time passed before
+ */
+static gboolean feedback_flush(gint64 end_time)
+{
+        gboolean flushed = TRUE;
+
+        g_mutex_lock(&feedback_mutex);
+        while (flushed && (!g_queue_is_empty(&feedback_queue) || feedback_current))
+                flushed = g_cond_wait_until(&feedback_cond, &feedback_mutex, end_time);
+        flushed = g_queue_is_empty(&feedback_queue) && !feedback_current;
+        g_mutex_unlock(&feedback_mutex);
+
+        return flushed;
+}
+
+/**
+ * @brief Persist all final feedback messages still queued or being sent via feedback_persist().
+ *        They stay queued, the feedback thread keeps trying to send them meanwhile.
+ */
+static void feedback_persist_pending(void)
+{
+        g_mutex_lock(&feedback_mutex);
+        if (feedback_current && g_strcmp0(feedback_current->execution, "proceeding"))
+                feedback_persist(feedback_current);
+        for (GList *l = feedback_queue.head; l; l = l->next) {
+                FeedbackMessage *pending = l->data;
+
+                if (g_strcmp0(pending->execution, "proceeding"))
+                        feedback_persist(pending);
+        }
+        g_mutex_unlock(&feedback_mutex);
+}
+
+/**
+ * @brief Check whether final feedback (e.g. an installation result) is queued or being sent,
+ *        without blocking. Pending progress feedback is not taken into account.
+ *
+ * @return TRUE if final feedback is pending, FALSE otherwise
+ */
+static gboolean feedback_final_pending(void)
+{
+        gboolean pending = FALSE;
+
+        g_mutex_lock(&feedback_mutex);
+        if (feedback_current && g_strcmp0(feedback_current->execution, "proceeding"))
+                pending = TRUE;
+        for (GList *l = feedback_queue.head; l && !pending; l = l->next) {
+                FeedbackMessage *message = l->data;
+
+                pending = g_strcmp0(message->execution, "proceeding") != 0;
+        }
+        g_mutex_unlock(&feedback_mutex);
+
+        return pending;
+}
+
+/**
+ * @brief Send all queued feedback messages and stop the feedback thread.
+ */
+static void feedback_stop(void)
+{
+        if (!thread_feedback)
+                return;
+
+        g_mutex_lock(&feedback_mutex);
+        feedback_stopping = TRUE;
+        g_cond_broadcast(&feedback_cond);
+        g_mutex_unlock(&feedback_mutex);
+
+        g_thread_join(thread_feedback);
+        thread_feedback = NULL;
+}
+
+/**
+ * @brief Queue feedback for sending to hawkBit by the feedback thread, so slow hawkBit responses
+ *        never block downloads or installations.
+ *        Messages are sent in order. A coalescable message replaces a coalescable message for the
+ *        same URL still waiting at the end of the queue. If the queue is full, the oldest pending
+ *        progress message is dropped, final results are never dropped.
+ *
+ * @param[in] url       hawkBit URL used for request
+ * @param[in] id        hawkBit action ID
+ * @param[in] detail    Detail message
+ * @param[in] finished  hawkBit status of the result
+ * @param[in] execution hawkBit status of the action execution
+ * @param[in] coalesce  whether message may be superseded by a subsequent coalescable message
+ */
+static void feedback_queue_push(const gchar *url, const gchar *id, const gchar *detail,
+                                const gchar *finished, const gchar *execution,
+                                gboolean coalesce)
+{
+        FeedbackMessage *message = NULL, *tail = NULL;
+
+        message = g_new0(FeedbackMessage, 1);
+        message->url = g_strdup(url);
+        message->id = g_strdup(id);
+        message->detail = g_strdup(detail);
+        message->finished = g_strdup(finished);
+        message->execution = g_strdup(execution);
+        message->coalesce = coalesce;
+
+        g_mutex_lock(&feedback_mutex);
+
+        tail = g_queue_peek_tail(&feedback_queue);
+        if (coalesce && tail && tail->coalesce && !g_strcmp0(tail->url, url)) {
+                log_debug("Superseding pending feedback \"%s\"", tail->detail);
+                feedback_message_free(g_queue_pop_tail(&feedback_queue));
+        } else if (g_queue_get_length(&feedback_queue) >= FEEDBACK_QUEUE_MAX_LENGTH) {
+                for (GList *l = feedback_queue.head; l; l = l->next) {
+                        FeedbackMessage *pending = l->data;
+
+                        if (g_strcmp0(pending->execution, "proceeding"))
+                                continue;
+
+                        log_debug("Feedback queue full, dropping \"%s\"", pending->detail);
+                        g_queue_delete_link(&feedback_queue, l);
+                        feedback_message_free(pending);
+                        break;
+                }
+        }
+
+        g_queue_push_tail(&feedback_queue, message);
+        g_cond_broadcast(&feedback_cond);
+        g_mutex_unlock(&feedback_mutex);
+}
+
+/**
+ * @brief Send feedback to hawkBit asynchronously.
+ *
+ * @param[in] url       hawkBit URL used for request
+ * @param[in] id        hawkBit action ID
+ * @param[in] detail    Detail message
+ * @param[in] finished  hawkBit status of the result
+ * @param[in] execution hawkBit status of the action execution
+ */
+static void feedback(const gchar *url, const gchar *id, const gchar *detail,
+                     const gchar *finished, const gchar *execution)
+{
+        g_return_if_fail(url);
+        g_return_if_fail(id);
+        g_return_if_fail(detail);
+        g_return_if_fail(finished);
+        g_return_if_fail(execution);
+
+        if (!g_strcmp0(finished, "failure"))
+                g_warning("%s", detail);
+        else
+                g_message("%s", detail);
+
+        feedback_queue_push(url, id, detail, finished, execution, FALSE);
+}
+
+/**
+ * @brief Send progress feedback to hawkBit asynchronously (finished=none, execution=proceeding).
+ *
+ * @param[in] url      hawkBit URL used for request
+ * @param[in] id       hawkBit action ID
+ * @param[in] detail   Detail message
+ * @param[in] coalesce whether message may be superseded by subsequent coalescable progress
+ */
+static void feedback_progress(const gchar *url, const gchar *id, const gchar *detail,
+                              gboolean coalesce)
+{
+        g_return_if_fail(url);
+        g_return_if_fail(id);
+        g_return_if_fail(detail);
+
+        g_message("%s", detail);
+
+        feedback_queue_push(url, id, detail, "none", "proceeding", coalesce);
+}
+
+/**
+ * @brief Add random jitter of up to config's poll_jitter seconds to given time, spreading polls
+ *        of many targets.
+ *
+ * @param[in] seconds Time in seconds
+ * @return seconds plus jitter
+ */
+static long get_jittered_time(long seconds)
+{
+        if (hawkbit_config->poll_jitter <= 0)
+                return seconds;
+
+        return seconds + g_random_int_range(0, hawkbit_config->poll_jitter + 1);
+}
+
+/**
+ * @brief Get the time until the next poll after attempt polls failed in a row: config's
+ *        retry_wait, backed off as described for get_backoff_time(), at least the time requested
+ *        by the server, plus jitter.
+ *
+ * @param[in] attempt     Number of polls failed in a row before the current one
+ * @param[in] retry_after Time to wait requested by the server [ms], see get_retry_after()
+ * @return time until the next poll in seconds
+ */
+static long get_retry_time(guint attempt, gint64 retry_after)
+{
+        gint64 wait = get_backoff_time((gint64) hawkbit_config->retry_wait * 1000, attempt);
+
+        return get_jittered_time((long) (MAX(wait, retry_after) / 1000));
+}
+
+/**
+ * @brief Get polling sleep time requested by hawkBit JSON response.
+ *
+ * @param[in] root JsonNode* with hawkBit response
+ * @return time to sleep in seconds, either from JSON or (if not found) from config's retry_wait,
+ *         plus jitter
+ */
+static long json_get_polling_sleeptime(JsonNode *root)
+{
+        g_autofree gchar *sleeptime_str = NULL;
+        g_autoptr(GError) error = NULL;
+        struct tm time;
+
+        g_return_val_if_fail(root, 0L);
+
+        sleeptime_str = json_get_string(root, "$.config.polling.sleep", &error);
+        if (!sleeptime_str) {
+                g_warning("Polling sleep time not found: %s. Using fallback: %ds",
+                          error->message, hawkbit_config->retry_wait);
+                return get_jittered_time(hawkbit_config->retry_wait);
+        }
+
+        strptime(sleeptime_str, "%T", &time);
+        return get_jittered_time(time.tm_sec + (time.tm_min * 60) + (time.tm_hour * 60 * 60));
+}
+
+/**
+ * @brief Get polling sleep time from hawkBit JSON response.
+ *
+ * @param[in] root JsonNode* with hawkBit response
+ * @return time to sleep in seconds, either from JSON or (if not found) from config's retry_wait
+ *         plus jitter (or 5s during active action)
+ */
+static long json_get_sleeptime(JsonNode *root)
+{
+        g_return_val_if_fail(root, 0L);
+
+        /* When processing an action, return fixed sleeptime of 5s to allow
+         * receiving cancelation requests etc.*/
+        g_mutex_lock(&active_action->mutex);
+        if (active_action->state == ACTION_STATE_PROCESSING ||
+            active_action->state == ACTION_STATE_DOWNLOADING ||
+            active_action->state == ACTION_STATE_CANCEL_REQUESTED) {
+                g_mutex_unlock(&active_action->mutex);
+                return 5L;
+        }
+        g_mutex_unlock(&active_action->mutex);
+
+        return json_get_polling_sleeptime(root);
+}
+
+/**
+ * @brief Build API URL of given controller
+ *
+ * @param controller_id[in] hawkBit controller id
+ * @param path[in] a printf()-like format string describing the API path or NULL for base path
+ * @param args[in] The arguments to be inserted in path
+ *
+ * @return a newly allocated full API URL
+ */
+__attribute__((__format__(__printf__, 2, 0)))
+static gchar* build_controller_api_urlv(const gchar *controller_id, const gchar *path,
+                                        va_list args)
+{
+        g_autofree gchar *buffer = NULL;
+
+        if (path)
+                buffer = g_strdup_vprintf(path, args);
+
+        return g_strconcat(api_base_url, controller_id, buffer ? "/" : "", buffer ? buffer : "",
+                           NULL);
+}
+
+/**
+ * @brief Build API URL
+ *
+ * @param path[in] a printf()-like format string describing the API path or NULL for base path
+ * @param ... The arguments to be inserted in path
+ *
+ * @return a newly allocated full API URL
+ */
+__attribute__((__format__(__printf__, 1, 2)))
+static gchar* build_api_url(const gchar *path, ...)
+{
+        gchar *url = NULL;
+        va_list args;
+
+        va_start(args, path);
+        url = build_controller_api_urlv(hawkbit_config->controller_id, path, args);
+        va_end(args);
+
+        return url;
+}
+
+/**
+ * @brief Build API URL of given controller
+ *
+ * @param controller_id[in] hawkBit controller id
+ * @param path[in] a printf()-like format string describing the API path or NULL for base path
+ * @param ... The arguments to be inserted in path
+ *
+ * @return a newly allocated full API URL
+ */
+__attribute__((__format__(__printf__, 2, 3)))
+static gchar* build_controller_api_url(const gchar *controller_id, const gchar *path, ...)
+{
+        gchar *url = NULL;
+        va_list args;
+
+        va_start(args, path);
+        url = build_controller_api_urlv(controller_id, path, args);
+        va_end(args);
+
+        return url;
+}
+
+gboolean hawkbit_progress(const gchar *msg)
+{
+        g_autofree gchar *feedback_url = NULL;
+
+        g_return_val_if_fail(msg, FALSE);
+
+        g_mutex_lock(&active_action->mutex);
+
+        feedback_url = build_api_url("deploymentBase/%s/feedback", active_action->id);
+
+        // RAUC progress may arrive faster than hawkBit accepts it, only the latest one matters
+        feedback_progress(feedback_url, active_action->id, msg, TRUE);
+
+        g_mutex_unlock(&active_action->mutex);
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Start providing meta information that will allow the hawkBit to identify the device on
+ * a hardware level.
+ *
+ * @see https://www.eclipse.org/hawkbit/rest-api/rootcontroller-api-guide/#_put_tenant_controller_v1_controllerid_configdata
+ *
+ * @param[in]  curl_source GSource created with curl_source_new() running the request
+ * @param[in]  done        Function called once the request finished
+ * @param[in]  user_data   User data passed to done
+ * @param[out] error       Error
+ * @return TRUE if the request was started, FALSE otherwise (error set)
+ */
+static gboolean identify(GSource *curl_source, RestResponseFunc done, gpointer user_data,
+                         GError **error)
+{
+        g_autofree gchar *put_config_data_url = NULL;
+        g_autoptr(JsonBuilder) builder = NULL;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        log_debug("Providing meta information to hawkbit server");
+        put_config_data_url = build_api_url("configData");
+
+        builder = json_build_status(NULL, NULL, "success", "closed", hawkbit_config->device);
+
+        return rest_request_async(curl_source, PUT, put_config_data_url, builder, NULL, done,
+                                  user_data, error);
+}
+
+/**
+ * @brief Deletes RAUC bundle at config's bundle_download_location and its resume sidecar.
+ */
+static void process_deployment_cleanup()
+{
+        g_autofree gchar *resume_file = get_resume_file();
+
+        if (g_file_test(resume_file, G_FILE_TEST_IS_REGULAR) && g_remove(resume_file))
+                g_warning("Failed to delete file: %s", resume_file);
+
+        peer_server_withdraw();
+
+        if (!g_file_test(hawkbit_config->bundle_download_location, G_FILE_TEST_IS_REGULAR))
+                return;
+
+        if (g_remove(hawkbit_config->bundle_download_location))
+                g_warning("Failed to delete file: %s", hawkbit_config->bundle_download_location);
+}
+
+/**
+ * @brief Account for the active action being finished, successfully or not. Must be called with
+ *        active_action->mutex held.
+ */
+static void action_record_finished(void)
+{
+        metrics_record_phase(METRICS_PHASE_DEPLOYMENT,
+                             g_get_monotonic_time() - active_action->start_time);
+}
+
+/**
+ * @brief Thread rebooting the system once hawkBit knows about the installation result, or once
+ *        config's reboot_feedback_timeout passed, without blocking the main loop meanwhile.
+ *        Final feedback not sent by then is persisted via feedback_persist_pending().
+ *
+ * @param[in] data unused
+ * @return NULL is returned if rebooting failed
+ */
+static gpointer reboot_thread(gpointer data)
+{
+        gint64 end_time = g_get_monotonic_time() +
+                          hawkbit_config->reboot_feedback_timeout * G_TIME_SPAN_SECOND;
+
+        if (!feedback_flush(end_time)) {
+                g_warning("hawkBit did not acknowledge the installation result within %ds, "
+                          "rebooting anyway", hawkbit_config->reboot_feedback_timeout);
+                feedback_persist_pending();
+        }
+
+        // write out queued log messages, they would be lost otherwise
+        shutdown_logging();
+        sync();
+        if (reboot(RB_AUTOBOOT) < 0)
+                g_critical("Failed to reboot: %s", g_strerror(errno));
+
+        g_atomic_int_set(&reboot_pending, FALSE);
+        return NULL;
+}
+
+gboolean install_complete_cb(gpointer ptr)
+{
+        struct on_install_complete_userdata *result = ptr;
+        g_autofree gchar *feedback_url = NULL;
+
+        g_return_val_if_fail(ptr, FALSE);
+
+        g_mutex_lock(&active_action->mutex);
+
+        metrics_record_phase(METRICS_PHASE_INSTALL,
+                             g_get_monotonic_time() - active_action->install_start_time);
+
+        feedback_url = build_api_url("deploymentBase/%s/feedback", active_action->id);
+
+        // download thread falls back to the next artifact, action is not finished yet
+        if (!result->install_success && active_action->install_fallback) {
+                feedback_progress(feedback_url, active_action->id,
+                                  "Failed to install software bundle, falling back to next artifact.",
+                                  FALSE);
+                g_mutex_unlock(&active_action->mutex);
+                return G_SOURCE_REMOVE;
+        }
+
+        action_set_state(result->install_success ? ACTION_STATE_SUCCESS : ACTION_STATE_ERROR);
+        feedback(feedback_url, active_action->id,
+                 result->install_success ? "Software bundle installed successfully."
+                 : "Failed to install software bundle.",
+                 result->install_success ? "success" : "failure",
+                 "closed");
+        action_record_finished();
+
+        process_deployment_cleanup();
+        g_mutex_unlock(&active_action->mutex);
+
+        if (result->install_success && hawkbit_config->post_update_reboot &&
+            !thread_reboot) {
+                g_atomic_int_set(&reboot_pending, TRUE);
+                thread_reboot = g_thread_new("reboot", reboot_thread, NULL);
+        }
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Check whether cancelation of the active action was requested.
+ *
+ * @param[out] error Error, set to RHU_HAWKBIT_CLIENT_ERROR_CANCELATION if cancelation was
+ *                   requested
+ * @return TRUE if cancelation was requested (error set), FALSE otherwise
+ */
+static gboolean check_cancel_requested(GError **error)
+{
+        gboolean cancel;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        g_mutex_lock(&active_action->mutex);
+        cancel = active_action->state == ACTION_STATE_CANCEL_REQUESTED;
+        g_mutex_unlock(&active_action->mutex);
+
+        if (cancel)
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_CANCELATION,
+                            "Download canceled");
+
+        return cancel;
+}
+
+/**
+ * @brief Wait until downloading is allowed according to config's download_windows.
+ *
+ * @param[out] error Error, set to RHU_HAWKBIT_CLIENT_ERROR_CANCELATION if cancelation was
+ *                   requested meanwhile
+ * @return TRUE if downloading is allowed, FALSE if canceled (error set)
+ */
+static gboolean wait_for_download_window(GError **error)
+{
+        curl_off_t rate;
+        gboolean paused = FALSE;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        while (!get_download_rate(&rate)) {
+                if (!paused) {
+                        g_message("Outside of download windows, pausing download.");
+                        paused = TRUE;
+                }
+
+                if (check_cancel_requested(error))
+                        return FALSE;
+
+                g_usleep(G_USEC_PER_SEC);
+        }
+
+        if (paused)
+                g_message("Inside download window, continuing download.");
+
+        return TRUE;
+}
+
+/**
+ * @brief Wait the given time before retrying a download, staying responsive to cancelation.
+ *
+ * @param[in]  wait  Time to wait [ms]
+ * @param[out] error Error, set to RHU_HAWKBIT_CLIENT_ERROR_CANCELATION if cancelation was
+ *                   requested meanwhile
+ * @return TRUE once waited, FALSE if canceled (error set)
+ */
+static gboolean wait_for_retry(gint64 wait, GError **error)
+{
+        gint64 end = g_get_monotonic_time() + wait * 1000;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        while (!check_cancel_requested(error)) {
+                gint64 now = g_get_monotonic_time();
+
+                if (now >= end)
+                        return TRUE;
+
+                g_usleep(MIN(end - now, G_USEC_PER_SEC));
+        }
+
+        return FALSE;
+}
+
+/**
+ * @brief Load the resume sidecar left behind by an interrupted download.
+ *
+ * @return GKeyFile* with the sidecar's contents or NULL if there is none (or it is unreadable)
+ */
+static GKeyFile* load_resume_file(void)
+{
+        g_autoptr(GKeyFile) resume_info = g_key_file_new();
+        g_autofree gchar *resume_file = get_resume_file();
+        g_autoptr(GError) error = NULL;
+
+        if (!g_key_file_load_from_file(resume_info, resume_file, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        log_debug("Ignoring resume sidecar: %s", error->message);
+                return NULL;
+        }
+
+        return g_steal_pointer(&resume_info);
+}
+
+/**
+ * @brief Check whether the resume sidecar left behind by an interrupted download belongs to
+ *        action_id, i.e. the partial download should be kept.
+ *
+ * @param[in] action_id hawkBit action id
+ * @return TRUE if the sidecar belongs to action_id, FALSE otherwise or if resuming is disabled
+ */
+static gboolean resume_file_matches_action(const gchar *action_id)
+{
+        g_autoptr(GKeyFile) resume_info = NULL;
+        g_autofree gchar *stored_id = NULL;
+
+        if (!hawkbit_config->resume_downloads || !action_id)
+                return FALSE;
+
+        resume_info = load_resume_file();
+        if (!resume_info)
+                return FALSE;
+
+        stored_id = g_key_file_get_string(resume_info, "resume", "action_id", NULL);
+        return !g_strcmp0(stored_id, action_id);
+}
+
+/**
+ * @brief Set up persisting resume information for the download of artifact in
+ *        state->resume_info. A partial download left behind by a previous run (e.g. before a
+ *        power cut) is resumed only if its resume sidecar describes the same action and artifact
+ *        and the persisted prefix is intact. It is discarded otherwise. Data written after the
+ *        last checkpoint is dropped as it may not have reached the disk.
+ *
+ * @param[in,out] state    DownloadState of the download, updated with the resumed prefix
+ * @param[in]     artifact Artifact to download
+ */
+static void prepare_resumable_download(DownloadState *state, const Artifact *artifact)
+{
+        const gchar *file = hawkbit_config->bundle_download_location;
+        const gchar *keys[] = { "action_id", "url", "size", "sha1", NULL };
+        g_autoptr(GKeyFile) stored = NULL;
+        g_autoptr(Checksum) prefix = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *prefix_sha1 = NULL;
+        GStatBuf bundle_stat;
+        gint64 offset;
+
+        g_return_if_fail(state);
+        g_return_if_fail(artifact);
+
+        state->resume_info = g_key_file_new();
+        g_mutex_lock(&active_action->mutex);
+        g_key_file_set_string(state->resume_info, "resume", "action_id", active_action->id);
+        g_mutex_unlock(&active_action->mutex);
+        g_key_file_set_string(state->resume_info, "resume", "url", artifact->download_url);
+        g_key_file_set_int64(state->resume_info, "resume", "size", artifact->size);
+        g_key_file_set_string(state->resume_info, "resume", "sha1", artifact->sha1);
+
+        stored = load_resume_file();
+        if (!stored)
+                return;
+
+        for (const gchar **key = keys; *key; key++) {
+                g_autofree gchar *expected = g_key_file_get_string(state->resume_info, "resume",
+                                                                   *key, NULL);
+                g_autofree gchar *value = g_key_file_get_string(stored, "resume", *key, NULL);
+
+                if (g_strcmp0(expected, value)) {
+                        g_message("Discarding partial download, %s does not match.", *key);
+                        goto discard;
+                }
+        }
+
+        offset = g_key_file_get_int64(stored, "resume", "offset", NULL);
+        prefix_sha1 = g_key_file_get_string(stored, "resume", "prefix_sha1", NULL);
+        if (g_stat(file, &bundle_stat) || bundle_stat.st_size < offset || offset <= 0 ||
+            !prefix_sha1) {
+                g_message("Discarding partial download, it is incomplete.");
+                goto discard;
+        }
+
+        if (truncate(file, offset) ||
+            !download_state_update_from_file(state, file, offset, &error)) {
+                g_message("Discarding partial download: %s",
+                          error ? error->message : g_strerror(errno));
+                goto discard;
+        }
+
+        prefix = checksum_copy(state->sha1);
+        if (g_strcmp0(checksum_get_string(prefix), prefix_sha1)) {
+                g_message("Discarding partial download, its checksum does not match.");
+                goto discard;
+        }
+
+        state->etag = g_key_file_get_string(stored, "resume", "etag", NULL);
+        state->last_modified = g_key_file_get_string(stored, "resume", "last_modified", NULL);
+        g_message("Resuming interrupted download at offset %" G_GINT64_FORMAT ".", offset);
+        return;
+
+discard:
+        download_state_reset(state);
+        process_deployment_cleanup();
+}
+
+/**
+ * @brief Get the artifact cache key of the given Artifact, based on its strongest checksum.
+ *
+ * @param[in] artifact Artifact to get cache key for
+ * @return newly allocated cache key
+ */
+static gchar* artifact_cache_key(const Artifact *artifact)
+{
+        g_return_val_if_fail(artifact, NULL);
+
+        if (artifact->sha256)
+                return g_strdup_printf("sha256-%s", artifact->sha256);
+
+        return g_strdup_printf("sha1-%s", artifact->sha1);
+}
+
+/**
+ * @brief Check whether the given Artifact is available in config's artifact_cache_dir.
+ *
+ * @param[in] artifact Artifact to look up
+ * @return TRUE if cached, FALSE otherwise or if caching is disabled
+ */
+static gboolean artifact_is_cached(const Artifact *artifact)
+{
+        g_autofree gchar *key = NULL;
+
+        g_return_val_if_fail(artifact, FALSE);
+
+        if (!hawkbit_config->artifact_cache_dir)
+                return FALSE;
+
+        key = artifact_cache_key(artifact);
+        return artifact_cache_lookup(hawkbit_config->artifact_cache_dir, key, artifact->size);
+}
+
+/**
+ * @brief Provide the given Artifact at config's bundle_download_location from
+ *        artifact_cache_dir. Cache entries were verified when stored, so checksums are not
+ *        recalculated.
+ *
+ * @param[in] artifact Artifact to restore
+ * @return TRUE if the artifact was restored from cache, FALSE otherwise or if caching is disabled
+ */
+static gboolean restore_cached_artifact(const Artifact *artifact)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *key = NULL;
+
+        g_return_val_if_fail(artifact, FALSE);
+
+        if (!hawkbit_config->artifact_cache_dir)
+                return FALSE;
+
+        key = artifact_cache_key(artifact);
+        if (!artifact_cache_restore(hawkbit_config->artifact_cache_dir, key, artifact->size,
+                                    hawkbit_config->bundle_download_location, &error)) {
+                if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning("Failed to restore cached artifact: %s", error->message);
+                return FALSE;
+        }
+
+        g_message("Artifact %s found in cache, skipping download.", key);
+        g_mutex_lock(&active_action->mutex);
+        feedback_progress(artifact->feedback_url, active_action->id,
+                          "Artifact found in cache, skipping download.", FALSE);
+        g_mutex_unlock(&active_action->mutex);
+
+        return TRUE;
+}
+
+/**
+ * @brief Add the verified Artifact at config's bundle_download_location to artifact_cache_dir.
+ *        Failing to do so is not fatal, the next deployment of the artifact downloads it again.
+ *
+ * @param[in] artifact Artifact to cache
+ */
+static void cache_artifact(const Artifact *artifact)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *key = NULL;
+
+        g_return_if_fail(artifact);
+
+        if (!hawkbit_config->artifact_cache_dir)
+                return;
+
+        key = artifact_cache_key(artifact);
+        if (!artifact_cache_store(hawkbit_config->artifact_cache_dir, key,
+                                  hawkbit_config->bundle_download_location,
+                                  (gint64) hawkbit_config->artifact_cache_max_size * 1024 * 1024,
+                                  &error))
+                g_warning("Failed to cache artifact: %s", error->message);
+}
+
+/**
+ * @brief Let peers download the verified Artifact at config's bundle_download_location from us,
+ *        if config's peer_port is set.
+ *
+ * @param[in] artifact Artifact to publish
+ */
+static void publish_artifact(const Artifact *artifact)
+{
+        g_autofree gchar *key = NULL;
+
+        g_return_if_fail(artifact);
+
+        if (!hawkbit_config->peer_port)
+                return;
+
+        key = artifact_cache_key(artifact);
+        peer_server_publish(key, hawkbit_config->bundle_download_location);
+}
+
+/**
+ * @brief Check whether state covers the complete Artifact with matching checksums, without
+ *        finishing state's checksums.
+ *
+ * @param[in] state    DownloadState to check
+ * @param[in] artifact Artifact to compare with
+ * @return TRUE if state matches artifact, FALSE otherwise
+ */
+static gboolean download_state_matches(DownloadState *state, const Artifact *artifact)
+{
+        g_autoptr(Checksum) sha1 = NULL;
+        g_autoptr(Checksum) sha256 = NULL;
+
+        g_return_val_if_fail(state, FALSE);
+        g_return_val_if_fail(artifact, FALSE);
+
+        if (state->size != artifact->size)
+                return FALSE;
+
+        sha1 = checksum_copy(state->sha1);
+        if (g_strcmp0(checksum_get_string(sha1), artifact->sha1))
+                return FALSE;
+
+        if (!state->sha256)
+                return TRUE;
+
+        sha256 = checksum_copy(state->sha256);
+        return !g_strcmp0(checksum_get_string(sha256), artifact->sha256);
+}
+
+/**
+ * @brief Get the URL of the artifact at download_url on the given mirror, i.e. download_url with
+ *        scheme, host and port replaced by mirror.
+ *
+ * @param[in] download_url URL of the artifact at hawkBit
+ * @param[in] mirror       Base URL of the mirror, without trailing slash
+ * @return newly allocated URL, NULL if download_url has no path
+ */
+static gchar* get_mirror_url(const gchar *download_url, const gchar *mirror)
+{
+        const gchar *host, *path;
+
+        g_return_val_if_fail(download_url, NULL);
+        g_return_val_if_fail(mirror, NULL);
+
+        host = strstr(download_url, "://");
+        path = host ? strchr(host + 3, '/') : NULL;
+        if (!path)
+                return NULL;
+
+        return g_strconcat(mirror, path, NULL);
+}
+
+/**
+ * @brief Curl callback counting the bytes received by a probe in curl_off_t*. Aborts after
+ *        MIRROR_PROBE_SIZE, in case the server ignored the range and replies the complete file.
+ *
+ * @see   https://curl.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
+ */
+static size_t curl_write_probe_cb(const void *content, size_t size, size_t nmemb, void *data)
+{
+        curl_off_t *received = data;
+        size_t real_size = size * nmemb;
+
+        g_return_val_if_fail(data, 0);
+
+        *received += real_size;
+        return *received > MIRROR_PROBE_SIZE ? 0 : real_size;
+}
+
+/**
+ * @brief struct containing a download source and the result of probing it.
+ */
+typedef struct DownloadSource_ {
+        gchar *url;                       /**< URL of the artifact at the source */
+        gboolean auth;                    /**< whether hawkBit credentials are sent to the source */
+        gint64 probe_time;                /**< duration of the probe in microseconds, -1 if failed */
+        CURL *curl;                       /**< handle of the running probe or NULL */
+        struct curl_slist *headers;       /**< request headers of the running probe or NULL */
+        curl_off_t received;              /**< bytes received by the running probe */
+} DownloadSource;
+
+/**
+ * @brief Free a DownloadSource.
+ *
+ * @param[in] data DownloadSource* to free
+ */
+static void download_source_free(gpointer data)
+{
+        DownloadSource *source = data;
+
+        if (source->curl)
+                curl_easy_cleanup(source->curl);
+        curl_slist_free_all(source->headers);
+        g_free(source->url);
+        g_free(source);
+}
+
+/**
+ * @brief GCompareFunc ordering DownloadSource** by probe time, fastest first and failed last.
+ */
+static gint download_source_compare(gconstpointer a, gconstpointer b)
+{
+        const DownloadSource *source_a = *(const DownloadSource **) a;
+        const DownloadSource *source_b = *(const DownloadSource **) b;
+        gint64 time_a = source_a->probe_time < 0 ? G_MAXINT64 : source_a->probe_time;
+        gint64 time_b = source_b->probe_time < 0 ? G_MAXINT64 : source_b->probe_time;
+
+        return (time_a > time_b) - (time_a < time_b);
+}
+
+/**
+ * @brief Start probing a download source by requesting the first MIRROR_PROBE_SIZE bytes of the
+ *        artifact it serves, covering name lookup, connection setup and the first data, within
+ *        MIRROR_PROBE_TIMEOUT.
+ *
+ * @param[in]  multi  Curl multi handle to add the probe to
+ * @param[in]  source DownloadSource to probe
+ * @param[out] error  Error
+ * @return TRUE if the probe was started, FALSE otherwise (error set)
+ */
+static gboolean download_source_probe_start(CURLM *multi, DownloadSource *source,
+                                            GError **error)
+{
+        g_autofree gchar *range = NULL;
+        CURLMcode mcode;
+
+        g_return_val_if_fail(multi, FALSE);
+        g_return_val_if_fail(source && !source->curl, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if ((source->auth && !set_auth_curl_header(&source->headers, error)) ||
+            !add_curl_header(&source->headers, "Accept: application/octet-stream", error))
+                return FALSE;
+
+        source->curl = curl_easy_init();
+        if (!source->curl) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Unable to start libcurl easy session");
+                return FALSE;
+        }
+
+        range = g_strdup_printf("0-%d", MIRROR_PROBE_SIZE - 1);
+        set_default_curl_opts(source->curl);
+        curl_easy_setopt(source->curl, CURLOPT_URL, source->url);
+        curl_easy_setopt(source->curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(source->curl, CURLOPT_MAXREDIRS, 8L);
+        curl_easy_setopt(source->curl, CURLOPT_TIMEOUT, (long) MIRROR_PROBE_TIMEOUT);
+        curl_easy_setopt(source->curl, CURLOPT_RANGE, range);
+        curl_easy_setopt(source->curl, CURLOPT_HTTPHEADER, source->headers);
+        curl_easy_setopt(source->curl, CURLOPT_WRITEFUNCTION, curl_write_probe_cb);
+        curl_easy_setopt(source->curl, CURLOPT_WRITEDATA, &source->received);
+        curl_easy_setopt(source->curl, CURLOPT_PRIVATE, source);
+
+        mcode = curl_multi_add_handle(multi, source->curl);
+        if (mcode != CURLM_OK) {
+                g_clear_pointer(&source->curl, curl_easy_cleanup);
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Failed to add probe: %s", curl_multi_strerror(mcode));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Evaluate the finished probe of source, setting its probe_time, and release its handle.
+ *
+ * @param[in] multi  Curl multi handle the probe was added to
+ * @param[in] source DownloadSource probed
+ * @param[in] code   Curl result of the probe
+ */
+static void download_source_probe_done(CURLM *multi, DownloadSource *source, CURLcode code)
+{
+        gdouble total_time = 0;
+        glong http_code = 0;
+
+        g_return_if_fail(source && source->curl);
+
+        connection_cache_record(source->curl, code);
+        curl_easy_getinfo(source->curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_easy_getinfo(source->curl, CURLINFO_TOTAL_TIME, &total_time);
+        curl_multi_remove_handle(multi, source->curl);
+        g_clear_pointer(&source->curl, curl_easy_cleanup);
+        g_clear_pointer(&source->headers, curl_slist_free_all);
+
+        // aborting a complete reply after enough data is not a failure of the source
+        if (code != CURLE_OK &&
+            !(code == CURLE_WRITE_ERROR && source->received > MIRROR_PROBE_SIZE)) {
+                log_debug("Probing %s failed: %s", source->url, curl_easy_strerror(code));
+                return;
+        }
+        if (http_code != 200 && http_code != 206) {
+                log_debug("Probing %s failed: HTTP request failed: %ld", source->url, http_code);
+                return;
+        }
+
+        log_debug("Probing %s took %.3f s", source->url, total_time);
+        source->probe_time = (gint64) (total_time * G_USEC_PER_SEC);
+}
+
+/**
+ * @brief Probe all sources in parallel with download_source_probe_start(), within
+ *        MIRROR_PROBE_TIMEOUT in total. Sources failing the probe keep a probe_time of -1.
+ *
+ * @param[in] sources GPtrArray of DownloadSource to probe
+ */
+static void download_sources_probe(GPtrArray *sources)
+{
+        CURLM *multi = NULL;
+        int running = 0;
+
+        g_return_if_fail(sources);
+
+        multi = curl_multi_init();
+        if (!multi) {
+                g_warning("Unable to start libcurl multi session, not probing download sources");
+                return;
+        }
+
+        for (guint i = 0; i < sources->len; i++) {
+                DownloadSource *source = g_ptr_array_index(sources, i);
+                g_autoptr(GError) error = NULL;
+
+                source->probe_time = -1;
+                if (!download_source_probe_start(multi, source, &error))
+                        log_debug("Probing %s failed: %s", source->url, error->message);
+        }
+
+        do {
+                CURLMsg *msg;
+                int msgs_left;
+
+                curl_multi_perform(multi, &running);
+
+                while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+                        DownloadSource *source = NULL;
+
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+
+                        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &source);
+                        download_source_probe_done(multi, source, msg->data.result);
+                }
+
+                if (running)
+                        curl_multi_wait(multi, NULL, 0, 100, NULL);
+        } while (running);
+
+        // release probes that were not reported as done
+        for (guint i = 0; i < sources->len; i++) {
+                DownloadSource *source = g_ptr_array_index(sources, i);
+
+                if (source->curl)
+                        curl_multi_remove_handle(multi, source->curl);
+                g_clear_pointer(&source->curl, curl_easy_cleanup);
+                g_clear_pointer(&source->headers, curl_slist_free_all);
+        }
+
+        curl_multi_cleanup(multi);
+}
+
+/**
+ * @brief Add the given Artifact's URL at each of the mirrors to sources.
+ *
+ * @param[in] sources  GPtrArray of DownloadSource to add to
+ * @param[in] artifact Artifact to download
+ * @param[in] mirrors  Base URLs of the mirrors or NULL
+ * @param[in] auth     Whether to send hawkBit credentials to the mirrors
+ */
+static void download_sources_add_mirrors(GPtrArray *sources, const Artifact *artifact,
+                                         GStrv mirrors, gboolean auth)
+{
+        for (gchar **mirror = mirrors; mirror && *mirror; mirror++) {
+                DownloadSource *source = NULL;
+                gchar *url = get_mirror_url(artifact->download_url, *mirror);
+
+                if (!url)
+                        continue;
+
+                source = g_new0(DownloadSource, 1);
+                source->url = url;
+                source->auth = auth;
+                g_ptr_array_add(sources, source);
+        }
+}
+
+/**
+ * @brief Get the sources to download the given Artifact from: hawkBit and config's mirrors and
+ *        authenticated_mirrors, probed with download_sources_probe() and ordered fastest first.
+ *        Sources failing the probe are tried last. Without mirrors, hawkBit is the only source
+ *        and nothing is probed.
+ *
+ * @param[in] artifact Artifact to download
+ * @return GPtrArray of DownloadSource, holding at least hawkBit
+ */
+static GPtrArray* get_download_sources(const Artifact *artifact)
+{
+        GPtrArray *sources = g_ptr_array_new_with_free_func(download_source_free);
+        DownloadSource *hawkbit = g_new0(DownloadSource, 1);
+
+        g_return_val_if_fail(artifact, NULL);
+
+        hawkbit->url = g_strdup(artifact->download_url);
+        hawkbit->auth = TRUE;
+        g_ptr_array_add(sources, hawkbit);
+
+        download_sources_add_mirrors(sources, artifact, hawkbit_config->mirrors, FALSE);
+        download_sources_add_mirrors(sources, artifact, hawkbit_config->authenticated_mirrors,
+                                     TRUE);
+
+        if (sources->len == 1)
+                return sources;
+
+        download_sources_probe(sources);
+
+        // stable for equal times, so hawkBit goes first if all probes fail
+        g_ptr_array_sort(sources, download_source_compare);
+
+        return sources;
+}
+
+/**
+ * @brief Try to download the given Artifact from the peers in config's peers, in order, before
+ *        falling back to hawkBit. A peer's download is only accepted if its checksums match, so
+ *        peers cannot tamper with bundles. Data received from a peer failing mid-transfer cannot
+ *        be verified on its own and is discarded, keeping only data downloaded from hawkBit
+ *        before.
+ *
+ * @param[in]  artifact Artifact to download
+ * @param[in]  state    DownloadState of the download
+ * @param[out] speed    Average download speed
+ * @param[out] error    Error, only set to RHU_HAWKBIT_CLIENT_ERROR_CANCELATION if canceled
+ * @return TRUE if a peer provided the complete artifact, FALSE otherwise
+ */
+static gboolean download_from_peers(const Artifact *artifact, DownloadState *state,
+                                    curl_off_t *speed, GError **error)
+{
+        const gchar *file = hawkbit_config->bundle_download_location;
+        g_autofree gchar *key = NULL, *etag = NULL, *last_modified = NULL;
+        g_autoptr(GKeyFile) resume_info = NULL;
+        curl_off_t trusted = 0;
+        GStatBuf bundle_stat;
+        gboolean res = FALSE;
+
+        g_return_val_if_fail(artifact, FALSE);
+        g_return_val_if_fail(state, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!hawkbit_config->peers)
+                return FALSE;
+
+        key = artifact_cache_key(artifact);
+
+        // validators refer to hawkBit's file, peers must neither see nor replace them
+        etag = g_steal_pointer(&state->etag);
+        last_modified = g_steal_pointer(&state->last_modified);
+
+        // unverified peer data must not be persisted as resumable prefix
+        resume_info = g_steal_pointer(&state->resume_info);
+
+        // data of a partial download from hawkBit, peers continue from there
+        if (g_stat(file, &bundle_stat) == 0)
+                trusted = (curl_off_t) bundle_stat.st_size;
+
+        for (gchar **peer = hawkbit_config->peers; *peer && !res; peer++) {
+                g_autofree gchar *url = g_strdup_printf("http://%s/%s", *peer, key);
+                g_autoptr(GError) ierror = NULL;
+
+                if (check_cancel_requested(error) || !wait_for_download_window(error))
+                        break;
+
+                g_message("Trying to download %s from peer %s", key, *peer);
+                if (!download_state_update_from_file(state, file, trusted, &ierror) ||
+                    !get_binary(url, TRUE, FALSE, file, trusted, artifact->size, state, speed,
+                                &ierror)) {
+                        g_message("Downloading from peer %s failed: %s", *peer, ierror->message);
+                } else {
+                        res = download_state_matches(state, artifact);
+                        if (!res)
+                                g_message("Peer %s provided a corrupt bundle, discarding it.",
+                                          *peer);
+                }
+
+                if (res)
+                        break;
+
+                // drop everything the peer sent, the checksums are brought up to date with the
+                // shrunk file by download_state_update_from_file()
+                if (truncate(file, trusted) && errno != ENOENT) {
+                        g_message("Discarding peer data failed: %s", g_strerror(errno));
+                        download_state_reset(state);
+                        process_deployment_cleanup();
+                        trusted = 0;
+                }
+        }
+
+        state->resume_info = g_steal_pointer(&resume_info);
+        g_free(state->etag);
+        g_free(state->last_modified);
+        state->etag = g_steal_pointer(&etag);
+        state->last_modified = g_steal_pointer(&last_modified);
+
+        if (res)
+                g_message("Downloaded %s from peer.", key);
+
+        return res;
+}
+
+/**
+ * @brief Download given Artifact to config's bundle_download_location (resuming if configured),
+ *        verify its checksums and send hawkBit progress feedback.
+ *
+ * @param[in]  artifact Artifact to download
+ * @param[out] error    Error, RHU_HAWKBIT_CLIENT_ERROR_CANCELATION if canceled
+ * @return TRUE if download and checksum verification succeeded, FALSE otherwise (error set)
+ */
+static gboolean download_artifact(Artifact *artifact, GError **error)
+{
+        g_autoptr(GError) ierror = NULL;
+        g_autofree gchar *msg = NULL, *resume_file = NULL;
+        g_autoptr(DownloadState) state = NULL;
+        g_autoptr(GPtrArray) sources = NULL;
+        const gchar *sha1sum = NULL, *sha256sum = NULL, *url = NULL;
+        gint64 start_time, download_time = 0, prefix_hash_time, wait;
+        guint resume_failures = 0, source = 0, failovers = 0;
+        gboolean retry = FALSE, from_peer, auth = FALSE;
+        curl_off_t speed;
+
+        g_return_val_if_fail(artifact, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (restore_cached_artifact(artifact)) {
+                publish_artifact(artifact);
+                return TRUE;
+        }
+
+        // the file is about to change, peers must not download it in the meantime
+        peer_server_withdraw();
+
+        state = download_state_new(artifact->sha256 != NULL);
+        if (hawkbit_config->resume_downloads)
+                prepare_resumable_download(state, artifact);
+        prefix_hash_time = state->hash_time;
+
+        start_time = g_get_monotonic_time();
+        from_peer = download_from_peers(artifact, state, &speed, &ierror);
+        if (ierror) {
+                g_propagate_error(error, g_steal_pointer(&ierror));
+                return FALSE;
+        }
+        if (!from_peer) {
+                sources = get_download_sources(artifact);
+                url = ((DownloadSource *) g_ptr_array_index(sources, source))->url;
+                auth = ((DownloadSource *) g_ptr_array_index(sources, source))->auth;
+                download_time += g_get_monotonic_time() - start_time;
+                g_message("Start downloading: %s", url);
+        }
+
+        while (!from_peer) {
+                gboolean resumable = FALSE, progress;
+                GStatBuf bundle_stat;
+                curl_off_t resume_from = 0;
+                gint segments;
+
+                if (!wait_for_download_window(error))
+                        return FALSE;
+
+                if (retry)
+                        metrics_record_retry(METRICS_TRANSFER_DOWNLOAD);
+                retry = TRUE;
+                start_time = g_get_monotonic_time();
+
+                // Download software bundle (artifact), never append to a linked cache entry
+                if (g_stat(hawkbit_config->bundle_download_location, &bundle_stat) == 0) {
+                        if (bundle_stat.st_nlink > 1)
+                                process_deployment_cleanup();
+                        else
+                                resume_from = (curl_off_t) bundle_stat.st_size;
+                }
+
+                // account for already downloaded data (only read once, on first resume)
+                if (!download_state_update_from_file(state,
+                                                     hawkbit_config->bundle_download_location,
+                                                     resume_from, error)) {
+                        g_prefix_error(error, "Download failed: ");
+                        return FALSE;
+                }
+
+                if (resume_from)
+                        metrics_record_resume();
+
+                segments = get_download_segment_count(artifact->size, resume_from);
+                if (segments > 1) {
+                        if (get_binary_segmented(url, auth,
+                                                 hawkbit_config->bundle_download_location,
+                                                 resume_from, artifact->size, segments,
+                                                 &speed, &ierror) &&
+                            download_state_update_from_file(
+                                    state, hawkbit_config->bundle_download_location,
+                                    artifact->size, &ierror))
+                                break;
+                } else if (get_binary(url, FALSE, auth, hawkbit_config->bundle_download_location,
+                                      resume_from, artifact->size, state, &speed, &ierror)) {
+                        break;
+                }
+
+                download_time += g_get_monotonic_time() - start_time;
+
+                if (g_error_matches(ierror, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_CANCELATION)) {
+                        g_propagate_error(error, g_steal_pointer(&ierror));
+                        return FALSE;
+                }
+
+                // resume right away with the rate limit now in effect
+                if (g_error_matches(ierror, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD_RESCHEDULED)) {
+                        log_debug("%s, resuming download..", ierror->message);
+                        g_clear_error(&ierror);
+                        continue;
+                }
+
+                for (const gint *code = &resumable_codes[0]; *code; code++)
+                        resumable |= g_error_matches(ierror, RHU_HAWKBIT_CLIENT_CURL_ERROR, *code);
+
+                progress = g_stat(hawkbit_config->bundle_download_location, &bundle_stat) == 0 &&
+                           (curl_off_t) bundle_stat.st_size > resume_from;
+
+                if (!resumable) {
+                        g_propagate_prefixed_error(error, g_steal_pointer(&ierror),
+                                                   "Download failed: ");
+                        return FALSE;
+                }
+
+                // a source making progress starts a new cycle through the sources, without
+                // resuming each source only gets one attempt
+                if (progress)
+                        resume_failures = 0;
+                if (progress && hawkbit_config->resume_downloads)
+                        failovers = 0;
+                failovers++;
+
+                if (failovers >= sources->len && !hawkbit_config->resume_downloads) {
+                        g_propagate_prefixed_error(error, g_steal_pointer(&ierror),
+                                                   "Download failed: ");
+                        return FALSE;
+                }
+
+                // switch to the next source right away, continuing with the data received so
+                // far if resuming, starting over otherwise
+                if (sources->len > 1) {
+                        const gchar *prev_url = url;
+
+                        source = (source + 1) % sources->len;
+                        url = ((DownloadSource *) g_ptr_array_index(sources, source))->url;
+                        auth = ((DownloadSource *) g_ptr_array_index(sources, source))->auth;
+                        g_message("Downloading from %s failed: %s, switching to %s", prev_url,
+                                  ierror->message, url);
+
+                        // validators are specific to a source, the checksums still cover all data
+                        g_clear_pointer(&state->etag, g_free);
+                        g_clear_pointer(&state->last_modified, g_free);
+                        if (!hawkbit_config->resume_downloads)
+                                process_deployment_cleanup();
+                }
+
+                // back off once all sources failed in a row without progress
+                if (failovers < sources->len) {
+                        g_clear_error(&ierror);
+                        continue;
+                }
+
+                failovers = 0;
+                wait = get_backoff_time(RESUME_WAIT_MS, resume_failures++);
+                log_debug("%s, resuming download..", curl_easy_strerror(ierror->code));
+
+                g_clear_error(&ierror);
+
+                if (!wait_for_retry(wait, error))
+                        return FALSE;
+        }
+
+        // checksum verification starts with hashing data read back from disk, if any
+        download_time += g_get_monotonic_time() - start_time;
+        metrics_record_phase(METRICS_PHASE_DOWNLOAD,
+                             download_time - (state->hash_time - prefix_hash_time));
+        start_time = g_get_monotonic_time();
+
+        // notify hawkbit that download is complete
+        msg = g_strdup_printf("Download complete. %.2f MB/s",
+                              (double)speed/(1024*1024));
+        g_mutex_lock(&active_action->mutex);
+        feedback_progress(artifact->feedback_url, active_action->id, msg, FALSE);
+        g_mutex_unlock(&active_action->mutex);
+
+        // validate checksums, calculated during download
+        sha1sum = checksum_get_string(state->sha1);
+        if (g_strcmp0(artifact->sha1, sha1sum)) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD,
+                            "Software: %s V%s. Invalid checksum: %s expected %s", artifact->name,
+                            artifact->version, sha1sum, artifact->sha1);
+                return FALSE;
+        }
+
+        if (state->sha256) {
+                sha256sum = checksum_get_string(state->sha256);
+                if (g_strcmp0(artifact->sha256, sha256sum)) {
+                        g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD,
+                                    "Software: %s V%s. Invalid SHA-256 checksum: %s expected %s",
+                                    artifact->name, artifact->version, sha256sum,
+                                    artifact->sha256);
+                        return FALSE;
+                }
+        }
+
+        metrics_record_phase(METRICS_PHASE_CHECKSUM,
+                             state->hash_time + g_get_monotonic_time() - start_time);
+
+        g_mutex_lock(&active_action->mutex);
+        feedback_progress(artifact->feedback_url, active_action->id, "File checksum OK.", FALSE);
+        g_mutex_unlock(&active_action->mutex);
+
+        // download is complete, nothing to resume anymore
+        resume_file = get_resume_file();
+        g_remove(resume_file);
+
+        cache_artifact(artifact);
+        publish_artifact(artifact);
+
+        return TRUE;
+}
+
+/**
+ * @brief If config's preflight_check is set, let RAUC check the artifact's bundle is validly
+ *        signed and compatible before downloading it. RAUC inspects the bundle via HTTP(S)
+ *        streaming, so only the byte ranges holding its signature and manifest are fetched. The
+ *        check is skipped for cached artifacts and if RAUC does not support it.
+ *
+ * @param[in]  artifact Artifact to check
+ * @param[out] error    Error
+ * @return TRUE if the bundle passed or the check was skipped, FALSE otherwise (error set)
+ */
+static gboolean preflight_check(Artifact *artifact, GError **error)
+{
+        g_autofree gchar *auth_header = NULL;
+        g_autoptr(GError) ierror = NULL;
+
+        g_return_val_if_fail(artifact, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (!hawkbit_config->preflight_check || !check_bundle_cb || artifact_is_cached(artifact))
+                return TRUE;
+
+        g_message("Checking bundle before download: %s", artifact->download_url);
+        auth_header = build_auth_header();
+        if (check_bundle_cb(artifact->download_url, auth_header, hawkbit_config->ssl_verify,
+                            &ierror))
+                return TRUE;
+
+        if (g_error_matches(ierror, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+                g_message("RAUC does not support inspecting bundles, skipping check.");
+                return TRUE;
+        }
+
+        g_propagate_prefixed_error(error, g_steal_pointer(&ierror), "Bundle check failed: ");
+        return FALSE;
+}
+
+/**
+ * @brief Thread to download the first of the given Artifacts, verfiy its checksum, send hawkBit
+ * feedback and call software_ready_cb() callback on success.
+ * If downloading or installing an Artifact fails, the next one is tried.
+ * In stream_bundle mode, the download is skipped and RAUC is passed the artifact's URL instead,
+ * unless the artifact is cached.
+ *
+ * @param[in] data GPtrArray* of Artifact* to process, in order of preference
+ * @return gpointer being 1 (TRUE) if download succeeded, 0 (FALSE) otherwise. The return value is
+ *         meant to be used with the GPOINTER_TO_INT() macro only.
+ *         Note that if the download thread waited for installation to finish ('run_once' mode),
+ *         TRUE means both installation and download succeeded.
+ */
+static gpointer download_thread(gpointer data)
+{
+        struct on_new_software_userdata userdata = {
+                .install_progress_callback = (GSourceFunc) hawkbit_progress,
+                .install_complete_callback = install_complete_cb,
+                .file = hawkbit_config->bundle_download_location,
+                .auth_header = NULL,
+                .ssl_verify = hawkbit_config->ssl_verify,
+                .wait = run_once,
+                .install_success = FALSE,
+        };
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GPtrArray) artifacts = data;
+        g_autofree gchar *auth_header = NULL;
+        Artifact *artifact = NULL;
+
+        g_return_val_if_fail(data, NULL);
+
+        thread_priority_apply("downloader");
+
+        for (guint i = 0; i < artifacts->len; i++) {
+                gboolean fallback = i + 1 < artifacts->len;
+
+                artifact = g_ptr_array_index(artifacts, i);
+
+                g_mutex_lock(&active_action->mutex);
+                if (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
+                        goto cancel;
+
+                action_set_state(ACTION_STATE_DOWNLOADING);
+                g_mutex_unlock(&active_action->mutex);
+
+                // install cached artifacts from disk, even in stream_bundle mode
+                userdata.file = hawkbit_config->bundle_download_location;
+                userdata.auth_header = NULL;
+
+                if (hawkbit_config->stream_bundle && !artifact_is_cached(artifact)) {
+                        // let RAUC stream the bundle from hawkBit, it verifies the bundle on its own
+                        g_message("Streaming bundle: %s", artifact->download_url);
+                        g_free(auth_header);
+                        auth_header = build_auth_header();
+                        userdata.file = artifact->download_url;
+                        userdata.auth_header = auth_header;
+                } else if (!preflight_check(artifact, &error) ||
+                           !download_artifact(artifact, &error)) {
+                        if (g_error_matches(error, RHU_HAWKBIT_CLIENT_ERROR,
+                                            RHU_HAWKBIT_CLIENT_ERROR_CANCELATION)) {
+                                g_mutex_lock(&active_action->mutex);
+                                goto cancel;
+                        }
+                        if (!fallback)
+                                goto report_err;
+
+                        g_mutex_lock(&active_action->mutex);
+                        feedback_progress(artifact->feedback_url, active_action->id,
+                                          error->message, FALSE);
+                        g_mutex_unlock(&active_action->mutex);
+                        g_clear_error(&error);
+
+                        // do not resume the next artifact's download from this one
+                        process_deployment_cleanup();
+                        continue;
+                }
+
+                // last chance to cancel installation
+
+                g_mutex_lock(&active_action->mutex);
+                if (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
+                        goto cancel;
+
+                // skip installation if hawkBit asked us to do so
+                if (!artifact->do_install) {
+                        action_set_state(ACTION_STATE_NONE);
+                        action_record_finished();
+                        g_mutex_unlock(&active_action->mutex);
+
+                        return GINT_TO_POINTER(TRUE);
+                }
+
+                // start installation, cancelations are impossible now
+                action_set_state(ACTION_STATE_INSTALLING);
+                active_action->install_fallback = fallback;
+                active_action->install_start_time = g_get_monotonic_time();
+                g_mutex_unlock(&active_action->mutex);
+
+                // wait for the result if there is an artifact left to fall back to
+                userdata.wait = run_once || fallback;
+                software_ready_cb(&userdata);
+
+                if (!fallback || userdata.install_success)
+                        return GINT_TO_POINTER(userdata.install_success);
+
+                g_message("Installing %s failed, falling back to next artifact.",
+                          artifact->download_url);
+                process_deployment_cleanup();
+        }
+
+        // all artifacts were skipped, not expected
+        g_return_val_if_reached(GINT_TO_POINTER(FALSE));
+
+report_err:
+        g_mutex_lock(&active_action->mutex);
+        feedback(artifact->feedback_url, active_action->id, error->message, "failure", "closed");
+
+        action_set_state(ACTION_STATE_ERROR);
+
+cancel:
+        if (active_action->state == ACTION_STATE_CANCEL_REQUESTED) {
+                // hawkBit does not know about local cancelations, let it close the action
+                if (active_action->cancel_local)
+                        feedback(artifact->feedback_url, active_action->id,
+                                 "Download canceled locally.", "failure", "closed");
+                action_set_state(ACTION_STATE_CANCELED);
+        }
+
+        action_record_finished();
+        process_deployment_cleanup();
+
+        g_mutex_unlock(&active_action->mutex);
+
+        return GINT_TO_POINTER(FALSE);
+}
+
+/**
+ * @brief Get value of the software module metadata entry with the given key. hawkBit only passes
+ *        metadata marked as "target visible" to the DDI API.
+ *
+ * @param[in] json_chunk JsonNode* of the deployment chunk
+ * @param[in] key        Metadata key to look up
+ * @return newly allocated metadata value or NULL if the chunk has no such metadata entry
+ */
+static gchar* json_get_chunk_metadata(JsonNode *json_chunk, const gchar *key)
+{
+        g_autoptr(JsonArray) json_metadata = NULL;
+
+        g_return_val_if_fail(json_chunk, NULL);
+        g_return_val_if_fail(key, NULL);
+
+        json_metadata = json_get_array(json_chunk, "$.metadata", NULL);
+        if (!json_metadata)
+                return NULL;
+
+        for (guint i = 0; i < json_array_get_length(json_metadata); i++) {
+                JsonNode *json_entry = json_array_get_element(json_metadata, i);
+                g_autofree gchar *entry_key = json_get_string(json_entry, "$.key", NULL);
+
+                if (!g_strcmp0(entry_key, key))
+                        return json_get_string(json_entry, "$.value", NULL);
+        }
+
+        return NULL;
+}
+
+/**
+ * @brief Create Artifact from hawkBit deployment chunk and one of its artifacts.
+ *
+ * @param[in]  json_chunk    JsonNode* of the deployment chunk
+ * @param[in]  json_artifact JsonNode* of the chunk's artifact
+ * @param[out] error         Error
+ * @return newly allocated Artifact* or NULL on error (error set). Should be freed with
+ *         artifact_free().
+ */
+static Artifact* artifact_from_json(JsonNode *json_chunk, JsonNode *json_artifact,
+                                    GError **error)
+{
+        g_autoptr(Artifact) artifact = g_new0(Artifact, 1);
+        GError *ierror = NULL;
+
+        g_return_val_if_fail(json_chunk, NULL);
+        g_return_val_if_fail(json_artifact, NULL);
+        g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+        artifact->version = json_get_string(json_chunk, "$.version", error);
+        if (!artifact->version)
+                return NULL;
+
+        artifact->name = json_get_string(json_chunk, "$.name", error);
+        if (!artifact->name)
+                return NULL;
+
+        artifact->size = json_get_int(json_artifact, "$.size", &ierror);
+        if (ierror) {
+                g_propagate_error(error, ierror);
+                return NULL;
+        }
+
+        artifact->sha1 = json_get_string(json_artifact, "$.hashes.sha1", error);
+        if (!artifact->sha1)
+                return NULL;
+
+        // SHA-256 is verified in addition if hawkBit provides it
+        artifact->sha256 = json_get_string(json_artifact, "$.hashes.sha256", NULL);
+
+        // favour https download
+        artifact->download_url = json_get_string(json_artifact, "$._links.download.href", NULL);
+        if (!artifact->download_url)
+                artifact->download_url = json_get_string(
+                        json_artifact, "$._links.download-http.href", error);
+
+        if (!artifact->download_url) {
+                g_prefix_error(error, "\"$._links.download{-http,}.href\": ");
+                return NULL;
+        }
+
+        // delta bundles announce the version they apply to via software module metadata
+        artifact->base_version = json_get_chunk_metadata(json_chunk, "base_version");
+
+        return g_steal_pointer(&artifact);
+}
+
+/**
+ * @brief GCompareFunc ordering Artifact** by size, smallest first.
+ */
+static gint artifact_compare_size(gconstpointer a, gconstpointer b)
+{
+        const Artifact *artifact_a = *(const Artifact **) a;
+        const Artifact *artifact_b = *(const Artifact **) b;
+
+        return (artifact_a->size > artifact_b->size) - (artifact_a->size < artifact_b->size);
+}
+
+/**
+ * @brief Collect the artifacts of a hawkBit deployment applicable to this target. A deployment
+ *        consists of one full bundle, optionally accompanied by delta bundles (chunks with
+ *        base_version metadata) as alternatives to it. Each chunk must hold a single artifact.
+ *        Delta bundles are only applicable if their base_version matches the installed version.
+ *        Applicable deltas are ordered by size, so the smallest is tried first, the full bundle
+ *        always comes last as the fallback.
+ *
+ * @param[in]  resp_root             JsonNode* of the deployment resource
+ * @param[in]  action_id             hawkBit action id of the deployment, for error messages
+ * @param[in]  get_installed_version InstalledVersionFunc to query the installed version with or
+ *                                   NULL to skip all delta bundles
+ * @param[out] error                 Error
+ * @return GPtrArray* of Artifact*, NULL on error (error set). Empty if no artifact is applicable.
+ */
+static GPtrArray* get_applicable_artifacts(JsonNode *resp_root, const gchar *action_id,
+                                           InstalledVersionFunc get_installed_version,
+                                           GError **error)
+{
+        g_autoptr(GPtrArray) artifacts = g_ptr_array_new_with_free_func(
+                (GDestroyNotify) artifact_free);
+        g_autoptr(JsonArray) json_chunks = NULL;
+        g_autoptr(Artifact) full_bundle = NULL;
+        g_autofree gchar *installed_version = NULL;
+        gboolean installed_version_queried = FALSE;
+
+        g_return_val_if_fail(resp_root, NULL);
+        g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+        json_chunks = json_get_array(resp_root, "$.deployment.chunks", error);
+        if (!json_chunks)
+                return NULL;
+
+        for (guint i = 0; i < json_array_get_length(json_chunks); i++) {
+                JsonNode *json_chunk = json_array_get_element(json_chunks, i);
+                g_autoptr(JsonArray) json_artifacts = NULL;
+                g_autoptr(Artifact) artifact = NULL;
+
+                json_artifacts = json_get_array(json_chunk, "$.artifacts", error);
+                if (!json_artifacts)
+                        return NULL;
+                if (!json_array_get_length(json_artifacts))
+                        continue;
+                if (json_array_get_length(json_artifacts) > 1) {
+                        g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_MULTI_ARTIFACTS,
+                                    "Deployment %s unsupported: cannot handle multiple artifacts.",
+                                    action_id);
+                        return NULL;
+                }
+
+                artifact = artifact_from_json(json_chunk,
+                                              json_array_get_element(json_artifacts, 0), error);
+                if (!artifact)
+                        return NULL;
+
+                // anything but delta bundles would need to be installed in addition
+                if (!artifact->base_version) {
+                        if (full_bundle) {
+                                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                                            RHU_HAWKBIT_CLIENT_ERROR_MULTI_CHUNKS,
+                                            "Deployment %s unsupported: cannot handle multiple chunks.",
+                                            action_id);
+                                return NULL;
+                        }
+                        full_bundle = g_steal_pointer(&artifact);
+                        continue;
+                }
+
+                if (!installed_version_queried) {
+                        g_autoptr(GError) ierror = NULL;
+
+                        installed_version_queried = TRUE;
+                        if (get_installed_version)
+                                installed_version = get_installed_version(&ierror);
+                        if (!installed_version)
+                                g_warning("Cannot determine installed version, ignoring delta bundles: %s",
+                                          ierror ? ierror->message : "not supported");
+                }
+
+                if (g_strcmp0(artifact->base_version, installed_version)) {
+                        log_debug("Skipping delta bundle %s (Name: %s, Version: %s), it applies to version %s only.",
+                                artifact->download_url, artifact->name, artifact->version,
+                                artifact->base_version);
+                        continue;
+                }
+
+                g_ptr_array_add(artifacts, g_steal_pointer(&artifact));
+        }
+
+        g_ptr_array_sort(artifacts, artifact_compare_size);
+        if (full_bundle)
+                g_ptr_array_add(artifacts, g_steal_pointer(&full_bundle));
+
+        return g_steal_pointer(&artifacts);
+}
+
+/**
+ * @brief Start processing hawkBit deployment described by req_root by requesting the deployment
+ *        resource. Its response is processed with process_deployment_response().
+ *        Must be called under locked active_action->mutex.
+ *
+ * @param[in]  req_root    JsonNode* describing the deployment to process
+ * @param[in]  curl_source GSource created with curl_source_new() running the request
+ * @param[in]  done        Function called once the request finished
+ * @param[in]  user_data   User data passed to done
+ * @param[out] error       Error
+ * @return TRUE if the request was started, FALSE otherwise (error set)
+ */
+static gboolean process_deployment(JsonNode *req_root, GSource *curl_source,
+                                   RestResponseFunc done, gpointer user_data, GError **error)
+{
+        g_autofree gchar *deployment = NULL;
+
+        g_return_val_if_fail(req_root, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (active_action->state >= ACTION_STATE_PROCESSING) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_ALREADY_IN_PROGRESS,
+                            "Deployment %s is already in progress.", active_action->id);
+                // no need to tell hawkBit about this
+                return FALSE;
+        }
+
+        action_set_state(ACTION_STATE_PROCESSING);
+        active_action->cancel_local = FALSE;
+        active_action->start_time = g_get_monotonic_time();
+
+        // get deployment URL
+        deployment = json_get_string(req_root, "$._links.deploymentBase.href", error);
+        if (!deployment)
+                goto error;
+
+        // get deployment resource
+        if (!rest_request_async(curl_source, GET, deployment, NULL, NULL, done, user_data, error))
+                goto error;
+
+        return TRUE;
+
+error:
+        process_deployment_cleanup();
+        action_set_state(ACTION_STATE_NONE);
+
+        return FALSE;
+}
+
+/**
+ * @brief Process the deployment resource requested by process_deployment(): check for free
+ *        space and start the download thread.
+ *        Must be called under locked active_action->mutex.
+ *
+ * @param[in]  response      Parsed deployment resource or NULL if the request failed
+ * @param[in]  request_error Error of the deployment resource request or NULL
+ * @param[out] error         Error
+ * @return TRUE if processing deployment succeeded, FALSE otherwise (error set)
+ */
+static gboolean process_deployment_response(JsonParser *response, const GError *request_error,
+                                            GError **error)
+{
+        g_autoptr(GPtrArray) artifacts = NULL;
+        g_autofree gchar *feedback_url = NULL, *temp_id = NULL, *deployment_download = NULL,
+                         *deployment_update = NULL, *maintenance_window = NULL,
+                         *maintenance_msg = NULL;
+        JsonNode *resp_root = NULL;
+        Artifact *artifact = NULL;
+        gboolean do_install;
+        gint64 need_space = 0;
+        goffset freespace = 0;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (request_error) {
+                g_propagate_error(error, g_error_copy(request_error));
+                goto error;
+        }
+        if (!response) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_JSON_RESPONSE_PARSE,
+                            "Empty deployment resource");
+                goto error;
+        }
+
+        resp_root = json_parser_get_root(response);
+
+        // handle deployment.maintenanceWindow (only available if maintenance window is defined)
+        maintenance_window = json_get_string(resp_root, "$.deployment.maintenanceWindow", NULL);
+        maintenance_msg = maintenance_window
+                          ? g_strdup_printf(" (maintenance window is '%s')", maintenance_window)
+                          : g_strdup("");
+
+        // handle deployment.download=skip
+        deployment_download = json_get_string(resp_root, "$.deployment.download", error);
+        if (!deployment_download)
+                goto error;
+
+        if (!g_strcmp0(deployment_download, "skip")) {
+                g_message("hawkBit requested to skip download, not downloading yet%s.",
+                          maintenance_msg);
+                action_set_state(ACTION_STATE_NONE);
+                return TRUE;
+        }
+
+        // handle deployment.update=skip
+        deployment_update = json_get_string(resp_root, "$.deployment.update", error);
+        if (!deployment_update)
+                goto error;
+
+        do_install = g_strcmp0(deployment_update, "skip") != 0;
+        if (!do_install && hawkbit_config->stream_bundle) {
+                // nothing to download ahead of installation when streaming
+                g_message("hawkBit requested to skip installation, not streaming bundle yet%s.",
+                          maintenance_msg);
+                action_set_state(ACTION_STATE_NONE);
+                return TRUE;
+        }
+        if (!do_install)
+                g_message("hawkBit requested to skip installation, not invoking RAUC yet%s.",
+                          maintenance_msg);
+
+        // remember deployment's action id
+        temp_id = json_get_string(resp_root, "$.id", error);
+
+        if (!do_install && !g_strcmp0(temp_id, active_action->id)) {
+                log_debug("Deployment %s is still waiting%s.", active_action->id, maintenance_msg);
+                action_set_state(ACTION_STATE_NONE);
+                return TRUE;
+        }
+
+        // clean up on changed deployment id, unless a previous run left a download to resume
+        if (g_strcmp0(temp_id, active_action->id) && !resume_file_matches_action(temp_id))
+                process_deployment_cleanup();
+        else
+                log_debug("Continuing scheduled deployment %s%s.", active_action->id,
+                        maintenance_msg);
+
+        g_free(active_action->id);
+        active_action->id = g_steal_pointer(&temp_id);
+        if (!active_action->id)
+                goto error;
+        log_set_action_id(active_action->id);
+
+        feedback_url = build_api_url("deploymentBase/%s/feedback", active_action->id);
+
+        // collect all applicable artifacts, the first one is downloaded, the others are fallbacks
+        artifacts = get_applicable_artifacts(resp_root, active_action->id, installed_version_cb,
+                                             error);
+        if (!artifacts)
+                goto proc_error;
+        if (!artifacts->len) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_NO_APPLICABLE_ARTIFACT,
+                            "Deployment %s has no artifact applicable to this target.",
+                            active_action->id);
+                goto proc_error;
+        }
+
+        for (guint i = 0; i < artifacts->len; i++) {
+                Artifact *candidate = g_ptr_array_index(artifacts, i);
+
+                candidate->do_install = do_install;
+                candidate->feedback_url = g_strdup(feedback_url);
+        }
+
+        artifact = g_ptr_array_index(artifacts, 0);
+        g_message("New software ready for download (Name: %s, Version: %s, Size: %" G_GINT64_FORMAT " bytes, URL: %s)",
+                  artifact->name, artifact->version, artifact->size, artifact->download_url);
+        if (artifacts->len > 1)
+                g_message("%u more artifact(s) available as fallback", artifacts->len - 1);
+
+        // check if there is enough free diskspace for any candidate falling back to (not needed
+        // when streaming or cached)
+        for (guint i = 0; i < artifacts->len && !hawkbit_config->stream_bundle; i++) {
+                Artifact *candidate = g_ptr_array_index(artifacts, i);
+
+                if (!artifact_is_cached(candidate))
+                        need_space = MAX(need_space, candidate->size);
+        }
+        if (need_space &&
+            !get_available_space(hawkbit_config->bundle_download_location, &freespace, error))
+                goto proc_error;
+
+        if (need_space && freespace < need_space) {
+                // notify hawkbit that there is not enough free space
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+                            "File size %" G_GINT64_FORMAT " exceeds available space %" G_GOFFSET_FORMAT,
+                            need_space, freespace);
+                goto proc_error;
+        }
+
+        // unref/free previous download thread by joining it
+        if (thread_download)
+                g_thread_join(thread_download);
+
+        // start download thread
+        thread_download = g_thread_new("downloader", download_thread,
+                                       (gpointer) g_steal_pointer(&artifacts));
+
+        return TRUE;
+
+proc_error:
+        feedback(feedback_url, active_action->id, (*error)->message, "failure", "closed");
+        action_record_finished();
+
+error:
+        // clean up failed deployment
+        process_deployment_cleanup();
+        action_set_state(ACTION_STATE_NONE);
+
+        return FALSE;
+}
+
+/**
+ * @brief Start processing hawkBit cancel action described by req_root by requesting the cancel
+ *        details. Its response is processed with process_cancel_response().
+ *
+ * @param[in]  req_root    JsonNode* describing the cancel action
+ * @param[in]  curl_source GSource created with curl_source_new() running the request
+ * @param[in]  done        Function called once the request finished
+ * @param[in]  user_data   User data passed to done
+ * @param[out] error       Error
+ * @return TRUE if the request was started, FALSE otherwise (error set)
+ */
+static gboolean process_cancel(JsonNode *req_root, GSource *curl_source, RestResponseFunc done,
+                               gpointer user_data, GError **error)
+{
+        g_autofree gchar *cancel_url = NULL;
+
+        g_return_val_if_fail(req_root, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        // get cancel url
+        cancel_url = json_get_string(req_root, "$._links.cancelAction.href", error);
+        if (!cancel_url)
+                return FALSE;
+
+        // retrieve cancel details
+        return rest_request_async(curl_source, GET, cancel_url, NULL, NULL, done, user_data,
+                                  error);
+}
+
+/**
+ * @brief Process the cancel details requested by process_cancel(). If the action to cancel is
+ *        being downloaded, the download thread is asked to cancel it, check
+ *        process_cancel_pending() before sending the result with process_cancel_finish().
+ *
+ * @param[in]  response Parsed cancel details
+ * @param[out] error    Error
+ * @return stop id of the action to cancel, NULL on error (error set)
+ */
+static gchar* process_cancel_response(JsonParser *response, GError **error)
+{
+        g_autofree gchar *stop_id = NULL;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+        if (!response) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_JSON_RESPONSE_PARSE,
+                            "Empty cancel action resource");
+                return NULL;
+        }
+
+        // retrieve stop id
+        stop_id = json_get_string(json_parser_get_root(response), "$.cancelAction.stopId", error);
+        if (!stop_id)
+                return NULL;
+
+        g_message("Received cancelation for action %s", stop_id);
+
+        // cancel action if install not started yet
+        g_mutex_lock(&active_action->mutex);
+        if (!g_strcmp0(stop_id, active_action->id) &&
+            (active_action->state == ACTION_STATE_PROCESSING ||
+             active_action->state == ACTION_STATE_DOWNLOADING)) {
+                log_debug("Action %s is in state %d, waiting for cancel request to be processed",
+                        stop_id, active_action->state);
+                action_set_state(ACTION_STATE_CANCEL_REQUESTED);
+        }
+        // hawkBit's cancelation supersedes a local one still pending
+        if (!g_strcmp0(stop_id, active_action->id))
+                active_action->cancel_local = FALSE;
+        g_mutex_unlock(&active_action->mutex);
+
+        return g_steal_pointer(&stop_id);
+}
+
+/**
+ * @brief Check whether the download thread did not process a cancel request yet.
+ *
+ * @return TRUE if the cancel request is still pending, FALSE otherwise
+ */
+static gboolean process_cancel_pending(void)
+{
+        gboolean pending;
+
+        g_mutex_lock(&active_action->mutex);
+        pending = active_action->state == ACTION_STATE_CANCEL_REQUESTED;
+        g_mutex_unlock(&active_action->mutex);
+
+        return pending;
+}
+
+/**
+ * @brief Send the result of canceling action stop_id to hawkBit.
+ *
+ * @param[in]  stop_id hawkBit action ID to cancel
+ * @param[out] error   Error
+ * @return TRUE if cancel action succeeded, FALSE otherwise (error set)
+ */
+static gboolean process_cancel_finish(const gchar *stop_id, GError **error)
+{
+        gboolean res = TRUE;
+        g_autofree gchar *feedback_url = NULL, *msg = NULL;
+
+        g_return_val_if_fail(stop_id, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        // send cancel feedback
+        feedback_url = build_api_url("cancelAction/%s/feedback", stop_id);
+
+        g_mutex_lock(&active_action->mutex);
+        if (g_strcmp0(stop_id, active_action->id))
+                action_set_state(ACTION_STATE_NONE);
+
+        // send feedback
+        switch (active_action->state) {
+        case ACTION_STATE_NONE:
+                // action unknown, acknowledge cancelation nonetheless
+                log_debug("Received cancelation for unprocessed action %s, acknowledging.",
+                        stop_id);
+        // fall through
+        case ACTION_STATE_CANCELED:
+                feedback(feedback_url, stop_id, "Action canceled.", "success", "closed");
+                break;
+        case ACTION_STATE_SUCCESS:
+                log_debug("Cancelation impossible, installation succeeded already");
+                break;
+        case ACTION_STATE_ERROR:
+                log_debug("Cancelation impossible, installation failed already");
+                break;
+        case ACTION_STATE_INSTALLING:
+                msg = g_strdup("Cancelation impossible, installation started already.");
+                feedback(feedback_url, stop_id, msg, "success", "rejected");
+                res = FALSE;
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_CANCELATION,
+                            "%s", msg);
+                break;
+        default:
+                // other states are not expected here
+                g_critical("Unexpected action state after cancel request: %d", active_action->state);
+                g_assert_not_reached();
+                break;
+        }
+
+        g_mutex_unlock(&active_action->mutex);
+        return res;
+}
+
+void hawkbit_init(Config *config, GSourceFunc on_install_ready,
+                  InstalledVersionFunc get_installed_version, BundleCheckFunc check_bundle)
+{
+        g_autoptr(GError) error = NULL;
+
+        g_return_if_fail(config);
+
+        hawkbit_config = config;
+        software_ready_cb = on_install_ready;
+        installed_version_cb = get_installed_version;
+        check_bundle_cb = check_bundle;
+        curl_global_init(CURL_GLOBAL_ALL);
+        metrics_init(config->metrics_file);
+        connection_cache_init(config->connection_state_file);
+        checksum_set_backend(config->checksum_backend);
+        thread_priority_set(&config->thread_priority);
+
+#ifdef __GLIBC__
+        // a single malloc arena for all threads keeps the heap from fragmenting across arenas
+        if (config->low_memory)
+                mallopt(M_ARENA_MAX, 1);
+#endif
+
+        // API base URL and headers do not change at runtime, build them once
+        g_free(api_base_url);
+        api_base_url = g_strdup_printf("%s://%s/%s/controller/v1/",
+                                       config->ssl ? "https" : "http", config->hawkbit_server,
+                                       config->tenant_id);
+        g_clear_pointer(&api_headers, curl_slist_free_all);
+        g_clear_pointer(&api_body_headers, curl_slist_free_all);
+        api_headers = build_api_headers(FALSE, &error);
+        if (api_headers)
+                api_body_headers = build_api_headers(TRUE, &error);
+        if (error)
+                g_critical("Failed to set up API request headers: %s", error->message);
+
+        if (config->http2 &&
+            !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2))
+                g_message("libcurl lacks HTTP/2 support, falling back to HTTP/1.1");
+}
+
+/**
+ * @brief Callback for SIGHUP, re-reads config's download rate options, so they apply to running
+ * and future downloads without restarting.
+ *
+ * @param[in] user_data unused
+ * @return G_SOURCE_CONTINUE is always returned
+ */
+static gboolean reload_download_rate_cb(gpointer user_data)
+{
+        g_autoptr(GArray) windows = NULL;
+        g_autoptr(GError) error = NULL;
+        GArray *old_windows = NULL;
+        int max_download_rate = 0;
+
+        if (!load_download_rate_config(hawkbit_config->config_file, &max_download_rate, &windows,
+                                       &error)) {
+                g_warning("Failed to reload download rate options: %s", error->message);
+                return G_SOURCE_CONTINUE;
+        }
+
+        G_LOCK(download_rate);
+        old_windows = hawkbit_config->download_windows;
+        hawkbit_config->max_download_rate = max_download_rate;
+        hawkbit_config->download_windows = g_steal_pointer(&windows);
+        G_UNLOCK(download_rate);
+
+        if (old_windows)
+                g_array_unref(old_windows);
+
+        g_message("Reloaded download rate options.");
+        return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Steps of processing a poll response, run in this order.
+ */
+enum PollStep {
+        POLL_STEP_IDENTIFY,           /**< send the controller attributes if asked for */
+        POLL_STEP_DEPLOYMENT,         /**< process a deployment */
+        POLL_STEP_CANCEL,             /**< process a cancelation */
+        POLL_STEP_DONE,
+};
+
+typedef struct ClientData_ {
+        GMainLoop *loop;
+        gboolean res;
+        long hawkbit_interval_check_sec;
+        GSource *poll_source;
+        GSource *curl_source;
+        RestValidator poll_validator;
+        JsonParser *poll_response;
+        gint64 poll_start;
+        gint64 feedback_wait_start;
+        enum PollStep poll_step;
+        gboolean poll_res;
+        gboolean reprocess;
+        gint identify_retries;
+        guint failed_polls;
+        gchar *cancel_id;
+        gboolean polling;
+        gboolean poll_now;
+} ClientData;
+
+static gboolean hawkbit_pull_cb(gpointer user_data);
+
+/**
+ * @brief Arm a one-shot timer running func with data, replacing a previously armed timer. There
+ *        is a single timer: either for the next poll or for a step of the current poll waiting
+ *        for something.
+ *
+ * @param[in] data   ClientData*
+ * @param[in] source Timeout GSource, ownership is taken
+ * @param[in] name   Name of the timer
+ * @param[in] func   Function to call once the timer expired
+ */
+static void schedule_timeout(ClientData *data, GSource *source, const gchar *name,
+                             GSourceFunc func)
+{
+        g_return_if_fail(data);
+        g_return_if_fail(source);
+
+        if (data->poll_source) {
+                g_source_destroy(data->poll_source);
+                g_source_unref(data->poll_source);
+        }
+
+        data->poll_source = source;
+        g_source_set_name(data->poll_source, name);
+        g_source_set_callback(data->poll_source, func, data, NULL);
+        g_source_attach(data->poll_source, g_main_loop_get_context(data->loop));
+}
+
+/**
+ * @brief Arm a one-shot timer running hawkbit_pull_cb() in given number of seconds, replacing a
+ *        previously armed timer.
+ *
+ * @param[in] data    ClientData*
+ * @param[in] seconds Time until next poll in seconds
+ */
+static void schedule_pull(ClientData *data, long seconds)
+{
+        g_return_if_fail(data);
+
+        log_debug("Next poll in %lds", seconds);
+
+        schedule_timeout(data, g_timeout_source_new_seconds(MAX(seconds, 0)), "Poll timeout",
+                         hawkbit_pull_cb);
+}
+
+/**
+ * @brief In low-memory mode, return memory freed by the finished poll to the system and log the
+ *        process' memory use, so a fixed memory budget can be verified.
+ */
+static void low_memory_trim(void)
+{
+        guint64 rss = 0, peak = 0;
+
+        if (!hawkbit_config->low_memory)
+                return;
+
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+
+        if (metrics_get_memory_usage(&rss, &peak))
+                log_info("Memory use: %" G_GUINT64_FORMAT " KiB resident, %" G_GUINT64_FORMAT
+                       " KiB peak", rss / 1024, peak / 1024);
+}
+
+/**
+ * @brief Finish the current poll: account for its duration and arm the timer for the next poll.
+ *        In run_once mode, the main loop is quit instead, once a running download finished.
+ *
+ * @param[in] data ClientData*
+ */
+static void poll_finish(ClientData *data)
+{
+        g_return_if_fail(data);
+
+        metrics_record_phase(METRICS_PHASE_POLL, g_get_monotonic_time() - data->poll_start);
+        low_memory_trim();
+
+        if (run_once) {
+                if (thread_download) {
+                        gpointer thread_ret = g_thread_join(thread_download);
+                        data->poll_res = GPOINTER_TO_INT(thread_ret);
+                        thread_download = NULL;
+                }
+
+                data->res = data->poll_res;
+                g_main_loop_quit(data->loop);
+                return;
+        }
+
+        connection_cache_save(FALSE);
+
+        // a poll asked for meanwhile follows right away
+        data->polling = FALSE;
+        schedule_pull(data, data->poll_now ? 0 : data->hawkbit_interval_check_sec);
+        data->poll_now = FALSE;
+}
+
+/**
+ * @brief Account for the result of a poll step. A failed step is logged and the poll response
+ *        is processed again on the next poll, even if hawkBit's response does not change.
+ *
+ * @param[in] data  ClientData*
+ * @param[in] error Error of the step or NULL if it succeeded
+ */
+static void poll_step_result(ClientData *data, const GError *error)
+{
+        g_return_if_fail(data);
+
+        data->poll_res = !error;
+        if (!error)
+                return;
+
+        g_warning("%s", error->message);
+        data->reprocess = TRUE;
+}
+
+static void poll_continue(ClientData *data);
+
+/**
+ * @brief Callback for main loop, continues processing the poll response after a step waited.
+ *
+ * @param[in] user_data ClientData*
+ * @return G_SOURCE_REMOVE is always returned
+ */
+static gboolean poll_continue_cb(gpointer user_data)
+{
+        poll_continue(user_data);
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief RestResponseFunc of identify().
+ */
+static void identify_done(JsonParser *response, gboolean unchanged,
+                          const GError *error, gint64 retry_after,
+                          gpointer user_data)
+{
+        ClientData *data = user_data;
+        gint64 wait;
+
+        if (is_retriable_api_error(error) && data->identify_retries < MAX_RETRIES_ON_API_ERROR) {
+                wait = MAX(get_backoff_time(API_RETRY_WAIT_MS, data->identify_retries),
+                           retry_after);
+                data->identify_retries++;
+                log_debug("%s Trying again in %.1fs (%d/%d)..", error->message,
+                        (gdouble) wait / 1000, data->identify_retries, MAX_RETRIES_ON_API_ERROR);
+                metrics_record_retry(METRICS_TRANSFER_API);
+
+                data->poll_step = POLL_STEP_IDENTIFY;
+                schedule_timeout(data, g_timeout_source_new(wait), "Identify retry",
+                                 poll_continue_cb);
+                return;
+        }
+
+        poll_step_result(data, error);
+        poll_continue(data);
+}
+
+/**
+ * @brief RestResponseFunc of process_deployment().
+ */
+static void process_deployment_done(JsonParser *response, gboolean unchanged,
+                                    const GError *request_error, gint64 retry_after,
+                                    gpointer user_data)
+{
+        ClientData *data = user_data;
+        g_autoptr(GError) error = NULL;
 
-                resp_root = json_parser_get_root(parser);
-                json_resp_str = json_to_string(resp_root, TRUE);
-                g_debug("Response body: %s", json_resp_str);
-                *jsonResponseParser = g_steal_pointer(&parser);
-        }
+        g_mutex_lock(&active_action->mutex);
+        process_deployment_response(response, request_error, &error);
+        g_mutex_unlock(&active_action->mutex);
 
-        return TRUE;
+        poll_step_result(data, error);
+        poll_continue(data);
 }
 
 /**
- * @brief Perform REST request with JSON data, expecting response JSON data. On HTTP error
- * 409 (Conflict) and 429 (Too Many Requests), try again (up to MAX_RETRIES_ON_API_ERROR).
+ * @brief Callback for main loop, sends the result of a cancelation once the download thread
+ *        processed it, checking every POLL_WAIT_INTERVAL_MS.
  *
- * @param[in]  method             HTTP Method, e.g. GET
- * @param[in]  url                URL used in HTTP REST request
- * @param[in]  jsonRequestBody    REST request body. If NULL, no body is sent
- * @param[out] jsonResponseParser Return location for a REST response or NULL to skip response
- *                                parsing
- * @param[out] error              Error
- * @return TRUE if request and response parser (if given) suceeded, FALSE otherwise (error set).
+ * @param[in] user_data ClientData*
+ * @return G_SOURCE_CONTINUE while the cancelation is pending, G_SOURCE_REMOVE otherwise
  */
-static gboolean rest_request_retriable(enum HTTPMethod method, const gchar *url,
-                                       JsonBuilder *jsonRequestBody,
-                                       JsonParser **jsonResponseParser, GError **error)
+static gboolean process_cancel_wait_cb(gpointer user_data)
 {
-        gboolean res, retry;
-        gint retry_count = 0;
-        GError *ierror = NULL;
+        ClientData *data = user_data;
+        g_autofree gchar *stop_id = NULL;
+        g_autoptr(GError) error = NULL;
 
-        g_return_val_if_fail(url, FALSE);
-        g_return_val_if_fail(jsonResponseParser == NULL || *jsonResponseParser == NULL, FALSE);
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        if (process_cancel_pending())
+                return G_SOURCE_CONTINUE;
 
-        while (1) {
-                res = rest_request(method, url, jsonRequestBody, jsonResponseParser, &ierror);
-                retry = (g_error_matches(ierror, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 409) ||
-                         g_error_matches(ierror, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 429)) &&
-                        retry_count < MAX_RETRIES_ON_API_ERROR;
-                if (!retry)
-                        break;
+        stop_id = g_steal_pointer(&data->cancel_id);
+        process_cancel_finish(stop_id, &error);
+        poll_step_result(data, error);
+        poll_continue(data);
 
-                g_debug("%s Trying again (%d/%d)..", ierror->message, retry_count+1,
-                        MAX_RETRIES_ON_API_ERROR);
-                g_clear_error(&ierror);
-                g_usleep(1000000);
-                retry_count++;
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief RestResponseFunc of process_cancel().
+ */
+static void process_cancel_done(JsonParser *response, gboolean unchanged,
+                                const GError *request_error, gint64 retry_after,
+                                gpointer user_data)
+{
+        ClientData *data = user_data;
+        g_autoptr(GError) error = NULL;
+
+        if (request_error) {
+                poll_step_result(data, request_error);
+                poll_continue(data);
+                return;
         }
 
-        if (!res)
-                g_propagate_error(error, ierror);
+        g_free(data->cancel_id);
+        data->cancel_id = process_cancel_response(response, &error);
+        if (!data->cancel_id) {
+                poll_step_result(data, error);
+                poll_continue(data);
+                return;
+        }
 
-        return res;
+        // the download thread stops at the next occasion, do not block the main loop meanwhile
+        if (process_cancel_pending()) {
+                schedule_timeout(data, g_timeout_source_new(POLL_WAIT_INTERVAL_MS),
+                                 "Cancel wait", process_cancel_wait_cb);
+                return;
+        }
+
+        process_cancel_wait_cb(data);
 }
 
 /**
- * @brief Build hawkBit JSON request.
- *
- * @see https://www.eclipse.org/hawkbit/rest-api/rootcontroller-api-guide/#_post_tenant_controller_v1_controllerid_deploymentbase_actionid_feedback
+ * @brief Run the remaining steps asked for by the poll response one after another: each step's
+ *        request is started and processing continues from its callback. Finishes the poll once
+ *        all steps are done.
  *
- * @param[in] id         hawkBit action ID or NULL (configData usecase)
- * @param[in] detail     Detail message or NULL (configData usecase)
- * @param[in] finished   hawkBit status of the result
- * @param[in] execution  hawkBit status of the action execution
- * @param[in] attributes hawkBit controller attributes or NULL (feedback usecase)
- * @return JsonBuilder* with built hawkBit request
+ * @param[in] data ClientData*
  */
-static JsonBuilder* json_build_status(const gchar *id, const gchar *detail, const gchar *finished,
-                                      const gchar *execution, GHashTable *attributes)
+static void poll_continue(ClientData *data)
 {
-        GHashTableIter iter;
-        gpointer key, value;
-        g_autoptr(JsonBuilder) builder = NULL;
-        time_t current_time;
-        struct tm time_info;
-        char timeString[16];
+        JsonNode *json_root = json_parser_get_root(data->poll_response);
 
-        g_return_val_if_fail(finished, NULL);
-        g_return_val_if_fail(execution, NULL);
+        while (data->poll_step < POLL_STEP_DONE) {
+                g_autoptr(GError) error = NULL;
 
-        // get current time in UTC
-        time(&current_time);
-        gmtime_r(&current_time, &time_info);
-        strftime(timeString, sizeof(timeString), "%Y%m%dT%H%M%S", &time_info);
+                switch (data->poll_step++) {
+                case POLL_STEP_IDENTIFY:
+                        if (!json_contains(json_root, "$._links.configData"))
+                                break;
 
-        builder = json_builder_new();
+                        // hawkBit has asked us to identify ourselves
+                        if (identify(data->curl_source, identify_done, data, &error))
+                                return;
 
-        // build json status
-        json_builder_begin_object(builder);
+                        poll_step_result(data, error);
+                        break;
+                case POLL_STEP_DEPLOYMENT:
+                        if (!json_contains(json_root, "$._links.deploymentBase")) {
+                                g_message("No new software.");
+                                break;
+                        }
+
+                        // hawkBit has a new deployment for us
+                        g_mutex_lock(&active_action->mutex);
+                        if (process_deployment(json_root, data->curl_source,
+                                               process_deployment_done, data, &error)) {
+                                g_mutex_unlock(&active_action->mutex);
+                                return;
+                        }
+                        g_mutex_unlock(&active_action->mutex);
 
-        if (id) {
-                json_builder_set_member_name(builder, "id");
-                json_builder_add_string_value(builder, id);
+                        if (g_error_matches(error, RHU_HAWKBIT_CLIENT_ERROR,
+                                            RHU_HAWKBIT_CLIENT_ERROR_ALREADY_IN_PROGRESS)) {
+                                log_debug("%s", error->message);
+                                data->poll_res = FALSE;
+                        } else {
+                                poll_step_result(data, error);
+                        }
+                        break;
+                case POLL_STEP_CANCEL:
+                        if (!json_contains(json_root, "$._links.cancelAction"))
+                                break;
+
+                        if (process_cancel(json_root, data->curl_source, process_cancel_done,
+                                           data, &error))
+                                return;
+
+                        poll_step_result(data, error);
+                        break;
+                default:
+                        g_assert_not_reached();
+                }
         }
 
-        json_builder_set_member_name(builder, "time");
-        json_builder_add_string_value(builder, timeString);
+        // make sure failed actions are retried, even if hawkBit's response does not change
+        if (data->reprocess) {
+                g_clear_pointer(&data->poll_validator.etag, g_free);
+                g_clear_pointer(&data->poll_validator.checksum, g_free);
+        }
 
-        json_builder_set_member_name(builder, "status");
-        json_builder_begin_object(builder);
-        json_builder_set_member_name(builder, "result");
-        json_builder_begin_object(builder);
+        // get hawkbit sleep time (how often should we check for new software)
+        data->hawkbit_interval_check_sec = json_get_sleeptime(json_root);
 
-        json_builder_set_member_name(builder, "finished");
-        json_builder_add_string_value(builder, finished);
-        json_builder_end_object(builder);
+        poll_finish(data);
+}
 
-        json_builder_set_member_name(builder, "execution");
-        json_builder_add_string_value(builder, execution);
+/**
+ * @brief RestResponseFunc of the poll of the controller base poll resource, starts processing
+ *        the actions asked for.
+ */
+static void hawkbit_pull_done(JsonParser *response, gboolean unchanged,
+                              const GError *error, gint64 retry_after,
+                              gpointer user_data)
+{
+        ClientData *data = user_data;
 
-        if (detail) {
-                json_builder_set_member_name(builder, "details");
-                json_builder_begin_array(builder);
-                json_builder_add_string_value(builder, detail);
-                json_builder_end_array(builder);
+        data->poll_res = !error;
+        if (error) {
+                if (g_error_matches(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 401)) {
+                        if (hawkbit_config->auth_token)
+                                g_warning("Failed to authenticate. Check if auth_token is correct?");
+                        if (hawkbit_config->gateway_token)
+                                g_warning("Failed to authenticate. Check if gateway_token is correct?");
+                } else {
+                        g_warning("Scheduled check for new software failed: %s (%d)",
+                                  error->message, error->code);
+                }
+
+                data->hawkbit_interval_check_sec = get_retry_time(data->failed_polls++,
+                                                                  retry_after);
+                poll_finish(data);
+                return;
         }
-        json_builder_end_object(builder);
 
-        if (attributes) {
-                json_builder_set_member_name(builder, "data");
-                json_builder_begin_object(builder);
-                g_hash_table_iter_init(&iter, attributes);
-                while (g_hash_table_iter_next(&iter, &key, &value)) {
-                        json_builder_set_member_name(builder, key);
-                        json_builder_add_string_value(builder, value);
+        data->failed_polls = 0;
+        dbus_service_set_last_poll(g_get_real_time() / G_USEC_PER_SEC);
+
+        if (unchanged) {
+                JsonNode *json_root = data->poll_response ?
+                                      json_parser_get_root(data->poll_response) : NULL;
+
+                if (!json_root) {
+                        // no response to reuse, make sure the next poll is processed again
+                        g_warning("Empty poll response");
+                        g_clear_pointer(&data->poll_validator.etag, g_free);
+                        g_clear_pointer(&data->poll_validator.checksum, g_free);
+                        data->poll_res = FALSE;
+                        data->hawkbit_interval_check_sec = get_retry_time(data->failed_polls++,
+                                                                          0);
+                        poll_finish(data);
+                        return;
                 }
-                json_builder_end_object(builder);
+
+                // nothing to do that was not done on the previous poll already
+                log_debug("Controller state unchanged since last poll.");
+                data->hawkbit_interval_check_sec = json_get_sleeptime(json_root);
+                poll_finish(data);
+                return;
         }
-        json_builder_end_object(builder);
 
-        return g_steal_pointer(&builder);
+        // keep response, it is reused for unchanged responses
+        g_clear_object(&data->poll_response);
+        data->poll_response = response ? g_object_ref(response) : NULL;
+
+        data->poll_step = POLL_STEP_IDENTIFY;
+        data->reprocess = FALSE;
+        data->identify_retries = 0;
+        poll_continue(data);
 }
 
 /**
- * @brief Send feedback to hawkBit.
+ * @brief Callback for main loop, run by the timer armed with schedule_pull(), starts polling the
+ * controller base poll resource. The response is processed by hawkbit_pull_done(), which triggers
+ * appropriate actions and arms the timer for the next poll once they are done. The main loop is
+ * never blocked meanwhile.
  *
- * @param[in]  url        hawkBit URL used for request
- * @param[in]  id         hawkBit action ID
- * @param[in]  detail     Detail message
- * @param[in]  finished   hawkBit status of the result
- * @param[in]  execution  hawkBit status of the action execution
- * @param[out] error      Error
- * @return TRUE if feedback was sent successfully, FALSE otherwise (error set)
+ * @param[in] user_data ClientData*
+ * @return G_SOURCE_REMOVE is always returned, the next poll is scheduled via schedule_pull()
  */
-static gboolean feedback(const gchar *url, const gchar *id, const gchar *detail,
-                         const gchar *finished, const gchar *execution, GError **error)
+static gboolean hawkbit_pull_cb(gpointer user_data)
 {
-        g_autoptr(JsonBuilder) builder = NULL;
-        gboolean res = FALSE;
+        ClientData *data = user_data;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *get_tasks_url = NULL;
 
-        g_return_val_if_fail(url, FALSE);
-        g_return_val_if_fail(id, FALSE);
-        g_return_val_if_fail(detail, FALSE);
-        g_return_val_if_fail(finished, FALSE);
-        g_return_val_if_fail(execution, FALSE);
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        g_return_val_if_fail(user_data, FALSE);
 
-        if (!g_strcmp0(finished, "failure"))
-                g_warning("%s", detail);
-        else
-                g_message("%s", detail);
+        // the system is about to reboot, the installed action must not be processed again
+        if (g_atomic_int_get(&reboot_pending)) {
+                schedule_pull(data, data->hawkbit_interval_check_sec);
+                return G_SOURCE_REMOVE;
+        }
 
-        builder = json_build_status(id, detail, finished, execution, NULL);
+        data->polling = TRUE;
+
+        // let hawkBit know about the previous result before asking for new actions, otherwise the
+        // finished action is offered again, but do not hold back polls for long
+        if (!data->feedback_wait_start)
+                data->feedback_wait_start = g_get_monotonic_time();
+        if (feedback_final_pending() &&
+            g_get_monotonic_time() - data->feedback_wait_start <
+            FEEDBACK_WAIT_MAX_MS * G_TIME_SPAN_MILLISECOND) {
+                schedule_timeout(data, g_timeout_source_new(FEEDBACK_WAIT_INTERVAL_MS),
+                                 "Feedback wait", hawkbit_pull_cb);
+                return G_SOURCE_REMOVE;
+        }
+        data->feedback_wait_start = 0;
 
-        res = rest_request_retriable(POST, url, builder, NULL, error);
-        if (!res)
-                g_prefix_error(error, "Failed to report \"%s\" feedback: ", detail);
+        data->poll_start = g_get_monotonic_time();
 
-        return res;
+        if (g_atomic_int_compare_and_exchange(&poll_validator_stale, TRUE, FALSE)) {
+                g_clear_pointer(&data->poll_validator.etag, g_free);
+                g_clear_pointer(&data->poll_validator.checksum, g_free);
+        }
+
+        // build hawkBit get tasks URL
+        get_tasks_url = build_api_url(NULL);
+
+        g_message("Checking for new software...");
+        if (!rest_request_async(data->curl_source, GET, get_tasks_url, NULL, &data->poll_validator,
+                                hawkbit_pull_done, data, &error))
+                hawkbit_pull_done(NULL, FALSE, error, 0, data);
+
+        return G_SOURCE_REMOVE;
 }
 
+/*
+ * Gateway mode: one process serves all controllers of config's gateway_devices, authenticated
+ * with the gateway token. Their requests are multiplexed over the curl source driven by the main
+ * loop, each controller is polled on its own schedule and keeps its own action state. Bundles
+ * are downloaded once per checksum, no matter how many controllers wait for them.
+ */
+
+typedef struct GatewayDownload_ GatewayDownload;
+
+/**
+ * @brief struct containing the state of a controller served in gateway mode.
+ */
+typedef struct GatewayDevice_ {
+        const GatewayDeviceConfig *config; /**< controller id and attributes */
+        RestValidator poll_validator;     /**< validators of the previous poll response */
+        JsonParser *poll_response;        /**< previous changed poll response or NULL */
+        gint64 next_poll;                 /**< monotonic time of the next poll */
+        guint failed_polls;               /**< number of polls failed in a row */
+        guint pending;                    /**< number of requests in flight */
+        gboolean polled;                  /**< polled at least once */
+        gboolean failed;                  /**< a poll or action failed (run_once result) */
+        gchar *action_id;                 /**< hawkBit action id of the current deployment or NULL */
+        gchar *feedback_url;              /**< feedback URL of the current deployment or NULL */
+        enum ActionState state;           /**< state of the current deployment */
+        gboolean do_install;              /**< whether the bundle should be installed */
+        GatewayDownload *download;        /**< download the controller uses or NULL */
+} GatewayDevice;
+
+/**
+ * @brief struct containing a bundle download shared by all controllers deployed the same
+ *        artifact.
+ */
+struct GatewayDownload_ {
+        CURL *curl;                       /**< Curl handle of the transfer or NULL */
+        struct curl_slist *headers;       /**< request headers */
+        gboolean active;                  /**< transfer is running on the curl source */
+        gchar *key;                       /**< artifact cache key, identifying the bundle */
+        Artifact *artifact;               /**< artifact downloaded */
+        gchar *file;                      /**< path the bundle is downloaded to */
+        BundleWriter writer;              /**< writer of file during transfer */
+        DownloadState *state;             /**< checksums of the data written */
+        GPtrArray *devices;               /**< GatewayDevice* using the download */
+        gboolean complete;                /**< bundle is downloaded and verified */
+};
+
+/**
+ * @brief struct containing the state of gateway mode.
+ */
+typedef struct Gateway_ {
+        GMainLoop *loop;                  /**< main loop transfers and polls are run from */
+        GSource *curl_source;             /**< curl source running all transfers */
+        GPtrArray *devices;               /**< GatewayDevice* of all controllers */
+        GHashTable *downloads;            /**< artifact cache key -> GatewayDownload* */
+        GSource *poll_source;             /**< timer for the next due poll */
+} Gateway;
+
+static Gateway *gateway = NULL;
+
 /**
- * @brief Send progress feedback to hawkBit (finished=none, execution=proceeding).
+ * @brief Start REST request with JSON data on behalf of device, expecting response JSON data.
+ *        The done callback is passed device as user data and must decrement its pending count.
  *
- * @param[in]  url    hawkBit URL used for request
- * @param[in]  id     hawkBit action ID
- * @param[in]  detail Detail message
- * @param[out] error  Error
- * @return TRUE if feedback was sent successfully, FALSE otherwise (error set)
+ * @param[in]  device          GatewayDevice to make the request for
+ * @param[in]  method          HTTP Method, e.g. GET
+ * @param[in]  url             URL used in HTTP REST request
+ * @param[in]  jsonRequestBody REST request body. If NULL, no body is sent
+ * @param[in]  validator       RestValidator of the previous response or NULL
+ * @param[in]  done            Callback to evaluate the response
+ * @param[out] error           Error
+ * @return TRUE if the request was started, FALSE otherwise (error set)
  */
-static gboolean feedback_progress(const gchar *url, const gchar *id, const gchar *detail,
-                                  GError **error)
+static gboolean gateway_request(GatewayDevice *device, enum HTTPMethod method, const gchar *url,
+                                JsonBuilder *jsonRequestBody, RestValidator *validator,
+                                RestResponseFunc done, GError **error)
 {
-        gboolean res = FALSE;
+        g_return_val_if_fail(device, FALSE);
 
-        g_return_val_if_fail(url, FALSE);
-        g_return_val_if_fail(id, FALSE);
-        g_return_val_if_fail(detail, FALSE);
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        if (!rest_request_async(gateway->curl_source, method, url, jsonRequestBody, validator,
+                                done, device, error))
+                return FALSE;
 
-        res = feedback(url, id, detail, "none", "proceeding", error);
-        g_prefix_error(error, "Progress feedback: ");
+        device->pending++;
 
-        return res;
+        return TRUE;
 }
 
 /**
- * @brief Get polling sleep time from hawkBit JSON response.
+ * @brief Send feedback to hawkBit asynchronously on behalf of device.
  *
- * @param[in] root JsonNode* with hawkBit response
- * @return time to sleep in seconds, either from JSON or (if not found) from config's retry_wait (or 5s during active action)
+ * @param[in] device    GatewayDevice to send feedback for
+ * @param[in] url       hawkBit URL used for request
+ * @param[in] id        hawkBit action ID
+ * @param[in] detail    Detail message
+ * @param[in] finished  hawkBit status of the result
+ * @param[in] execution hawkBit status of the action execution
  */
-static long json_get_sleeptime(JsonNode *root)
+static void gateway_feedback(GatewayDevice *device, const gchar *url, const gchar *id,
+                             const gchar *detail, const gchar *finished, const gchar *execution)
 {
-        g_autofree gchar *sleeptime_str = NULL;
-        g_autoptr(GError) error = NULL;
-        struct tm time;
+        g_return_if_fail(device);
+        g_return_if_fail(url);
+        g_return_if_fail(id);
+        g_return_if_fail(detail);
 
-        g_return_val_if_fail(root, 0L);
+        if (!g_strcmp0(finished, "failure"))
+                g_warning("%s: %s", device->config->controller_id, detail);
+        else
+                g_message("%s: %s", device->config->controller_id, detail);
 
-        /* When processing an action, return fixed sleeptime of 5s to allow
-         * receiving cancelation requests etc.*/
-        g_mutex_lock(&active_action->mutex);
-        if (active_action->state == ACTION_STATE_PROCESSING ||
-            active_action->state == ACTION_STATE_DOWNLOADING ||
-            active_action->state == ACTION_STATE_CANCEL_REQUESTED) {
-                g_mutex_unlock(&active_action->mutex);
-                return 5L;
-        }
-        g_mutex_unlock(&active_action->mutex);
+        feedback_queue_push(url, id, detail, finished, execution, FALSE);
+}
 
-        sleeptime_str = json_get_string(root, "$.config.polling.sleep", &error);
-        if (!sleeptime_str) {
-                g_warning("Polling sleep time not found: %s. Using fallback: %ds",
-                          error->message, hawkbit_config->retry_wait);
-                return hawkbit_config->retry_wait;
-        }
+/**
+ * @brief Remember that processing device's poll response failed, so it is processed again on
+ *        the next poll even if hawkBit's response does not change.
+ *
+ * @param[in] device GatewayDevice that failed
+ */
+static void gateway_device_failed(GatewayDevice *device)
+{
+        g_return_if_fail(device);
 
-        strptime(sleeptime_str, "%T", &time);
-        return (time.tm_sec + (time.tm_min * 60) + (time.tm_hour * 60 * 60));
+        device->failed = TRUE;
+        g_clear_pointer(&device->poll_validator.etag, g_free);
+        g_clear_pointer(&device->poll_validator.checksum, g_free);
 }
 
 /**
- * @brief Build API URL
+ * @brief Log error on behalf of device and remember processing its poll response failed.
  *
- * @param path[in] a printf()-like format string describing the API path or NULL for base path
- * @param ... The arguments to be inserted in path
+ * @param[in] device GatewayDevice that failed
+ * @param[in] error  Error
+ */
+static void gateway_device_error(GatewayDevice *device, const GError *error)
+{
+        g_return_if_fail(device);
+        g_return_if_fail(error);
+
+        g_warning("%s: %s", device->config->controller_id, error->message);
+        gateway_device_failed(device);
+}
+
+/**
+ * @brief Check whether device has neither a request in flight nor an unfinished deployment.
  *
- * @return a newly allocated full API URL
+ * @param[in] device GatewayDevice to check
+ * @return TRUE if device is idle, FALSE otherwise
  */
-__attribute__((__format__(__printf__, 1, 2)))
-static gchar* build_api_url(const gchar *path, ...)
+static gboolean gateway_device_idle(const GatewayDevice *device)
 {
-        g_autofree gchar *buffer = NULL;
-        va_list args;
+        return !device->pending && !device->download &&
+               device->state != ACTION_STATE_PROCESSING;
+}
 
-        if (path) {
-                va_start(args, path);
-                buffer = g_strdup_vprintf(path, args);
-                va_end(args);
+/**
+ * @brief Set the time device is polled next, unless in run_once mode.
+ *
+ * @param[in] device  GatewayDevice to schedule
+ * @param[in] seconds Time until next poll in seconds
+ */
+static void gateway_device_schedule(GatewayDevice *device, long seconds)
+{
+        g_return_if_fail(device);
+
+        if (run_once) {
+                device->next_poll = G_MAXINT64;
+                return;
         }
 
-        return g_strdup_printf(
-                "%s://%s/%s/controller/v1/%s%s%s",
-                hawkbit_config->ssl ? "https" : "http",
-                hawkbit_config->hawkbit_server, hawkbit_config->tenant_id,
-                hawkbit_config->controller_id,
-                buffer ? "/" : "",
-                buffer ? buffer : "");
+        log_debug("%s: Next poll in %lds", device->config->controller_id, seconds);
+        device->next_poll = g_get_monotonic_time() + (gint64) MAX(seconds, 0) * G_USEC_PER_SEC;
 }
 
-gboolean hawkbit_progress(const gchar *msg)
+static gboolean gateway_poll_cb(gpointer user_data);
+
+/**
+ * @brief Arm the timer for the earliest due poll of all controllers without requests in flight.
+ *        In run_once mode, the main loop is quit once all controllers were polled and are idle.
+ */
+static void gateway_update(void)
 {
-        g_autofree gchar *feedback_url = NULL;
-        g_autoptr(GError) error = NULL;
+        gint64 next = G_MAXINT64;
+        gboolean done = TRUE;
 
-        g_return_val_if_fail(msg, FALSE);
+        for (guint i = 0; i < gateway->devices->len; i++) {
+                GatewayDevice *device = g_ptr_array_index(gateway->devices, i);
 
-        g_mutex_lock(&active_action->mutex);
+                if (!device->polled || !gateway_device_idle(device))
+                        done = FALSE;
+                if (!device->pending)
+                        next = MIN(next, device->next_poll);
+        }
 
-        feedback_url = build_api_url("deploymentBase/%s/feedback", active_action->id);
+        if (run_once && done) {
+                g_main_loop_quit(gateway->loop);
+                return;
+        }
+
+        if (gateway->poll_source) {
+                g_source_destroy(gateway->poll_source);
+                g_clear_pointer(&gateway->poll_source, g_source_unref);
+        }
+
+        if (next == G_MAXINT64)
+                return;
 
-        if (!feedback_progress(feedback_url, active_action->id, msg, &error))
-                g_warning("%s", error->message);
+        gateway->poll_source = g_timeout_source_new(
+                MAX(next - g_get_monotonic_time(), 0) / 1000);
+        g_source_set_name(gateway->poll_source, "Gateway poll timeout");
+        g_source_set_callback(gateway->poll_source, gateway_poll_cb, NULL, NULL);
+        g_source_attach(gateway->poll_source, g_main_loop_get_context(gateway->loop));
+}
 
-        g_mutex_unlock(&active_action->mutex);
+static void gateway_download_free(GatewayDownload *download)
+{
+        if (!download)
+                return;
 
-        return G_SOURCE_REMOVE;
+        if (download->active)
+                curl_source_remove(gateway->curl_source, download->curl);
+        if (download->curl)
+                curl_easy_cleanup(download->curl);
+        curl_slist_free_all(download->headers);
+        bundle_writer_close(&download->writer, NULL);
+        download_state_free(download->state);
+
+        if (g_remove(download->file) && errno != ENOENT)
+                g_warning("Failed to delete file: %s", download->file);
+
+        artifact_free(download->artifact);
+        g_ptr_array_unref(download->devices);
+        g_free(download->file);
+        g_free(download->key);
+        g_free(download);
 }
 
 /**
- * @brief Provide meta information that will allow the hawkBit to identify the device on a hardware
- * level.
- *
- * @see https://www.eclipse.org/hawkbit/rest-api/rootcontroller-api-guide/#_put_tenant_controller_v1_controllerid_configdata
+ * @brief Stop device from using its download. A download no controller uses anymore is aborted
+ *        (or its file deleted if complete).
  *
- * @param[out] error Error
- * @return TRUE if identification succeeded, FALSE otherwise (error set)
+ * @param[in] device GatewayDevice to detach
  */
-static gboolean identify(GError **error)
+static void gateway_download_detach(GatewayDevice *device)
 {
-        g_autofree gchar *put_config_data_url = NULL;
-        g_autoptr(JsonBuilder) builder = NULL;
+        GatewayDownload *download = NULL;
 
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+        g_return_if_fail(device);
 
-        g_debug("Providing meta information to hawkbit server");
-        put_config_data_url = build_api_url("configData");
+        download = g_steal_pointer(&device->download);
+        if (!download)
+                return;
 
-        builder = json_build_status(NULL, NULL, "success", "closed", hawkbit_config->device);
+        g_ptr_array_remove(download->devices, device);
+        if (download->devices->len)
+                return;
+
+        if (!download->complete)
+                g_message("Aborting download of %s, no controller needs it anymore.",
+                          download->key);
 
-        return rest_request_retriable(PUT, put_config_data_url, builder, NULL, error);
+        g_hash_table_remove(gateway->downloads, download->key);
 }
 
 /**
- * @brief Deletes RAUC bundle at config's bundle_download_location.
+ * @brief Child watch callback for gateway_install_command, sends the installation's result as
+ *        feedback.
+ *
+ * @param[in] pid       Process id of the install command
+ * @param[in] status    Wait status of the install command
+ * @param[in] user_data GatewayDevice* the bundle was installed on
  */
-static void process_deployment_cleanup()
-{
-        if (!g_file_test(hawkbit_config->bundle_download_location, G_FILE_TEST_IS_REGULAR))
-                return;
-
-        if (g_remove(hawkbit_config->bundle_download_location))
-                g_warning("Failed to delete file: %s", hawkbit_config->bundle_download_location);
-}
-
-gboolean install_complete_cb(gpointer ptr)
+static void gateway_install_done_cb(GPid pid, gint status, gpointer user_data)
 {
-        gboolean res = FALSE;
+        GatewayDevice *device = user_data;
         g_autoptr(GError) error = NULL;
-        struct on_install_complete_userdata *result = ptr;
-        g_autofree gchar *feedback_url = NULL;
-
-        g_return_val_if_fail(ptr, FALSE);
+        g_autofree gchar *msg = NULL;
 
-        g_mutex_lock(&active_action->mutex);
-
-        active_action->state = result->install_success ? ACTION_STATE_SUCCESS : ACTION_STATE_ERROR;
-        feedback_url = build_api_url("deploymentBase/%s/feedback", active_action->id);
-        res = feedback(
-                feedback_url, active_action->id,
-                result->install_success ? "Software bundle installed successfully."
-                : "Failed to install software bundle.",
-                result->install_success ? "success" : "failure",
-                "closed", &error);
-
-        if (!res)
-                g_warning("%s", error->message);
-
-        process_deployment_cleanup();
-        g_mutex_unlock(&active_action->mutex);
+        g_spawn_close_pid(pid);
 
-        if (result->install_success && hawkbit_config->post_update_reboot) {
-                sync();
-                if (reboot(RB_AUTOBOOT) < 0)
-                        g_critical("Failed to reboot: %s", g_strerror(errno));
+        if (g_spawn_check_exit_status(status, &error)) {
+                device->state = ACTION_STATE_SUCCESS;
+                gateway_feedback(device, device->feedback_url, device->action_id,
+                                 "Software bundle installed successfully.", "success", "closed");
+        } else {
+                device->state = ACTION_STATE_ERROR;
+                msg = g_strdup_printf("Failed to install software bundle: %s", error->message);
+                gateway_feedback(device, device->feedback_url, device->action_id, msg, "failure",
+                                 "closed");
+                device->failed = TRUE;
         }
 
-        return G_SOURCE_REMOVE;
+        gateway_download_detach(device);
+        gateway_update();
 }
 
 /**
- * @brief Thread to download given Artifact, verfiy its checksum, send hawkBit
- * feedback and call software_ready_cb() callback on success.
+ * @brief Run gateway_install_command with the downloaded bundle to install it on device. The
+ *        command is passed the bundle as last argument and RHU_CONTROLLER_ID, RHU_ACTION_ID and
+ *        RHU_BUNDLE in its environment.
  *
- * @param[in] data Artifact* to process
- * @return gpointer being 1 (TRUE) if download succeeded, 0 (FALSE) otherwise. The return value is
- *         meant to be used with the GPOINTER_TO_INT() macro only.
- *         Note that if the download thread waited for installation to finish ('run_once' mode),
- *         TRUE means both installation and download succeeded.
+ * @param[in]  device GatewayDevice to install the bundle on
+ * @param[out] error  Error
+ * @return TRUE if the install command was started, FALSE otherwise (error set)
  */
-static gpointer download_thread(gpointer data)
+static gboolean gateway_install(GatewayDevice *device, GError **error)
 {
-        struct on_new_software_userdata userdata = {
-                .install_progress_callback = (GSourceFunc) hawkbit_progress,
-                .install_complete_callback = install_complete_cb,
-                .file = hawkbit_config->bundle_download_location,
-                .install_success = FALSE,
-        };
-        g_autoptr(GError) error = NULL, feedback_error = NULL;
-        g_autofree gchar *msg = NULL, *sha1sum = NULL;
-        g_autoptr(Artifact) artifact = data;
-        curl_off_t speed;
+        g_auto(GStrv) argv = NULL, envp = NULL;
+        g_autoptr(GSource) child_source = NULL;
+        g_autoptr(GPtrArray) args = g_ptr_array_new();
+        GatewayDownload *download = NULL;
+        gint argc = 0;
+        GPid pid;
+
+        g_return_val_if_fail(device && device->download, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-        g_return_val_if_fail(data, NULL);
+        download = device->download;
 
-        g_mutex_lock(&active_action->mutex);
-        if (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
-                goto cancel;
+        if (!g_shell_parse_argv(hawkbit_config->gateway_install_command, &argc, &argv, error)) {
+                g_prefix_error(error, "Invalid gateway_install_command: ");
+                return FALSE;
+        }
+        for (gint i = 0; i < argc; i++)
+                g_ptr_array_add(args, argv[i]);
+        g_ptr_array_add(args, download->file);
+        g_ptr_array_add(args, NULL);
+
+        envp = g_get_environ();
+        envp = g_environ_setenv(envp, "RHU_CONTROLLER_ID", device->config->controller_id, TRUE);
+        envp = g_environ_setenv(envp, "RHU_ACTION_ID", device->action_id, TRUE);
+        envp = g_environ_setenv(envp, "RHU_BUNDLE", download->file, TRUE);
+
+        if (!g_spawn_async(NULL, (gchar **) args->pdata, envp,
+                           G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid,
+                           error)) {
+                g_prefix_error(error, "Failed to run gateway_install_command: ");
+                return FALSE;
+        }
 
-        active_action->state = ACTION_STATE_DOWNLOADING;
-        g_mutex_unlock(&active_action->mutex);
+        g_message("%s: Installing %s (action %s).", device->config->controller_id,
+                  download->key, device->action_id);
+        device->state = ACTION_STATE_INSTALLING;
 
-        g_message("Start downloading: %s", artifact->download_url);
+        child_source = g_child_watch_source_new(pid);
+        g_source_set_callback(child_source, (GSourceFunc) gateway_install_done_cb, device, NULL);
+        g_source_attach(child_source, g_main_loop_get_context(gateway->loop));
 
-        while (1) {
-                gboolean resumable = FALSE;
-                GStatBuf bundle_stat;
-                curl_off_t resume_from = 0;
+        return TRUE;
+}
 
-                g_clear_pointer(&sha1sum, g_free);
+/**
+ * @brief Hand the completed download over to device: install it via gateway_install_command if
+ *        configured and requested by hawkBit, otherwise report it as downloaded (or wait for
+ *        hawkBit to allow installation).
+ *
+ * @param[in] device GatewayDevice whose download is complete
+ */
+static void gateway_deliver(GatewayDevice *device)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *msg = NULL;
 
-                // Download software bundle (artifact)
-                if (g_stat(hawkbit_config->bundle_download_location, &bundle_stat) == 0)
-                        resume_from = (curl_off_t) bundle_stat.st_size;
+        g_return_if_fail(device && device->download && device->download->complete);
 
-                if (get_binary(artifact->download_url, hawkbit_config->bundle_download_location,
-                               resume_from, &sha1sum, &speed, &error))
-                        break;
+        if (!device->do_install) {
+                g_message("%s: hawkBit requested to skip installation, not installing yet.",
+                          device->config->controller_id);
+                device->state = ACTION_STATE_NONE;
+                gateway_download_detach(device);
+                return;
+        }
 
-                for (const gint *code = &resumable_codes[0]; *code; code++)
-                        resumable |= g_error_matches(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, *code);
+        if (!hawkbit_config->gateway_install_command) {
+                device->state = ACTION_STATE_SUCCESS;
+                gateway_feedback(device, device->feedback_url, device->action_id,
+                                 "Software bundle downloaded.", "success", "downloaded");
+                gateway_download_detach(device);
+                return;
+        }
 
-                if (!hawkbit_config->resume_downloads || !resumable) {
-                        g_prefix_error(&error, "Download failed: ");
-                        goto report_err;
-                }
-                g_debug("%s, resuming download..", curl_easy_strerror(error->code));
+        if (gateway_install(device, &error))
+                return;
 
-                g_mutex_lock(&active_action->mutex);
-                if (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
-                        goto cancel;
-                g_mutex_unlock(&active_action->mutex);
+        device->state = ACTION_STATE_ERROR;
+        msg = g_strdup_printf("Failed to install software bundle: %s", error->message);
+        gateway_feedback(device, device->feedback_url, device->action_id, msg, "failure",
+                         "closed");
+        gateway_device_failed(device);
+        gateway_download_detach(device);
+}
 
-                g_clear_error(&error);
+/**
+ * @brief CurlTransferFunc of bundle downloads. Verifies the bundle's checksums, stores it in
+ *        config's artifact_cache_dir and delivers it to all controllers waiting for it.
+ */
+static void gateway_download_done(CURL *curl, CURLcode res, gpointer user_data)
+{
+        GatewayDownload *download = user_data;
+        g_autoptr(GPtrArray) devices = g_ptr_array_new();
+        g_autoptr(GError) error = NULL, cache_error = NULL;
+        const gchar *sha1sum = NULL, *sha256sum = NULL;
+        Artifact *artifact = download->artifact;
+        glong http_code = 0;
 
-                // sleep 0.5 s before attempting to resume download
-                g_usleep(500000);
-        }
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        metrics_record_transfer(METRICS_TRANSFER_DOWNLOAD, curl,
+                                res == CURLE_OK && http_code == 200);
+        connection_cache_record(curl, res);
+        download->active = FALSE;
+        download->state->writer = NULL;
+        download->state->curl = NULL;
+        g_clear_pointer(&download->curl, curl_easy_cleanup);
+        g_clear_pointer(&download->headers, curl_slist_free_all);
+
+        // delivering or failing detaches devices from the download, freeing it along with the last
+        for (guint i = 0; i < download->devices->len; i++)
+                g_ptr_array_add(devices, g_ptr_array_index(download->devices, i));
+
+        if (!bundle_writer_close(&download->writer, &error))
+                goto error;
 
-        // notify hawkbit that download is complete
-        msg = g_strdup_printf("Download complete. %.2f MB/s",
-                              (double)speed/(1024*1024));
-        g_mutex_lock(&active_action->mutex);
-        if (!feedback_progress(artifact->feedback_url, active_action->id, msg, &error)) {
-                g_warning("%s", error->message);
-                g_clear_error(&error);
+        if (res != CURLE_OK) {
+                g_set_error(&error, RHU_HAWKBIT_CLIENT_CURL_ERROR, res, "%s",
+                            curl_easy_strerror(res));
+                goto error;
+        }
+        if (http_code != 200) {
+                g_set_error(&error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, http_code,
+                            "HTTP request failed: %ld", http_code);
+                goto error;
         }
-        g_mutex_unlock(&active_action->mutex);
 
-        // validate checksum
+        sha1sum = checksum_get_string(download->state->sha1);
         if (g_strcmp0(artifact->sha1, sha1sum)) {
                 g_set_error(&error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD,
                             "Software: %s V%s. Invalid checksum: %s expected %s", artifact->name,
                             artifact->version, sha1sum, artifact->sha1);
-                goto report_err;
-        }
-
-        g_mutex_lock(&active_action->mutex);
-        if (!feedback_progress(artifact->feedback_url, active_action->id, "File checksum OK.",
-                               &error)) {
-                g_warning("%s", error->message);
-                g_clear_error(&error);
+                goto error;
         }
-        g_mutex_unlock(&active_action->mutex);
-
-        // last chance to cancel installation
-
-        g_mutex_lock(&active_action->mutex);
-        if (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
-                goto cancel;
-
-        // skip installation if hawkBit asked us to do so
-        if (!artifact->do_install) {
-                active_action->state = ACTION_STATE_NONE;
-                g_mutex_unlock(&active_action->mutex);
-
-                return GINT_TO_POINTER(TRUE);
+        if (download->state->sha256) {
+                sha256sum = checksum_get_string(download->state->sha256);
+                if (g_strcmp0(artifact->sha256, sha256sum)) {
+                        g_set_error(&error, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_DOWNLOAD,
+                                    "Software: %s V%s. Invalid SHA-256 checksum: %s expected %s",
+                                    artifact->name, artifact->version, sha256sum,
+                                    artifact->sha256);
+                        goto error;
+                }
         }
 
-        // start installation, cancelations are impossible now
-        active_action->state = ACTION_STATE_INSTALLING;
-        g_cond_signal(&active_action->cond);
-        g_mutex_unlock(&active_action->mutex);
-
-        software_ready_cb(&userdata);
-
-        return GINT_TO_POINTER(userdata.install_success);
+        g_message("Download of %s complete, checksum OK.", download->key);
+        download->complete = TRUE;
 
-report_err:
-        g_mutex_lock(&active_action->mutex);
-        if (!feedback(artifact->feedback_url, active_action->id, error->message, "failure",
-                      "closed", &feedback_error))
-                g_warning("%s", feedback_error->message);
+        if (hawkbit_config->artifact_cache_dir &&
+            !artifact_cache_store(hawkbit_config->artifact_cache_dir, download->key,
+                                  download->file,
+                                  (gint64) hawkbit_config->artifact_cache_max_size * 1024 * 1024,
+                                  &cache_error))
+                g_warning("Failed to cache artifact: %s", cache_error->message);
 
-        active_action->state = ACTION_STATE_ERROR;
-
-cancel:
-        if (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
-                active_action->state = ACTION_STATE_CANCELED;
+        for (guint i = 0; i < devices->len; i++)
+                gateway_deliver(g_ptr_array_index(devices, i));
 
-        process_deployment_cleanup();
+        gateway_update();
+        return;
 
-        g_cond_signal(&active_action->cond);
-        g_mutex_unlock(&active_action->mutex);
+error:
+        g_prefix_error(&error, "Download failed: ");
+        for (guint i = 0; i < devices->len; i++) {
+                GatewayDevice *device = g_ptr_array_index(devices, i);
+
+                device->state = ACTION_STATE_ERROR;
+                gateway_feedback(device, device->feedback_url, device->action_id, error->message,
+                                 "failure", "closed");
+                gateway_device_failed(device);
+                gateway_download_detach(device);
+        }
 
-        return GINT_TO_POINTER(FALSE);
+        gateway_update();
 }
 
 /**
- * @brief Process hawkBit deployment described by req_root.
- *        Must be called under locked active_action->mutex.
+ * @brief Start downloading download's artifact to its file.
  *
- * @param[in]  req_root JsonNode* describing the deployment to process
+ * @param[in]  download GatewayDownload to start
  * @param[out] error    Error
- * @return TRUE if processing deployment succeeded, FALSE otherwise (error set)
+ * @return TRUE if the transfer was started, FALSE otherwise (error set)
  */
-static gboolean process_deployment(JsonNode *req_root, GError **error)
+static gboolean gateway_download_start(GatewayDownload *download, GError **error)
 {
-        g_autoptr(Artifact) artifact = g_new0(Artifact, 1);
-        g_autofree gchar *deployment = NULL, *feedback_url = NULL, *temp_id = NULL,
-                         *deployment_download = NULL, *deployment_update = NULL,
-                         *maintenance_window = NULL, *maintenance_msg = NULL;
-        g_autoptr(JsonParser) json_response_parser = NULL;
-        g_autoptr(JsonArray) json_chunks = NULL, json_artifacts = NULL;
-        JsonNode *resp_root = NULL, *json_chunk = NULL, *json_artifact = NULL;
-        goffset freespace;
+        Artifact *artifact = NULL;
+        curl_off_t rate = 0;
+        CURL *curl = NULL;
+        CURLMcode mres;
 
-        g_return_val_if_fail(req_root, FALSE);
+        g_return_val_if_fail(download, FALSE);
         g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-        if (active_action->state >= ACTION_STATE_PROCESSING) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
-                            RHU_HAWKBIT_CLIENT_ERROR_ALREADY_IN_PROGRESS,
-                            "Deployment %s is already in progress.", active_action->id);
-                // no need to tell hawkBit about this
+        artifact = download->artifact;
+        if (!bundle_writer_open(&download->writer, download->file, 0, artifact->size, error))
+                return FALSE;
+
+        curl = curl_easy_init();
+        if (!curl) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Unable to start libcurl easy session");
                 return FALSE;
         }
+        download->curl = curl;
+        download->state = download_state_new(artifact->sha256 != NULL);
+        download->state->writer = &download->writer;
+        download->state->curl = curl;
 
-        active_action->state = ACTION_STATE_PROCESSING;
+        set_default_curl_opts(curl);
+        curl_easy_setopt(curl, CURLOPT_URL, artifact->download_url);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 8L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_file_cb);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, download->state);
 
-        // get deployment URL
-        deployment = json_get_string(req_root, "$._links.deploymentBase.href", error);
-        if (!deployment)
-                goto error;
+        // abort if slower than configured download rate during configured time span
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, hawkbit_config->low_speed_time);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, hawkbit_config->low_speed_rate);
 
-        // get deployment resource
-        if (!rest_request(GET, deployment, NULL, &json_response_parser, error))
-                goto error;
+        // apply the rate limit in effect at start, shared downloads are not rescheduled
+        get_download_rate(&rate);
+        if (rate > 0)
+                curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, rate);
 
-        resp_root = json_parser_get_root(json_response_parser);
+        if (!set_auth_curl_header(&download->headers, error) ||
+            !add_curl_header(&download->headers, "Accept: application/octet-stream", error)) {
+                download->headers = NULL;
+                return FALSE;
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, download->headers);
+
+        g_message("Downloading %s (Name: %s, Version: %s, Size: %" G_GINT64_FORMAT " bytes, URL: %s)",
+                  download->key, artifact->name, artifact->version, artifact->size,
+                  artifact->download_url);
+        mres = curl_source_add(gateway->curl_source, curl, gateway_download_done, download,
+                               NULL);
+        if (mres != CURLM_OK) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_CURL_ERROR, CURLE_FAILED_INIT,
+                            "Failed to start download: %s", curl_multi_strerror(mres));
+                return FALSE;
+        }
+        download->active = TRUE;
 
-        // handle deployment.maintenanceWindow (only available if maintenance window is defined)
-        maintenance_window = json_get_string(resp_root, "$.deployment.maintenanceWindow", NULL);
-        maintenance_msg = maintenance_window
-                          ? g_strdup_printf(" (maintenance window is '%s')", maintenance_window)
-                          : g_strdup("");
+        return TRUE;
+}
 
-        // handle deployment.download=skip
-        deployment_download = json_get_string(resp_root, "$.deployment.download", error);
-        if (!deployment_download)
-                goto error;
+/**
+ * @brief Let device use the download of artifact, shared by all controllers deployed an artifact
+ *        with the same checksum. The download is started (or restored from config's
+ *        artifact_cache_dir) if there is none yet. Delivers the bundle right away if complete.
+ *
+ * @param[in]  device   GatewayDevice to attach
+ * @param[in]  artifact Artifact to download, ownership is taken
+ * @param[out] error    Error
+ * @return TRUE on success, FALSE otherwise (error set)
+ */
+static gboolean gateway_download_attach(GatewayDevice *device, Artifact *artifact,
+                                        GError **error)
+{
+        g_autoptr(Artifact) owned_artifact = artifact;
+        g_autoptr(GError) cache_error = NULL;
+        g_autofree gchar *key = NULL;
+        GatewayDownload *download = NULL;
+        goffset freespace = 0;
+
+        g_return_val_if_fail(device && !device->download, FALSE);
+        g_return_val_if_fail(artifact, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-        if (!g_strcmp0(deployment_download, "skip")) {
-                g_message("hawkBit requested to skip download, not downloading yet%s.",
-                          maintenance_msg);
-                active_action->state = ACTION_STATE_NONE;
+        key = artifact_cache_key(artifact);
+        download = g_hash_table_lookup(gateway->downloads, key);
+        if (download) {
+                g_message("%s: Sharing download of %s with %u other controller(s).",
+                          device->config->controller_id, key, download->devices->len);
+                g_ptr_array_add(download->devices, device);
+                device->download = download;
+                if (download->complete)
+                        gateway_deliver(device);
                 return TRUE;
         }
 
-        // handle deployment.update=skip
-        deployment_update = json_get_string(resp_root, "$.deployment.update", error);
-        if (!deployment_update)
-                goto error;
-
-        artifact->do_install = g_strcmp0(deployment_update, "skip") != 0;
-        if (!artifact->do_install)
-                g_message("hawkBit requested to skip installation, not invoking RAUC yet%s.",
-                          maintenance_msg);
-
-        // remember deployment's action id
-        temp_id = json_get_string(resp_root, "$.id", error);
+        download = g_new0(GatewayDownload, 1);
+        download->writer.fd = -1;
+        download->key = g_steal_pointer(&key);
+        download->artifact = g_steal_pointer(&owned_artifact);
+        download->file = g_strdup_printf("%s.%s", hawkbit_config->bundle_download_location,
+                                         download->key);
+        download->devices = g_ptr_array_new();
+
+        if (hawkbit_config->artifact_cache_dir &&
+            artifact_cache_restore(hawkbit_config->artifact_cache_dir, download->key,
+                                   artifact->size, download->file, &cache_error)) {
+                g_message("Artifact %s found in cache, skipping download.", download->key);
+                download->complete = TRUE;
+        } else {
+                if (cache_error && !g_error_matches(cache_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning("Failed to restore cached artifact: %s", cache_error->message);
+
+                if (!get_available_space(download->file, &freespace, error))
+                        goto error;
+                if (freespace < artifact->size) {
+                        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+                                    "File size %" G_GINT64_FORMAT " exceeds available space %" G_GOFFSET_FORMAT,
+                                    artifact->size, freespace);
+                        goto error;
+                }
 
-        if (!artifact->do_install && !g_strcmp0(temp_id, active_action->id)) {
-                g_debug("Deployment %s is still waiting%s.", active_action->id, maintenance_msg);
-                active_action->state = ACTION_STATE_NONE;
-                return TRUE;
+                if (!gateway_download_start(download, error))
+                        goto error;
         }
 
-        // clean up on changed deployment id
-        if (g_strcmp0(temp_id, active_action->id))
-                process_deployment_cleanup();
-        else
-                g_debug("Continuing scheduled deployment %s%s.", active_action->id,
-                        maintenance_msg);
-
-        g_free(active_action->id);
-        active_action->id = g_steal_pointer(&temp_id);
-        if (!active_action->id)
-                goto error;
+        g_hash_table_insert(gateway->downloads, download->key, download);
+        g_ptr_array_add(download->devices, device);
+        device->download = download;
+        if (download->complete)
+                gateway_deliver(device);
 
-        feedback_url = build_api_url("deploymentBase/%s/feedback", active_action->id);
+        return TRUE;
 
-        // downloading multiple chunks not supported, only first chunk is downloaded (RAUC bundle)
-        json_chunks = json_get_array(resp_root, "$.deployment.chunks", error);
-        if (!json_chunks)
-                goto proc_error;
-        if (json_array_get_length(json_chunks) > 1) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_MULTI_CHUNKS,
-                            "Deployment %s unsupported: cannot handle multiple chunks.", active_action->id);
-                goto proc_error;
-        }
+error:
+        gateway_download_free(download);
+        return FALSE;
+}
 
-        json_chunk = json_array_get_element(json_chunks, 0);
+/**
+ * @brief RestResponseFunc of deployment requests, sets up the deployment of the first applicable
+ *        artifact. Delta bundles are not applicable in gateway mode.
+ */
+static void gateway_deployment_done(JsonParser *response, gboolean unchanged,
+                                    const GError *request_error, gint64 retry_after,
+                                    gpointer user_data)
+{
+        GatewayDevice *device = user_data;
+        const gchar *controller_id = device->config->controller_id;
+        g_autofree gchar *deployment_download = NULL, *deployment_update = NULL,
+                         *action_id = NULL;
+        g_autoptr(GPtrArray) artifacts = NULL;
+        g_autoptr(GError) error = NULL;
+        JsonNode *resp_root = NULL;
+        Artifact *artifact = NULL;
 
-        // downloading multiple artifacts not supported, only first artifact is downloaded (RAUC bundle)
-        json_artifacts = json_get_array(json_chunk, "$.artifacts", error);
-        if (!json_artifacts)
-                goto proc_error;
-        if (json_array_get_length(json_artifacts) > 1) {
-                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_MULTI_ARTIFACTS,
-                            "Deployment %s unsupported: cannot handle multiple artifacts.",
-                            active_action->id);
-                goto proc_error;
+        device->pending--;
+        device->state = ACTION_STATE_NONE;
+        if (request_error) {
+                gateway_device_error(device, request_error);
+                goto out;
+        }
+        if (!response) {
+                g_set_error(&error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_JSON_RESPONSE_PARSE,
+                            "Empty deployment resource");
+                goto error;
         }
 
-        json_artifact = json_array_get_element(json_artifacts, 0);
-
-        // get artifact information
-        artifact->version = json_get_string(json_chunk, "$.version", error);
-        if (!artifact->version)
-                goto proc_error;
-
-        artifact->name = json_get_string(json_chunk, "$.name", error);
-        if (!artifact->name)
-                goto proc_error;
+        resp_root = json_parser_get_root(response);
 
-        artifact->size = json_get_int(json_artifact, "$.size", error);
-        if (!artifact->size && error)
-                goto proc_error;
+        // handle deployment.download=skip
+        deployment_download = json_get_string(resp_root, "$.deployment.download", &error);
+        if (!deployment_download)
+                goto error;
 
-        artifact->sha1 = json_get_string(json_artifact, "$.hashes.sha1", error);
-        if (!artifact->sha1)
-                goto proc_error;
+        if (!g_strcmp0(deployment_download, "skip")) {
+                g_message("%s: hawkBit requested to skip download, not downloading yet.",
+                          controller_id);
+                goto out;
+        }
 
-        // favour https download
-        artifact->download_url = json_get_string(json_artifact, "$._links.download.href", NULL);
-        if (!artifact->download_url)
-                artifact->download_url = json_get_string(
-                        json_artifact, "$._links.download-http.href", error);
+        // handle deployment.update=skip
+        deployment_update = json_get_string(resp_root, "$.deployment.update", &error);
+        if (!deployment_update)
+                goto error;
 
-        if (!artifact->download_url) {
-                g_prefix_error(error, "\"$._links.download{-http,}.href\": ");
-                goto proc_error;
+        action_id = json_get_string(resp_root, "$.id", &error);
+        if (!action_id)
+                goto error;
+
+        device->do_install = g_strcmp0(deployment_update, "skip") != 0;
+        if (!device->do_install && !g_strcmp0(action_id, device->action_id)) {
+                log_debug("%s: Deployment %s is still waiting.", controller_id, action_id);
+                goto out;
         }
 
-        g_message("New software ready for download (Name: %s, Version: %s, Size: %" G_GINT64_FORMAT " bytes, URL: %s)",
-                  artifact->name, artifact->version, artifact->size, artifact->download_url);
+        g_free(device->action_id);
+        device->action_id = g_steal_pointer(&action_id);
+        g_free(device->feedback_url);
+        device->feedback_url = build_controller_api_url(controller_id, "deploymentBase/%s/feedback",
+                                                        device->action_id);
 
-        // check if there is enough free diskspace
-        if (!get_available_space(hawkbit_config->bundle_download_location, &freespace, error))
+        artifacts = get_applicable_artifacts(resp_root, device->action_id, NULL, &error);
+        if (!artifacts)
                 goto proc_error;
-
-        if (freespace < artifact->size) {
-                // notify hawkbit that there is not enough free space
-                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
-                            "File size %" G_GINT64_FORMAT " exceeds available space %" G_GOFFSET_FORMAT,
-                            artifact->size, freespace);
+        if (!artifacts->len) {
+                g_set_error(&error, RHU_HAWKBIT_CLIENT_ERROR,
+                            RHU_HAWKBIT_CLIENT_ERROR_NO_APPLICABLE_ARTIFACT,
+                            "Deployment %s has no artifact applicable to this target.",
+                            device->action_id);
                 goto proc_error;
         }
 
-        artifact->feedback_url = g_steal_pointer(&feedback_url);
-
-        // unref/free previous download thread by joining it
-        if (thread_download)
-                g_thread_join(thread_download);
-
-        // start download thread
-        thread_download = g_thread_new("downloader", download_thread,
-                                       (gpointer) g_steal_pointer(&artifact));
+        // delta bundles are skipped without installed version, leaving only the full bundle
+        artifact = g_ptr_array_index(artifacts, artifacts->len - 1);
+        g_ptr_array_index(artifacts, artifacts->len - 1) = NULL;
+        artifact->do_install = device->do_install;
+        artifact->feedback_url = g_strdup(device->feedback_url);
+        g_message("%s: New software ready for download (Name: %s, Version: %s, Size: %" G_GINT64_FORMAT " bytes, URL: %s)",
+                  controller_id, artifact->name, artifact->version, artifact->size,
+                  artifact->download_url);
+
+        device->state = ACTION_STATE_DOWNLOADING;
+        if (!gateway_download_attach(device, artifact, &error))
+                goto proc_error;
 
-        return TRUE;
+        goto out;
 
 proc_error:
-        feedback(feedback_url, active_action->id, (*error)->message, "failure", "closed", NULL);
+        device->state = ACTION_STATE_ERROR;
+        gateway_feedback(device, device->feedback_url, device->action_id, error->message,
+                         "failure", "closed");
+        gateway_device_failed(device);
+        goto out;
 
 error:
-        // clean up failed deployment
-        process_deployment_cleanup();
-        active_action->state = ACTION_STATE_NONE;
+        gateway_device_error(device, error);
 
-        return FALSE;
+out:
+        gateway_update();
 }
 
 /**
- * @brief Process hawkBit cancel action described by req_root.
- *
- * @param[in]  req_root JsonNode* describing the cancel action
- * @param[out] error    Error
- * @return TRUE if cancel action succeeded, FALSE otherwise (error set)
+ * @brief RestResponseFunc of cancel requests, cancels device's deployment if its bundle is not
+ *        being installed yet.
  */
-static gboolean process_cancel(JsonNode *req_root, GError **error)
+static void gateway_cancel_done(JsonParser *response, gboolean unchanged,
+                                const GError *request_error, gint64 retry_after,
+                                gpointer user_data)
 {
-        gboolean res = TRUE;
-        g_autofree gchar *cancel_url = NULL, *feedback_url = NULL, *stop_id = NULL, *msg = NULL;
-        g_autoptr(JsonParser) json_response_parser = NULL;
-        JsonNode *resp_root = NULL;
-
-        g_return_val_if_fail(req_root, FALSE);
-        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-
-        // get cancel url
-        cancel_url = json_get_string(req_root, "$._links.cancelAction.href", error);
-        if (!cancel_url)
-                return FALSE;
-
-        // retrieve cancel details
-        if (!rest_request(GET, cancel_url, NULL, &json_response_parser, error))
-                return FALSE;
-
-        resp_root = json_parser_get_root(json_response_parser);
+        GatewayDevice *device = user_data;
+        const gchar *controller_id = device->config->controller_id;
+        g_autofree gchar *stop_id = NULL, *feedback_url = NULL;
+        g_autoptr(GError) error = NULL;
+        enum ActionState state;
 
-        // retrieve stop id
-        stop_id = json_get_string(resp_root, "$.cancelAction.stopId", error);
-        if (!stop_id)
-                return FALSE;
+        device->pending--;
+        if (request_error) {
+                gateway_device_error(device, request_error);
+                gateway_update();
+                return;
+        }
 
-        g_message("Received cancelation for action %s", stop_id);
+        stop_id = response ? json_get_string(json_parser_get_root(response),
+                                             "$.cancelAction.stopId", &error) : NULL;
+        if (!stop_id) {
+                if (!error)
+                        g_set_error(&error, RHU_HAWKBIT_CLIENT_ERROR,
+                                    RHU_HAWKBIT_CLIENT_ERROR_JSON_RESPONSE_PARSE,
+                                    "Empty cancel action resource");
+                goto error;
+        }
 
-        // send cancel feedback
-        feedback_url = build_api_url("cancelAction/%s/feedback", stop_id);
+        g_message("%s: Received cancelation for action %s", controller_id, stop_id);
+        feedback_url = build_controller_api_url(controller_id, "cancelAction/%s/feedback",
+                                                stop_id);
 
         // cancel action if install not started yet
-        g_mutex_lock(&active_action->mutex);
-        if (!g_strcmp0(stop_id, active_action->id) &&
-            (active_action->state == ACTION_STATE_PROCESSING ||
-             active_action->state == ACTION_STATE_DOWNLOADING)) {
-
-                g_debug("Action %s is in state %d, waiting for cancel request to be processed",
-                        stop_id, active_action->state);
-                active_action->state = ACTION_STATE_CANCEL_REQUESTED;
-
-                while (active_action->state == ACTION_STATE_CANCEL_REQUESTED)
-                        g_cond_wait(&active_action->cond, &active_action->mutex);
+        if (!g_strcmp0(stop_id, device->action_id) && device->state == ACTION_STATE_DOWNLOADING) {
+                gateway_download_detach(device);
+                device->state = ACTION_STATE_CANCELED;
         }
-        if (g_strcmp0(stop_id, active_action->id))
-                active_action->state = ACTION_STATE_NONE;
+        state = g_strcmp0(stop_id, device->action_id) ? ACTION_STATE_NONE : device->state;
 
-        // send feedback
-        switch (active_action->state) {
-        case ACTION_STATE_NONE:
-                // action unknown, acknowledge cancelation nonetheless
-                g_debug("Received cancelation for unprocessed action %s, acknowledging.",
-                        stop_id);
-        // fall through
-        case ACTION_STATE_CANCELED:
-                res = feedback(feedback_url, stop_id, "Action canceled.", "success", "closed",
-                               error);
+        switch (state) {
+        case ACTION_STATE_INSTALLING:
+                gateway_feedback(device, feedback_url, stop_id,
+                                 "Cancelation impossible, installation started already.",
+                                 "success", "rejected");
                 break;
         case ACTION_STATE_SUCCESS:
-                g_debug("Cancelation impossible, installation succeeded already");
+                log_debug("%s: Cancelation impossible, installation succeeded already",
+                        controller_id);
                 break;
         case ACTION_STATE_ERROR:
-                g_debug("Cancelation impossible, installation failed already");
-                break;
-        case ACTION_STATE_INSTALLING:
-                msg = g_strdup("Cancelation impossible, installation started already.");
-                res = feedback(feedback_url, stop_id, msg, "success", "rejected", error);
-                if (res) {
-                        res = FALSE;
-                        g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR,
-                                    RHU_HAWKBIT_CLIENT_ERROR_CANCELATION, "%s", msg);
-                }
+                log_debug("%s: Cancelation impossible, installation failed already",
+                        controller_id);
                 break;
         default:
-                // other states are not expected here
-                g_critical("Unexpected action state after cancel request: %d", active_action->state);
-                g_assert_not_reached();
+                // action unknown or canceled, acknowledge cancelation
+                gateway_feedback(device, feedback_url, stop_id, "Action canceled.", "success",
+                                 "closed");
                 break;
         }
 
-        g_mutex_unlock(&active_action->mutex);
-        return res;
+        gateway_update();
+        return;
+
+error:
+        gateway_device_error(device, error);
+        gateway_update();
 }
 
-void hawkbit_init(Config *config, GSourceFunc on_install_ready)
+/**
+ * @brief RestResponseFunc of configData requests.
+ */
+static void gateway_identify_done(JsonParser *response, gboolean unchanged,
+                                  const GError *error, gint64 retry_after,
+                                  gpointer user_data)
 {
-        g_return_if_fail(config);
+        GatewayDevice *device = user_data;
 
-        hawkbit_config = config;
-        software_ready_cb = on_install_ready;
-        curl_global_init(CURL_GLOBAL_ALL);
-}
+        device->pending--;
+        if (error)
+                gateway_device_error(device, error);
 
-typedef struct ClientData_ {
-        GMainLoop *loop;
-        gboolean res;
-        long hawkbit_interval_check_sec;
-        long last_run_sec;
-} ClientData;
+        gateway_update();
+}
 
 /**
- * @brief Callback for main loop, should run regularly, polls controller base poll resource and
- * triggers appropriate actions.
+ * @brief Start the requests asked for by device's poll response json_root: sending the
+ *        controller attributes, getting a deployment or a cancelation.
  *
- * @param[in] user_data ClientData*
- * @return TRUE if polling controller base resource and running appropriate actions succeeded,
- *         FALSE otherwise
+ * @param[in] device    GatewayDevice the poll response belongs to
+ * @param[in] json_root JsonNode* of the poll response
  */
-static gboolean hawkbit_pull_cb(gpointer user_data)
+static void gateway_process_poll(GatewayDevice *device, JsonNode *json_root)
 {
-        ClientData *data = user_data;
-        gboolean res = FALSE;
+        const gchar *controller_id = device->config->controller_id;
         g_autoptr(GError) error = NULL;
-        g_autofree gchar *get_tasks_url = NULL;
-        g_autoptr(JsonParser) json_response_parser = NULL;
-        JsonNode *json_root = NULL;
-
-        g_return_val_if_fail(user_data, FALSE);
-
-        if (++data->last_run_sec < data->hawkbit_interval_check_sec)
-                return G_SOURCE_CONTINUE;
 
-        data->last_run_sec = 0;
+        if (json_contains(json_root, "$._links.configData")) {
+                g_autoptr(JsonBuilder) builder = NULL;
+                g_autofree gchar *url = NULL;
+
+                // hawkBit has asked us to identify the controller
+                log_debug("%s: Providing meta information to hawkbit server", controller_id);
+                url = build_controller_api_url(controller_id, "configData");
+                builder = json_build_status(NULL, NULL, "success", "closed",
+                                            device->config->attributes);
+                if (!gateway_request(device, PUT, url, builder, NULL, gateway_identify_done,
+                                     &error)) {
+                        gateway_device_error(device, error);
+                        g_clear_error(&error);
+                }
+        }
 
-        // build hawkBit get tasks URL
-        get_tasks_url = build_api_url(NULL);
+        if (json_contains(json_root, "$._links.deploymentBase")) {
+                g_autofree gchar *url = NULL;
 
-        g_message("Checking for new software...");
-        res = rest_request(GET, get_tasks_url, NULL, &json_response_parser, &error);
-        if (!res) {
-                if (g_error_matches(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 401)) {
-                        if (hawkbit_config->auth_token)
-                                g_warning("Failed to authenticate. Check if auth_token is correct?");
-                        if (hawkbit_config->gateway_token)
-                                g_warning("Failed to authenticate. Check if gateway_token is correct?");
+                if (device->state >= ACTION_STATE_PROCESSING) {
+                        log_debug("%s: Deployment %s is already in progress.", controller_id,
+                                device->action_id);
                 } else {
-                        g_warning("Scheduled check for new software failed: %s (%d)",
-                                  error->message, error->code);
+                        url = json_get_string(json_root, "$._links.deploymentBase.href", &error);
+                        if (url && gateway_request(device, GET, url, NULL, NULL,
+                                                   gateway_deployment_done, &error)) {
+                                device->state = ACTION_STATE_PROCESSING;
+                        } else {
+                                gateway_device_error(device, error);
+                                g_clear_error(&error);
+                        }
                 }
+        } else {
+                log_debug("%s: No new software.", controller_id);
+        }
 
-                data->hawkbit_interval_check_sec = hawkbit_config->retry_wait;
-                goto out;
+        if (json_contains(json_root, "$._links.cancelAction")) {
+                g_autofree gchar *url = NULL;
+
+                url = json_get_string(json_root, "$._links.cancelAction.href", &error);
+                if (!url || !gateway_request(device, GET, url, NULL, NULL, gateway_cancel_done,
+                                             &error))
+                        gateway_device_error(device, error);
         }
+}
 
-        // owned by the JsonParser and should never be modified or freed
-        json_root = json_parser_get_root(json_response_parser);
+/**
+ * @brief RestResponseFunc of polls, processes the poll response and schedules the controller's
+ *        next poll.
+ */
+static void gateway_poll_done(JsonParser *response, gboolean unchanged,
+                              const GError *error, gint64 retry_after,
+                              gpointer user_data)
+{
+        GatewayDevice *device = user_data;
+        const gchar *controller_id = device->config->controller_id;
+        JsonNode *json_root = NULL;
 
-        if (json_contains(json_root, "$._links.configData")) {
-                // hawkBit has asked us to identify ourselves
-                res = identify(&error);
-                if (!res) {
-                        g_warning("%s", error->message);
-                        g_clear_error(&error);
-                }
+        device->pending--;
+        device->polled = TRUE;
+
+        if (error) {
+                if (g_error_matches(error, RHU_HAWKBIT_CLIENT_HTTP_ERROR, 401))
+                        g_warning("%s: Failed to authenticate. Check if gateway_token is correct?",
+                                  controller_id);
+                else
+                        g_warning("%s: Scheduled check for new software failed: %s (%d)",
+                                  controller_id, error->message, error->code);
+
+                device->failed = TRUE;
+                gateway_device_schedule(device, get_retry_time(device->failed_polls++,
+                                                               retry_after));
+                goto out;
         }
-        if (json_contains(json_root, "$._links.deploymentBase")) {
-                // hawkBit has a new deployment for us
-                g_mutex_lock(&active_action->mutex);
-                res = process_deployment(json_root, &error);
-                g_mutex_unlock(&active_action->mutex);
-                if (!res) {
-                        if (g_error_matches(error, RHU_HAWKBIT_CLIENT_ERROR,
-                                            RHU_HAWKBIT_CLIENT_ERROR_ALREADY_IN_PROGRESS))
-                                g_debug("%s", error->message);
-                        else
-                                g_warning("%s", error->message);
-                }
+
+        if (unchanged) {
+                // nothing to do that was not done on the previous poll already
+                log_debug("%s: Controller state unchanged since last poll.", controller_id);
         } else {
-                g_message("No new software.");
+                // keep response, it is reused for unchanged responses
+                g_clear_object(&device->poll_response);
+                device->poll_response = response ? g_object_ref(response) : NULL;
         }
-        if (json_contains(json_root, "$._links.cancelAction")) {
-                res = process_cancel(json_root, &error);
-                if (!res) {
-                        g_warning("%s", error->message);
-                        g_clear_error(&error);
-                }
+
+        json_root = device->poll_response ? json_parser_get_root(device->poll_response) : NULL;
+        if (!json_root) {
+                g_warning("%s: Empty poll response", controller_id);
+                gateway_device_failed(device);
+                gateway_device_schedule(device, get_retry_time(device->failed_polls++, 0));
+                goto out;
         }
 
-        // get hawkbit sleep time (how often should we check for new software)
-        data->hawkbit_interval_check_sec = json_get_sleeptime(json_root);
+        device->failed_polls = 0;
+        if (!unchanged)
+                gateway_process_poll(device, json_root);
+
+        // poll frequently during deployments to receive cancelation requests etc.
+        if (device->state == ACTION_STATE_PROCESSING || device->state == ACTION_STATE_DOWNLOADING)
+                gateway_device_schedule(device, 5L);
+        else
+                gateway_device_schedule(device, json_get_polling_sleeptime(json_root));
 
 out:
-        if (run_once) {
-                if (thread_download) {
-                        gpointer thread_ret = g_thread_join(thread_download);
-                        res = GPOINTER_TO_INT(thread_ret);
+        gateway_update();
+}
+
+/**
+ * @brief Callback for main loop, run by the timer armed with gateway_update(), polls all
+ *        controllers whose poll is due.
+ *
+ * @param[in] user_data unused
+ * @return G_SOURCE_REMOVE is always returned, the next timer is armed by gateway_update()
+ */
+static gboolean gateway_poll_cb(gpointer user_data)
+{
+        gint64 now = g_get_monotonic_time();
+
+        g_clear_pointer(&gateway->poll_source, g_source_unref);
+
+        for (guint i = 0; i < gateway->devices->len; i++) {
+                GatewayDevice *device = g_ptr_array_index(gateway->devices, i);
+                g_autofree gchar *url = NULL;
+                g_autoptr(GError) error = NULL;
+
+                if (device->pending || device->next_poll > now)
+                        continue;
+
+                log_debug("%s: Checking for new software...", device->config->controller_id);
+                url = build_controller_api_url(device->config->controller_id, NULL);
+                if (!gateway_request(device, GET, url, NULL, &device->poll_validator,
+                                     gateway_poll_done, &error)) {
+                        g_warning("%s: Scheduled check for new software failed: %s",
+                                  device->config->controller_id, error->message);
+                        device->polled = TRUE;
+                        device->failed = TRUE;
+                        gateway_device_schedule(device,
+                                                get_retry_time(device->failed_polls++, 0));
                 }
+        }
 
-                data->res = res;
-                g_main_loop_quit(data->loop);
-                return G_SOURCE_REMOVE;
+        gateway_update();
+        return G_SOURCE_REMOVE;
+}
+
+static void gateway_device_free(GatewayDevice *device)
+{
+        if (!device)
+                return;
+
+        g_free(device->poll_validator.etag);
+        g_free(device->poll_validator.checksum);
+        g_clear_object(&device->poll_response);
+        g_free(device->action_id);
+        g_free(device->feedback_url);
+        g_free(device);
+}
+
+/**
+ * @brief Set up gateway mode on loop, polling all controllers of config's gateway_devices.
+ *        Initial polls are spread by config's poll_jitter.
+ *
+ * @param[in] loop        GMainLoop to run transfers and polls from
+ * @param[in] curl_source GSource created with curl_source_new() attached to loop's context,
+ *                        running all transfers
+ */
+static void gateway_start(GMainLoop *loop, GSource *curl_source)
+{
+        gint64 now = g_get_monotonic_time();
+
+        g_return_if_fail(!gateway);
+
+        gateway = g_new0(Gateway, 1);
+        gateway->loop = g_main_loop_ref(loop);
+        gateway->curl_source = g_source_ref(curl_source);
+        gateway->devices = g_ptr_array_new_with_free_func((GDestroyNotify) gateway_device_free);
+        gateway->downloads = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                                   (GDestroyNotify) gateway_download_free);
+
+        for (guint i = 0; i < hawkbit_config->gateway_devices->len; i++) {
+                GatewayDevice *device = g_new0(GatewayDevice, 1);
+
+                device->config = g_ptr_array_index(hawkbit_config->gateway_devices, i);
+                device->state = ACTION_STATE_NONE;
+                device->next_poll = now + (gint64) get_jittered_time(0) * G_USEC_PER_SEC;
+                g_ptr_array_add(gateway->devices, device);
+        }
+
+        g_message("Gateway mode: serving %u controller(s).", gateway->devices->len);
+        gateway_update();
+}
+
+/**
+ * @brief Tear down gateway mode set up with gateway_start(), aborting all downloads.
+ *
+ * @return TRUE if all polls and actions succeeded, FALSE otherwise
+ */
+static gboolean gateway_stop(void)
+{
+        gboolean res = TRUE;
+
+        g_return_val_if_fail(gateway, FALSE);
+
+        for (guint i = 0; i < gateway->devices->len; i++) {
+                GatewayDevice *device = g_ptr_array_index(gateway->devices, i);
+
+                res = res && !device->failed;
+        }
+
+        if (gateway->poll_source)
+                g_source_destroy(gateway->poll_source);
+        g_clear_pointer(&gateway->poll_source, g_source_unref);
+
+        g_hash_table_destroy(gateway->downloads);
+        g_ptr_array_unref(gateway->devices);
+        g_source_unref(gateway->curl_source);
+        g_main_loop_unref(gateway->loop);
+        g_clear_pointer(&gateway, g_free);
+
+        return res;
+}
+
+/**
+ * @brief Callback for SIGUSR1 and D-Bus' PollNow(), checks hawkBit for new software right away.
+ *        If a poll is running, the next one is started as soon as it finished instead. In
+ *        gateway mode, all controllers without requests in flight are polled.
+ *
+ * @param[in] user_data ClientData*
+ * @return G_SOURCE_CONTINUE is always returned
+ */
+static gboolean poll_now_cb(gpointer user_data)
+{
+        ClientData *data = user_data;
+
+        g_message("Immediate poll requested.");
+
+        if (gateway) {
+                gint64 now = g_get_monotonic_time();
+
+                for (guint i = 0; i < gateway->devices->len; i++) {
+                        GatewayDevice *device = g_ptr_array_index(gateway->devices, i);
+
+                        if (!device->pending)
+                                device->next_poll = now;
+                }
+
+                gateway_update();
+                return G_SOURCE_CONTINUE;
         }
 
+        if (data->polling)
+                data->poll_now = TRUE;
+        else
+                schedule_pull(data, 0);
+
         return G_SOURCE_CONTINUE;
 }
 
+/**
+ * @brief ServiceCancelFunc for D-Bus' CancelDownload(), lets the download thread cancel the
+ *        active action at the next occasion. hawkBit is told the action failed then.
+ *
+ * @param[out] error Error
+ * @return TRUE if the download is being canceled, FALSE otherwise (error set)
+ */
+static gboolean cancel_download(GError **error)
+{
+        gboolean res = TRUE;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        if (gateway) {
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_CANCELATION,
+                            "Canceling downloads is not supported in gateway mode");
+                return FALSE;
+        }
+
+        g_mutex_lock(&active_action->mutex);
+        switch (active_action->state) {
+        case ACTION_STATE_PROCESSING:
+        case ACTION_STATE_DOWNLOADING:
+                g_message("Canceling download as requested locally.");
+                active_action->cancel_local = TRUE;
+                action_set_state(ACTION_STATE_CANCEL_REQUESTED);
+                break;
+        case ACTION_STATE_CANCEL_REQUESTED:
+                // already being canceled
+                break;
+        case ACTION_STATE_INSTALLING:
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_CANCELATION,
+                            "Cancelation impossible, installation started already");
+                res = FALSE;
+                break;
+        default:
+                g_set_error(error, RHU_HAWKBIT_CLIENT_ERROR, RHU_HAWKBIT_CLIENT_ERROR_CANCELATION,
+                            "No download to cancel");
+                res = FALSE;
+                break;
+        }
+        g_mutex_unlock(&active_action->mutex);
+
+        return res;
+}
+
 int hawkbit_start_service_sync()
 {
         g_autoptr(GMainContext) ctx = NULL;
-        ClientData cdata;
-        g_autoptr(GSource) timeout_source = NULL;
+        g_autoptr(GSource) reload_source = NULL;
+        g_autoptr(GSource) poll_now_source = NULL;
+        g_autoptr(GError) error = NULL;
+        ClientData cdata = { 0 };
         int res = 0;
 #ifdef WITH_SYSTEMD
         g_autoptr(GSource) event_source = NULL;
@@ -1343,17 +6308,47 @@ int hawkbit_start_service_sync()
 #endif
 
         active_action = action_new();
+        feedback_start();
+
+        // peers are served from a thread of their own, failing to do so is not fatal
+        if (hawkbit_config->peer_port &&
+            !peer_server_start(hawkbit_config->peer_port, hawkbit_config->peer_address,
+                               hawkbit_config->peer_allow, hawkbit_config->artifact_cache_dir,
+                               &error))
+                g_warning("Failed to start peer server: %s", error->message);
 
         ctx = g_main_context_new();
         cdata.loop = g_main_loop_new(ctx, FALSE);
         cdata.hawkbit_interval_check_sec = hawkbit_config->retry_wait;
-        cdata.last_run_sec = hawkbit_config->retry_wait;
 
-        // pull every second
-        timeout_source = g_timeout_source_new(1000);
-        g_source_set_name(timeout_source, "Add timeout");
-        g_source_set_callback(timeout_source, (GSourceFunc) hawkbit_pull_cb, &cdata, NULL);
-        g_source_attach(timeout_source, ctx);
+        // all DDI requests are run from the main loop, without blocking it
+        cdata.curl_source = curl_source_new(hawkbit_config->gateway_devices
+                                            ? hawkbit_config->gateway_max_connections : 0);
+        g_source_attach(cdata.curl_source, ctx);
+
+        // first poll right away, hawkbit_pull_cb() schedules the following ones
+        if (hawkbit_config->gateway_devices)
+                gateway_start(cdata.loop, cdata.curl_source);
+        else
+                schedule_pull(&cdata, 0);
+
+        if (hawkbit_config->config_file) {
+                reload_source = g_unix_signal_source_new(SIGHUP);
+                g_source_set_callback(reload_source, reload_download_rate_cb, NULL, NULL);
+                g_source_attach(reload_source, ctx);
+        }
+
+        // local agents may ask for polls instead of waiting for the next one
+        if (!run_once) {
+                poll_now_source = g_unix_signal_source_new(SIGUSR1);
+                g_source_set_callback(poll_now_source, poll_now_cb, &cdata, NULL);
+                g_source_attach(poll_now_source, ctx);
+
+                g_clear_error(&error);
+                if (hawkbit_config->dbus_service &&
+                    !dbus_service_start(ctx, poll_now_cb, &cdata, cancel_download, &error))
+                        g_warning("Failed to export D-Bus interface: %s", error->message);
+        }
 
 #ifdef WITH_SYSTEMD
         res = sd_event_default(&event);
@@ -1380,6 +6375,8 @@ int hawkbit_start_service_sync()
 
         g_main_loop_run(cdata.loop);
 
+        if (gateway)
+                cdata.res = gateway_stop();
         res = cdata.res ? 0 : 1;
 
 #ifdef WITH_SYSTEMD
@@ -1391,7 +6388,31 @@ finish:
         g_source_destroy(event_source);
         sd_event_set_watchdog(event, FALSE);
 #endif
+        if (reload_source)
+                g_source_destroy(reload_source);
+        if (poll_now_source)
+                g_source_destroy(poll_now_source);
+        dbus_service_stop();
+        if (gateway)
+                gateway_stop();
+        if (cdata.poll_source)
+                g_source_destroy(cdata.poll_source);
+        g_clear_pointer(&cdata.poll_source, g_source_unref);
+        // aborts requests still in flight
+        g_source_destroy(cdata.curl_source);
+        g_clear_pointer(&cdata.curl_source, g_source_unref);
+        g_clear_object(&cdata.poll_response);
+        g_free(cdata.cancel_id);
+        g_free(cdata.poll_validator.etag);
+        g_free(cdata.poll_validator.checksum);
         g_main_loop_unref(cdata.loop);
+        peer_server_stop();
+        // reboots unless rebooting failed
+        if (thread_reboot)
+                g_thread_join(g_steal_pointer(&thread_reboot));
+        feedback_stop();
+        // after the last feedback was sent
+        connection_cache_save(TRUE);
         if (res < 0)
                 g_warning("%s", strerror(-res));
 
@@ -1408,9 +6429,38 @@ void artifact_free(Artifact *artifact)
         g_free(artifact->download_url);
         g_free(artifact->feedback_url);
         g_free(artifact->sha1);
+        g_free(artifact->sha256);
+        g_free(artifact->base_version);
         g_free(artifact);
 }
 
+void download_state_free(DownloadState *state)
+{
+        if (!state)
+                return;
+
+        checksum_free(state->sha1);
+        checksum_free(state->sha256);
+        g_free(state->etag);
+        g_free(state->last_modified);
+        if (state->resume_info)
+                g_key_file_unref(state->resume_info);
+        g_free(state);
+}
+
+void feedback_message_free(FeedbackMessage *message)
+{
+        if (!message)
+                return;
+
+        g_free(message->url);
+        g_free(message->id);
+        g_free(message->detail);
+        g_free(message->finished);
+        g_free(message->execution);
+        g_free(message);
+}
+
 void rest_payload_free(RestPayload *payload)
 {
         if (!payload)
@@ -8,8 +8,93 @@
 
 #include "json-helper.h"
 #include <stddef.h>
+#include <string.h>
 
 
+/**
+ * @brief Precompiled path: member names to walk from the root object or, for expressions which
+ *        are not plain member chains, NULL to fall back to JSONPath.
+ */
+struct JsonMemberPath_ {
+        gchar *expression;            /**< original JSONPath expression */
+        gchar **members;              /**< member names to walk, NULL for JSONPath fallback */
+};
+
+G_LOCK_DEFINE_STATIC(member_paths);
+static GHashTable *member_paths = NULL;
+
+static void json_member_path_free(JsonMemberPath *path)
+{
+        if (!path)
+                return;
+
+        g_free(path->expression);
+        g_strfreev(path->members);
+        g_free(path);
+}
+
+/**
+ * @brief Compile a JSONPath expression into a JsonMemberPath.
+ *
+ * @param[in] expression JSONPath expression
+ * @return JsonMemberPath*, compiled path
+ */
+static JsonMemberPath* json_member_path_compile(const gchar *expression)
+{
+        JsonMemberPath *path = g_new0(JsonMemberPath, 1);
+
+        path->expression = g_strdup(expression);
+
+        // only plain member chains like "$.a.b" are resolved directly
+        if (!g_str_has_prefix(expression, "$.") || strpbrk(expression, "[]*@?()'\" ") ||
+            strstr(expression, ".."))
+                return path;
+
+        path->members = g_strsplit(expression + 2, ".", -1);
+        if (!path->members[0] || !*path->members[0])
+                g_clear_pointer(&path->members, g_strfreev);
+
+        return path;
+}
+
+const JsonMemberPath* json_member_path(const gchar *expression)
+{
+        JsonMemberPath *path = NULL;
+
+        g_return_val_if_fail(expression, NULL);
+
+        G_LOCK(member_paths);
+        if (!member_paths)
+                member_paths = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                                     (GDestroyNotify) json_member_path_free);
+
+        path = g_hash_table_lookup(member_paths, expression);
+        if (!path) {
+                path = json_member_path_compile(expression);
+                g_hash_table_insert(member_paths, path->expression, path);
+        }
+        G_UNLOCK(member_paths);
+
+        return path;
+}
+
+JsonNode* json_member_path_lookup(JsonNode *json_node, const JsonMemberPath *path)
+{
+        g_return_val_if_fail(json_node, NULL);
+        g_return_val_if_fail(path && path->members, NULL);
+
+        for (gchar **member = path->members; *member; member++) {
+                if (!JSON_NODE_HOLDS_OBJECT(json_node))
+                        return NULL;
+
+                json_node = json_object_get_member(json_node_get_object(json_node), *member);
+                if (!json_node)
+                        return NULL;
+        }
+
+        return json_node;
+}
+
 /**
  * @brief Get the first JsonNode element matching path in json_node.
  *
@@ -22,12 +107,25 @@ static JsonNode* json_get_first_matching_element(JsonNode *json_node, const gcha
                                                  GError **error)
 {
         g_autoptr(JsonNode) match = NULL, node = NULL;
+        const JsonMemberPath *member_path = NULL;
         JsonArray *arr = NULL;
 
         g_return_val_if_fail(json_node, NULL);
         g_return_val_if_fail(path, NULL);
         g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
+        member_path = json_member_path(path);
+        if (member_path->members) {
+                node = json_member_path_lookup(json_node, member_path);
+                if (!node) {
+                        g_set_error(error, JSON_PARSER_ERROR, JSON_PARSER_ERROR_PARSE,
+                                    "Failed to retrieve element from array for path %s", path);
+                        return NULL;
+                }
+
+                return json_node_ref(g_steal_pointer(&node));
+        }
+
         match = json_path_query(path, json_node, error);
         if (!match)
                 return NULL;
@@ -128,10 +226,15 @@ gboolean json_contains(JsonNode *json_node, gchar *path)
 {
         g_autoptr(GError) error = NULL;
         g_autoptr(JsonNode) node = NULL;
+        const JsonMemberPath *member_path = NULL;
 
         g_return_val_if_fail(json_node, FALSE);
         g_return_val_if_fail(path, FALSE);
 
+        member_path = json_member_path(path);
+        if (member_path->members)
+                return json_member_path_lookup(json_node, member_path) != NULL;
+
         node = json_path_query(path, json_node, &error);
         if (!node) {
                 // failed to compile expression to JSONPath
@@ -4,12 +4,44 @@
  *
  * @file
  * @brief  Log handling
+ *
+ * Messages are queued in a ring buffer and written by a background thread, so threads logging
+ * never wait for a slow console or the journal. Fatal messages are written synchronously after
+ * everything queued before them, since the process aborts right afterwards.
  */
 
 #include "log.h"
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef WITH_SYSTEMD
+#include <sys/uio.h>
+#endif
+
+#define LOG_RING_SIZE 256
+
+/**
+ * @brief struct containing a queued log message.
+ */
+typedef struct LogEntry_ {
+        GLogLevelFlags level;         /**< log level */
+        gchar *message;               /**< formatted message */
+        gchar **fields;               /**< "KEY=value" journal fields or NULL */
+} LogEntry;
 
 static gboolean output_to_systemd = FALSE;
+static GLogLevelFlags enabled_log_levels = 0;
+
+static GMutex log_mutex;
+static GCond log_cond;
+static LogEntry log_ring[LOG_RING_SIZE];
+static guint log_head = 0;            // index of the oldest entry
+static guint log_len = 0;             // number of entries queued
+static guint log_dropped = 0;         // debug/info messages dropped since the last write
+static gboolean log_writing = FALSE;  // log thread writes popped entries
+static gboolean log_stop = FALSE;
+static GThread *log_thread = NULL;
+static gchar *log_action_id = NULL;
 
 /**
  * @brief convert GLogLevelFlags to string
@@ -65,6 +97,168 @@ static int log_level_to_int(GLogLevelFlags level)
 }
 #endif
 
+/**
+ * @brief     Write a log message to the journal or stdout/stderr.
+ *
+ * @param[in] level   Log level
+ * @param[in] message Log message
+ * @param[in] fields  NULL-terminated array of "KEY=value" journal fields or NULL
+ */
+static void log_write(GLogLevelFlags level, const gchar *message, const gchar *const *fields)
+{
+        const gchar *log_level_str;
+#ifdef WITH_SYSTEMD
+        if (output_to_systemd && fields) {
+                g_autofree gchar *message_field = g_strconcat("MESSAGE=", message, NULL);
+                g_autofree gchar *priority_field = g_strdup_printf("PRIORITY=%d",
+                                                                   log_level_to_int(level));
+                g_autofree struct iovec *iov = NULL;
+                guint n = g_strv_length((gchar **) fields);
+
+                iov = g_new0(struct iovec, n + 2);
+                iov[0].iov_base = message_field;
+                iov[0].iov_len = strlen(message_field);
+                iov[1].iov_base = priority_field;
+                iov[1].iov_len = strlen(priority_field);
+                for (guint i = 0; i < n; i++) {
+                        iov[i + 2].iov_base = (gchar *) fields[i];
+                        iov[i + 2].iov_len = strlen(fields[i]);
+                }
+
+                sd_journal_sendv(iov, n + 2);
+                return;
+        }
+        if (output_to_systemd) {
+                sd_journal_print(log_level_to_int(level), "%s", message);
+                return;
+        }
+#endif
+        log_level_str = log_level_to_string(level);
+        if (level <= G_LOG_LEVEL_WARNING) {
+                g_printerr("%s: %s\n", log_level_str, message);
+        } else {
+                g_print("%s: %s\n", log_level_str, message);
+        }
+}
+
+/**
+ * @brief     Log thread, writes queued messages in batches until shutdown_logging() was called
+ *            and the queue is empty.
+ *
+ * @param[in] data Not used
+ * @return    NULL is always returned
+ */
+static gpointer log_thread_func(gpointer data)
+{
+        LogEntry batch[LOG_RING_SIZE];
+
+        g_mutex_lock(&log_mutex);
+        while (TRUE) {
+                guint len, dropped;
+
+                while (!log_len && !log_stop)
+                        g_cond_wait(&log_cond, &log_mutex);
+                if (!log_len)
+                        break;
+
+                len = log_len;
+                for (guint i = 0; i < len; i++)
+                        batch[i] = log_ring[(log_head + i) % LOG_RING_SIZE];
+                log_head = (log_head + len) % LOG_RING_SIZE;
+                log_len = 0;
+                dropped = log_dropped;
+                log_dropped = 0;
+                log_writing = TRUE;
+                g_cond_broadcast(&log_cond);
+                g_mutex_unlock(&log_mutex);
+
+                // write without holding the lock, loggers only wait if the ring is full
+                for (guint i = 0; i < len; i++) {
+                        log_write(batch[i].level, batch[i].message,
+                                  (const gchar *const *) batch[i].fields);
+                        g_free(batch[i].message);
+                        g_strfreev(batch[i].fields);
+                }
+                if (dropped) {
+                        g_autofree gchar *msg = g_strdup_printf(
+                                "Dropped %u debug/info messages logged faster than they could be written",
+                                dropped);
+                        log_write(G_LOG_LEVEL_WARNING, msg, NULL);
+                }
+                fflush(stdout);
+
+                g_mutex_lock(&log_mutex);
+                log_writing = FALSE;
+                g_cond_broadcast(&log_cond);
+        }
+        g_mutex_unlock(&log_mutex);
+
+        return NULL;
+}
+
+/**
+ * @brief     Wait until all queued messages were written.
+ */
+static void log_flush(void)
+{
+        g_mutex_lock(&log_mutex);
+        while (log_thread && (log_len || log_writing))
+                g_cond_wait(&log_cond, &log_mutex);
+        g_mutex_unlock(&log_mutex);
+}
+
+/**
+ * @brief     Queue a log message for the log thread. If the ring is full, debug and info
+ *            messages are dropped, others wait for room. Once shutdown_logging() was called,
+ *            the message is written right away instead.
+ *
+ * @param[in] level   Log level
+ * @param[in] message Log message, ownership is taken
+ * @param[in] fields  NULL-terminated array of "KEY=value" journal fields or NULL
+ */
+static void log_enqueue(GLogLevelFlags level, gchar *message, const gchar *const *fields)
+{
+        LogEntry *entry;
+
+        g_mutex_lock(&log_mutex);
+        // the log thread is about to exit, nothing queued now would be written
+        if (log_stop) {
+                g_mutex_unlock(&log_mutex);
+                log_write(level, message, fields);
+                g_free(message);
+                return;
+        }
+
+        while (log_len == LOG_RING_SIZE) {
+                if (level & (G_LOG_LEVEL_INFO | G_LOG_LEVEL_DEBUG)) {
+                        log_dropped++;
+                        g_mutex_unlock(&log_mutex);
+                        g_free(message);
+                        return;
+                }
+                g_cond_wait(&log_cond, &log_mutex);
+        }
+
+        entry = &log_ring[(log_head + log_len++) % LOG_RING_SIZE];
+        entry->level = level;
+        entry->message = message;
+        entry->fields = NULL;
+
+        // in the journal, every message logged while an action is active is tagged with its id
+        if (output_to_systemd && (fields || log_action_id)) {
+                guint n = fields ? g_strv_length((gchar **) fields) : 0;
+
+                entry->fields = g_new0(gchar *, n + 2);
+                for (guint i = 0; i < n; i++)
+                        entry->fields[i] = g_strdup(fields[i]);
+                if (log_action_id)
+                        entry->fields[n] = g_strconcat("RHU_ACTION_ID=", log_action_id, NULL);
+        }
+
+        g_cond_broadcast(&log_cond);
+        g_mutex_unlock(&log_mutex);
+}
+
 /**
  * @brief     Glib log handler callback
  *
@@ -78,28 +272,83 @@ static void log_handler_cb(const gchar    *log_domain,
                            const gchar    *message,
                            gpointer user_data)
 {
-        const gchar *log_level_str;
-#ifdef WITH_SYSTEMD
-        if (output_to_systemd) {
-                int log_level_int = log_level_to_int(log_level & G_LOG_LEVEL_MASK);
-                sd_journal_print(log_level_int, "%s", message);
-        } else {
-#endif
-        log_level_str = log_level_to_string(log_level & G_LOG_LEVEL_MASK);
-        if (log_level <= G_LOG_LEVEL_WARNING) {
-                g_printerr("%s: %s\n", log_level_str, message);
-        } else {
-                g_print("%s: %s\n", log_level_str, message);
+        GLogLevelFlags level = log_level & G_LOG_LEVEL_MASK;
+
+        // the process aborts after fatal messages, so they must not wait in the queue
+        if (log_level & (G_LOG_FLAG_FATAL | G_LOG_FLAG_RECURSION) || !log_thread ||
+            g_thread_self() == log_thread) {
+                if (g_thread_self() != log_thread)
+                        log_flush();
+                log_write(level, message, NULL);
+                return;
         }
-#ifdef WITH_SYSTEMD
-}
-#endif
+
+        log_enqueue(level, g_strdup(message), NULL);
 }
 
 void setup_logging(const gchar *domain, GLogLevelFlags level, gboolean p_output_to_systemd)
 {
         output_to_systemd = p_output_to_systemd;
+        enabled_log_levels = level;
+        if (!log_thread)
+                log_thread = g_thread_new("log", log_thread_func, NULL);
         g_log_set_handler(NULL,
                           level | G_LOG_FLAG_FATAL | G_LOG_FLAG_RECURSION,
                           log_handler_cb, NULL);
 }
+
+void shutdown_logging(void)
+{
+        GThread *thread;
+
+        g_mutex_lock(&log_mutex);
+        log_stop = TRUE;
+        g_cond_broadcast(&log_cond);
+        thread = log_thread;
+        g_mutex_unlock(&log_mutex);
+
+        if (!thread)
+                return;
+
+        g_thread_join(thread);
+
+        // messages logged from now on are written right away
+        g_mutex_lock(&log_mutex);
+        log_thread = NULL;
+        log_stop = FALSE;
+        g_mutex_unlock(&log_mutex);
+}
+
+gboolean log_level_enabled(GLogLevelFlags level)
+{
+        return (enabled_log_levels & level) != 0;
+}
+
+void log_set_action_id(const gchar *action_id)
+{
+        g_mutex_lock(&log_mutex);
+        g_free(log_action_id);
+        log_action_id = g_strdup(action_id);
+        g_mutex_unlock(&log_mutex);
+}
+
+void log_structured(GLogLevelFlags level, const gchar *const *fields, const gchar *format, ...)
+{
+        g_autofree gchar *message = NULL;
+        va_list args;
+
+        if (!log_level_enabled(level))
+                return;
+
+        va_start(args, format);
+        message = g_strdup_vprintf(format, args);
+        va_end(args);
+
+        // fields are only output to the journal, pass the message through GLib otherwise
+        if (output_to_systemd && log_thread) {
+                log_enqueue(level, g_steal_pointer(&message), fields);
+                return;
+        }
+
+        g_log(G_LOG_DOMAIN, level, "%s", message);
+}
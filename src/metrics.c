@@ -0,0 +1,352 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief Transfer and deployment timing metrics, exported as Prometheus text file
+ */
+
+#include "metrics.h"
+
+#include <string.h>
+
+#include "log.h"
+
+#define METRICS_PREFIX "rauc_hawkbit_updater_"
+
+/**
+ * @brief Stages of a transfer, as reported by curl.
+ */
+enum TransferStage {
+        STAGE_DNS,                    /**< name resolution */
+        STAGE_CONNECT,                /**< TCP connect, after name resolution */
+        STAGE_TLS,                    /**< TLS handshake, after TCP connect */
+        STAGE_TTFB,                   /**< time from start until the first byte was received */
+        STAGE_TOTAL,                  /**< time from start until the transfer finished */
+        STAGE_COUNT,
+};
+
+/**
+ * @brief struct accumulating the transfers of one MetricsTransfer kind.
+ */
+typedef struct TransferStats_ {
+        guint64 count;                /**< number of transfers */
+        guint64 errors;               /**< number of failed transfers */
+        guint64 retries;              /**< number of retried transfers */
+        guint64 bytes;                /**< number of bytes received */
+        gdouble seconds[STAGE_COUNT]; /**< sum of all transfers' stage durations */
+        gdouble last[STAGE_COUNT];    /**< stage durations of the last transfer */
+} TransferStats;
+
+/**
+ * @brief struct accumulating the durations of one MetricsPhase.
+ */
+typedef struct PhaseStats_ {
+        guint64 count;                /**< number of times the phase finished */
+        gdouble seconds;              /**< sum of all durations */
+        gdouble last;                 /**< duration of the last run */
+} PhaseStats;
+
+static const gchar *transfer_names[METRICS_TRANSFER_COUNT] = { "api", "download" };
+static const gchar *stage_names[STAGE_COUNT] = { "dns", "connect", "tls", "ttfb", "total" };
+static const gchar *phase_names[METRICS_PHASE_COUNT] = {
+        "poll", "download", "checksum", "install", "deployment"
+};
+
+G_LOCK_DEFINE_STATIC(metrics);
+static gchar *metrics_textfile = NULL;
+static guint64 metrics_generation = 0;
+G_LOCK_DEFINE_STATIC(metrics_textfile);
+static guint64 metrics_written_generation = 0;
+static TransferStats transfers[METRICS_TRANSFER_COUNT];
+static PhaseStats phases[METRICS_PHASE_COUNT];
+static guint64 download_resumes = 0;
+
+/**
+ * @brief Append Prometheus HELP and TYPE lines.
+ *
+ * @param[in] out  GString to append to
+ * @param[in] name Metric name without METRICS_PREFIX
+ * @param[in] type Metric type, "counter" or "gauge"
+ * @param[in] help Metric description
+ */
+static void append_header(GString *out, const gchar *name, const gchar *type, const gchar *help)
+{
+        g_string_append_printf(out, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+        g_string_append_printf(out, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+gboolean metrics_get_memory_usage(guint64 *rss, guint64 *peak)
+{
+        g_autofree gchar *status = NULL;
+        g_auto(GStrv) lines = NULL;
+        gboolean found_rss = FALSE, found_peak = FALSE;
+
+        g_return_val_if_fail(rss, FALSE);
+        g_return_val_if_fail(peak, FALSE);
+
+        if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+                return FALSE;
+
+        // values are given in kB, e.g. "VmHWM:	    4242 kB"
+        lines = g_strsplit(status, "\n", -1);
+        for (gchar **line = lines; *line; line++) {
+                if (g_str_has_prefix(*line, "VmRSS:")) {
+                        *rss = g_ascii_strtoull(*line + strlen("VmRSS:"), NULL, 10) * 1024;
+                        found_rss = TRUE;
+                } else if (g_str_has_prefix(*line, "VmHWM:")) {
+                        *peak = g_ascii_strtoull(*line + strlen("VmHWM:"), NULL, 10) * 1024;
+                        found_peak = TRUE;
+                }
+        }
+
+        return found_rss && found_peak;
+}
+
+/**
+ * @brief Render the accumulated metrics in the Prometheus text exposition format. Must be called
+ *        with the metrics lock held.
+ *
+ * @param[in] out GString to append to
+ */
+static void metrics_append_stats(GString *out)
+{
+        gchar num[G_ASCII_DTOSTR_BUF_SIZE];
+        gint i, j;
+
+        append_header(out, "transfers_total", "counter", "Number of HTTP transfers.");
+        for (i = 0; i < METRICS_TRANSFER_COUNT; i++)
+                g_string_append_printf(out, METRICS_PREFIX "transfers_total{kind=\"%s\"} %"
+                                       G_GUINT64_FORMAT "\n", transfer_names[i],
+                                       transfers[i].count);
+
+        append_header(out, "transfer_errors_total", "counter", "Number of failed HTTP transfers.");
+        for (i = 0; i < METRICS_TRANSFER_COUNT; i++)
+                g_string_append_printf(out, METRICS_PREFIX "transfer_errors_total{kind=\"%s\"} %"
+                                       G_GUINT64_FORMAT "\n", transfer_names[i],
+                                       transfers[i].errors);
+
+        append_header(out, "transfer_retries_total", "counter", "Number of retried HTTP transfers.");
+        for (i = 0; i < METRICS_TRANSFER_COUNT; i++)
+                g_string_append_printf(out, METRICS_PREFIX "transfer_retries_total{kind=\"%s\"} %"
+                                       G_GUINT64_FORMAT "\n", transfer_names[i],
+                                       transfers[i].retries);
+
+        append_header(out, "transfer_bytes_total", "counter", "Number of bytes received.");
+        for (i = 0; i < METRICS_TRANSFER_COUNT; i++)
+                g_string_append_printf(out, METRICS_PREFIX "transfer_bytes_total{kind=\"%s\"} %"
+                                       G_GUINT64_FORMAT "\n", transfer_names[i],
+                                       transfers[i].bytes);
+
+        append_header(out, "transfer_seconds_total", "counter",
+                      "Time spent in the stages of all HTTP transfers.");
+        for (i = 0; i < METRICS_TRANSFER_COUNT; i++) {
+                for (j = 0; j < STAGE_COUNT; j++)
+                        g_string_append_printf(out, METRICS_PREFIX "transfer_seconds_total{kind=\"%s\",stage=\"%s\"} %s\n",
+                                               transfer_names[i], stage_names[j],
+                                               g_ascii_dtostr(num, sizeof(num),
+                                                              transfers[i].seconds[j]));
+        }
+
+        append_header(out, "transfer_last_seconds", "gauge",
+                      "Time spent in the stages of the last HTTP transfer.");
+        for (i = 0; i < METRICS_TRANSFER_COUNT; i++) {
+                for (j = 0; j < STAGE_COUNT; j++)
+                        g_string_append_printf(out, METRICS_PREFIX "transfer_last_seconds{kind=\"%s\",stage=\"%s\"} %s\n",
+                                               transfer_names[i], stage_names[j],
+                                               g_ascii_dtostr(num, sizeof(num),
+                                                              transfers[i].last[j]));
+        }
+
+        append_header(out, "download_resumes_total", "counter",
+                      "Number of downloads resumed from a non-zero offset.");
+        g_string_append_printf(out, METRICS_PREFIX "download_resumes_total %" G_GUINT64_FORMAT
+                               "\n", download_resumes);
+
+        append_header(out, "phase_seconds", "summary", "Duration of poll and deployment phases.");
+        for (i = 0; i < METRICS_PHASE_COUNT; i++) {
+                g_string_append_printf(out, METRICS_PREFIX "phase_seconds_sum{phase=\"%s\"} %s\n",
+                                       phase_names[i],
+                                       g_ascii_dtostr(num, sizeof(num), phases[i].seconds));
+                g_string_append_printf(out, METRICS_PREFIX "phase_seconds_count{phase=\"%s\"} %"
+                                       G_GUINT64_FORMAT "\n", phase_names[i], phases[i].count);
+        }
+
+        append_header(out, "phase_last_seconds", "gauge",
+                      "Duration of the last run of poll and deployment phases.");
+        for (i = 0; i < METRICS_PHASE_COUNT; i++)
+                g_string_append_printf(out, METRICS_PREFIX "phase_last_seconds{phase=\"%s\"} %s\n",
+                                       phase_names[i],
+                                       g_ascii_dtostr(num, sizeof(num), phases[i].last));
+}
+
+/**
+ * @brief Render the memory usage metrics in the Prometheus text exposition format. Reads /proc,
+ *        so must be called without the metrics lock held.
+ *
+ * @param[in] out GString to append to
+ */
+static void metrics_append_memory(GString *out)
+{
+        guint64 rss = 0, peak = 0;
+
+        if (metrics_get_memory_usage(&rss, &peak)) {
+                append_header(out, "memory_rss_bytes", "gauge", "Resident set size.");
+                g_string_append_printf(out, METRICS_PREFIX "memory_rss_bytes %" G_GUINT64_FORMAT
+                                       "\n", rss);
+                append_header(out, "memory_peak_rss_bytes", "gauge",
+                              "Peak resident set size since start.");
+                g_string_append_printf(out, METRICS_PREFIX "memory_peak_rss_bytes %"
+                                       G_GUINT64_FORMAT "\n", peak);
+        }
+}
+
+/**
+ * @brief Atomically replace textfile with text, unless a newer snapshot was written in the
+ *        meantime. Must be called without the metrics lock held, so slow storage never blocks
+ *        threads recording metrics.
+ *
+ * @param[in] textfile   Path of the metrics text file
+ * @param[in] text       Rendered metrics
+ * @param[in] generation Generation of the snapshot text was rendered from
+ */
+static void metrics_write_textfile(const gchar *textfile, const gchar *text, guint64 generation)
+{
+        g_autoptr(GError) error = NULL;
+
+        G_LOCK(metrics_textfile);
+        if (generation > metrics_written_generation) {
+                if (!g_file_set_contents(textfile, text, -1, &error))
+                        g_warning("Failed to write metrics: %s", error->message);
+                metrics_written_generation = generation;
+        }
+        G_UNLOCK(metrics_textfile);
+}
+
+void metrics_init(const gchar *textfile)
+{
+        G_LOCK(metrics);
+        g_free(metrics_textfile);
+        metrics_textfile = g_strdup(textfile);
+        G_UNLOCK(metrics);
+}
+
+void metrics_record_transfer(MetricsTransfer kind, CURL *curl, gboolean success)
+{
+        g_autofree gchar *fields_bytes = NULL, *fields_kind = NULL;
+        gchar *fields_stages[STAGE_COUNT] = { NULL };
+        const gchar *fields[STAGE_COUNT + 3] = { NULL };
+        gdouble dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+        gdouble stages[STAGE_COUNT];
+        curl_off_t bytes = 0;
+        TransferStats *stats;
+        gint i;
+
+        g_return_if_fail(kind < METRICS_TRANSFER_COUNT);
+        g_return_if_fail(curl);
+
+        // curl's times are measured from the start of the transfer
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &tls);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+
+        stages[STAGE_DNS] = dns;
+        stages[STAGE_CONNECT] = MAX(connect - dns, 0);
+        // APPCONNECT is 0 for plain HTTP and reused connections
+        stages[STAGE_TLS] = tls > 0 ? MAX(tls - connect, 0) : 0;
+        stages[STAGE_TTFB] = ttfb;
+        stages[STAGE_TOTAL] = total;
+
+        G_LOCK(metrics);
+        stats = &transfers[kind];
+        stats->count++;
+        stats->bytes += bytes;
+        if (!success)
+                stats->errors++;
+        for (i = 0; i < STAGE_COUNT; i++) {
+                stats->seconds[i] += stages[i];
+                stats->last[i] = stages[i];
+        }
+        G_UNLOCK(metrics);
+
+        if (!log_level_enabled(G_LOG_LEVEL_DEBUG))
+                return;
+
+        fields_kind = g_strdup_printf("RHU_TRANSFER=%s", transfer_names[kind]);
+        fields_bytes = g_strdup_printf("RHU_BYTES=%" CURL_FORMAT_CURL_OFF_T, bytes);
+        fields[0] = fields_kind;
+        fields[1] = fields_bytes;
+        for (i = 0; i < STAGE_COUNT; i++) {
+                g_autofree gchar *key = g_ascii_strup(stage_names[i], -1);
+
+                fields_stages[i] = g_strdup_printf("RHU_%s_SECONDS=%.6f", key, stages[i]);
+                fields[i + 2] = fields_stages[i];
+        }
+
+        log_structured(G_LOG_LEVEL_DEBUG, fields,
+                       "Transfer metrics (%s): dns %.3f s, connect %.3f s, tls %.3f s, "
+                       "ttfb %.3f s, total %.3f s, %" CURL_FORMAT_CURL_OFF_T " bytes%s",
+                       transfer_names[kind], stages[STAGE_DNS], stages[STAGE_CONNECT],
+                       stages[STAGE_TLS], stages[STAGE_TTFB], stages[STAGE_TOTAL], bytes,
+                       success ? "" : ", failed");
+
+        for (i = 0; i < STAGE_COUNT; i++)
+                g_free(fields_stages[i]);
+}
+
+void metrics_record_retry(MetricsTransfer kind)
+{
+        g_return_if_fail(kind < METRICS_TRANSFER_COUNT);
+
+        G_LOCK(metrics);
+        transfers[kind].retries++;
+        G_UNLOCK(metrics);
+}
+
+void metrics_record_resume(void)
+{
+        G_LOCK(metrics);
+        download_resumes++;
+        G_UNLOCK(metrics);
+}
+
+void metrics_record_phase(MetricsPhase phase, gint64 duration)
+{
+        g_autofree gchar *field_phase = NULL, *field_duration = NULL, *textfile = NULL;
+        g_autoptr(GString) text = NULL;
+        const gchar *fields[3] = { NULL };
+        gdouble seconds = (gdouble) duration / G_USEC_PER_SEC;
+        guint64 generation = 0;
+
+        g_return_if_fail(phase < METRICS_PHASE_COUNT);
+
+        G_LOCK(metrics);
+        phases[phase].count++;
+        phases[phase].seconds += seconds;
+        phases[phase].last = seconds;
+        if (metrics_textfile) {
+                textfile = g_strdup(metrics_textfile);
+                text = g_string_new(NULL);
+                metrics_append_stats(text);
+                generation = ++metrics_generation;
+        }
+        G_UNLOCK(metrics);
+
+        if (text) {
+                metrics_append_memory(text);
+                metrics_write_textfile(textfile, text->str, generation);
+        }
+
+        if (!log_level_enabled(G_LOG_LEVEL_INFO))
+                return;
+
+        field_phase = g_strdup_printf("RHU_PHASE=%s", phase_names[phase]);
+        field_duration = g_strdup_printf("RHU_DURATION_SECONDS=%.6f", seconds);
+        fields[0] = field_phase;
+        fields[1] = field_duration;
+
+        log_structured(G_LOG_LEVEL_INFO, fields, "Phase %s took %.3f s", phase_names[phase],
+                       seconds);
+}
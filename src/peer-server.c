@@ -0,0 +1,520 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief Minimal HTTP server providing verified bundles to peers in the local network
+ *
+ * Only what curl needs to download a bundle is implemented: GET and HEAD requests for a cache
+ * key, optionally for a single byte range, answered on a connection closed afterwards. Bundles
+ * are sent with sendfile(), so serving them costs hardly any CPU or memory.
+ */
+
+#include "peer-server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "artifact-cache.h"
+#include "log.h"
+#include "thread-priority.h"
+
+#define PEER_MAX_CONNECTIONS  4
+#define PEER_REQUEST_MAX_SIZE 8 * 1024            // 8KB
+#define PEER_SENDFILE_CHUNK   4 * 1024 * 1024     // 4MB
+#define PEER_TIMEOUT          30                  // s
+
+G_LOCK_DEFINE_STATIC(peer_server);
+static GSocketListener *listener = NULL;
+static GCancellable *cancellable = NULL;
+static GThread *accept_thread = NULL;
+static GThreadPool *pool = NULL;
+static gchar *cache_dir = NULL;
+static GPtrArray *allowed = NULL;
+static gchar *published_key = NULL;
+static gchar *published_file = NULL;
+
+/**
+ * @brief Send all of data to socket.
+ *
+ * @param[in] socket Socket to send to
+ * @param[in] data   Data to send
+ * @param[in] len    Length of data
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean peer_send(GSocket *socket, const gchar *data, gsize len)
+{
+        while (len) {
+                g_autoptr(GError) error = NULL;
+                gssize sent = g_socket_send(socket, data, len, cancellable, &error);
+
+                if (sent < 0) {
+                        log_debug("Failed to send to peer: %s", error->message);
+                        return FALSE;
+                }
+
+                data += sent;
+                len -= sent;
+        }
+
+        return TRUE;
+}
+
+/**
+ * @brief Send a response without body.
+ *
+ * @param[in] socket  Socket to send to
+ * @param[in] status  HTTP status code
+ * @param[in] reason  HTTP reason phrase
+ * @param[in] headers Additional header lines, each terminated by CRLF, or ""
+ */
+static void peer_respond(GSocket *socket, int status, const gchar *reason, const gchar *headers)
+{
+        g_autofree gchar *response = g_strdup_printf("HTTP/1.1 %d %s\r\n"
+                                                     "Content-Length: 0\r\n"
+                                                     "%s"
+                                                     "Connection: close\r\n"
+                                                     "\r\n", status, reason, headers);
+
+        peer_send(socket, response, strlen(response));
+}
+
+/**
+ * @brief Receive the request head (request line and headers) from socket.
+ *
+ * @param[in] socket Socket to receive from
+ * @return newly allocated, NUL-terminated request head or NULL if the peer did not send a
+ *         complete one within PEER_REQUEST_MAX_SIZE and PEER_TIMEOUT
+ */
+static gchar* peer_receive_request(GSocket *socket)
+{
+        g_autofree gchar *buf = g_malloc(PEER_REQUEST_MAX_SIZE + 1);
+        gsize len = 0;
+
+        while (len < PEER_REQUEST_MAX_SIZE) {
+                g_autoptr(GError) error = NULL;
+                gssize r = g_socket_receive(socket, buf + len, PEER_REQUEST_MAX_SIZE - len,
+                                            cancellable, &error);
+
+                if (r <= 0) {
+                        if (r < 0)
+                                log_debug("Failed to receive from peer: %s", error->message);
+                        return NULL;
+                }
+
+                len += r;
+                buf[len] = '\0';
+                if (strstr(buf, "\r\n\r\n"))
+                        return g_steal_pointer(&buf);
+        }
+
+        return NULL;
+}
+
+/**
+ * @brief Parse the value of a Range request header. Only a single range "bytes=first-[last]" or
+ *        "bytes=-suffix" is supported, other ranges are ignored like a missing header.
+ *
+ * @param[in]  value Header value
+ * @param[in]  size  Size of the requested file
+ * @param[out] first Offset of the first byte requested, set to 0 unless a valid range was found
+ * @param[out] last  Offset of the last byte requested, set to size - 1 unless a valid range was
+ *                   found
+ * @return 206 if a satisfiable range was found, 416 if it is not satisfiable, 200 otherwise
+ */
+static int peer_parse_range(const gchar *value, goffset size, goffset *first, goffset *last)
+{
+        const gchar *spec = NULL;
+        gchar *end = NULL;
+
+        *first = 0;
+        *last = size - 1;
+
+        if (!g_str_has_prefix(value, "bytes=") || strchr(value, ','))
+                return 200;
+        spec = value + strlen("bytes=");
+
+        if (*spec == '-') {
+                gint64 suffix = g_ascii_strtoll(spec + 1, &end, 10);
+
+                if (end == spec + 1 || *end || suffix < 0)
+                        return 200;
+                if (!suffix)
+                        return 416;
+
+                *first = MAX(size - suffix, 0);
+                return 206;
+        }
+
+        *first = g_ascii_strtoll(spec, &end, 10);
+        if (end == spec || *end != '-' || *first < 0) {
+                *first = 0;
+                return 200;
+        }
+
+        spec = end + 1;
+        if (*spec) {
+                *last = g_ascii_strtoll(spec, &end, 10);
+                if (*end || *last < *first) {
+                        *first = 0;
+                        *last = size - 1;
+                        return 200;
+                }
+                *last = MIN(*last, size - 1);
+        }
+
+        return *first < size ? 206 : 416;
+}
+
+/**
+ * @brief Open the bundle published as key, or cached as key in cache_dir.
+ *
+ * @param[in] key Cache key requested
+ * @return file descriptor or -1 if key is not served
+ */
+static int peer_open_bundle(const gchar *key)
+{
+        g_autofree gchar *file = NULL;
+        g_autoptr(GError) error = NULL;
+        int fd = -1;
+
+        G_LOCK(peer_server);
+        if (published_key && !g_strcmp0(key, published_key))
+                file = g_strdup(published_file);
+        G_UNLOCK(peer_server);
+
+        if (file) {
+                fd = g_open(file, O_RDONLY | O_CLOEXEC, 0);
+                if (fd >= 0)
+                        return fd;
+                log_debug("Failed to open %s: %s", file, g_strerror(errno));
+        }
+
+        if (!cache_dir)
+                return -1;
+
+        fd = artifact_cache_open(cache_dir, key, &error);
+        if (fd < 0 && !g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                log_debug("%s", error->message);
+
+        return fd;
+}
+
+/**
+ * @brief Send bytes first to last of fd to socket with sendfile().
+ *
+ * @param[in] socket Socket to send to
+ * @param[in] fd     File to send
+ * @param[in] first  Offset of the first byte to send
+ * @param[in] last   Offset of the last byte to send
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean peer_sendfile(GSocket *socket, int fd, goffset first, goffset last)
+{
+        int socket_fd = g_socket_get_fd(socket);
+        off_t offset = first;
+
+        while (offset <= last && !g_cancellable_is_cancelled(cancellable)) {
+                ssize_t sent = sendfile(socket_fd, fd, &offset,
+                                        MIN(PEER_SENDFILE_CHUNK, last + 1 - offset));
+
+                if (sent > 0 || (sent < 0 && errno == EINTR))
+                        continue;
+
+                // GSocket's file descriptor is non-blocking
+                if (sent < 0 && errno == EAGAIN &&
+                    g_socket_condition_timed_wait(socket, G_IO_OUT,
+                                                  PEER_TIMEOUT * G_USEC_PER_SEC, cancellable,
+                                                  NULL))
+                        continue;
+
+                log_debug("Failed to send bundle to peer: %s",
+                        sent ? g_strerror(errno) : "file shrunk");
+                return FALSE;
+        }
+
+        return offset > last;
+}
+
+/**
+ * @brief Check whether the peer connected on socket is in the allow-list given to
+ *        peer_server_start(), if any.
+ *
+ * @param[in] socket Socket connected to the peer
+ * @return TRUE if the peer may be served, FALSE otherwise
+ */
+static gboolean peer_allowed(GSocket *socket)
+{
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autofree gchar *peer = NULL;
+        GInetAddress *inet_address;
+
+        if (!allowed)
+                return TRUE;
+
+        address = g_socket_get_remote_address(socket, NULL);
+        if (!G_IS_INET_SOCKET_ADDRESS(address))
+                return FALSE;
+
+        inet_address = g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(address));
+        for (guint i = 0; i < allowed->len; i++) {
+                if (g_inet_address_mask_matches(g_ptr_array_index(allowed, i), inet_address))
+                        return TRUE;
+        }
+
+        peer = g_inet_address_to_string(inet_address);
+        g_message("Refusing peer %s, not in peer_allow", peer);
+        return FALSE;
+}
+
+/**
+ * @brief GFunc serving a single request on the GSocket* connection passed as data.
+ */
+static void peer_serve(gpointer data, gpointer user_data)
+{
+        g_autoptr(GSocket) socket = data;
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autoptr(GString) response = NULL;
+        g_autofree gchar *request = NULL, *peer = NULL;
+        g_auto(GStrv) lines = NULL, request_line = NULL;
+        const gchar *key = NULL, *range = NULL;
+        goffset first, last;
+        GStatBuf st;
+        int status, fd;
+
+        if (g_cancellable_is_cancelled(cancellable))
+                return;
+
+        // pool threads are shared by all connections, apply to each in case the pool grew
+        thread_priority_apply("peer-server");
+
+        address = g_socket_get_remote_address(socket, NULL);
+        if (G_IS_INET_SOCKET_ADDRESS(address))
+                peer = g_inet_address_to_string(g_inet_socket_address_get_address(
+                                G_INET_SOCKET_ADDRESS(address)));
+
+        request = peer_receive_request(socket);
+        if (!request) {
+                peer_respond(socket, 400, "Bad Request", "");
+                return;
+        }
+
+        lines = g_strsplit(request, "\r\n", -1);
+        request_line = g_strsplit(lines[0], " ", 3);
+        if (g_strv_length(request_line) != 3 || request_line[1][0] != '/') {
+                peer_respond(socket, 400, "Bad Request", "");
+                return;
+        }
+        if (g_strcmp0(request_line[0], "GET") && g_strcmp0(request_line[0], "HEAD")) {
+                peer_respond(socket, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n");
+                return;
+        }
+        key = request_line[1] + 1;
+
+        for (gchar **line = lines + 1; *line && **line; line++) {
+                if (!g_ascii_strncasecmp(*line, "Range:", strlen("Range:")))
+                        range = g_strstrip(*line + strlen("Range:"));
+        }
+
+        fd = peer_open_bundle(key);
+        if (fd < 0) {
+                peer_respond(socket, 404, "Not Found", "");
+                return;
+        }
+
+        if (fstat(fd, &st)) {
+                peer_respond(socket, 500, "Internal Server Error", "");
+                goto out;
+        }
+
+        // content is addressed by checksum, so range requests never need validators
+        status = peer_parse_range(range ? range : "", st.st_size, &first, &last);
+        if (status == 416) {
+                g_autofree gchar *content_range = g_strdup_printf(
+                        "Content-Range: bytes */%" G_GOFFSET_FORMAT "\r\n",
+                        (goffset) st.st_size);
+
+                peer_respond(socket, 416, "Range Not Satisfiable", content_range);
+                goto out;
+        }
+
+        response = g_string_new(NULL);
+        g_string_append_printf(response, "HTTP/1.1 %d %s\r\n", status,
+                               status == 206 ? "Partial Content" : "OK");
+        g_string_append(response, "Content-Type: application/octet-stream\r\n");
+        g_string_append_printf(response, "Content-Length: %" G_GOFFSET_FORMAT "\r\n",
+                               last + 1 - first);
+        g_string_append(response, "Accept-Ranges: bytes\r\n");
+        if (status == 206)
+                g_string_append_printf(response, "Content-Range: bytes %" G_GOFFSET_FORMAT "-%"
+                                       G_GOFFSET_FORMAT "/%" G_GOFFSET_FORMAT "\r\n", first,
+                                       last, (goffset) st.st_size);
+        g_string_append(response, "Connection: close\r\n\r\n");
+
+        if (!peer_send(socket, response->str, response->len) ||
+            !g_strcmp0(request_line[0], "HEAD"))
+                goto out;
+
+        g_message("Serving %s to peer %s", key, peer ? peer : "(unknown)");
+        if (peer_sendfile(socket, fd, first, last))
+                log_debug("Served %s to peer %s", key, peer ? peer : "(unknown)");
+
+out:
+        g_close(fd, NULL);
+}
+
+/**
+ * @brief Thread accepting peer connections and passing them to the thread pool. Once
+ *        PEER_MAX_CONNECTIONS connections wait for a busy worker, further ones are refused with
+ *        503, so peers fall back to another source instead of waiting.
+ *
+ * @param[in] data unused
+ * @return NULL
+ */
+static gpointer peer_accept_thread(gpointer data)
+{
+        while (!g_cancellable_is_cancelled(cancellable)) {
+                g_autoptr(GError) error = NULL;
+                GSocket *socket = g_socket_listener_accept_socket(listener, NULL, cancellable,
+                                                                  &error);
+
+                if (!socket) {
+                        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                                g_warning("Failed to accept peer connection: %s", error->message);
+                                g_usleep(G_USEC_PER_SEC);
+                        }
+                        continue;
+                }
+
+                g_socket_set_timeout(socket, PEER_TIMEOUT);
+
+                if (!peer_allowed(socket)) {
+                        peer_respond(socket, 403, "Forbidden", "");
+                        g_object_unref(socket);
+                        continue;
+                }
+
+                if (g_thread_pool_unprocessed(pool) >= PEER_MAX_CONNECTIONS) {
+                        peer_respond(socket, 503, "Service Unavailable", "Retry-After: 60\r\n");
+                        g_object_unref(socket);
+                        continue;
+                }
+
+                if (!g_thread_pool_push(pool, socket, &error)) {
+                        g_warning("Failed to serve peer connection: %s", error->message);
+                        g_object_unref(socket);
+                }
+        }
+
+        return NULL;
+}
+
+gboolean peer_server_start(guint16 port, const gchar *address, GStrv allow, const gchar *dir,
+                           GError **error)
+{
+        g_return_val_if_fail(port, FALSE);
+        g_return_val_if_fail(!accept_thread, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        listener = g_socket_listener_new();
+        if (address) {
+                g_autoptr(GInetAddress) inet_address = g_inet_address_new_from_string(address);
+                g_autoptr(GSocketAddress) socket_address = NULL;
+
+                if (!inet_address) {
+                        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                    "Invalid address %s", address);
+                        g_clear_object(&listener);
+                        return FALSE;
+                }
+
+                socket_address = g_inet_socket_address_new(inet_address, port);
+                if (!g_socket_listener_add_address(listener, socket_address, G_SOCKET_TYPE_STREAM,
+                                                   G_SOCKET_PROTOCOL_TCP, NULL, NULL, error)) {
+                        g_prefix_error(error, "Failed to listen on %s port %u: ", address, port);
+                        g_clear_object(&listener);
+                        return FALSE;
+                }
+        } else if (!g_socket_listener_add_inet_port(listener, port, NULL, error)) {
+                g_prefix_error(error, "Failed to listen on port %u: ", port);
+                g_clear_object(&listener);
+                return FALSE;
+        }
+
+        for (gchar **entry = allow; entry && *entry; entry++) {
+                GInetAddressMask *mask = g_inet_address_mask_new_from_string(*entry, error);
+
+                if (!mask) {
+                        g_clear_pointer(&allowed, g_ptr_array_unref);
+                        g_clear_object(&listener);
+                        return FALSE;
+                }
+
+                if (!allowed)
+                        allowed = g_ptr_array_new_with_free_func(g_object_unref);
+                g_ptr_array_add(allowed, mask);
+        }
+
+        pool = g_thread_pool_new(peer_serve, NULL, PEER_MAX_CONNECTIONS, FALSE, error);
+        if (!pool) {
+                g_clear_pointer(&allowed, g_ptr_array_unref);
+                g_clear_object(&listener);
+                return FALSE;
+        }
+
+        g_free(cache_dir);
+        cache_dir = g_strdup(dir);
+        cancellable = g_cancellable_new();
+        accept_thread = g_thread_new("peer-server", peer_accept_thread, NULL);
+
+        if (address)
+                g_message("Serving bundles to peers on %s port %u", address, port);
+        else
+                g_message("Serving bundles to peers on port %u", port);
+        return TRUE;
+}
+
+void peer_server_publish(const gchar *key, const gchar *file)
+{
+        g_return_if_fail(key);
+        g_return_if_fail(file);
+
+        G_LOCK(peer_server);
+        g_free(published_key);
+        g_free(published_file);
+        published_key = g_strdup(key);
+        published_file = g_strdup(file);
+        G_UNLOCK(peer_server);
+}
+
+void peer_server_withdraw(void)
+{
+        G_LOCK(peer_server);
+        g_clear_pointer(&published_key, g_free);
+        g_clear_pointer(&published_file, g_free);
+        G_UNLOCK(peer_server);
+}
+
+void peer_server_stop(void)
+{
+        if (!accept_thread)
+                return;
+
+        // aborts accepting and blocking sends, queued connections are closed right away
+        g_cancellable_cancel(cancellable);
+        g_thread_join(accept_thread);
+        accept_thread = NULL;
+        g_thread_pool_free(pool, FALSE, TRUE);
+        pool = NULL;
+
+        g_socket_listener_close(listener);
+        g_clear_object(&listener);
+        g_clear_object(&cancellable);
+        g_clear_pointer(&cache_dir, g_free);
+        g_clear_pointer(&allowed, g_ptr_array_unref);
+        peer_server_withdraw();
+}
@@ -104,8 +104,10 @@ static gboolean on_new_software_ready_cb(gpointer data)
 
         notify_hawkbit_install_progress = userdata->install_progress_callback;
         notify_hawkbit_install_complete = userdata->install_complete_callback;
-        userdata->install_success = rauc_install(userdata->file, on_rauc_install_progress_cb,
-                                                 on_rauc_install_complete_cb, run_once);
+        userdata->install_success = rauc_install(userdata->file, userdata->auth_header,
+                                                 userdata->ssl_verify,
+                                                 on_rauc_install_progress_cb,
+                                                 on_rauc_install_complete_cb, userdata->wait);
 
         return G_SOURCE_REMOVE;
 }
@@ -118,6 +120,7 @@ int main(int argc, char **argv)
         GLogLevelFlags log_level;
         g_autoptr(Config) config = NULL;
         GLogLevelFlags fatal_mask;
+        int res;
 
         fatal_mask = g_log_set_always_fatal(G_LOG_FATAL_MASK);
         fatal_mask |= G_LOG_LEVEL_CRITICAL;
@@ -158,7 +161,11 @@ int main(int argc, char **argv)
         log_level = (opt_debug) ? G_LOG_LEVEL_MASK : config->log_level;
 
         setup_logging(PROGRAM, log_level, opt_output_systemd);
-        hawkbit_init(config, on_new_software_ready_cb);
+        hawkbit_init(config, on_new_software_ready_cb, rauc_get_installed_version,
+                     rauc_check_bundle);
 
-        return hawkbit_start_service_sync();
+        res = hawkbit_start_service_sync();
+        shutdown_logging();
+
+        return res;
 }
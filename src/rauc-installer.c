@@ -12,8 +12,10 @@
 #include <glib/gtypes.h>
 #include <stdio.h>
 #include "gobject/gclosure.h"
+#include "log.h"
 #include "rauc-installer.h"
 #include "rauc-installer-gen.h"
+#include "thread-priority.h"
 
 static GThread *thread_install = NULL;
 
@@ -113,6 +115,7 @@ static void install_context_free(struct install_context *context)
                 return;
 
         g_free(context->bundle);
+        g_free(context->auth_header);
         g_mutex_clear(&context->status_mutex);
 
         // make sure all pending events are processed
@@ -125,6 +128,46 @@ static void install_context_free(struct install_context *context)
         g_free(context);
 }
 
+GBusType rauc_get_bus_type(void)
+{
+        return (!g_strcmp0(g_getenv("DBUS_STARTER_BUS_TYPE"), "session"))
+               ? G_BUS_TYPE_SESSION : G_BUS_TYPE_SYSTEM;
+}
+
+/**
+ * @brief Check whether bundle is streamed via HTTP(S) rather than a local file.
+ *
+ * @param[in] bundle Bundle file or URL
+ * @return TRUE if bundle is an HTTP(S) URL, FALSE otherwise
+ */
+static gboolean bundle_is_streamed(const gchar *bundle)
+{
+        return g_str_has_prefix(bundle, "http://") || g_str_has_prefix(bundle, "https://");
+}
+
+/**
+ * @brief Build the arguments for installing or inspecting a bundle via HTTP(S) streaming.
+ *
+ * @param[in] auth_header HTTP header to pass along or NULL
+ * @param[in] ssl_verify  Verify server certificate
+ * @return floating GVariant* of type a{sv}
+ */
+static GVariant* build_streaming_args(const gchar *auth_header, gboolean ssl_verify)
+{
+        GVariantBuilder args;
+        const gchar *headers[] = { auth_header, NULL };
+
+        g_variant_builder_init(&args, G_VARIANT_TYPE_VARDICT);
+        if (auth_header)
+                g_variant_builder_add(&args, "{sv}", "http-headers",
+                                      g_variant_new_strv(headers, -1));
+        if (!ssl_verify)
+                g_variant_builder_add(&args, "{sv}", "tls-no-verify",
+                                      g_variant_new_boolean(TRUE));
+
+        return g_variant_builder_end(&args);
+}
+
 /**
  * @brief RAUC client mainloop
  *
@@ -134,8 +177,7 @@ static void install_context_free(struct install_context *context)
  */
 static gpointer install_loop_thread(gpointer data)
 {
-        GBusType bus_type = (!g_strcmp0(g_getenv("DBUS_STARTER_BUS_TYPE"), "session"))
-                            ? G_BUS_TYPE_SESSION : G_BUS_TYPE_SYSTEM;
+        GBusType bus_type = rauc_get_bus_type();
         RInstaller *r_installer_proxy = NULL;
         g_autoptr(GError) error = NULL;
         struct install_context *context = NULL;
@@ -144,8 +186,9 @@ static gpointer install_loop_thread(gpointer data)
 
         context = data;
         g_main_context_push_thread_default(context->loop_context);
+        thread_priority_apply("installer");
 
-        g_debug("Creating RAUC DBUS proxy");
+        log_debug("Creating RAUC DBUS proxy");
         r_installer_proxy = r_installer_proxy_new_for_bus_sync(
                 bus_type, G_DBUS_PROXY_FLAGS_GET_INVALIDATED_PROPERTIES,
                 "de.pengutronix.rauc", "/", NULL, &error);
@@ -164,8 +207,18 @@ static gpointer install_loop_thread(gpointer data)
                 goto out_loop;
         }
 
-        g_debug("Trying to contact RAUC DBUS service");
-        if (!r_installer_call_install_sync(r_installer_proxy, context->bundle, NULL, &error)) {
+        log_debug("Trying to contact RAUC DBUS service");
+        if (bundle_is_streamed(context->bundle)) {
+                // streaming requires InstallBundle(), available since RAUC v1.7
+                GVariant *args = build_streaming_args(context->auth_header, context->ssl_verify);
+
+                if (!r_installer_call_install_bundle_sync(r_installer_proxy, context->bundle, args,
+                                                          NULL, &error)) {
+                        g_warning("%s", error->message);
+                        goto out_loop;
+                }
+        } else if (!r_installer_call_install_sync(r_installer_proxy, context->bundle, NULL,
+                                                  &error)) {
                 g_warning("%s", error->message);
                 goto out_loop;
         }
@@ -189,8 +242,9 @@ notify_complete:
         return NULL;
 }
 
-gboolean rauc_install(const gchar *bundle, GSourceFunc on_install_notify,
-                      GSourceFunc on_install_complete, gboolean wait)
+gboolean rauc_install(const gchar *bundle, const gchar *auth_header, gboolean ssl_verify,
+                      GSourceFunc on_install_notify, GSourceFunc on_install_complete,
+                      gboolean wait)
 {
         GMainContext *loop_context = NULL;
         struct install_context *context = NULL;
@@ -200,6 +254,8 @@ gboolean rauc_install(const gchar *bundle, GSourceFunc on_install_notify,
         loop_context = g_main_context_new();
         context = install_context_new();
         context->bundle = g_strdup(bundle);
+        context->auth_header = g_strdup(auth_header);
+        context->ssl_verify = ssl_verify;
         context->notify_event = on_install_notify;
         context->notify_complete = on_install_complete;
         context->mainloop = g_main_loop_new(loop_context, FALSE);
@@ -226,3 +282,102 @@ gboolean rauc_install(const gchar *bundle, GSourceFunc on_install_notify,
         // return immediately if we did not wait for the install thread
         return TRUE;
 }
+
+gchar* rauc_get_installed_version(GError **error)
+{
+        RInstaller *r_installer_proxy = NULL;
+        g_autoptr(GVariant) slot_status = NULL;
+        GVariantIter iter;
+        const gchar *slot_name = NULL;
+        GVariant *slot_dict = NULL;
+        gchar *installed_version = NULL;
+        gboolean res;
+
+        g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+        r_installer_proxy = r_installer_proxy_new_for_bus_sync(
+                rauc_get_bus_type(), G_DBUS_PROXY_FLAGS_NONE, "de.pengutronix.rauc", "/", NULL,
+                error);
+        if (!r_installer_proxy) {
+                g_prefix_error(error, "Failed to create RAUC DBUS proxy: ");
+                return NULL;
+        }
+
+        res = r_installer_call_get_slot_status_sync(r_installer_proxy, &slot_status, NULL, error);
+        g_clear_pointer(&r_installer_proxy, g_object_unref);
+        if (!res)
+                return NULL;
+
+        g_variant_iter_init(&iter, slot_status);
+        while (!installed_version &&
+               g_variant_iter_next(&iter, "(&s@a{sv})", &slot_name, &slot_dict)) {
+                g_autoptr(GVariant) dict = slot_dict;
+                const gchar *state = NULL, *version = NULL;
+
+                if (!g_variant_lookup(dict, "state", "&s", &state) ||
+                    g_strcmp0(state, "booted") ||
+                    !g_variant_lookup(dict, "bundle.version", "&s", &version))
+                        continue;
+
+                log_debug("Booted slot %s has bundle version %s", slot_name, version);
+                installed_version = g_strdup(version);
+        }
+
+        if (!installed_version)
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                            "No booted slot with bundle version found");
+
+        return installed_version;
+}
+
+gboolean rauc_check_bundle(const gchar *bundle, const gchar *auth_header, gboolean ssl_verify,
+                           GError **error)
+{
+        RInstaller *r_installer_proxy = NULL;
+        g_autoptr(GVariant) info = NULL;
+        g_autoptr(GVariant) update = NULL;
+        g_autofree gchar *system_compatible = NULL;
+        const gchar *compatible = NULL;
+        GVariant *args = NULL;
+        gboolean res;
+
+        g_return_val_if_fail(bundle, FALSE);
+        g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+        r_installer_proxy = r_installer_proxy_new_for_bus_sync(
+                rauc_get_bus_type(), G_DBUS_PROXY_FLAGS_NONE, "de.pengutronix.rauc", "/", NULL,
+                error);
+        if (!r_installer_proxy) {
+                g_prefix_error(error, "Failed to create RAUC DBUS proxy: ");
+                return FALSE;
+        }
+
+        // streamed bundles are inspected by fetching the signature and manifest only
+        args = bundle_is_streamed(bundle) ? build_streaming_args(auth_header, ssl_verify)
+               : g_variant_new("a{sv}", NULL);
+        res = r_installer_call_inspect_bundle_sync(r_installer_proxy, bundle, args, &info, NULL,
+                                                   error);
+        system_compatible = r_installer_dup_compatible(r_installer_proxy);
+        g_clear_pointer(&r_installer_proxy, g_object_unref);
+        if (!res) {
+                if (error)
+                        g_dbus_error_strip_remote_error(*error);
+                return FALSE;
+        }
+
+        update = g_variant_lookup_value(info, "update", G_VARIANT_TYPE_VARDICT);
+        if (!update || !g_variant_lookup(update, "compatible", "&s", &compatible)) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Bundle information lacks compatible");
+                return FALSE;
+        }
+
+        if (g_strcmp0(compatible, system_compatible)) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                            "Bundle compatible '%s' does not match system compatible '%s'",
+                            compatible, system_compatible ? system_compatible : "");
+                return FALSE;
+        }
+
+        return TRUE;
+}
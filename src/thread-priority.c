@@ -0,0 +1,100 @@
+/**
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * @file
+ * @brief Scheduling parameters for threads streaming and hashing bundles
+ *
+ * On Linux, I/O priority, scheduling policy, nice level and CPU affinity are all attributes of a
+ * thread, so they are applied by each thread to itself without affecting the main loop.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "thread-priority.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// see linux/ioprio.h, not shipped by all C libraries' kernel headers
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_CLASS_SHIFT 13
+
+static ThreadPriority thread_priority = { 0 };
+static gint warned = 0;
+
+void thread_priority_set(const ThreadPriority *priority)
+{
+        g_return_if_fail(priority);
+
+        if (thread_priority.cpu_affinity)
+                g_array_unref(thread_priority.cpu_affinity);
+
+        thread_priority = *priority;
+        if (thread_priority.cpu_affinity)
+                g_array_ref(thread_priority.cpu_affinity);
+}
+
+/**
+ * @brief Log failing to apply a scheduling parameter: as warning the first time, as debug
+ *        message afterwards, since every thread started runs into the same failure.
+ *
+ * @param[in] what Name of the parameter
+ * @param[in] name Name of the thread
+ * @param[in] err  errno of the failure
+ */
+static void thread_priority_failed(const gchar *what, const gchar *name, int err)
+{
+        if (g_atomic_int_compare_and_exchange(&warned, 0, 1))
+                g_warning("Failed to set %s of %s thread: %s", what, name, g_strerror(err));
+        else
+                log_debug("Failed to set %s of %s thread: %s", what, name, g_strerror(err));
+}
+
+void thread_priority_apply(const gchar *name)
+{
+        pid_t tid = (pid_t) syscall(SYS_gettid);
+
+        g_return_if_fail(name);
+
+        if (thread_priority.io_class != IO_CLASS_DEFAULT) {
+                int ioprio = thread_priority.io_class == IO_CLASS_IDLE
+                             ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+                             : (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | thread_priority.io_priority;
+
+                if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio))
+                        thread_priority_failed("I/O priority", name, errno);
+        }
+
+        if (thread_priority.cpu_policy != CPU_POLICY_OTHER) {
+                struct sched_param param = { .sched_priority = 0 };
+                int policy = thread_priority.cpu_policy == CPU_POLICY_IDLE
+                             ? SCHED_IDLE : SCHED_BATCH;
+
+                if (sched_setscheduler(tid, policy, &param))
+                        thread_priority_failed("scheduling policy", name, errno);
+        }
+
+        if (thread_priority.nice && thread_priority.cpu_policy != CPU_POLICY_IDLE &&
+            setpriority(PRIO_PROCESS, tid, thread_priority.nice))
+                thread_priority_failed("nice level", name, errno);
+
+        if (thread_priority.cpu_affinity) {
+                cpu_set_t set;
+
+                CPU_ZERO(&set);
+                for (guint i = 0; i < thread_priority.cpu_affinity->len; i++)
+                        CPU_SET(g_array_index(thread_priority.cpu_affinity, guint, i), &set);
+
+                if (sched_setaffinity(tid, sizeof(set), &set))
+                        thread_priority_failed("CPU affinity", name, errno);
+        }
+}
@@ -2,9 +2,11 @@
 # SPDX-FileCopyrightText: 2021 Enrico Jörns <e.joerns@pengutronix.de>, Pengutronix
 # SPDX-FileCopyrightText: 2021 Bastian Krause <bst@pengutronix.de>, Pengutronix
 
+import json
 import os
 import sys
 from configparser import ConfigParser
+from pathlib import Path
 
 import pytest
 
@@ -17,6 +19,30 @@ def pytest_addoption(parser):
         '--hawkbit-instance',
         help='HOST:PORT of hawkBit instance to use (default: %(default)s)',
         default='localhost:8080')
+    parser.addoption(
+        '--performance', action='store_true',
+        help='run performance tests (marked "performance"), skipped by default')
+    parser.addoption(
+        '--performance-baselines',
+        help='JSON file of performance baselines to compare against (default: %(default)s)',
+        default=str(Path(__file__).parent / 'performance-baselines.json'))
+    parser.addoption(
+        '--update-performance-baselines', action='store_true',
+        help='store performance measurements as new baselines instead of comparing them')
+
+def pytest_configure(config):
+    config.addinivalue_line(
+        'markers', 'performance: performance regression test, needs --performance to run')
+
+def pytest_collection_modifyitems(config, items):
+    """Skip performance tests unless --performance is given."""
+    if config.getoption('--performance'):
+        return
+
+    skip = pytest.mark.skip(reason='performance test, pass --performance to run')
+    for item in items:
+        if 'performance' in item.keywords:
+            item.add_marker(skip)
 
 @pytest.fixture(autouse=True)
 def env_setup(monkeypatch):
@@ -125,6 +151,13 @@ def rauc_bundle(tmp_path_factory):
     bundle.write_bytes(os.urandom(512)*1024)
     return str(bundle)
 
+@pytest.fixture(scope='session')
+def large_rauc_bundle(tmp_path_factory):
+    """Creates a temporary 32 MB file to be used as a dummy RAUC bundle for performance tests."""
+    bundle = tmp_path_factory.mktemp('data') / 'large-bundle.raucb'
+    bundle.write_bytes(os.urandom(1024*1024)*32)
+    return str(bundle)
+
 @pytest.fixture
 def assign_bundle(hawkbit, hawkbit_target_added, rauc_bundle, tmp_path):
     """
@@ -132,28 +165,46 @@ def assign_bundle(hawkbit, hawkbit_target_added, rauc_bundle, tmp_path):
     Creates a distributionset from this softwaremodule. Assigns this distributionset to the target
     created by the hawkbit_target_added fixture. Returns the corresponding action ID of this
     assignment.
+    Files given as `extra_artifacts` are added to each softwaremodule in addition, `metadata` is
+    added as target visible metadata to each softwaremodule. `bundle` replaces the file from the
+    rauc_bundle fixture. Each (file, base version) tuple given as `delta_bundles` is added as an
+    additional application softwaremodule with `base_version` metadata.
     """
     swmodules = []
     artifacts = []
     distributionsets = []
     actions = []
 
-    def _assign_bundle(swmodules_num=1, artifacts_num=1, params=None):
+    def _assign_bundle(swmodules_num=1, artifacts_num=1, params=None, extra_artifacts=(),
+                       metadata=None, bundle=rauc_bundle, delta_bundles=()):
         for i in range(swmodules_num):
             swmodule_type = 'application' if swmodules_num > 1 else 'os'
             swmodules.append(hawkbit.add_softwaremodule(module_type=swmodule_type))
 
             for k in range(artifacts_num):
                 # hawkBit will reject files with the same name, so symlink to unique names
-                symlink_dest = tmp_path / f'{os.path.basename(rauc_bundle)}_{k}'
+                symlink_dest = tmp_path / f'{os.path.basename(bundle)}_{k}'
                 try:
-                    os.symlink(rauc_bundle, symlink_dest)
+                    os.symlink(bundle, symlink_dest)
                 except FileExistsError:
                     pass
 
                 artifacts.append(hawkbit.add_artifact(symlink_dest, swmodules[-1]))
 
+            for extra_artifact in extra_artifacts:
+                artifacts.append(hawkbit.add_artifact(extra_artifact, swmodules[-1]))
+
+            if metadata:
+                hawkbit.add_softwaremodule_metadata(metadata, swmodules[-1])
+
+        for delta_bundle, base_version in delta_bundles:
+            swmodules.append(hawkbit.add_softwaremodule(module_type='application'))
+            artifacts.append(hawkbit.add_artifact(delta_bundle, swmodules[-1]))
+            hawkbit.add_softwaremodule_metadata({'base_version': base_version}, swmodules[-1])
+
         dist_type = 'app' if swmodules_num > 1 else 'os'
+        if delta_bundles:
+            dist_type = 'os_app'
         distributionsets.append(hawkbit.add_distributionset(module_ids=swmodules,
                                                             dist_type=dist_type))
         actions.append(hawkbit.assign_target(distributionsets[-1], params=params))
@@ -221,6 +272,22 @@ def rauc_dbus_install_failure(rauc_bundle):
     assert proc.isalive()
     assert proc.terminate(force=True)
 
+@pytest.fixture
+def rauc_dbus_incompatible(rauc_bundle):
+    """
+    Creates a RAUC D-Bus dummy interface on the SessionBus reporting a bundle compatible not
+    matching the system compatible on InspectBundle().
+    """
+    proc = run_pexpect(f'{sys.executable} -m rauc_dbus_dummy {rauc_bundle} '
+                       '--bundle-compatible=other-device',
+                       cwd=os.path.dirname(__file__))
+    proc.expect('Interface published')
+
+    yield
+
+    assert proc.isalive()
+    assert proc.terminate(force=True)
+
 @pytest.fixture(scope='session')
 def nginx_config(tmp_path_factory):
     """
@@ -328,3 +395,103 @@ def partial_download_port(nginx_proxy):
         'limit_rate': '70k',
     }
     return nginx_proxy(location_options)
+
+@pytest.fixture
+def impaired_port(nginx_proxy):
+    """
+    Runs an nginx proxy limiting download speeds to `rate` (nginx size, e.g. '2m' for 2 MB/s, 0
+    for unlimited). Emulates latency (`delay`, `jitter`) and packet `loss` (tc-netem(8) syntax,
+    e.g. '40ms', '1%') for all traffic from and to the proxy's port on the loopback device.
+    Network emulation needs tc and CAP_NET_ADMIN, the test is skipped otherwise. Only one port
+    per test can be impaired. Returns the port the proxy is running on.
+    """
+    import shutil
+    import subprocess
+
+    qdisc_added = False
+
+    def tc(*args):
+        return subprocess.run(['tc', *args], capture_output=True, text=True, check=False)
+
+    def _impaired_port(*, rate=0, delay=None, jitter=None, loss=None):
+        nonlocal qdisc_added
+
+        port = nginx_proxy({'proxy_limit_rate': rate})
+
+        netem = []
+        if delay:
+            netem += ['delay', delay] + ([jitter] if jitter else [])
+        if loss:
+            netem += ['loss', loss]
+        if not netem:
+            return port
+
+        if not shutil.which('tc'):
+            pytest.skip('tc unavailable')
+
+        # unmatched traffic is sorted into bands 1:1 and 1:2 by the prio qdisc's default priomap
+        commands = [
+            ('qdisc', 'add', 'dev', 'lo', 'root', 'handle', '1:', 'prio'),
+            ('qdisc', 'add', 'dev', 'lo', 'parent', '1:3', 'handle', '30:', 'netem', *netem),
+        ]
+        for filter_prio, (protocol, match) in enumerate((('ip', 'ip'), ('ipv6', 'ip6')), 1):
+            for direction in ('sport', 'dport'):
+                commands.append(('filter', 'add', 'dev', 'lo', 'parent', '1:0', 'protocol',
+                                 protocol, 'prio', str(filter_prio), 'u32', 'match', match,
+                                 direction, str(port), '0xffff', 'flowid', '1:3'))
+
+        for command in commands:
+            proc = tc(*command)
+            if proc.returncode:
+                if qdisc_added:
+                    tc('qdisc', 'del', 'dev', 'lo', 'root')
+                pytest.skip(f'tc failed (CAP_NET_ADMIN required): {proc.stderr.strip()}')
+            qdisc_added = True
+
+        return port
+
+    yield _impaired_port
+
+    if qdisc_added:
+        tc('qdisc', 'del', 'dev', 'lo', 'root')
+
+@pytest.fixture(scope='session')
+def performance_baseline(pytestconfig):
+    """
+    Compares performance measurements against the baselines stored in the file given by
+    --performance-baselines. A measurement regresses if it is worse than its baseline by more than
+    the baseline's relative `tolerance` plus its absolute `slack`, both stored along with the
+    baseline value. With --update-performance-baselines, measurements are stored as new baselines
+    instead, keeping tolerance and slack of existing baselines.
+    """
+    path = Path(pytestconfig.getoption('--performance-baselines'))
+    update = pytestconfig.getoption('--update-performance-baselines')
+    baselines = json.loads(path.read_text()) if path.exists() else {}
+
+    def _check(name, value, *, higher_is_better=False, tolerance=0.25, slack=0.0):
+        """
+        Returns a description of the regression if `value` regressed against baseline `name`,
+        None otherwise. Skips the test if there is no baseline for `name`.
+        """
+        if update:
+            baseline = baselines.setdefault(name, {'tolerance': tolerance, 'slack': slack})
+            baseline['value'] = value
+            return None
+
+        baseline = baselines.get(name)
+        if baseline is None:
+            pytest.skip(f'No baseline for {name}, pass --update-performance-baselines to store '
+                        'measurements as baselines')
+
+        allowed = baseline['value'] * baseline['tolerance'] + baseline['slack']
+        if higher_is_better and value < baseline['value'] - allowed:
+            return f'{name}: {value:.3f} < {baseline["value"] - allowed:.3f}'
+        if not higher_is_better and value > baseline['value'] + allowed:
+            return f'{name}: {value:.3f} > {baseline["value"] + allowed:.3f}'
+
+        return None
+
+    yield _check
+
+    if update:
+        path.write_text(json.dumps(baselines, indent=4, sort_keys=True) + '\n')
@@ -6,6 +6,7 @@ import hashlib
 import time
 from pathlib import Path
 
+import requests
 from gi.repository import GLib
 from pydbus.generic import signal
 
@@ -27,15 +28,72 @@ class Installer:
     Completed = signal()
     PropertiesChanged = signal()
 
-    def __init__(self, bundle, completed_code=0):
+    def __init__(self, bundle, completed_code=0, installed_version='1.0',
+                 compatible='rauc-hawkbit-updater-test', bundle_compatible=None):
         self._bundle = bundle
         self._completed_code = completed_code
+        self._installed_version = installed_version
+        self._compatible = compatible
+        self._bundle_compatible = bundle_compatible or compatible
 
         self._operation = 'idle'
         self._last_error = ''
         self._progress = 0, '', 1
 
     def Install(self, source):
+        print(f'installing {source}')
+
+        # check bundle checksum matches expected checksum (passed to constructor)
+        assert self._get_bundle_sha1(source) == self._get_bundle_sha1(self._bundle)
+
+        self._mimic_install()
+
+    def InstallBundle(self, source, args):
+        print(f'installing {source} with args {list(args)}')
+
+        if source.startswith('http'):
+            # mimic streaming: fetch bundle with given headers, compare with expected bundle
+            headers = dict(header.split(': ', 1) for header in args.get('http-headers', []))
+            req = requests.get(source, headers=headers, verify=not args.get('tls-no-verify'))
+            req.raise_for_status()
+            assert hashlib.sha1(req.content).hexdigest() == self._get_bundle_sha1(self._bundle)
+        else:
+            assert self._get_bundle_sha1(source) == self._get_bundle_sha1(self._bundle)
+
+        self._mimic_install()
+
+    def InspectBundle(self, source, args):
+        print(f'inspecting {source} with args {list(args)}')
+
+        if source.startswith('http'):
+            # mimic streaming: fetch the bundle's end holding signature and manifest only
+            headers = dict(header.split(': ', 1) for header in args.get('http-headers', []))
+            headers['Range'] = 'bytes=-4096'
+            req = requests.get(source, headers=headers, verify=not args.get('tls-no-verify'))
+            req.raise_for_status()
+            assert req.status_code == 206
+        else:
+            assert self._get_bundle_sha1(source) == self._get_bundle_sha1(self._bundle)
+
+        return {
+            'update': GLib.Variant('a{sv}', {
+                'compatible': GLib.Variant('s', self._bundle_compatible),
+                'version': GLib.Variant('s', '2.0'),
+            }),
+        }
+
+    def GetSlotStatus(self):
+        return [
+            ('rootfs.0', {
+                'state': GLib.Variant('s', 'booted'),
+                'bundle.version': GLib.Variant('s', self._installed_version),
+            }),
+            ('rootfs.1', {
+                'state': GLib.Variant('s', 'inactive'),
+            }),
+        ]
+
+    def _mimic_install(self):
         def mimic_install():
             """Mimics a sucessful/failing installation, depending on `self._completed_code`."""
             progresses = [
@@ -76,11 +134,6 @@ class Installer:
             # do not call again
             return False
 
-        print(f'installing {source}')
-
-        # check bundle checksum matches expected checksum (passed to constructor)
-        assert self._get_bundle_sha1(source) == self._get_bundle_sha1(self._bundle)
-
         GLib.timeout_add_seconds(interval=1, function=mimic_install)
 
     @staticmethod
@@ -115,6 +168,10 @@ class Installer:
         self._progress = value
         self.PropertiesChanged(Installer.interface, {'Progress': self.Progress}, [])
 
+    @property
+    def Compatible(self):
+        return self._compatible
+
     @property
     def LastError(self):
         return self._last_error
@@ -133,11 +190,18 @@ if __name__ == '__main__':
     parser.add_argument('bundle', help='Expected RAUC bundle')
     parser.add_argument('--completed-code', type=int, default=0,
                         help='Code to emit as D-Bus Completed signal')
+    parser.add_argument('--installed-version', default='1.0',
+                        help='Bundle version to report for the booted slot')
+    parser.add_argument('--compatible', default='rauc-hawkbit-updater-test',
+                        help='System compatible')
+    parser.add_argument('--bundle-compatible',
+                        help='Compatible to report for inspected bundles, defaults to --compatible')
     args = parser.parse_args()
 
     loop = GLib.MainLoop()
     bus = SessionBus()
-    installer = Installer(args.bundle, args.completed_code)
+    installer = Installer(args.bundle, args.completed_code, args.installed_version,
+                          args.compatible, args.bundle_compatible)
     with bus.publish('de.pengutronix.rauc', ('/', installer)):
         print('Interface published')
         loop.run()
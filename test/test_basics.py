@@ -2,12 +2,14 @@
 # SPDX-FileCopyrightText: 2021 Enrico Jörns <e.joerns@pengutronix.de>, Pengutronix
 # SPDX-FileCopyrightText: 2021 Bastian Krause <bst@pengutronix.de>, Pengutronix
 
-import re
 from configparser import ConfigParser
+import re
+import signal
+import stat
 
 import pytest
 
-from helper import run
+from helper import run, run_pexpect, available_port
 
 def test_version():
     """Test version argument."""
@@ -92,6 +94,99 @@ def test_register_and_check_valid_gateway_token(hawkbit, adjust_config, trailing
     assert 'MESSAGE: Checking for new software...' in out
     assert err == ''
 
+def test_config_gateway_mode_without_gateway_token(adjust_config):
+    """Test config with controller_ids but auth_token instead of gateway_token."""
+    config = adjust_config({'client': {'controller_ids': 'gateway-target-1;gateway-target-2'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == \
+            'Loading config file failed: Gateway mode (controller_ids, controller_dir) requires gateway_token.'
+
+def test_config_retry_backoff_max_too_small(adjust_config):
+    """Test config with retry_backoff_max below retry_wait."""
+    config = adjust_config({'client': {'retry_backoff_max': '10'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == \
+            'Loading config file failed: retry_backoff_max (10) must be 0 or at least retry_wait (60)'
+
+def test_config_reboot_feedback_timeout_negative(adjust_config):
+    """Test config with negative reboot_feedback_timeout."""
+    config = adjust_config({'client': {'reboot_feedback_timeout': '-1'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == \
+            'Loading config file failed: reboot_feedback_timeout (-1) must not be negative'
+
+def test_retry_backoff_jitter(adjust_config):
+    """
+    Test the wait after a failed poll is jittered below retry_wait already on the first retry if
+    retry_backoff_max is set, so devices failing at the same time do not retry in lockstep.
+    """
+    config = adjust_config({
+        'client': {
+            'hawkbit_server': f'localhost:{available_port()}',
+            'retry_wait': '60',
+            'retry_backoff_max': '600',
+        }
+    })
+
+    proc = run_pexpect(f'rauc-hawkbit-updater -c "{config}"')
+    try:
+        proc.expect('Scheduled check for new software failed')
+        proc.expect(r'Next poll in (\d+)s')
+        assert int(proc.match.group(1)) < 60
+    finally:
+        proc.terminate(force=True)
+
+def test_gateway_identify(hawkbit, config, adjust_config, tmp_path):
+    """
+    Test that gateway mode polls all controllers from controller_ids and controller_dir and that
+    each is identified with its own attributes.
+    """
+    ref_config = ConfigParser()
+    ref_config.read(config)
+    target_name = ref_config.get('client', 'target_name')
+
+    controller_dir = tmp_path / 'controllers'
+    controller_dir.mkdir()
+    (controller_dir / 'second.conf').write_text(
+            '[controller]\ntarget_name = gateway-target-2\n\n[device]\nhw_revision = 3\n')
+
+    gateway_token = hawkbit.get_config('authentication.gatewaytoken.key')
+    config = adjust_config(
+            {'client': {
+                'gateway_token': gateway_token,
+                'controller_ids': target_name,
+                'controller_dir': str(controller_dir),
+            }},
+            remove={'client': 'auth_token'},
+    )
+
+    try:
+        out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+        assert exitcode == 0
+        assert 'Gateway mode: serving 2 controller(s).' in out
+        assert f'{target_name}: Providing meta information to hawkbit server' in out
+        assert 'gateway-target-2: Providing meta information to hawkbit server' in out
+        assert err == ''
+
+        assert dict(ref_config.items('device')) == hawkbit.get_attributes()
+        assert hawkbit.get_attributes('gateway-target-2') == {'hw_revision': '3'}
+    finally:
+        # hawkBit creates unknown targets polled with the gateway token
+        hawkbit.delete_target('gateway-target-2')
+
 def test_register_and_check_invalid_auth_token(adjust_config):
     """Test config with invalid auth_token."""
     config = adjust_config({'client': {'auth_token': 'wrong-auth-token'}})
@@ -130,11 +225,136 @@ def test_identify(hawkbit, config):
 
     assert dict(ref_config.items('device')) == hawkbit.get_attributes()
 
+def test_identify_http2_compressed_responses(hawkbit, adjust_config):
+    """
+    Test that identifying works with HTTP/2 and compressed responses enabled. Plain HTTP falls
+    back to HTTP/1.1.
+    """
+    config = adjust_config({'client': {'http2': 'true', 'compressed_responses': 'true'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 0
+    assert 'Providing meta information to hawkbit server' in out
+    assert err == ''
+
+    ref_config = ConfigParser()
+    ref_config.read(config)
+
+    assert dict(ref_config.items('device')) == hawkbit.get_attributes()
+
+def test_connection_state_file(hawkbit, adjust_config, tmp_path):
+    """
+    Test that DNS results and TLS sessions are persisted to connection_state_file, readable by its
+    owner only, and that a subsequent run loads it.
+    """
+    state_file = tmp_path / 'connection.state'
+    config = adjust_config({'client': {'connection_state_file': str(state_file)}})
+
+    for _ in range(2):
+        out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+        assert exitcode == 0
+        assert 'MESSAGE: Checking for new software...' in out
+        assert err == ''
+        assert state_file.exists()
+        assert stat.S_IMODE(state_file.stat().st_mode) == 0o600
+
+def test_low_memory(adjust_config):
+    """Test that low_memory mode polls and reports the memory use."""
+    config = adjust_config({'client': {'low_memory': 'true', 'log_level': 'info'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 0
+    assert 'MESSAGE: Checking for new software...' in out
+    assert re.search(r'Memory use: \d+ KiB resident, \d+ KiB peak', out)
+    assert err == ''
+
+def test_max_response_size_exceeded(adjust_config):
+    """Test that a response exceeding max_response_size fails the poll."""
+    config = adjust_config({'client': {'max_response_size': '16'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 1
+    assert 'Response exceeds max_response_size (16 bytes)' in err
+
+def test_poll_unchanged(config):
+    """
+    Test that an unchanged base resource is detected on subsequent polls and not processed again.
+    """
+    # identify target first, so the base resource does not change between the polls below
+    _, _, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+    assert exitcode == 0
+
+    proc = run_pexpect(f'rauc-hawkbit-updater -d -c "{config}"')
+    proc.expect('No new software.')
+    # hawkBit's polling time is 30 s
+    proc.expect('Controller state unchanged since last poll.', timeout=40)
+    proc.terminate(force=True)
+
+def test_debug_log_ordered(config):
+    """
+    Test that debug messages written by the log thread are complete and in order, also when the
+    process exits right after logging them.
+    """
+    # identify target first, so the poll below only checks for new software
+    _, _, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+    assert exitcode == 0
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -d -c "{config}" -r')
+
+    assert exitcode == 0
+    assert 'Dropped' not in err
+    assert out.index('MESSAGE: Checking for new software...') < out.index('No new software.')
+
+def test_poll_now_signal(config):
+    """
+    Test that SIGUSR1 triggers a poll right away instead of waiting for hawkBit's polling time.
+    """
+    proc = run_pexpect(f'rauc-hawkbit-updater -c "{config}"')
+    proc.expect('No new software.')
+
+    proc.kill(signal.SIGUSR1)
+    proc.expect('Immediate poll requested.', timeout=2)
+    # hawkBit's polling time is 30 s
+    proc.expect('Checking for new software...', timeout=5)
+    proc.terminate(force=True)
+
+def test_dbus_service(adjust_config):
+    """
+    Test the D-Bus interface exported with dbus_service: properties reflect the last poll,
+    PollNow() triggers a poll right away and CancelDownload() fails without a download.
+    """
+    from gi.repository import GLib
+    from pydbus import SessionBus
+
+    config = adjust_config({'client': {'dbus_service': 'true'}})
+
+    proc = run_pexpect(f'rauc-hawkbit-updater -c "{config}"')
+    proc.expect('No new software.')
+
+    updater = SessionBus().get('de.pengutronix.rauc.HawkbitUpdater', '/')
+    assert updater.State == 'none'
+    assert updater.ActionId == ''
+    assert updater.LastPoll > 0
+
+    updater.PollNow()
+    proc.expect('Immediate poll requested.', timeout=2)
+    # hawkBit's polling time is 30 s
+    proc.expect('Checking for new software...', timeout=5)
+
+    with pytest.raises(GLib.Error, match='No download to cancel'):
+        updater.CancelDownload()
+
+    proc.terminate(force=True)
+
 @pytest.mark.parametrize("multi_object", ('chunks', 'artifacts'))
 def test_unsupported_multi_objects(hawkbit, config, assign_bundle, multi_object):
     """
-    Test that deployments with multiple software modules (called chunks in the DDI API) or multiple
-    artifacts are rejected.
+    Test that deployments with multiple software modules (called chunks in the DDI API) that are
+    not delta bundles or with multiple artifacts are rejected.
     """
     expected_error = rf'Deployment \d*? unsupported: cannot handle multiple {multi_object}.'
 
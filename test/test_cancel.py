@@ -64,6 +64,38 @@ def test_cancel_during_download(hawkbit, adjust_config, bundle_assigned, rate_li
     assert cancel_status[0]['type'] == 'canceled'
     assert 'Action canceled.' in cancel_status[0]['messages']
 
+def test_cancel_download_dbus(hawkbit, adjust_config, bundle_assigned, rate_limited_port):
+    """
+    Assign distribution containing bundle to target. Run rauc-hawkbit-updater configured to
+    communicate via rate-limited proxy with hawkBit and with dbus_service enabled. Cancel the
+    download via D-Bus once it started and make sure hawkBit is told the action failed.
+    """
+    from pydbus import SessionBus
+
+    port = rate_limited_port('70k')
+    config = adjust_config({'client': {
+        'hawkbit_server': f'{hawkbit.host}:{port}',
+        'dbus_service': 'true',
+    }})
+
+    proc = run_pexpect(f'rauc-hawkbit-updater -c "{config}"')
+    proc.expect('Start downloading: ')
+
+    updater = SessionBus().get('de.pengutronix.rauc.HawkbitUpdater', '/')
+    assert updater.State == 'downloading'
+    assert updater.ActionId == str(hawkbit.id['action'])
+    updater.CancelDownload()
+
+    proc.expect('Canceling download as requested locally.')
+    # wait for feedback to arrive at hawkbit server
+    proc.expect(TIMEOUT, timeout=2)
+    assert updater.State == 'canceled'
+    proc.terminate(force=True)
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'error'
+    assert 'Download canceled locally.' in status[0]['messages']
+
 def test_cancel_during_install(hawkbit, config, bundle_assigned, rauc_dbus_install_success):
     """
     Assign distribution containing bundle to target. Run rauc-hawkbit-updater and cancel the
@@ -2,8 +2,14 @@
 # SPDX-FileCopyrightText: 2021 Bastian Krause <bst@pengutronix.de>, Pengutronix
 
 import re
+import socket
+import threading
+from configparser import ConfigParser
+from pathlib import Path
 
-from helper import run
+import pytest
+
+from helper import run, run_pexpect, available_port
 
 def test_download_inexistent_location(hawkbit, bundle_assigned, adjust_config):
     """
@@ -124,6 +130,31 @@ def test_download_slow_with_resume(hawkbit, bundle_assigned, adjust_config, rate
     assert 'Download complete.' in out
     assert 'File checksum OK.' in out
 
+def test_download_resume_after_restart(hawkbit, bundle_assigned, adjust_config,
+                                       rate_limited_port):
+    """
+    Assign bundle to target, kill rauc-hawkbit-updater during the (slow) download and test the
+    next run resumes the download from the persisted checkpoint.
+    """
+    port = rate_limited_port(20000)
+    config = adjust_config({
+        'client': {
+            'hawkbit_server': f'{hawkbit.host}:{port}',
+            'resume_downloads': 'true',
+        }
+    })
+
+    proc = run_pexpect(f'rauc-hawkbit-updater -c "{config}" -r')
+    proc.expect('Saved resume checkpoint at offset [1-9]', timeout=20)
+    proc.terminate(force=True)
+
+    # ignore failing installation
+    out, _, _ = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert re.findall('Resuming interrupted download at offset [1-9]', out)
+    assert 'Download complete.' in out
+    assert 'File checksum OK.' in out
+
 def test_download_only(hawkbit, config, assign_bundle):
     """Test "downloadonly" deployment."""
     assign_bundle(params={'type': 'downloadonly'})
@@ -141,3 +172,468 @@ def test_download_only(hawkbit, config, assign_bundle):
 
     # check last status message
     assert 'File checksum OK.' in status[0]['messages']
+
+def test_download_segmented(hawkbit, bundle_assigned, adjust_config, rauc_bundle):
+    """Assign bundle to target and test download of bundle in multiple parallel segments."""
+    bundle_size = Path(rauc_bundle).stat().st_size
+    config = adjust_config({
+        'client': {
+            'download_segments': '4',
+            'download_segment_min_size': str(64*1024),
+        }
+    })
+
+    # ignore failing installation
+    out, _, _ = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert f'Downloading {bundle_size} bytes in 4 segments' in out
+    assert 'Download complete.' in out
+    assert 'File checksum OK.' in out
+
+def test_download_segmented_with_resume(hawkbit, bundle_assigned, adjust_config,
+                                        partial_download_port):
+    """
+    Assign bundle to target and test segmented download of partial bundle parts with download
+    resuming configured. Failed segments should be resumed on their own.
+    """
+    config = adjust_config({
+        'client': {
+            'hawkbit_server': f'{hawkbit.host}:{partial_download_port}',
+            'resume_downloads': 'true',
+            'download_segments': '2',
+            'download_segment_min_size': str(64*1024),
+        }
+    })
+
+    # ignore failing installation
+    out, _, _ = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert re.findall('resuming segment from offset [1-9]', out)
+    assert 'Download complete.' in out
+    assert 'File checksum OK.' in out
+
+def test_download_max_rate(hawkbit, bundle_assigned, adjust_config):
+    """Assign bundle to target and test download limited by max_download_rate."""
+    config = adjust_config({
+        'client': {
+            'max_download_rate': str(100*1024),
+            'download_windows': '00:00-00:00',
+        }
+    })
+
+    # ignore failing installation
+    out, _, _ = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    speed = re.search(r'Download complete. ([0-9.]+) MB/s', out)
+    assert speed
+    assert float(speed.group(1)) <= 0.11
+    assert 'File checksum OK.' in out
+
+def test_download_cached(hawkbit, assign_bundle, adjust_config, rauc_dbus_install_success,
+                         tmp_path):
+    """
+    Assign bundle to target twice and test the second deployment is installed from the artifact
+    cache instead of downloading it again.
+    """
+    cache_dir = tmp_path / 'cache'
+    config = adjust_config({'client': {'artifact_cache_dir': str(cache_dir)}})
+
+    assign_bundle()
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Start downloading' in out
+    assert 'Software bundle installed successfully.' in out
+    assert exitcode == 0
+    assert len(list(cache_dir.iterdir())) == 1
+
+    assign_bundle()
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'found in cache, skipping download.' in out
+    assert 'Start downloading' not in out
+    assert 'Software bundle installed successfully.' in out
+    assert err == ''
+    assert exitcode == 0
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'finished'
+
+def test_download_from_peer(hawkbit, assign_bundle, adjust_config, rauc_dbus_install_success,
+                            tmp_path):
+    """
+    Install a bundle with one rauc-hawkbit-updater, then let it serve the bundle from its artifact
+    cache to peers. Assign the bundle again and test another rauc-hawkbit-updater downloads it from
+    the first one instead of hawkBit.
+    """
+    peer_port = available_port()
+    config = adjust_config({'client': {'artifact_cache_dir': str(tmp_path / 'cache')}})
+
+    assign_bundle()
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Software bundle installed successfully.' in out
+    assert exitcode == 0
+
+    # serve peers only, the peer must not pick up the next deployment itself
+    peer_config = ConfigParser()
+    peer_config.read(config)
+    peer_config.set('client', 'hawkbit_server', f'localhost:{available_port()}')
+    peer_config.set('client', 'peer_port', str(peer_port))
+    peer_config_file = tmp_path / 'peer.conf'
+    with peer_config_file.open('w') as f:
+        peer_config.write(f)
+
+    peer = run_pexpect(f'rauc-hawkbit-updater -c "{peer_config_file}"')
+    peer.expect(f'Serving bundles to peers on port {peer_port}')
+
+    config = adjust_config({
+        'client': {
+            'bundle_download_location': str(tmp_path / 'from-peer.raucb'),
+            'peers': f'localhost:{peer_port}',
+        }
+    }, remove={'client': 'artifact_cache_dir'})
+
+    assign_bundle()
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'from peer' in out
+    assert 'Start downloading' not in out
+    assert 'File checksum OK.' in out
+    assert 'Software bundle installed successfully.' in out
+    assert exitcode == 0
+
+    peer.expect('Serving sha[0-9]+-[0-9a-f]+ to peer ')
+    assert peer.isalive()
+    peer.terminate(force=True)
+
+def test_download_peer_unavailable(hawkbit, bundle_assigned, adjust_config):
+    """
+    Assign bundle to target and test the download falls back to hawkBit if no peer is reachable.
+    """
+    peer = f'localhost:{available_port()}'
+    config = adjust_config({'client': {'peers': peer}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert f'Downloading from peer {peer} failed' in out
+    assert 'Start downloading' in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_peer_not_allowed(hawkbit, bundle_assigned, adjust_config, config, tmp_path):
+    """
+    Run a rauc-hawkbit-updater serving peers of another subnet only and test it refuses the
+    download, which falls back to hawkBit.
+    """
+    peer_port = available_port()
+    peer_config = ConfigParser()
+    peer_config.read(config)
+    peer_config.set('client', 'hawkbit_server', f'localhost:{available_port()}')
+    peer_config.set('client', 'peer_port', str(peer_port))
+    peer_config.set('client', 'peer_address', '127.0.0.1')
+    peer_config.set('client', 'peer_allow', '192.0.2.0/24')
+    peer_config_file = tmp_path / 'peer.conf'
+    with peer_config_file.open('w') as f:
+        peer_config.write(f)
+
+    peer = run_pexpect(f'rauc-hawkbit-updater -c "{peer_config_file}"')
+    peer.expect(f'Serving bundles to peers on 127.0.0.1 port {peer_port}')
+
+    config = adjust_config({'client': {'peers': f'127.0.0.1:{peer_port}'}})
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert f'Downloading from peer 127.0.0.1:{peer_port} failed' in out
+    assert 'Start downloading' in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+    peer.expect('Refusing peer 127.0.0.1, not in peer_allow')
+    assert peer.isalive()
+    peer.terminate(force=True)
+
+def test_download_peer_partial(hawkbit, bundle_assigned, adjust_config):
+    """
+    Assign bundle to target and test garbage sent by a peer failing mid-transfer is discarded:
+    the download falls back to hawkBit from the start and the checksum matches.
+    """
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as server:
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server.bind(('localhost', 0))
+        server.listen()
+
+        def serve_partial():
+            conn, _ = server.accept()
+            with conn:
+                conn.recv(4096)
+                conn.sendall(b'HTTP/1.1 200 OK\r\nContent-Length: 1000000\r\n\r\n' +
+                             b'\0' * 4096)
+
+        thread = threading.Thread(target=serve_partial, daemon=True)
+        thread.start()
+
+        peer = f'localhost:{server.getsockname()[1]}'
+        config = adjust_config({'client': {'peers': peer}})
+
+        out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+        thread.join(timeout=5)
+
+    assert f'Downloading from peer {peer} failed' in out
+    assert 'Resuming download from offset' not in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_peers_invalid(adjust_config):
+    """Test config with peers entry lacking a port."""
+    config = adjust_config({'client': {'peers': 'localhost'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == 'Loading config file failed: ' \
+            "Invalid peers entry 'localhost', expected HOST:PORT"
+
+@pytest.mark.parametrize("option,value,message", (
+    ('peer_address', 'localhost', 'peer_address (localhost) must be an IP address'),
+    ('peer_allow', '192.168.1.0/33', "Invalid peer_allow entry '192.168.1.0/33', "
+                                     "expected ADDRESS[/PREFIX]"),
+))
+def test_download_peer_server_invalid(adjust_config, option, value, message):
+    """Test config with invalid peer server restrictions."""
+    config = adjust_config({'client': {'peer_port': '8888', option: value}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == f'Loading config file failed: {message}'
+
+def mirror_options(hawkbit, options={}):
+    """
+    Returns nginx_proxy() options for a mirror in front of hawkBit that does not require (or see)
+    credentials, but adds the target's credentials to requests forwarded to hawkBit itself.
+    """
+    target_token = hawkbit.get_target().get('securityToken')
+    return {**options, 'proxy_set_header': f'Authorization "TargetToken {target_token}"'}
+
+def test_download_mirror(hawkbit, bundle_assigned, adjust_config, nginx_proxy):
+    """
+    Assign bundle to target and test hawkBit and a mirror are probed before downloading. An
+    unreachable mirror is probed, but not downloaded from.
+    """
+    mirror = f'http://localhost:{nginx_proxy(mirror_options(hawkbit))}'
+    unreachable_mirror = f'http://localhost:{available_port()}'
+    config = adjust_config({'client': {'mirrors': f'{mirror};{unreachable_mirror}/'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert f'Probing {mirror}/' in out
+    assert f'Probing {unreachable_mirror}/' in out
+    assert f'Start downloading: {unreachable_mirror}' not in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_mirror_no_credentials(hawkbit, bundle_assigned, adjust_config, nginx_proxy):
+    """
+    Assign bundle to target and test hawkBit credentials are not sent to a mirror: a plain proxy
+    in front of hawkBit fails the probe and the bundle is downloaded from hawkBit.
+    """
+    mirror = f'http://localhost:{nginx_proxy({})}'
+    config = adjust_config({'client': {'mirrors': mirror}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert re.findall(f'Probing {mirror}/[^ ]+ failed: HTTP request failed: 40[13]', out)
+    assert f'Start downloading: {mirror}' not in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_mirror_failover(hawkbit, bundle_assigned, adjust_config, rate_limited_port,
+                                  nginx_proxy):
+    """
+    Assign bundle to target and test the download switches sources once the fastest probed
+    source, a mirror, gets too slow mid-download and continues where the previous source stopped.
+    """
+    # limit hawkBit to 20 KB/s, the mirror is only slowed down to 70 KB/s after 200 KB
+    port = rate_limited_port('20k')
+    mirror_port = nginx_proxy(mirror_options(hawkbit, {
+        'limit_rate_after': '200k',
+        'limit_rate': '70k',
+    }))
+    mirror = f'http://localhost:{mirror_port}'
+    config = adjust_config({
+        'client': {
+            'hawkbit_server': f'{hawkbit.host}:{port}',
+            'mirrors': mirror,
+            'low_speed_time': '3',
+            'low_speed_rate': '100000',
+        }
+    })
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r', timeout=90)
+
+    assert f'Start downloading: {mirror}/' in out
+    assert f'Downloading from {mirror}/' in out
+    assert re.findall(r'failed: Timeout was reached, switching to http://[^ ]+:' f'{port}/', out)
+    assert re.findall('Resuming download from offset [1-9]', out)
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_mirror_failover_no_resume(hawkbit, bundle_assigned, adjust_config,
+                                            rate_limited_port, nginx_proxy):
+    """
+    Assign bundle to target and test the download switches sources without resume_downloads,
+    starting over at the next source, and fails once each source failed.
+    """
+    port = rate_limited_port('20k')
+    mirror_port = nginx_proxy(mirror_options(hawkbit, {
+        'limit_rate_after': '200k',
+        'limit_rate': '70k',
+    }))
+    mirror = f'http://localhost:{mirror_port}'
+    config = adjust_config({
+        'client': {
+            'hawkbit_server': f'{hawkbit.host}:{port}',
+            'mirrors': mirror,
+            'resume_downloads': 'false',
+            'low_speed_time': '3',
+            'low_speed_rate': '100000',
+        }
+    })
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r', timeout=90)
+
+    assert re.findall(r'failed: Timeout was reached, switching to http://[^ ]+:' f'{port}/', out)
+    assert 'Resuming download from offset' not in out
+    assert 'Download failed: Timeout was reached' in err
+    assert exitcode == 1
+
+def test_download_mirrors_invalid(adjust_config):
+    """Test config with mirrors entry lacking the URL scheme."""
+    config = adjust_config({'client': {'mirrors': 'localhost:8080'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == 'Loading config file failed: ' \
+            "Invalid mirrors entry 'localhost:8080', expected http(s)://HOST[:PORT][/PATH]"
+
+def test_download_authenticated_mirrors_cleartext(adjust_config):
+    """Test config with authenticated_mirrors entry using plain HTTP."""
+    config = adjust_config({'client': {'authenticated_mirrors': 'http://localhost:8080'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == 'Loading config file failed: ' \
+            "Invalid authenticated_mirrors entry 'http://localhost:8080', " \
+            "expected https://HOST[:PORT][/PATH]"
+
+@pytest.mark.parametrize("backend", ('auto', 'software', 'kernel'))
+def test_download_checksum_backend(hawkbit, bundle_assigned, adjust_config, backend):
+    """
+    Assign bundle to target and test its checksum is verified with the given checksum_backend.
+    """
+    config = adjust_config({'client': {'checksum_backend': backend}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Download complete' in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_checksum_backend_invalid(adjust_config):
+    """Test config with invalid checksum_backend."""
+    config = adjust_config({'client': {'checksum_backend': 'gpu'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == 'Loading config file failed: ' \
+            "Invalid checksum_backend 'gpu', expected auto, software or kernel"
+
+@pytest.mark.parametrize("io_mode", ('buffered', 'dontneed', 'direct'))
+def test_download_io_mode(hawkbit, bundle_assigned, adjust_config, io_mode):
+    """Assign bundle to target and test download with the given download_io_mode."""
+    config = adjust_config({
+        'client': {
+            'download_io_mode': io_mode,
+            'download_write_size': '10000',
+        }
+    })
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Download complete' in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_io_mode_invalid(adjust_config):
+    """Test config with invalid download_io_mode."""
+    config = adjust_config({'client': {'download_io_mode': 'mmap'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == 'Loading config file failed: ' \
+            "Invalid download_io_mode 'mmap', expected buffered, dontneed or direct"
+
+def test_download_flush_size(hawkbit, bundle_assigned, adjust_config):
+    """Assign bundle to target and test buffered download flushed every download_flush_size."""
+    config = adjust_config({
+        'client': {
+            'download_write_size': '10000',
+            'download_flush_size': '65536',
+        }
+    })
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Download complete' in out
+    assert 'File checksum OK.' in out
+    assert exitcode == 1
+
+def test_download_thread_priority(hawkbit, bundle_assigned, adjust_config):
+    """
+    Assign bundle to target and test download with lowered I/O and CPU priority, restricted to
+    CPU 0. Lowering priorities needs no privileges, so no failures are expected.
+    """
+    config = adjust_config({
+        'client': {
+            'io_scheduling_class': 'idle',
+            'cpu_scheduling_policy': 'batch',
+            'nice': '10',
+            'cpu_affinity': '0',
+        }
+    })
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Download complete' in out
+    assert 'File checksum OK.' in out
+    assert 'Failed to set' not in err
+    assert exitcode == 1
+
+@pytest.mark.parametrize('option,value,message', (
+    ('io_scheduling_class', 'realtime',
+     "Invalid io_scheduling_class 'realtime', expected default, best-effort or idle"),
+    ('io_scheduling_priority', '8', 'io_scheduling_priority (8) must be between 0 and 7'),
+    ('cpu_scheduling_policy', 'fifo',
+     "Invalid cpu_scheduling_policy 'fifo', expected other, batch or idle"),
+    ('nice', '20', 'nice (20) must be between -20 and 19'),
+    ('cpu_affinity', '3-1',
+     "Invalid cpu_affinity entry '3-1', expected CPU or CPU range below 1024"),
+))
+def test_download_thread_priority_invalid(adjust_config, option, value, message):
+    """Test config with invalid thread priority options."""
+    config = adjust_config({'client': {option: value}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert exitcode == 4
+    assert out == ''
+    assert err.strip() == f'Loading config file failed: {message}'
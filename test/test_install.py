@@ -1,9 +1,11 @@
 # SPDX-License-Identifier: LGPL-2.1-only
 # SPDX-FileCopyrightText: 2021 Bastian Krause <bst@pengutronix.de>, Pengutronix
 
+from configparser import ConfigParser
 from datetime import datetime, timedelta
 from pathlib import Path
 
+import pytest
 from pexpect import TIMEOUT
 
 from helper import run, run_pexpect, timezone_offset_utc
@@ -41,6 +43,105 @@ def test_install_success(hawkbit, config, bundle_assigned, rauc_dbus_install_suc
     status = hawkbit.get_action_status()
     assert status[0]['type'] == 'finished'
 
+def test_install_preflight_check(hawkbit, adjust_config, bundle_assigned,
+                                 rauc_dbus_install_success):
+    """
+    Assign bundle to target and test the bundle is checked by RAUC before it is downloaded and
+    installed.
+    """
+    config = adjust_config({'client': {'preflight_check': 'true'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Checking bundle before download' in out
+    assert 'Download complete' in out
+    assert 'Software bundle installed successfully.' in out
+    assert err == ''
+    assert exitcode == 0
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'finished'
+
+def test_install_preflight_check_incompatible(hawkbit, adjust_config, bundle_assigned,
+                                              rauc_dbus_incompatible):
+    """
+    Assign bundle to target and test an incompatible bundle is rejected before it is downloaded.
+    Make sure the failure is reported to hawkBit.
+    """
+    config = adjust_config({'client': {'preflight_check': 'true'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Checking bundle before download' in out
+    assert 'Start downloading' not in out
+    assert exitcode == 1
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'error'
+    assert 'Bundle check failed: Bundle compatible \'other-device\' does not match system ' \
+           'compatible \'rauc-hawkbit-updater-test\'' in status[0]['messages']
+
+def test_install_gateway(hawkbit, config, adjust_config, bundle_assigned, rauc_bundle):
+    """
+    Assign bundle to target and test successful download and installation via
+    gateway_install_command in gateway mode. Make sure installation result is received correctly by
+    hawkBit.
+    """
+    ref_config = ConfigParser()
+    ref_config.read(config)
+    target_name = ref_config.get('client', 'target_name')
+
+    gateway_token = hawkbit.get_config('authentication.gatewaytoken.key')
+    config = adjust_config(
+            {'client': {
+                'gateway_token': gateway_token,
+                'controller_ids': target_name,
+                'gateway_install_command': f'sh -c \'cmp "$RHU_BUNDLE" "{rauc_bundle}"\'',
+            }},
+            remove={'client': 'auth_token'},
+    )
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert f'{target_name}: New software ready for download' in out
+    assert 'complete, checksum OK.' in out
+    assert f'{target_name}: Software bundle installed successfully.' in out
+    assert err == ''
+    assert exitcode == 0
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'finished'
+
+def test_install_metrics(hawkbit, adjust_config, bundle_assigned, rauc_dbus_install_success,
+                         rauc_bundle, tmp_path):
+    """
+    Assign bundle to target and test successful download and installation with metrics_file set.
+    Make sure transfers and all phases are accounted for in the Prometheus text file.
+    """
+    metrics_file = tmp_path / 'rauc-hawkbit-updater.prom'
+    config = adjust_config({'client': {'metrics_file': str(metrics_file)}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Software bundle installed successfully.' in out
+    assert 'Phase install took' in out
+    assert err == ''
+    assert exitcode == 0
+
+    metrics = {}
+    for line in metrics_file.read_text().splitlines():
+        if line.startswith('#'):
+            continue
+        name, value = line.rsplit(' ', 1)
+        metrics[name] = float(value)
+
+    assert metrics['rauc_hawkbit_updater_transfers_total{kind="api"}'] > 0
+    assert metrics['rauc_hawkbit_updater_transfers_total{kind="download"}'] == 1
+    assert metrics['rauc_hawkbit_updater_transfer_bytes_total{kind="download"}'] == \
+            Path(rauc_bundle).stat().st_size
+    for phase in ('poll', 'download', 'checksum', 'install', 'deployment'):
+        assert metrics[f'rauc_hawkbit_updater_phase_seconds_count{{phase="{phase}"}}'] == 1
+
 def test_install_failure(hawkbit, config, bundle_assigned, rauc_dbus_install_failure):
     """
     Assign bundle to target and test successful download and failing installation. Make sure
@@ -56,6 +157,52 @@ def test_install_failure(hawkbit, config, bundle_assigned, rauc_dbus_install_fai
     assert status[0]['type'] == 'error'
     assert 'Failed to install software bundle.' in status[0]['messages']
 
+def test_install_fallback(hawkbit, config, assign_bundle, rauc_dbus_install_success, tmp_path):
+    """
+    Assign a distribution set containing a small broken delta bundle for the installed version
+    besides the full bundle to target and test the delta is tried first and installation falls
+    back to the full bundle after installing the delta failed.
+    """
+    broken_bundle = tmp_path / 'broken.raucb'
+    broken_bundle.write_bytes(b'not a bundle')
+
+    assign_bundle(delta_bundles=((broken_bundle, '1.0'),))
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'Size: 12 bytes' in out
+    assert 'falling back to next artifact' in out
+    assert 'Software bundle installed successfully.' in out
+    assert exitcode == 0
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'finished'
+    assert any('Failed to install software bundle, falling back to next artifact.' in message
+               for entry in status for message in entry['messages'])
+
+@pytest.mark.parametrize("base_version", ('1.0', '0.9'))
+def test_install_delta_base_version(hawkbit, config, assign_bundle, rauc_bundle,
+                                    rauc_dbus_install_success, base_version):
+    """
+    Assign a software module with `base_version` metadata (i.e. a delta bundle) and test it is only
+    installed if the base version matches the installed version reported by RAUC.
+    """
+    assign_bundle(metadata={'base_version': base_version})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    if base_version == '1.0':
+        assert 'Software bundle installed successfully.' in out
+        assert exitcode == 0
+        return
+
+    assert 'Skipping delta bundle' in out
+    assert 'has no artifact applicable to this target.' in err
+    assert exitcode == 1
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'error'
+
 def test_install_maintenance_window(hawkbit, config, rauc_bundle, assign_bundle,
                                     rauc_dbus_install_success):
     bundle_size = Path(rauc_bundle).stat().st_size
@@ -90,3 +237,22 @@ def test_install_maintenance_window(hawkbit, config, rauc_bundle, assign_bundle,
 
     status = hawkbit.get_action_status()
     assert status[0]['type'] == 'finished'
+
+def test_install_streaming(hawkbit, adjust_config, bundle_assigned, rauc_dbus_install_success):
+    """
+    Assign bundle to target and test successful installation in streaming mode, i.e. RAUC is passed
+    the bundle URL (and the authorization header) instead of a downloaded file.
+    """
+    config = adjust_config({'client': {'stream_bundle': 'true'}})
+
+    out, err, exitcode = run(f'rauc-hawkbit-updater -c "{config}" -r')
+
+    assert 'New software ready for download' in out
+    assert 'Streaming bundle: http' in out
+    assert 'Start downloading' not in out
+    assert 'Software bundle installed successfully.' in out
+    assert err == ''
+    assert exitcode == 0
+
+    status = hawkbit.get_action_status()
+    assert status[0]['type'] == 'finished'
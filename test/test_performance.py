@@ -0,0 +1,106 @@
+# SPDX-License-Identifier: LGPL-2.1-only
+
+import logging
+import signal
+import time
+
+import pytest
+
+from helper import run_pexpect
+
+# network impairments emulated between rauc-hawkbit-updater and hawkBit, see impaired_port
+PROFILES = {
+    'unimpaired': {},
+    'wan': {'rate': '2m', 'delay': '40ms', 'jitter': '10ms'},
+    'lossy': {'rate': '1m', 'delay': '20ms', 'loss': '1%'},
+}
+
+# measurement: (higher is better, absolute slack for noise of short measurements)
+MEASUREMENTS = {
+    'first_poll_seconds': (False, 0.2),
+    'download_start_seconds': (False, 0.2),
+    'download_mbytes_per_second': (True, 0.0),
+    'checksum_seconds': (False, 0.1),
+    'feedback_seconds': (False, 0.2),
+}
+
+def read_metrics(metrics_file):
+    """Returns the metrics of the Prometheus text file `metrics_file` as dict."""
+    metrics = {}
+    for line in metrics_file.read_text().splitlines():
+        if line.startswith('#'):
+            continue
+        name, value = line.rsplit(' ', 1)
+        metrics[name] = float(value)
+
+    return metrics
+
+def wait_for_status_message(hawkbit, message, timeout=60):
+    """Waits until hawkBit lists `message` in the status of the most recent action."""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if any(message in status['messages'] for status in hawkbit.get_action_status()):
+            return
+        time.sleep(0.02)
+
+    raise TimeoutError(f'hawkBit did not receive "{message}" within {timeout} s')
+
+@pytest.mark.performance
+@pytest.mark.parametrize('profile', PROFILES)
+def test_performance_deployment(hawkbit, adjust_config, assign_bundle, large_rauc_bundle,
+                                impaired_port, performance_baseline, tmp_path, profile):
+    """
+    Measure a "downloadonly" deployment of a large bundle under emulated network impairment and
+    compare against stored baselines:
+    - time from start to the first finished poll
+    - delay from assigning a deployment (and triggering a poll) until the download starts
+    - sustained download throughput
+    - checksum verification time
+    - time from reporting the verified download until hawkBit lists the feedback
+    """
+    port = impaired_port(**PROFILES[profile])
+    metrics_file = tmp_path / 'rauc-hawkbit-updater.prom'
+    config = adjust_config({
+        'client': {
+            'hawkbit_server': f'{hawkbit.host}:{port}',
+            'metrics_file': str(metrics_file),
+            'timeout': '600',
+        }
+    })
+    results = {}
+
+    start = time.monotonic()
+    proc = run_pexpect(f'rauc-hawkbit-updater -c "{config}"', timeout=600)
+    try:
+        proc.expect('No new software.')
+        results['first_poll_seconds'] = time.monotonic() - start
+
+        assign_bundle(params={'type': 'downloadonly'}, bundle=large_rauc_bundle)
+        start = time.monotonic()
+        proc.kill(signal.SIGUSR1)
+        proc.expect('Start downloading')
+        results['download_start_seconds'] = time.monotonic() - start
+
+        proc.expect('File checksum OK.')
+        start = time.monotonic()
+        wait_for_status_message(hawkbit, 'File checksum OK.')
+        results['feedback_seconds'] = time.monotonic() - start
+    finally:
+        proc.terminate(force=True)
+
+    metrics = read_metrics(metrics_file)
+    results['download_mbytes_per_second'] = \
+            metrics['rauc_hawkbit_updater_transfer_bytes_total{kind="download"}'] / (1024*1024) / \
+            metrics['rauc_hawkbit_updater_phase_last_seconds{phase="download"}']
+    results['checksum_seconds'] = \
+            metrics['rauc_hawkbit_updater_phase_last_seconds{phase="checksum"}']
+
+    regressions = []
+    for name, (higher_is_better, slack) in MEASUREMENTS.items():
+        logging.getLogger(__name__).info('%s.%s: %.3f', profile, name, results[name])
+        regression = performance_baseline(f'{profile}.{name}', results[name],
+                                          higher_is_better=higher_is_better, slack=slack)
+        if regression:
+            regressions.append(regression)
+
+    assert not regressions, f'Performance regressed: {", ".join(regressions)}'